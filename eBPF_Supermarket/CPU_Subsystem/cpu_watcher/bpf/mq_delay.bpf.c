@@ -28,10 +28,45 @@ BPF_HASH(send_msg1,pid_t,struct send_events,1024);//记录pid->u_msg_ptr的关
 BPF_HASH(send_msg2,u64,struct send_events,1024);//记录msg->time的关系；
 BPF_HASH(rcv_msg1,pid_t,struct rcv_events,1024);//记录pid->u_msg_ptr的关系；do_mq_timedsend入参
 BPF_ARRAY(mq_ctrl_map,int,struct mq_ctrl,1);
-struct {
-	__uint(type, BPF_MAP_TYPE_RINGBUF);
-	__uint(max_entries, 256 * 1024);
-} rb SEC(".maps");
+BPF_PERCPU_HASH(mq_queue_stats,u64,struct mq_queue_stat,MQ_QUEUE_ENTRIES);//每个队列的时延直方图、深度与进程对
+
+//新建队列统计项时使用的初始值
+static const struct mq_queue_stat zero_stat;
+
+static inline u32 log2_u64(u64 v) {
+	u32 r, shift;
+	r = (v > 0xFFFFFFFF) << 5; v >>= r;
+	shift = (v > 0xFFFF) << 4; v >>= shift; r |= shift;
+	shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+	shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+	shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+	return r | (v >> 1);
+}
+
+static inline struct mq_queue_stat *get_queue_stat(u64 ino) {
+	struct mq_queue_stat *stat = bpf_map_lookup_elem(&mq_queue_stats, &ino);
+	if (stat) {
+		return stat;
+	}
+	bpf_map_update_elem(&mq_queue_stats, &ino, &zero_stat, BPF_NOEXIST);
+	return bpf_map_lookup_elem(&mq_queue_stats, &ino);
+}
+
+/*由当前进程的mqdes找到队列对应的inode*/
+static inline struct inode *mq_inode(mqd_t mqdes) {
+	struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+	struct fdtable *fdt = BPF_CORE_READ(task, files, fdt);
+	struct file **fds;
+	struct file *file;
+	if (!fdt || mqdes < 0 || mqdes >= BPF_CORE_READ(fdt, max_fds)) {
+		return NULL;
+	}
+	fds = BPF_CORE_READ(fdt, fd);
+	if (bpf_probe_read_kernel(&file, sizeof(file), &fds[mqdes]) || !file) {
+		return NULL;
+	}
+	return BPF_CORE_READ(file, f_inode);
+}
 
 static inline struct mq_ctrl *get_mq_ctrl(void) {
     struct mq_ctrl *mq_ctrl;
@@ -43,31 +78,6 @@ static inline struct mq_ctrl *get_mq_ctrl(void) {
 }
 
 
-// int print_send_info(struct send_events * mq_send_info,int flag){
-// 	bpf_printk("---------------------test----------------------------test--------------------------test--------------------------------------------test---------------------test---------------------test\n");
-// 	bpf_printk("send_msg_prio: %-8lu\n",mq_send_info->msg_prio);
-// 	bpf_printk("mqdes: %-08lu  send_pid: %-08lu  send_enter_time: %-16lu\n",mq_send_info->mqdes,mq_send_info->send_pid,mq_send_info->send_enter_time);
-// 	if(flag > 0){
-// 		bpf_printk("u_msg_ptr: 0x%08lx  src: 0x%08lx\n",mq_send_info->u_msg_ptr,mq_send_info->src);
-// 		if(flag==2)	bpf_printk("Key_msg_ptr: 0x%08lx  \n",mq_send_info->Key_msg_ptr);
-// 	}
-// 	bpf_printk("---------------------test----------------------------test--------------------------test--------------------------------------------test---------------------test---------------------test\n");
-// 	return 0;
-// }
-
-// int print_rcv_info(struct rcv_events * mq_rcv_info,int flag){
-// 	bpf_printk("---------------------test----------------------------test--------------------------test--------------------------------------------test---------------------test---------------------test\n");
-// 	bpf_printk("rcv_msg_prio: %-8lu\n",mq_rcv_info->msg_prio);	
-// 	bpf_printk("mqdes: %-08lu  rcv_pid: %-08lu  rcv_enter_time: %-16lu\n",mq_rcv_info->mqdes,mq_rcv_info->rcv_pid,mq_rcv_info->rcv_enter_time);
-// 	if(flag > 0){
-// 		bpf_printk("u_msg_ptr: 0x%08lx  dest: 0x%08lx\n",mq_rcv_info->u_msg_ptr,mq_rcv_info->dest);
-// 		if(flag==2)	bpf_printk("Key_msg_ptr: 0x%08lx  \n",mq_rcv_info->Key_msg_ptr);
-// 	}
-// 	bpf_printk("---------------------test----------------------------test--------------------------test--------------------------------------------test---------------------test---------------------test\n");
-// 	return 0;
-// }
-	
-
 /*获取 mq_send_info -> send_time send_pid mdqes u_msg_ptr msg_len msg_prio*/
 SEC("kprobe/do_mq_timedsend")
 int BPF_KPROBE(mq_timedsend,mqd_t mqdes, const char *u_msg_ptr,
@@ -89,6 +99,12 @@ int BPF_KPROBE(mq_timedsend,mqd_t mqdes, const char *u_msg_ptr,
 		mq_send_info.msg_len = msg_len;
 		mq_send_info.msg_prio = msg_prio;
 		mq_send_info.u_msg_ptr = u_msg_ptr;
+	struct inode *inode = mq_inode(mqdes);
+	if (!inode) {
+		return 0;
+	}
+	mq_send_info.ino = BPF_CORE_READ(inode, i_ino);
+	mq_send_info.mq_info = (const char *)inode - bpf_core_field_offset(struct mqueue_inode_info, vfs_inode);
 
 	bpf_map_update_elem(&send_msg1, &pid, &mq_send_info, BPF_ANY);//pid->u_msg_ptr
 	return 0;	
@@ -142,13 +158,12 @@ int BPF_KRETPROBE(load_msg_exit,void *ret){
 }
 
 SEC("kretprobe/do_mq_timedsend")
-int BPF_KRETPROBE(do_mq_timedsend_exit,void *ret)
+int BPF_KRETPROBE(do_mq_timedsend_exit,long ret)
 {
 	struct mq_ctrl *mq_ctrl = get_mq_ctrl();
 	if (!mq_ctrl) {
         return 0;
     }
-	bpf_printk("do_mq_timedsend_exit----------------------------------------------------------------\n");
 	u64 send_exit_time = bpf_ktime_get_ns();//开始发送信息时间；
 	int pid = bpf_get_current_pid_tgid();//发送端pid
 	u64 Key; 
@@ -160,9 +175,28 @@ int BPF_KRETPROBE(do_mq_timedsend_exit,void *ret)
 	Key = mq_send_info1->Key_msg_ptr;
 	struct send_events *mq_send_info2 = bpf_map_lookup_elem(&send_msg2, &Key);
 	if(!mq_send_info2){
+		bpf_map_delete_elem(&send_msg1,&pid);
+		return 0;
+	}
+	if (ret) {
+		/*发送失败，消息块已被内核释放*/
+		bpf_map_delete_elem(&send_msg2,&Key);
+		bpf_map_delete_elem(&send_msg1,&pid);
 		return 0;
 	}
 	mq_send_info2->send_exit_time = send_exit_time;
+
+	/*发送完成后采样队列深度*/
+	struct mq_queue_stat *stat = get_queue_stat(mq_send_info2->ino);
+	if (stat) {
+		const struct mqueue_inode_info *info = mq_send_info2->mq_info;
+		u64 depth = BPF_CORE_READ(info, attr.mq_curmsgs);
+		stat->sends++;
+		stat->depth_sum += depth;
+		if (depth > stat->depth_max) {
+			stat->depth_max = depth;
+		}
+	}
 	bpf_map_delete_elem(&send_msg1,&pid);
 	return 0;	
 } 
@@ -233,7 +267,6 @@ int BPF_KRETPROBE(do_mq_timedreceive_exit,void *ret){
     }
 	u64 rcv_exit_time = bpf_ktime_get_ns();
 	int pid = bpf_get_current_pid_tgid();
-	u64 send_enter_time,delay;
 	u64 Key;
 	
 	/*获取发送端、接收端信息*/
@@ -244,24 +277,28 @@ int BPF_KRETPROBE(do_mq_timedreceive_exit,void *ret){
 	Key = mq_rcv_info->Key_msg_ptr;
 	struct send_events *mq_send_info = bpf_map_lookup_elem(&send_msg2,&Key);
 	if(!mq_send_info){
+		bpf_map_delete_elem(&rcv_msg1,&pid);
 		return 0;
 	}
 
-	/*ringbuffer传值*/
-	struct mq_events *e;
-	e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
-	if (!e)	return 0;
-	e->send_pid = mq_send_info->send_pid;
-	e->rcv_pid = pid;
-	e->mqdes = mq_send_info->mqdes;
-		e->msg_len = mq_send_info->msg_len;
-		e->msg_prio = mq_send_info->msg_prio;
-
-		e->send_enter_time = mq_send_info->send_enter_time;
-		e->send_exit_time = mq_send_info->send_exit_time;
-		e->rcv_enter_time = mq_rcv_info->rcv_enter_time;
-		e->rcv_exit_time = rcv_exit_time;
-	bpf_ringbuf_submit(e, 0);
+	/*在内核中按队列聚合，消息速率再高也不增加上报的事件量*/
+	struct mq_queue_stat *stat = get_queue_stat(mq_send_info->ino);
+	if (stat) {
+		u64 delay = rcv_exit_time - mq_send_info->send_enter_time;
+		u32 slot = log2_u64(delay);
+		if (slot >= MQ_HIST_SLOTS) {
+			slot = MQ_HIST_SLOTS - 1;
+		}
+		stat->slots[slot]++;
+		stat->count++;
+		stat->sum_delay += delay;
+		if (delay > stat->max_delay) {
+			stat->max_delay = delay;
+		}
+		stat->send_pid = mq_send_info->send_pid;
+		stat->rcv_pid = pid;
+		stat->last_ts = rcv_exit_time;
+	}
 	bpf_map_delete_elem(&send_msg2, &Key);//暂时性删除
 	bpf_map_delete_elem(&rcv_msg1,&pid);//删除rcv_msg1  map;
 	return 0;
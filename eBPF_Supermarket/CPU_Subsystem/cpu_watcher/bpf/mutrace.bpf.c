@@ -27,10 +27,28 @@ BPF_HASH(kmutex_info_map, u64, struct mutex_info, 1024);
 BPF_HASH(umutex_info_map, u64, struct mutex_info, 1024);
 BPF_HASH(trylock_map, u64, struct trylock_info, 1024);
 BPF_ARRAY(mu_ctrl_map, int, struct mu_ctrl, 1);
+//kretprobe可能丢失(maxactive耗尽)，使用LRU使遗留的每线程等待项被自动淘汰
+BPF_LRU_HASH(kmutex_wait_map, u32, struct lock_wait, 10240);
+BPF_HASH(kmutex_stat_map, struct lock_stat_key, struct lock_stat, KMUTEX_STAT_ENTRIES);
 struct {
-    __uint(type, BPF_MAP_TYPE_RINGBUF);
-    __uint(max_entries, 256 * 1024);
-} rb SEC(".maps");
+    __uint(type, BPF_MAP_TYPE_STACK_TRACE);
+    __uint(key_size, sizeof(u32));
+    __uint(value_size, MAX_STACK_DEPTH * sizeof(u64));
+    __uint(max_entries, 4096);
+} kmutex_stacks SEC(".maps");
+
+//新建统计项时使用的初始值,放在只读段中以免占用栈空间
+static const struct lock_stat zero_stat;
+
+static inline u32 log2_u64(u64 v) {
+    u32 r, shift;
+    r = (v > 0xFFFFFFFF) << 5; v >>= r;
+    shift = (v > 0xFFFF) << 4; v >>= shift; r |= shift;
+    shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+    shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+    shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+    return r | (v >> 1);
+}
 
 static inline struct mu_ctrl *get_mu_ctrl(void) {
     struct mu_ctrl *mu_ctrl = bpf_map_lookup_elem(&mu_ctrl_map, &ctrl_key);
@@ -106,33 +124,24 @@ int BPF_KPROBE(trace_mutex_lock_slowpath, struct mutex *lock) {
     if (!mu_ctrl) {
         return 0;
     }
-    if (!mu_ctrl) return 0;
 
     u64 lock_addr = (u64)lock;
     u64 ts = bpf_ktime_get_ns();
-    struct mutex_contention_event *e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
-    if (!e) return 0;
-
-    pid_t pid = bpf_get_current_pid_tgid();
-    struct task_struct *owner_task, *contender_task;
+    u32 pid = bpf_get_current_pid_tgid();
+    struct task_struct *owner_task;
+    struct lock_wait wait = {};
     long owner;
 
-    e->contender_pid = pid;
-    e->ptr = lock_addr;
-    bpf_get_current_comm(&e->contender_name, sizeof(e->contender_name));
+    wait.ptr = lock_addr;
+    wait.start_time = ts;
+    wait.stack_id = bpf_get_stackid(ctx, &kmutex_stacks, 0);
     bpf_probe_read_kernel(&owner, sizeof(owner), &lock->owner);
-    owner_task = (struct task_struct *)(owner & ~0x1L);
-    contender_task = (struct task_struct *)bpf_get_current_task();
-    bpf_probe_read_kernel(&e->contender_prio, sizeof(e->contender_prio), &contender_task->prio);
-
+    owner_task = (struct task_struct *)(owner & ~0x7L);
     if (owner_task) {
-        bpf_probe_read_kernel(&e->owner_pid, sizeof(e->owner_pid), &owner_task->pid);
-        bpf_probe_read_kernel_str(&e->owner_name, sizeof(e->owner_name), owner_task->comm);
-        bpf_probe_read_kernel(&e->owner_prio, sizeof(e->owner_prio), &owner_task->prio);
-    } else {
-        e->owner_pid = 0;
-        __builtin_memset(e->owner_name, 0, sizeof(e->owner_name));
+        bpf_probe_read_kernel(&wait.owner_pid, sizeof(wait.owner_pid), &owner_task->pid);
+        bpf_probe_read_kernel_str(&wait.owner_name, sizeof(wait.owner_name), owner_task->comm);
     }
+    bpf_map_update_elem(&kmutex_wait_map, &pid, &wait, BPF_ANY);
 
     struct mutex_info *info = bpf_map_lookup_elem(&kmutex_info_map, &lock_addr);
     if (info) {
@@ -145,8 +154,44 @@ int BPF_KPROBE(trace_mutex_lock_slowpath, struct mutex *lock) {
         new_info.count = 1;
         bpf_map_update_elem(&kmutex_info_map, &lock_addr, &new_info, BPF_ANY);
     }
+    return 0;
+}
 
-    bpf_ringbuf_submit(e, 0);
+//慢路径返回时已获得锁,在内核中按(锁, 栈)累计等待时间直方图
+SEC("kretprobe/__mutex_lock_slowpath")
+int BPF_KRETPROBE(trace_mutex_lock_slowpath_ret) {
+    u32 pid = bpf_get_current_pid_tgid();
+    struct lock_wait *wait = bpf_map_lookup_elem(&kmutex_wait_map, &pid);
+    if (!wait) {
+        return 0;
+    }
+    u64 delta = bpf_ktime_get_ns() - wait->start_time;
+    struct lock_stat_key key = {
+        .ptr = wait->ptr,
+        .stack_id = wait->stack_id < 0 ? -1 : wait->stack_id,
+    };
+    struct lock_stat *stat = bpf_map_lookup_elem(&kmutex_stat_map, &key);
+    if (!stat) {
+        bpf_map_update_elem(&kmutex_stat_map, &key, &zero_stat, BPF_NOEXIST);
+        stat = bpf_map_lookup_elem(&kmutex_stat_map, &key);
+        if (!stat) {
+            goto out;
+        }
+    }
+    u32 slot = log2_u64(delta);
+    if (slot >= LOCK_HIST_SLOTS) {
+        slot = LOCK_HIST_SLOTS - 1;
+    }
+    __sync_fetch_and_add(&stat->slots[slot], 1);
+    __sync_fetch_and_add(&stat->count, 1);
+    __sync_fetch_and_add(&stat->wait_total, delta);
+    if (delta > stat->wait_max) {
+        stat->wait_max = delta;
+    }
+    stat->last_owner = wait->owner_pid;
+    __builtin_memcpy(stat->last_owner_name, wait->owner_name, sizeof(stat->last_owner_name));
+out:
+    bpf_map_delete_elem(&kmutex_wait_map, &pid);
     return 0;
 }
 
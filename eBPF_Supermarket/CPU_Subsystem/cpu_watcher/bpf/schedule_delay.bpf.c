@@ -26,10 +26,51 @@ char LICENSE[] SEC("license") = "Dual BSD/GPL";
 const int ctrl_key = 0;
 BPF_HASH(has_scheduled,struct proc_id, bool, 10240);//记录该进程是否调度过
 BPF_HASH(enter_schedule,struct proc_id, struct schedule_event, 10240);//记录该进程上运行队列的时间
-BPF_ARRAY(sys_schedule,int,struct sum_schedule,1);//记录整个系统的调度延迟
-BPF_ARRAY(threshold_schedule,int,struct proc_schedule,10240);//记录每个进程的调度延迟
-BPF_HASH(proc_histories,struct proc_id, struct proc_history, 10240);//记录每个进程运行前的两个进程
+BPF_PERCPU_ARRAY(sched_cpu_stats,u32,struct sched_cpu_stat,1);//每个CPU的调度延迟直方图
+BPF_PERCPU_HASH(sched_cgroup_hist,u64,struct sched_hist,SCHED_CGROUP_ENTRIES);//每个cgroup的调度延迟直方图
 BPF_ARRAY(schedule_ctrl_map,int,struct schedule_ctrl,1);
+BPF_ARRAY(sched_epoch,u32,u64,1);//用户态每读取一次max_delay加一
+//超过阈值的尾部事件，容量固定并按CPU限速采样
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, 256 * 1024);
+} rb SEC(".maps");
+
+//新建cgroup统计项时使用的初始值
+static const struct sched_hist zero_hist;
+
+static inline u32 log2_u64(u64 v) {
+    u32 r, shift;
+    r = (v > 0xFFFFFFFF) << 5; v >>= r;
+    shift = (v > 0xFFFF) << 4; v >>= shift; r |= shift;
+    shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+    shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+    shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+    return r | (v >> 1);
+}
+
+static inline void hist_add(struct sched_hist *hist, u64 delay) {
+    u32 slot = log2_u64(delay);
+    if (slot >= SCHED_HIST_SLOTS) {
+        slot = SCHED_HIST_SLOTS - 1;
+    }
+    hist->slots[slot]++;
+    hist->count++;
+    hist->sum_delay += delay;
+}
+
+//每个CPU每秒最多输出SCHED_TAIL_PER_SEC个尾部事件
+static inline bool tail_sample(struct sched_cpu_stat *stat, u64 now) {
+    if (now - stat->tail_window >= 1000000000ULL) {
+        stat->tail_window = now;
+        stat->tail_events = 0;
+    }
+    if (stat->tail_events >= SCHED_TAIL_PER_SEC) {
+        return false;
+    }
+    stat->tail_events++;
+    return true;
+}
 
 static inline struct schedule_ctrl *get_schedule_ctrl(void) {
     struct schedule_ctrl *sched_ctrl;
@@ -103,8 +144,6 @@ int BPF_PROG(sched_switch, bool preempt, struct task_struct *prev, struct task_s
     if (!sched_ctrl) {
         return 0;
     }
-    struct proc_history *history;
-    struct proc_history new_history;
     u64 current_time = bpf_ktime_get_ns();
     pid_t prev_pid = prev->pid;
     unsigned int prev_state = prev->__state;
@@ -113,8 +152,6 @@ int BPF_PROG(sched_switch, bool preempt, struct task_struct *prev, struct task_s
     int next_cpu = bpf_get_smp_processor_id();
     bool *issched;
     struct schedule_event *schedule_event;
-    struct sum_schedule *sum_schedule;
-    int key = 0;
     struct proc_id next_id = {};
     u64 delay;
     if (prev_state == TASK_RUNNING) {
@@ -151,56 +188,53 @@ int BPF_PROG(sched_switch, bool preempt, struct task_struct *prev, struct task_s
         *issched = true;
     }
     delay = current_time - schedule_event->enter_time;
-    struct proc_schedule proc_schedule;
-    proc_schedule.delay = delay;
-    proc_schedule.id= next_id;
-    bpf_probe_read_kernel_str(&proc_schedule.proc_name, sizeof(proc_schedule.proc_name), next->comm);
-    bpf_map_update_elem(&threshold_schedule, &key, &proc_schedule, BPF_ANY);
-    sum_schedule = bpf_map_lookup_elem(&sys_schedule, &key);
-    if (!sum_schedule) {
-        struct sum_schedule sum_schedule = {};
-        sum_schedule.sum_count++;
-        sum_schedule.sum_delay += delay;
-        if (delay > sum_schedule.max_delay) {
-            sum_schedule.max_delay = delay;
-            if (next->pid != 0) {
-                bpf_probe_read_kernel_str(&sum_schedule.proc_name_max, sizeof(sum_schedule.proc_name_max), next->comm);
-            }
-        } else if (sum_schedule.min_delay == 0 || delay < sum_schedule.min_delay) {
-            sum_schedule.min_delay = delay;
-            if (next->pid != 0) {
-                bpf_probe_read_kernel_str(&sum_schedule.proc_name_min, sizeof(sum_schedule.proc_name_min), next->comm);
-            }
+    u32 stat_key = 0;
+    struct sched_cpu_stat *stat = bpf_map_lookup_elem(&sched_cpu_stats, &stat_key);
+    if (!stat) return 0;
+    //每CPU的数组元素，无需原子操作
+    hist_add(&stat->hist, delay);
+    u64 *epoch = bpf_map_lookup_elem(&sched_epoch, &stat_key);
+    if (epoch && stat->max_epoch != *epoch) {
+        stat->max_epoch = *epoch;
+        stat->max_delay = 0;
+    }
+    if (delay > stat->max_delay) {
+        stat->max_delay = delay;
+        bpf_probe_read_kernel_str(&stat->max_proc_name, sizeof(stat->max_proc_name), next->comm);
+    }
+
+    u64 cgroup_id = BPF_CORE_READ(next, cgroups, dfl_cgrp, kn, id);
+    struct sched_hist *cgroup_hist = bpf_map_lookup_elem(&sched_cgroup_hist, &cgroup_id);
+    if (!cgroup_hist) {
+        bpf_map_update_elem(&sched_cgroup_hist, &cgroup_id, &zero_hist, BPF_NOEXIST);
+        cgroup_hist = bpf_map_lookup_elem(&sched_cgroup_hist, &cgroup_id);
+    }
+    if (cgroup_hist) {
+        hist_add(cgroup_hist, delay);
+    }
+
+    if (sched_ctrl->min_us_set && delay / 1000 > sched_ctrl->min_us && next_pid != 0) {
+        struct sched_tail_event *e = NULL;
+        if (tail_sample(stat, current_time)) {
+            e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
         }
-        bpf_map_update_elem(&sys_schedule, &key, &sum_schedule, BPF_ANY);
-    } else {
-        sum_schedule->sum_count++;
-        sum_schedule->sum_delay += delay;
-        if (delay > sum_schedule->max_delay) {
-            sum_schedule->max_delay = delay;
-            bpf_probe_read_kernel_str(&sum_schedule->proc_name_max, sizeof(sum_schedule->proc_name_max), next->comm);
-        } else if (sum_schedule->min_delay == 0 || delay < sum_schedule->min_delay) {
-            sum_schedule->min_delay = delay;
-            if (next->pid != 0) {
-                bpf_probe_read_kernel_str(&sum_schedule->proc_name_min, sizeof(sum_schedule->proc_name_min), next->comm);
-            }
+        if (e) {
+            e->pid = next_pid;
+            e->cpu = next_cpu;
+            e->delay = delay;
+            e->cgroup_id = cgroup_id;
+            bpf_probe_read_kernel_str(&e->comm, sizeof(e->comm), next->comm);
+            e->prev[0] = stat->last_prev;
+            e->prev[1].pid = prev_pid;
+            bpf_probe_read_kernel_str(&e->prev[1].comm, sizeof(e->prev[1].comm), prev->comm);
+            bpf_ringbuf_submit(e, 0);
+        } else {
+            stat->tail_dropped++;
         }
     }
-    history = bpf_map_lookup_elem(&proc_histories, &next_id);
-    if (history) {
-        // 如果找到了，更新历史记录
-        new_history.last[0] = history->last[1];
-        new_history.last[1].pid = prev->pid;
-        bpf_probe_read_kernel_str(&new_history.last[1].comm, sizeof(new_history.last[1].comm), prev->comm);
-        bpf_map_update_elem(&proc_histories, &next_id, &new_history, BPF_ANY);
-    } else {
-        // 如果没有找到，初始化新的历史记录
-        new_history.last[0].pid = 0;  // 初始化为0，表示没有历史信息
-        new_history.last[0].comm[0] = '\0';
-        new_history.last[1].pid = prev->pid;
-        bpf_probe_read_kernel_str(&new_history.last[1].comm, sizeof(new_history.last[1].comm), prev->comm);
-        bpf_map_update_elem(&proc_histories, &next_id, &new_history, BPF_ANY);
-    }
+    //记录本CPU上被换出的进程，供下一次的尾部事件使用
+    stat->last_prev.pid = prev_pid;
+    bpf_probe_read_kernel_str(&stat->last_prev.comm, sizeof(stat->last_prev.comm), prev->comm);
     return 0;
 }
 
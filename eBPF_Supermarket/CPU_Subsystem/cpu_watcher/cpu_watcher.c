@@ -104,6 +104,7 @@ static int preemptmap_fd;
 static int schedulemap_fd;
 struct schedule_ctrl sd_ctrl = {};
 static int mqmap_fd;
+struct mq_ctrl mq_ctrl = {};
 static int mumap_fd;
 struct mu_ctrl mu_ctrl = {};
 
@@ -292,113 +293,69 @@ static int print_all()
 		}
 	}
 	int nprocs = get_nprocs();
-	/*proc:*/
-	int key_proc = 1;
-	int err_proc, fd_proc = bpf_map__fd(sar_skel->maps.countMap);
-	u64 total_forks;
-	err_proc = bpf_map_lookup_elem(fd_proc, &key_proc, &total_forks); 
-	if (err_proc < 0) {
-		fprintf(stderr, "failed to lookup infos of total_forks: %d\n", err_proc);
+	/*所有计数器位于同一个每CPU结构体中，一次查找读取全部CPU的数据*/
+	struct sar_stats percpu_stats[MAX_CPU_NR], total = {};
+	int fd_stats = bpf_map__fd(sar_skel->maps.sar_stats_map);
+	err = bpf_map_lookup_elem(fd_stats, &key, percpu_stats);
+	if (err < 0) {
+		fprintf(stderr, "failed to lookup infos of sar_stats: %d\n", err);
 		return -1;
 	}
+	for (int cpu = 0; cpu < nr_cpus; cpu++) {
+		const struct sar_stats *st = &percpu_stats[cpu];
+		total.cswch += st->cswch;
+		if (st->forks > total.forks)
+			total.forks = st->forks;
+		total.irq_time += st->irq_time;
+		total.softirq_time += st->softirq_time;
+		total.idle_time += st->idle_time;
+		total.kt_time += st->kt_time;
+		total.ut_time += st->ut_time;
+		total.tick_user += st->tick_user;
+	}
+
+	/*proc:*/
 	u64 __proc;
-	__proc = total_forks - proc;
-	proc = total_forks;
+	__proc = total.forks - proc;
+	proc = total.forks;
 
 	/*cswch:*/
-	int key_cswch = 0;
-	int err_cswch, fd_cswch = bpf_map__fd(sar_skel->maps.countMap);
-	u64 sched_total;
-	err_cswch = bpf_map_lookup_elem(fd_cswch, &key_cswch, &sched_total);
-	if (err_cswch < 0) {
-		fprintf(stderr, "failed to lookup infos of sched_total: %d\n", err_cswch);
-		return -1;
-	}
 	u64 __sched;
-	__sched = sched_total - sched;
-	sched = sched_total;
-
-	 /*runqlen:*/ 
-	int key_runqlen = 0;
-	int err_runqlen, fd_runqlen = bpf_map__fd(sar_skel->maps.runqlen);
-	int runqlen;
-	err_runqlen = bpf_map_lookup_elem(fd_runqlen, &key_runqlen, &runqlen);
-	if (err_runqlen < 0) {
-		fprintf(stderr, "failed to lookup infos of runqlen: %d\n", err_runqlen);
-		return -1;
+	__sched = total.cswch - sched;
+	sched = total.cswch;
+
+	/*runqlen:按rq所属CPU记录，各CPU求和*/
+	int runqlen = 0;
+	int fd_runqlen = bpf_map__fd(sar_skel->maps.runqlen_map);
+	for (__u32 cpu = 0; cpu < (__u32)nr_cpus && cpu < MAX_CPU_NR; cpu++) {
+		__u64 nr_running;
+		if (!bpf_map_lookup_elem(fd_runqlen, &cpu, &nr_running))
+			runqlen += nr_running;
 	}
 
 	/*irqtime:*/
-	int key_irqtime = 0;
-	int err_irqtime, fd_irqtime = bpf_map__fd(sar_skel->maps.irq_Last_time);
-	u64 __irqtime;
-    __irqtime = irqtime;
-	err_irqtime = bpf_map_lookup_elem(fd_irqtime, &key_irqtime, &irqtime);
-	if (err_irqtime < 0) {
-		fprintf(stderr, "failed to lookup infos of irqtime: %d\n", err_irqtime);
-		return -1;
-	}
-    u64 dtairqtime = (irqtime - __irqtime);
+	u64 dtairqtime = total.irq_time - irqtime;
+	irqtime = total.irq_time;
 
 	/*softirq:*/
-	int key_softirq = 0;
-	int err_softirq, fd_softirq = bpf_map__fd(sar_skel->maps.softirqLastTime);
-	u64 __softirq;
-    __softirq = softirq;
-	err_softirq = bpf_map_lookup_elem(fd_softirq, &key_softirq, &softirq); 
-	if (err_softirq < 0) {
-		fprintf(stderr, "failed to lookup infos of softirq: %d\n", err_softirq);
-		return -1;
-	}
-    u64 dtasoftirq = (softirq - __softirq);
+	u64 dtasoftirq = total.softirq_time - softirq;
+	softirq = total.softirq_time;
 
 	/*idle*/
-	int key_idle = 0;
-	int err_idle, fd_idle = bpf_map__fd(sar_skel->maps.idleLastTime);
-	u64 __idle;
-    __idle = idle;
-	err_idle = bpf_map_lookup_elem(fd_idle, &key_idle, &idle);
-	if (err_idle < 0) {
-		fprintf(stderr, "failed to lookup infos of idle: %d\n", err_idle);
-		return -1;
-	}
-    u64 dtaidle = (idle - __idle);	
+	u64 dtaidle = total.idle_time - idle;
+	idle = total.idle_time;
 
 	/*kthread*/
-	int key_kthread = 0;
-	int err_kthread, fd_kthread = bpf_map__fd(sar_skel->maps.kt_LastTime);
-	unsigned long  _ktTime=0; 
-	_ktTime = ktTime;
-	err_kthread = bpf_map_lookup_elem(fd_kthread, &key_kthread,&ktTime);
-	if (err_kthread < 0) {
-		fprintf(stderr, "failed to lookup infos: %d\n", err_kthread);
-		return -1;
-	}
-	unsigned long dtaKT = ktTime -_ktTime;
+	unsigned long dtaKT = total.kt_time - ktTime;
+	ktTime = total.kt_time;
 
 	/*Uthread*/
-	int key_uthread = 0;
-	int err_uthread, fd_uthread = bpf_map__fd(sar_skel->maps.ut_LastTime);
-	unsigned long  _utTime=0; 
-	_utTime = utTime;
-	err_uthread = bpf_map_lookup_elem(fd_uthread, &key_uthread,&utTime);
-	if (err_uthread < 0) {
-		fprintf(stderr, "failed to lookup infos: %d\n", err_uthread);
-		return -1;
-	}
-	unsigned long dtaUT = utTime -_utTime;
+	unsigned long dtaUT = total.ut_time - utTime;
+	utTime = total.ut_time;
 
 	/*sys*/
-	int key_sys = 0;
-	int err_sys, fd_sys = bpf_map__fd(sar_skel->maps.tick_user);
-	u64 __tick_user =0 ;// 用于存储从映射中查找到的值
-	__tick_user = tick_user;
-	//tick_user = 0;
-	err_sys = bpf_map_lookup_elem(fd_sys, &key_sys, &tick_user);
-	if (err_sys < 0) {
-		fprintf(stderr, "failed to lookup infos of sys: %d\n", err_sys);
-		return -1;
-	}
+	u64 __tick_user = tick_user;
+	tick_user = total.tick_user;
 	u64 dtaTickUser = tick_user - __tick_user;
 	u64 dtaUTRaw = dtaTickUser/(99.0000) * 1000000000; 
 	u64 dtaSysc = abs(dtaUT - dtaUTRaw);
@@ -576,50 +533,6 @@ static int attach(struct mutrace_bpf *mu_skel)
 }
 
 
-//mutrace输出
-static int mutrace_print(void *ctx, void *data, unsigned long data_sz) {
-	int err,key = 0;
-	err = bpf_map_lookup_elem(mumap_fd,&key,&mu_ctrl);
-	if (err < 0) {
-		fprintf(stderr, "failed to lookup infos: %d\n", err);
-		return -1;
-	}
-	if(!mu_ctrl.mu_func)	return 0;
-	if(mu_ctrl.prev_watcher == MUTEX_WATCHER ){
-		printf("%s\n","    lock_ptr               owner_pid       owner_comm       owner_prio   contender_pid     contender_comm  contender_prio   contender_count");
-		mu_ctrl.prev_watcher = MUTEX_WATCHER + 9;//打印表头功能关
-		err = bpf_map_update_elem(mumap_fd, &key, &mu_ctrl, 0);
-		if(err < 0){
-			fprintf(stderr, "Failed to update elem\n");
-		}
-	}else if (mu_ctrl.prev_watcher == MUTEX_WATCHER +1) {
-		printf("%s\n","    lock_ptr              locked_total       locked_max     contended_total       count     last_owner        last_owmer_name");
-		mu_ctrl.prev_watcher = MUTEX_WATCHER + 9;//打印表头功能关
-		err = bpf_map_update_elem(mumap_fd, &key, &mu_ctrl, 0);
-		if(err < 0){
-			fprintf(stderr, "Failed to update elem\n");
-		}
-	}else if (mu_ctrl.prev_watcher == MUTEX_WATCHER +2) {
-		printf("%s\n","    lock_ptr              locked_total       locked_max     contended_total       count     last_owner        last_owmer_name");
-		mu_ctrl.prev_watcher = MUTEX_WATCHER + 9;//打印表头功能关
-		err = bpf_map_update_elem(mumap_fd, &key, &mu_ctrl, 0);
-		if(err < 0){
-			fprintf(stderr, "Failed to update elem\n");
-		}
-	}
-	if(!mu_ctrl.mutex_detail&& (!mu_ctrl.umutex)){
-		const struct mutex_contention_event *e = data;
-		if (e->owner_pid == 0 || e->contender_pid == 0||e->owner_pid == 1) {
-			return 0;
-		}
-		// 增加锁争用次数
-		increment_lock_count(e->ptr);
-		uint64_t contention_count = get_lock_count(e->ptr);
-		printf("%15llu %15d %15s %15d %15d %15s %15d %15ld\n", e->ptr, e->owner_pid, e->owner_name, e->owner_prio,e->contender_pid, e->contender_name, e->contender_prio,contention_count);
-	}
-    return 0;
-}
-
 static int kmutex_detail() {
     int fd = bpf_map__fd(mu_skel->maps.kmutex_info_map);
     u64 key, next_key;
@@ -650,9 +563,244 @@ static int umutex_detail() {
     return 0;
 }
 
+/* 内核互斥锁争用排名：内核按(锁, 争用栈)聚合，用户态按锁合并后按本周期总等待时间排序 */
+#define MUTEX_TOP_N 10
+#define MUTEX_STACK_SHOW 4
+#define KSYM_MAX_OFFSET 0x1000
+
+static struct lock_table lock_table;
+static struct ksyms *ksyms;
+
+static int drain_kmutex_stats(void)
+{
+	int fd = bpf_map__fd(mu_skel->maps.kmutex_stat_map);
+	static struct lock_stat_key *keys;
+	static struct lock_stat *values;
+	int total;
+
+	if (!keys) {
+		keys = calloc(KMUTEX_STAT_ENTRIES, sizeof(*keys));
+		values = calloc(KMUTEX_STAT_ENTRIES, sizeof(*values));
+		if (!keys || !values)
+			return -ENOMEM;
+	}
+	total = lookup_and_delete_all(fd, keys, values, KMUTEX_STAT_ENTRIES,
+				      sizeof(*keys), sizeof(*values));
+	if (total < 0)
+		return total;
+
+	for (int i = 0; i < total; i++) {
+		const struct lock_stat *v = &values[i];
+		struct lock_agg *agg = lock_table_get(&lock_table, keys[i].ptr);
+		if (!agg)
+			return -ENOMEM;
+		agg->wait_total += v->wait_total;
+		agg->count += v->count;
+		if (v->wait_max > agg->wait_max)
+			agg->wait_max = v->wait_max;
+		for (int j = 0; j < LOCK_HIST_SLOTS; j++)
+			agg->slots[j] += v->slots[j];
+		// 只保留单个周期内等待时间最多的争用栈
+		if (keys[i].stack_id >= 0 && v->wait_total > agg->top_stack_wait) {
+			agg->top_stack_id = keys[i].stack_id;
+			agg->top_stack_wait = v->wait_total;
+		}
+		agg->last_owner = v->last_owner;
+		memcpy(agg->last_owner_name, v->last_owner_name, sizeof(agg->last_owner_name));
+	}
+	return 0;
+}
+
+static int cmp_lock_wait(const void *a, const void *b)
+{
+	const struct lock_agg *x = *(const struct lock_agg **)a;
+	const struct lock_agg *y = *(const struct lock_agg **)b;
+	return x->wait_total < y->wait_total ? 1 : x->wait_total > y->wait_total ? -1 : 0;
+}
+
+static double lock_percentile_us(const struct lock_agg *agg, double percentile)
+{
+	return hist_percentile_us(agg->slots, LOCK_HIST_SLOTS, agg->count, agg->wait_max, percentile);
+}
+
+// 静态定义的锁可由kallsyms符号化，动态分配的锁输出'-'
+static const char *lock_name(u64 ptr, char *buf, size_t size)
+{
+	const struct ksym *sym = ksyms__search(ksyms, ptr);
+	if (!sym || ptr - sym->addr >= KSYM_MAX_OFFSET)
+		return "-";
+	if (ptr == sym->addr)
+		return sym->name;
+	snprintf(buf, size, "%s+0x%llx", sym->name, ptr - sym->addr);
+	return buf;
+}
+
+static void print_lock_stack(int stack_id)
+{
+	int fd = bpf_map__fd(mu_skel->maps.kmutex_stacks);
+	u64 ips[MAX_STACK_DEPTH] = {};
+	if (stack_id < 0 || bpf_map_lookup_elem(fd, &stack_id, ips))
+		return;
+	printf("%20s", "stack:");
+	for (int i = 0; i < MAX_STACK_DEPTH && i < MUTEX_STACK_SHOW && ips[i]; i++) {
+		const struct ksym *sym = ksyms__search(ksyms, ips[i]);
+		printf("%s%s", i ? " <- " : " ", sym ? sym->name : "[unknown]");
+	}
+	printf("\n");
+}
+
+static int kmutex_contention_rank(void)
+{
+	struct lock_agg **rank;
+	size_t nr = 0;
+	char buf[128];
+	int err;
+
+	err = drain_kmutex_stats();
+	if (err < 0) {
+		fprintf(stderr, "failed to drain kmutex stats: %d\n", err);
+		return err;
+	}
+	if (!lock_table.count)
+		return 0;
+	rank = calloc(lock_table.count, sizeof(*rank));
+	if (!rank)
+		return -ENOMEM;
+	for (size_t i = 0; i < lock_table.capacity; i++) {
+		if (lock_table.entries[i].ptr && lock_table.entries[i].count)
+			rank[nr++] = &lock_table.entries[i];
+	}
+	qsort(rank, nr, sizeof(*rank), cmp_lock_wait);
+
+	time_t now = time(NULL);
+	struct tm *localTime = localtime(&now);
+	printf("\nTime: %02d:%02d:%02d\n", localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
+	printf("%18s %28s %14s %10s %10s %10s %10s %10s %10s %16s\n", "lock_ptr", "lock_sym",
+	       "wait_total/us", "count", "avg/us", "p50/us", "p99/us", "max/us", "last_owner", "owner_comm");
+	for (size_t i = 0; i < nr && i < MUTEX_TOP_N; i++) {
+		const struct lock_agg *agg = rank[i];
+		printf("%#18lx %28s %14.2f %10lu %10.2f %10.2f %10.2f %10.2f %10d %16s\n", agg->ptr,
+		       lock_name(agg->ptr, buf, sizeof(buf)), agg->wait_total / 1000.0, agg->count,
+		       agg->wait_total / 1000.0 / agg->count, lock_percentile_us(agg, 0.5),
+		       lock_percentile_us(agg, 0.99), agg->wait_max / 1000.0, agg->last_owner,
+		       agg->last_owner_name);
+		print_lock_stack(agg->top_stack_id);
+	}
+	free(rank);
+	// 每个周期只输出该周期内的争用，避免旧数据与top_stack_wait一直累积
+	lock_table_reset(&lock_table);
+	return 0;
+}
+
+//mutrace输出
+static int mutrace_print(void)
+{
+	int err,key = 0;
+	err = bpf_map_lookup_elem(mumap_fd,&key,&mu_ctrl);
+	if (err < 0) {
+		fprintf(stderr, "failed to lookup infos: %d\n", err);
+		return -1;
+	}
+	if(!mu_ctrl.mu_func)	return 0;
+	if (mu_ctrl.prev_watcher == MUTEX_WATCHER +1 || mu_ctrl.prev_watcher == MUTEX_WATCHER +2) {
+		printf("%s\n","    lock_ptr              locked_total       locked_max     contended_total       count     last_owner        last_owmer_name");
+	}
+	if (mu_ctrl.prev_watcher != MUTEX_WATCHER + 9) {
+		mu_ctrl.prev_watcher = MUTEX_WATCHER + 9;//打印表头功能关
+		err = bpf_map_update_elem(mumap_fd, &key, &mu_ctrl, 0);
+		if(err < 0){
+			fprintf(stderr, "Failed to update elem\n");
+		}
+	}
+	if (mu_ctrl.mutex_detail) {
+		kmutex_detail();
+	} else if (mu_ctrl.umutex) {
+		umutex_detail();
+	} else {
+		return kmutex_contention_rank();
+	}
+	printf("-------------------------------------------------------------\n");
+	return 0;
+}
+
+/* schedule_delay: 内核按CPU和cgroup统计log2直方图，用户态计算本周期的分位数 */
+#define SCHED_TOP_N 3
+
+static struct sched_hist sched_last[MAX_CPU_NR];//上一周期每个CPU的直方图快照
+static u64 sched_last_dropped;
+
+// 按CPU/cgroup的直方图没有单独的最大值，max_ns为0时只在桶内插值
+static double sched_percentile_us(const struct sched_hist *hist, u64 max_ns, double percentile)
+{
+	return hist_percentile_us(hist->slots, SCHED_HIST_SLOTS, hist->count, max_ns, percentile);
+}
+
+static void sched_hist_merge(struct sched_hist *dst, const struct sched_hist *src)
+{
+	for (int i = 0; i < SCHED_HIST_SLOTS; i++)
+		dst->slots[i] += src->slots[i];
+	dst->count += src->count;
+	dst->sum_delay += src->sum_delay;
+}
+
+struct sched_rank {
+	u64 id;//CPU号或cgroup id
+	struct sched_hist hist;
+	double p99;
+};
+
+static int cmp_sched_rank(const void *a, const void *b)
+{
+	const struct sched_rank *x = a, *y = b;
+	return x->p99 < y->p99 ? 1 : x->p99 > y->p99 ? -1 : 0;
+}
+
+static void print_sched_hist(const char *label, const struct sched_hist *hist)
+{
+	printf("%-24s %10llu %12.3lf %12.3lf %12.3lf %12.3lf\n", label, hist->count,
+	       hist->count ? hist->sum_delay / 1000.0 / hist->count : 0.0,
+	       sched_percentile_us(hist, 0, 0.5), sched_percentile_us(hist, 0, 0.99),
+	       sched_percentile_us(hist, 0, 0.999));
+}
+
+//读取并清空每cgroup的直方图，按p99排序
+static int sched_cgroup_rank(struct sched_rank **rank)
+{
+	int fd = bpf_map__fd(sd_skel->maps.sched_cgroup_hist);
+	static u64 *keys;
+	static struct sched_hist *values;
+	int count, nr = 0;
+
+	if (!keys) {
+		keys = calloc(SCHED_CGROUP_ENTRIES, sizeof(*keys));
+		values = calloc((size_t)SCHED_CGROUP_ENTRIES * nr_cpus, sizeof(*values));
+		if (!keys || !values)
+			return -ENOMEM;
+	}
+	count = lookup_and_delete_all(fd, keys, values, SCHED_CGROUP_ENTRIES, sizeof(*keys),
+				      sizeof(*values) * nr_cpus);
+	if (count <= 0)
+		return count;
+	*rank = calloc(count, sizeof(**rank));
+	if (!*rank)
+		return -ENOMEM;
+	for (int i = 0; i < count; i++) {
+		struct sched_rank *r = &(*rank)[nr];
+		r->id = keys[i];
+		for (int cpu = 0; cpu < nr_cpus; cpu++)
+			sched_hist_merge(&r->hist, &values[(size_t)i * nr_cpus + cpu]);
+		if (!r->hist.count)
+			continue;
+		r->p99 = sched_percentile_us(&r->hist, 0, 0.99);
+		nr++;
+	}
+	qsort(*rank, nr, sizeof(**rank), cmp_sched_rank);
+	return nr;
+}
+
 static int schedule_print()
 {
-    int err,key = 0;
+	int err,key = 0;
 	err = bpf_map_lookup_elem(schedulemap_fd,&key,&sd_ctrl);
 	if (err < 0) {
 		fprintf(stderr, "failed to lookup infos: %d\n", err);
@@ -661,7 +809,8 @@ static int schedule_print()
 	if(!sd_ctrl.schedule_func)	return 0;	
 
 	if(sd_ctrl.prev_watcher == SCHEDULE_WACTHER ){
-		printf("%-8s %s\n",  "  TIME ", "avg_delay/μs     max_delay/μs    max_proc_name    min_delay/μs   min_proc_name");
+		printf("%-24s %10s %12s %12s %12s %12s   %s\n", "  TIME ", "count", "avg_delay/μs",
+		       "p50/μs", "p99/μs", "p999/μs", "max_delay/μs max_proc_name");
 		sd_ctrl.prev_watcher = SCHEDULE_WACTHER + 9;//打印表头功能关
 		err = bpf_map_update_elem(schedulemap_fd, &key, &sd_ctrl, 0);
 		if(err < 0){
@@ -669,9 +818,8 @@ static int schedule_print()
 		}
 	}
 	else if(sd_ctrl.prev_watcher == SCHEDULE_WACTHER +1){
-			// printf("sd_ctrl.prev_watcher = %d\n",sd_ctrl.prev_watcher);
 			printf("调度延时大于%dms的进程:\n",sd_ctrl.min_us/1000);
-			printf("%s\n","pid        COMM                   schedule_delay/us");
+			printf("%s\n","pid        COMM                   schedule_delay/us   cpu  cgroup");
 		sd_ctrl.prev_watcher = SCHEDULE_WACTHER + 9;//打印表头功能关.
 		err = bpf_map_update_elem(schedulemap_fd, &key, &sd_ctrl, 0);
 		if(err < 0){
@@ -679,95 +827,329 @@ static int schedule_print()
 		}		
 	}
 
-	if(!sd_ctrl.min_us_set){
-		struct sum_schedule info;
-		int err, fd = bpf_map__fd(sd_skel->maps.sys_schedule);
-		time_t now = time(NULL);
-		struct tm *localTime = localtime(&now);
-		int hour = localTime->tm_hour;
-		int min = localTime->tm_min;
-		int sec = localTime->tm_sec;
-		unsigned long long avg_delay; 
-		err = bpf_map_lookup_elem(fd, &key, &info);
-		if (err < 0) {
-			fprintf(stderr, "failed to lookup infos: %d\n", err);
-			return -1;
-		}
-		avg_delay = info.sum_delay / info.sum_count;
-		if (!ifprint) {
-			ifprint=1;
-		}else{
-			printf("%02d:%02d:%02d  %-15lf %-15lf  %10s %15lf  %15s\n",
-			hour, min, sec, avg_delay / 1000.0, info.max_delay / 1000.0,info.proc_name_max,info.min_delay / 1000.0,info.proc_name_min);
-		}
+	/*一次查找读取全部CPU的统计*/
+	struct sched_cpu_stat stats[MAX_CPU_NR];
+	struct sched_rank cpus[MAX_CPU_NR];
+	struct sched_hist total = {};
+	u64 max_delay = 0, dropped = 0, epoch = 0;
+	const char *max_proc_name = "";
+	int nr = 0;
+	int epoch_fd = bpf_map__fd(sd_skel->maps.sched_epoch);
+	bpf_map_lookup_elem(epoch_fd, &key, &epoch);
+	err = bpf_map_lookup_elem(bpf_map__fd(sd_skel->maps.sched_cpu_stats), &key, stats);
+	if (err < 0) {
+		fprintf(stderr, "failed to lookup sched_cpu_stats: %d\n", err);
+		return -1;
+	}
+	//切换周期后，内核在各CPU下一次记录时清零max_delay，只保留本周期的最大值
+	epoch++;
+	bpf_map_update_elem(epoch_fd, &key, &epoch, BPF_ANY);
+	for (int cpu = 0; cpu < nr_cpus; cpu++) {
+		struct sched_hist *last = &sched_last[cpu];
+		struct sched_rank *r = &cpus[nr];
+		memset(r, 0, sizeof(*r));
+		r->id = cpu;
+		//直方图在内核中持续累加，与上一周期的快照相减得到本周期的分布
+		for (int i = 0; i < SCHED_HIST_SLOTS; i++)
+			r->hist.slots[i] = stats[cpu].hist.slots[i] - last->slots[i];
+		r->hist.count = stats[cpu].hist.count - last->count;
+		r->hist.sum_delay = stats[cpu].hist.sum_delay - last->sum_delay;
+		*last = stats[cpu].hist;
+		if (stats[cpu].max_epoch == epoch - 1 && stats[cpu].max_delay > max_delay) {
+			max_delay = stats[cpu].max_delay;
+			max_proc_name = stats[cpu].max_proc_name;
+		}
+		dropped += stats[cpu].tail_dropped;
+		if (!r->hist.count)
+			continue;
+		sched_hist_merge(&total, &r->hist);
+		r->p99 = sched_percentile_us(&r->hist, 0, 0.99);
+		nr++;
 	}
-	else{
-		struct proc_schedule info;
-		struct proc_id id_key;
-		struct proc_history prev_info;
-        int key = 0;  
-        int err, fd1 = bpf_map__fd(sd_skel->maps.threshold_schedule),fd2 = bpf_map__fd(sd_skel->maps.proc_histories);
-        err = bpf_map_lookup_elem(fd1, &key, &info);
-        if (err < 0) {
-            fprintf(stderr, "failed to lookup infos: %d\n", err);
-            return -1;
-        }
-        if (info.delay / 1000 > sd_ctrl.min_us&&info.id.pid!=0) {
-			id_key.pid = info.id.pid;
-    		id_key.cpu_id = info.id.cpu_id;
-			err = bpf_map_lookup_elem(fd2, &id_key, &prev_info);
-			if (err < 0) {
-				fprintf(stderr, "Failed to lookup proc_histories with PID %d and CPU ID %d: %d\n", id_key.pid, id_key.cpu_id, err);
-				return -1;
-			}
-            if (!entry_exists(info.id.pid, info.proc_name, info.delay / 1000)) {
-                printf("%-10d %-16s %15lld", info.id.pid, info.proc_name, info.delay / 1000);
-                add_entry(info.id.pid, info.proc_name, info.delay / 1000);
-				for (int i = 0; i < 2; i++) {
-					if (prev_info.last[i].pid != 0) {
-						printf("          Previous Process %d: PID=%-10d Name=%-16s ", i+1, prev_info.last[i].pid, prev_info.last[i].comm);
-					}
-				}
-				printf("\n"); 
-            }
 
-        }
+	struct sched_rank *cgroups = NULL;
+	int nr_cgroups = sched_cgroup_rank(&cgroups);
+
+	if (sd_ctrl.min_us_set) {
+		//尾部事件由ring buffer回调输出，这里只报告被采样丢弃的数量
+		if (dropped > sched_last_dropped)
+			printf("(%llu tail events dropped by sampling)\n", dropped - sched_last_dropped);
+		sched_last_dropped = dropped;
+		free(cgroups);
+		return 0;
+	}
+	if (!ifprint) {
+		ifprint=1;
+		free(cgroups);
+		return 0;
 	}
 
+	time_t now = time(NULL);
+	struct tm *localTime = localtime(&now);
+	char label[64];
+	snprintf(label, sizeof(label), "%02d:%02d:%02d", localTime->tm_hour, localTime->tm_min,
+		 localTime->tm_sec);
+	printf("%-24s %10llu %12.3lf %12.3lf %12.3lf %12.3lf   %-12.3lf %s\n", label, total.count,
+	       total.count ? total.sum_delay / 1000.0 / total.count : 0.0,
+	       sched_percentile_us(&total, max_delay, 0.5), sched_percentile_us(&total, max_delay, 0.99),
+	       sched_percentile_us(&total, max_delay, 0.999), max_delay / 1000.0, max_proc_name);
+	//p99最高的几个CPU与cgroup
+	qsort(cpus, nr, sizeof(*cpus), cmp_sched_rank);
+	for (int i = 0; i < nr && i < SCHED_TOP_N; i++) {
+		snprintf(label, sizeof(label), "  cpu%llu", cpus[i].id);
+		print_sched_hist(label, &cpus[i].hist);
+	}
+	for (int i = 0; i < nr_cgroups && i < SCHED_TOP_N; i++) {
+		const char *path = cgroup_name_lookup(cgroups[i].id, i == 0);
+		if (path)
+			snprintf(label, sizeof(label), "  %.21s", path);
+		else
+			snprintf(label, sizeof(label), "  cgroup%llu", cgroups[i].id);
+		print_sched_hist(label, &cgroups[i].hist);
+	}
+	free(cgroups);
     return 0;
 }
 
+//超过阈值的调度延迟尾部事件
+static int schedule_tail_print(void *ctx, void *data, unsigned long data_sz)
+{
+	const struct sched_tail_event *e = data;
+	const char *path;
+	if (!sd_ctrl.min_us_set)
+		return 0;
+	path = cgroup_name_lookup(e->cgroup_id, false);
+	printf("%-10d %-16s %15llu %5d  %-20s", e->pid, e->comm, e->delay / 1000, e->cpu,
+	       path ? path : "-");
+	for (int i = 0; i < 2; i++) {
+		if (e->prev[i].pid != 0) {
+			printf("          Previous Process %d: PID=%-10d Name=%-16s ", i+1, e->prev[i].pid, e->prev[i].comm);
+		}
+	}
+	printf("\n");
+	return 0;
+}
+
+
+/* mq_delay: 内核按队列聚合端到端时延与深度，用户态每周期取出并按p99排序 */
+struct mq_rank {
+	u64 ino;
+	struct mq_queue_stat stat;
+	double p99;
+};
 
-static int mq_event(void *ctx, void *data,unsigned long data_sz)
+static double mq_percentile_us(const struct mq_queue_stat *stat, double percentile)
 {
-	time_t now = time(NULL);// 获取当前时间
-	struct tm *localTime = localtime(&now);// 将时间转换为本地时间结构
-	const struct mq_events *e = data;
-	float send_delay,rcv_delay,delay;
-	if(!e->send_enter_time || !e->send_exit_time || !e->rcv_enter_time || !e->rcv_exit_time) {
-		printf("erro!\n");
+	return hist_percentile_us(stat->slots, MQ_HIST_SLOTS, stat->count, stat->max_delay, percentile);
+}
+
+static int cmp_mq_rank(const void *a, const void *b)
+{
+	const struct mq_rank *x = a, *y = b;
+	return x->p99 < y->p99 ? 1 : x->p99 > y->p99 ? -1 : 0;
+}
+
+//队列inode号到名字的缓存，由扫描/dev/mqueue得到
+#define MQ_NAME_CACHE 256
+struct mq_name_ent {
+	u64 ino;
+	char name[64];
+};
+static struct mq_name_ent mq_names[MQ_NAME_CACHE];
+static int nr_mq_names;
+
+static void mq_names_scan(void)
+{
+	DIR *dir = opendir("/dev/mqueue");
+	struct dirent *ent;
+	nr_mq_names = 0;
+	if (!dir)
+		return;
+	while ((ent = readdir(dir)) && nr_mq_names < MQ_NAME_CACHE) {
+		if (ent->d_name[0] == '.')
+			continue;
+		mq_names[nr_mq_names].ino = ent->d_ino;
+		snprintf(mq_names[nr_mq_names].name, sizeof(mq_names[0].name), "/%s", ent->d_name);
+		nr_mq_names++;
+	}
+	closedir(dir);
+}
+
+//按inode号查找队列名，未命中时重新扫描一次(每个周期最多一次)，仍找不到时退回inode号
+static const char *mq_name(u64 ino, bool *scanned, char *buf, size_t len)
+{
+	for (;;) {
+		for (int i = 0; i < nr_mq_names; i++) {
+			if (mq_names[i].ino == ino)
+				return mq_names[i].name;
+		}
+		if (*scanned)
+			break;
+		mq_names_scan();
+		*scanned = true;
+	}
+	snprintf(buf, len, "ino:%llu", ino);
+	return buf;
+}
+
+static int mq_print(void)
+{
+	static u64 *keys;
+	static struct mq_queue_stat *values;
+	struct mq_rank *rank;
+	int err, key = 0, count, nr = 0;
+	err = bpf_map_lookup_elem(mqmap_fd, &key, &mq_ctrl);
+	if (err < 0) {
+		fprintf(stderr, "failed to lookup infos: %d\n", err);
+		return -1;
+	}
+	if (!mq_ctrl.mq_func)
 		return 0;
+	if (mq_ctrl.prev_watcher == MQ_WACTHER) {
+		printf("%-24s %10s %12s %12s %12s %12s %10s %10s   %s\n", "  TIME / QUEUE", "count",
+		       "avg_delay/μs", "p50/μs", "p99/μs", "max_delay/μs", "avg_depth", "max_depth",
+		       "SND_PID->RCV_PID");
+		mq_ctrl.prev_watcher = MQ_WACTHER + 9;//打印表头功能关
+		err = bpf_map_update_elem(mqmap_fd, &key, &mq_ctrl, 0);
+		if (err < 0) {
+			fprintf(stderr, "Failed to update elem\n");
+		}
 	}
-	send_delay = (e->send_exit_time - e->send_enter_time)/1000000.0;
-	rcv_delay = (e->rcv_exit_time - e->rcv_enter_time)/1000000.0;	
-	if(e->send_enter_time < e->rcv_enter_time){
-		delay = (e->rcv_exit_time - e->send_enter_time)/1000000.0;
-	}else{
-		delay = (e->rcv_exit_time - e->send_enter_time)/1000000.0 + send_delay + rcv_delay;		
+
+	if (!keys) {
+		keys = calloc(MQ_QUEUE_ENTRIES, sizeof(*keys));
+		values = calloc((size_t)MQ_QUEUE_ENTRIES * nr_cpus, sizeof(*values));
+		if (!keys || !values)
+			return -ENOMEM;
 	}
-	printf("%02d:%02d:%02d   %-8u %-8u %-8u \t%-16llu %-16llu %-16llu %-16llu\t%-15.5f %-15.5f %-15.5f\n",
-		localTime->tm_hour, localTime->tm_min, localTime->tm_sec,
-		e->mqdes,e->send_pid,e->rcv_pid,
-		e->send_enter_time,e->send_exit_time,e->rcv_enter_time,e->rcv_exit_time,
-		send_delay,rcv_delay,delay);
+	count = lookup_and_delete_all(bpf_map__fd(mq_skel->maps.mq_queue_stats), keys, values,
+				      MQ_QUEUE_ENTRIES, sizeof(*keys), sizeof(*values) * nr_cpus);
+	if (count <= 0)
+		return count;
+	rank = calloc(count, sizeof(*rank));
+	if (!rank)
+		return -ENOMEM;
+	for (int i = 0; i < count; i++) {
+		struct mq_rank *r = &rank[nr];
+		u64 last_ts = 0;
+		r->ino = keys[i];
+		for (int cpu = 0; cpu < nr_cpus; cpu++) {
+			const struct mq_queue_stat *v = &values[(size_t)i * nr_cpus + cpu];
+			for (int j = 0; j < MQ_HIST_SLOTS; j++)
+				r->stat.slots[j] += v->slots[j];
+			r->stat.count += v->count;
+			r->stat.sum_delay += v->sum_delay;
+			r->stat.sends += v->sends;
+			r->stat.depth_sum += v->depth_sum;
+			if (v->max_delay > r->stat.max_delay)
+				r->stat.max_delay = v->max_delay;
+			if (v->depth_max > r->stat.depth_max)
+				r->stat.depth_max = v->depth_max;
+			//取各CPU中最近一次配对的发送/接收进程
+			if (v->last_ts > last_ts) {
+				last_ts = v->last_ts;
+				r->stat.send_pid = v->send_pid;
+				r->stat.rcv_pid = v->rcv_pid;
+			}
+		}
+		if (!r->stat.count && !r->stat.sends)
+			continue;
+		r->p99 = mq_percentile_us(&r->stat, 0.99);
+		nr++;
+	}
+	qsort(rank, nr, sizeof(*rank), cmp_mq_rank);
 
+	time_t now = time(NULL);
+	struct tm *localTime = localtime(&now);
+	bool scanned = false;
+	printf("%02d:%02d:%02d  (%d queues active)\n", localTime->tm_hour, localTime->tm_min,
+	       localTime->tm_sec, nr);
+	for (int i = 0; i < nr && i < MQ_TOP_N; i++) {
+		const struct mq_queue_stat *st = &rank[i].stat;
+		char name[64], label[64];
+		snprintf(label, sizeof(label), "  %.21s",
+			 mq_name(rank[i].ino, &scanned, name, sizeof(name)));
+		printf("%-24s %10llu %12.3lf %12.3lf %12.3lf %12.3lf %10.1lf %10llu   %d->%d\n", label,
+		       st->count, st->count ? st->sum_delay / 1000.0 / st->count : 0.0,
+		       mq_percentile_us(st, 0.5), mq_percentile_us(st, 0.99), st->max_delay / 1000.0,
+		       st->sends ? (double)st->depth_sum / st->sends : 0.0, st->depth_max,
+		       st->send_pid, st->rcv_pid);
+	}
+	free(rank);
 	return 0;
 }
 
+/* 所有子工具的ring buffer注册到同一个ring_buffer管理器，由一个epoll统一等待 */
+static struct ring_buffer *rb = NULL;
+
+static int add_ring_buffer(struct bpf_map *map, ring_buffer_sample_fn sample_cb)
+{
+	if (!rb) {
+		rb = ring_buffer__new(bpf_map__fd(map), sample_cb, NULL, NULL);
+		return rb ? 0 : -1;
+	}
+	return ring_buffer__add(rb, bpf_map__fd(map), sample_cb, NULL);
+}
+
+static u64 now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void preempt_summary(void)
+{
+	time_t now = time(NULL);
+	struct tm *localTime = localtime(&now);
+	if (!preempt_start_print) {
+		preempt_start_print = 1;
+	} else {
+		printf("----------------------------------------------------------------------------------------------------------\n");
+		if (preempt_count)
+			printf("\nAverage_preempt_Time: %8d ns\n", sum_preemptTime / preempt_count);
+	}
+	printf("\nTime: %02d:%02d:%02d\n", localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
+	printf("%-12s %-8s %-8s %11s\n", "COMM", "prev_pid", "next_pid", "duration_ns");
+	preempt_count = 0;
+	sum_preemptTime = 0;
+}
+
+/* 每个周期依次执行已开启子工具的汇总输出 */
+static int periodic_print(void)
+{
+	int err;
+	if (env.SAR) {
+		err = print_all();
+		if (err < 0)
+			return err;
+	}
+	if (env.CS_DELAY && cs_flag) {
+		histogram();
+	}
+	if (env.PREEMPT) {
+		preempt_summary();
+	}
+	if (env.SCHEDULE_DELAY) {
+		err = schedule_print();
+		if (err < 0)
+			return err;
+	}
+	if (env.MQ_DELAY) {
+		err = mq_print();
+		if (err < 0)
+			return err;
+	}
+	if (env.MUTRACE) {
+		err = mutrace_print();
+		if (err < 0)
+			return err;
+	}
+	return 0;
+}
 
 int main(int argc, char **argv)
 {
-	struct ring_buffer *rb = NULL;
 	struct bpf_map *cs_ctrl_map = NULL;
 	struct bpf_map *sar_ctrl_map = NULL;
 	struct bpf_map *sc_ctrl_map = NULL;
@@ -808,26 +1190,27 @@ int main(int argc, char **argv)
 		if (!cs_skel)
 		{
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = -1;
+			goto cleanup;
 		}
 		/* Load & verify BPF programs */
 		err = cs_delay_bpf__load(cs_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto cs_delay_cleanup;
+			goto cleanup;
 		}
 
 		err = common_pin_map(&cs_ctrl_map,cs_skel->obj,"cs_ctrl_map",cs_ctrl_path);
 		if(err < 0){
-			goto cs_delay_cleanup;
+			goto cleanup;
 		}
 		csmap_fd = bpf_map__fd(cs_ctrl_map);
 		struct cs_ctrl init_value = {false,CS_WACTHER};
 		err = bpf_map_update_elem(csmap_fd, &key, &init_value, 0);
 		if(err < 0){
 			fprintf(stderr, "Failed to update elem\n");
-			goto cs_delay_cleanup;
+			goto cleanup;
 		}
 
 		/* Attach tracepoints */
@@ -835,108 +1218,111 @@ int main(int argc, char **argv)
 		if (err)
 		{
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto cs_delay_cleanup;
+			goto cleanup;
 		}
-		rb = ring_buffer__new(bpf_map__fd(cs_skel->maps.rb), handle_event, NULL, NULL);	//ring_buffer__new() API，允许在不使用额外选项数据结构下指定回调
-		if (!rb) {
-			err = -1;
+		err = add_ring_buffer(cs_skel->maps.rb, handle_event);
+		if (err) {
 			fprintf(stderr, "Failed to create ring buffer\n");
-			goto cs_delay_cleanup;
+			goto cleanup;
 		}
-	}else if (env.PREEMPT) {
+	}
+	if (env.PREEMPT) {
 		preempt_skel = preempt_bpf__open();
 		if (!preempt_skel) {
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = -1;
+			goto cleanup;
 		}
 
 		err = preempt_bpf__load(preempt_skel);
 		if (err) {
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto preempt_cleanup;
+			goto cleanup;
 		}
 
 		err = common_pin_map(&preempt_ctrl_map,preempt_skel->obj,"preempt_ctrl_map",preempt_ctrl_path);
 		if(err < 0){
-			goto preempt_cleanup;
+			goto cleanup;
 		}
 		preemptmap_fd = bpf_map__fd(preempt_ctrl_map);
 		struct preempt_ctrl init_value = {false,PREEMPT_WACTHER};
 		err = bpf_map_update_elem(preemptmap_fd, &key, &init_value, 0);
 		if(err < 0){
 			fprintf(stderr, "Failed to update elem\n");
-			goto preempt_cleanup;
+			goto cleanup;
 		}
 		err = preempt_bpf__attach(preempt_skel);
 		if (err) {
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto preempt_cleanup;
+			goto cleanup;
 		}
 
-		rb = ring_buffer__new(bpf_map__fd(preempt_skel->maps.rb), preempt_print, NULL, NULL);
-		if (!rb) {
-			err = -1;
+		err = add_ring_buffer(preempt_skel->maps.rb, preempt_print);
+		if (err) {
 			fprintf(stderr, "Failed to create ring buffer\n");
-			goto preempt_cleanup;
+			goto cleanup;
 		}
-	}else if (env.SYSCALL_DELAY){
+	}
+	if (env.SYSCALL_DELAY) {
 		/* Load and verify BPF application */
 		sc_skel = sc_delay_bpf__open();
 		if (!sc_skel)
 		{
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = -1;
+			goto cleanup;
 		}
 		/* Load & verify BPF programs */
 		err = sc_delay_bpf__load(sc_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto sc_delay_cleanup;
+			goto cleanup;
 		}
 		err = common_pin_map(&sc_ctrl_map,sc_skel->obj,"sc_ctrl_map",sc_ctrl_path);
 		if(err < 0){
-			goto sc_delay_cleanup;
+			goto cleanup;
 		}
 		scmap_fd = bpf_map__fd(sc_ctrl_map);
 		struct sc_ctrl init_value = {false,SC_WACTHER};
 		err = bpf_map_update_elem(scmap_fd, &key, &init_value, 0);
 		if(err < 0){
 			fprintf(stderr, "Failed to update elem\n");
-			goto sc_delay_cleanup;
+			goto cleanup;
 		}
 		/* Attach tracepoints */
 		err = sc_delay_bpf__attach(sc_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto sc_delay_cleanup;
+			goto cleanup;
 		}
 		printf("%-8s   %-8s   %-15s %-15s\n","Time","Pid","syscall_id","delay/ms");
-		rb = ring_buffer__new(bpf_map__fd(sc_skel->maps.rb), syscall_delay_print, NULL, NULL);	//ring_buffer__new() API，允许在不使用额外选项数据结构下指定回调
-		if (!rb) {
-			err = -1;
+		err = add_ring_buffer(sc_skel->maps.rb, syscall_delay_print);
+		if (err) {
 			fprintf(stderr, "Failed to create ring buffer\n");
-			goto sc_delay_cleanup;		
+			goto cleanup;
 		}
 
 
-	}else if(env.SCHEDULE_DELAY){
+	}
+	if (env.SCHEDULE_DELAY) {
 
 	
 		sd_skel = schedule_delay_bpf__open();
 		if (!sd_skel) {
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = -1;
+			goto cleanup;
 		}
 		err = schedule_delay_bpf__load(sd_skel);
 		if (err) {
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto schedule_cleanup;
+			goto cleanup;
 		}
 		err = common_pin_map(&schedule_ctrl_map,sd_skel->obj,"schedule_ctrl_map",schedule_ctrl_path);
 		if(err < 0){
-			goto schedule_cleanup;
+			goto cleanup;
 		}
 		schedulemap_fd = bpf_map__fd(schedule_ctrl_map);
 		struct schedule_ctrl init_value = {false,false,10000,SCHEDULE_WACTHER};
@@ -944,20 +1330,27 @@ int main(int argc, char **argv)
 		err = bpf_map_update_elem(schedulemap_fd, &key, &init_value, 0);
 		if(err < 0){
 			fprintf(stderr, "Failed to update elem\n");
-			goto schedule_cleanup;
+			goto cleanup;
 		}
 		err = schedule_delay_bpf__attach(sd_skel);
 		if (err) {
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto schedule_cleanup;
+			goto cleanup;
+		}
+		err = add_ring_buffer(sd_skel->maps.rb, schedule_tail_print);
+		if (err) {
+			fprintf(stderr, "Failed to create ring buffer\n");
+			goto cleanup;
 		}
-	}else if (env.SAR){
+	}
+	if (env.SAR) {
 		/* Load and verify BPF application */
 		sar_skel = sar_bpf__open();
 		if (!sar_skel)
 		{
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = -1;
+			goto cleanup;
 		}
 		sar_skel->rodata->forks_addr = (u64)find_ksym(symbol_name);
 		/* Load & verify BPF programs */
@@ -965,58 +1358,60 @@ int main(int argc, char **argv)
 		if (err)
 		{
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto sar_cleanup;
+			goto cleanup;
 		}
 
 		/*perf_event加载*/
 		err = open_and_attach_perf_event(env.freq, sar_skel->progs.tick_update, links);
 		if (err)
-			goto sar_cleanup;
+			goto cleanup;
 
 		err = common_pin_map(&sar_ctrl_map,sar_skel->obj,"sar_ctrl_map",sar_ctrl_path);
 		if(err < 0){
-			goto sar_cleanup;
+			goto cleanup;
 		}
 		sarmap_fd = bpf_map__fd(sar_ctrl_map);
 		struct sar_ctrl init_value = {false,false,SAR_WACTHER};
 		err = bpf_map_update_elem(sarmap_fd, &key, &init_value, 0);
 		if(err < 0){
 			fprintf(stderr, "Failed to update elem\n");
-			goto sar_cleanup;
+			goto cleanup;
 		}
 
 		err = sar_bpf__attach(sar_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto sar_cleanup;
+			goto cleanup;
 		}
-	}else if(env.MQ_DELAY){
+	}
+	if (env.MQ_DELAY) {
 		/* Load and verify BPF application */
 		mq_skel = mq_delay_bpf__open();
 		if (!mq_skel)
 		{
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = -1;
+			goto cleanup;
 		}
 		/* Load & verify BPF programs */
 		err = mq_delay_bpf__load(mq_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto mq_delay_cleanup;
+			goto cleanup;
 		}
 
 		err = common_pin_map(&mq_ctrl_map,mq_skel->obj,"mq_ctrl_map",mq_ctrl_path);
 		if(err < 0){
-			goto mq_delay_cleanup;
+			goto cleanup;
 		}
 		mqmap_fd = bpf_map__fd(mq_ctrl_map);
 		struct mq_ctrl init_value = {false,MQ_WACTHER};
 		err = bpf_map_update_elem(mqmap_fd, &key, &init_value, 0);
 		if(err < 0){
 			fprintf(stderr, "Failed to update elem\n");
-			goto mq_delay_cleanup;
+			goto cleanup;
 		}
 
 		/* Attach tracepoints */
@@ -1024,30 +1419,25 @@ int main(int argc, char **argv)
 		if (err)
 		{
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto mq_delay_cleanup;
+			goto cleanup;
 		}
-		printf("%-8s   %-8s %-8s %-8s \t%-16s %-16s %-16s %-16s\t%-15s %-15s %-15s\n","Time","Mqdes","SND_PID","RCV_PID","SND_Enter","SND_EXit","RCV_Enter","RCV_EXit","SND_Delay/ms","RCV_Delay/ms","Delay/ms");		
-		rb = ring_buffer__new(bpf_map__fd(mq_skel->maps.rb), mq_event, NULL, NULL);	//ring_buffer__new() API，允许在不使用额外选项数据结构下指定回调
-		if (!rb) {
-			err = -1;
-			fprintf(stderr, "Failed to create ring buffer\n");
-			goto mq_delay_cleanup;
-		}
-	}else if (env.MUTRACE) {
+	}
+	if (env.MUTRACE) {
 		mu_skel = mutrace_bpf__open();
 		if (!mu_skel) {
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = -1;
+			goto cleanup;
 		}
 
 		err = mutrace_bpf__load(mu_skel);
 		if (err) {
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto mutrace_cleanup;
+			goto cleanup;
 		}
 		err = common_pin_map(&mu_ctrl_map,mu_skel->obj,"mu_ctrl_map",mu_ctrl_path);
 		if(err < 0){
-			goto mutrace_cleanup;
+			goto cleanup;
 		}
 		mumap_fd = bpf_map__fd(mu_ctrl_map);
 		struct mu_ctrl init_value = {false,false,false,MUTEX_WATCHER};
@@ -1055,188 +1445,89 @@ int main(int argc, char **argv)
 		err = bpf_map_update_elem(mumap_fd, &key, &init_value, 0);
 		if(err < 0){
 			fprintf(stderr, "Failed to update elem\n");
-			goto mutrace_cleanup;
+			goto cleanup;
 		}
 		//ctrl
 		if(err < 0){
-			goto mutrace_cleanup;
+			goto cleanup;
 		}
 		//ctrl
 		if(err < 0){
 			fprintf(stderr, "Failed to update elem\n");
-			goto mutrace_cleanup;
+			goto cleanup;
 		}
 		err = attach(mu_skel);
 		if (err) {
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto mutrace_cleanup;
+			goto cleanup;
 		}
 
-		rb = ring_buffer__new(bpf_map__fd(mu_skel->maps.rb), mutrace_print, NULL, NULL);
-		if (!rb) {
-			err = -1;
-			fprintf(stderr, "Failed to create ring buffer\n");
-			goto mutrace_cleanup;
-		}
+		ksyms = ksyms__load();
+		if (!ksyms)
+			fprintf(stderr, "Failed to load kallsyms, locks will not be symbolized\n");
+	}
+	if (!env.SAR && !env.CS_DELAY && !env.SYSCALL_DELAY && !env.PREEMPT &&
+	    !env.SCHEDULE_DELAY && !env.MQ_DELAY && !env.MUTRACE) {
+		printf("正在开发中......\n-c	打印cs_delay:\t对内核函数schedule()的执行时长进行测试;\n-s	sar工具;\n-y	打印sc_delay:\t系统调用运行延迟进行检测; \n-p	打印preempt_time:\t对抢占调度时间输出;\n");
+		goto cleanup;
 	}
+
+	/* 所有子工具共用一个事件循环：ring buffer事件随到随处理，周期性输出在到期时统一执行 */
+	u64 next_tick = now_ms() + env.period * 1000;
 	while (!exiting) {
-		if(env.SAR){
-			sleep(env.period);
-			err = print_all();
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-        	    printf("Error polling perf buffer: %d\n", err);
-				break;
-			}
-		}
-        else if(env.CS_DELAY){
-			sleep(1);
-			err = ring_buffer__poll(rb, 1000 /* timeout, s */);
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-        	    printf("Error polling perf buffer: %d\n", err);
-				break;
-			}
-    		struct cs_ctrl *cs_ctrl;
-			int ctrl_key = 0 ;
-			if(cs_flag){
-				histogram();
-			}
-		}
-		else if(env.SYSCALL_DELAY){
-			err = ring_buffer__poll(rb, 100 /* timeout, ms */);		//ring_buffer__poll(),轮询打开ringbuf缓冲区。如果有事件，handle_event函数会执行	
-			/* Ctrl-C will cause -EINTR */
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-				printf("Error polling perf buffer: %d\n", err);
-				break;
-			}
-			// time_t now = time(NULL);// 获取当前时间
-			// struct tm *localTime = localtime(&now);// 将时间转换为本地时间结构
-			// printf("\n\nTime: %02d:%02d:%02d\n",localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
-			// printf("----------------------------------------------------------------------------------------------------------\n");
-			// sleep(1);			
-		}
-		else if (env.PREEMPT) {
-			err = ring_buffer__poll(rb, 100 /* timeout, ms */);
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-				printf("Error polling perf buffer: %d\n", err);
-				break;
-			}
-			time_t now = time(NULL);
-			struct tm *localTime = localtime(&now);
-			if (!preempt_start_print) {
-				preempt_start_print = 1;
-			} else {
-				printf("----------------------------------------------------------------------------------------------------------\n");
-				printf("\nAverage_preempt_Time: %8d ns\n", sum_preemptTime / preempt_count);
-			}
-			printf("\nTime: %02d:%02d:%02d\n", localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
-			printf("%-12s %-8s %-8s %11s\n", "COMM", "prev_pid", "next_pid", "duration_ns");
-			preempt_count = 0;
-			sum_preemptTime = 0;
-			sleep(2);
-		}
-		else if (env.SCHEDULE_DELAY){
-			err = schedule_print();
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-				break;
-			}
-			if(env.SCHEDULE_DELAY&&!sd_ctrl.min_us_set){
-				sleep(1);
-			}	
+		long long timeout = (long long)(next_tick - now_ms());
+		if (timeout < 0)
+			timeout = 0;
+		if (rb) {
+			err = ring_buffer__poll(rb, timeout /* timeout, ms */);
+		} else {
+			err = usleep(timeout * 1000) ? -errno : 0;
+		}
+		/* Ctrl-C will cause -EINTR */
+		if (err == -EINTR) {
+			err = 0;
+			break;
 		}
-        else if(env.MQ_DELAY){
-			err = ring_buffer__poll(rb, 1000 /* timeout, s */);
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-        	    printf("Error polling perf buffer: %d\n", err);
-				break;
-			}
+		if (err < 0) {
+			printf("Error polling ring buffer: %d\n", err);
+			break;
 		}
-		else if (env.MUTRACE) {
-			err = ring_buffer__poll(rb, 100 /* timeout, ms */);
-			if (err == -EINTR) {
-				err = 0;
+		err = 0;
+		if (now_ms() >= next_tick) {
+			err = periodic_print();
+			if (err < 0)
 				break;
-			}
-			if (err < 0) {
-				printf("Error polling perf buffer: %d\n", err);
-				break;
-			}
-			if(env.MUTRACE&&mu_ctrl.mutex_detail){
-				err = kmutex_detail();
-				sleep(1);
-				printf("-------------------------------------------------------------\n");
-			}else if(env.MUTRACE&&mu_ctrl.umutex){
-				err = umutex_detail();
-				sleep(1);
-				printf("-------------------------------------------------------------\n");
-			}
-
-		}
-		else {
-			printf("正在开发中......\n-c	打印cs_delay:\t对内核函数schedule()的执行时长进行测试;\n-s	sar工具;\n-y	打印sc_delay:\t系统调用运行延迟进行检测; \n-p	打印preempt_time:\t对抢占调度时间输出;\n");
-			break;
+			next_tick += env.period * 1000;
 		}
 	}
 
-cs_delay_cleanup:
-	bpf_map__unpin(cs_ctrl_map, cs_ctrl_path);
+cleanup:
 	ring_buffer__free(rb);
+	for (int i = 0; i < MAX_CPU_NR; i++)
+		bpf_link__destroy(links[i]);
+	if (cs_ctrl_map)
+		bpf_map__unpin(cs_ctrl_map, cs_ctrl_path);
+	if (sar_ctrl_map)
+		bpf_map__unpin(sar_ctrl_map, sar_ctrl_path);
+	if (sc_ctrl_map)
+		bpf_map__unpin(sc_ctrl_map, sc_ctrl_path);
+	if (preempt_ctrl_map)
+		bpf_map__unpin(preempt_ctrl_map, preempt_ctrl_path);
+	if (schedule_ctrl_map)
+		bpf_map__unpin(schedule_ctrl_map, schedule_ctrl_path);
+	if (mq_ctrl_map)
+		bpf_map__unpin(mq_ctrl_map, mq_ctrl_path);
+	if (mu_ctrl_map)
+		bpf_map__unpin(mu_ctrl_map, mu_ctrl_path);
 	cs_delay_bpf__destroy(cs_skel);
-	return err < 0 ? -err : 0;
-
-sar_cleanup:
-	bpf_map__unpin(sar_ctrl_map, sar_ctrl_path);
 	sar_bpf__destroy(sar_skel);
-	return err < 0 ? -err : 0;
-
-sc_delay_cleanup:
-	bpf_map__unpin(sc_ctrl_map, sc_ctrl_path);
-	ring_buffer__free(rb);
 	sc_delay_bpf__destroy(sc_skel);
-	return err < 0 ? -err : 0;
-
-preempt_cleanup:
-	bpf_map__unpin(preempt_ctrl_map, preempt_ctrl_path);	
-	ring_buffer__free(rb);
 	preempt_bpf__destroy(preempt_skel);
-	return err < 0 ? -err : 0;
-
-schedule_cleanup:
-	bpf_map__unpin(schedule_ctrl_map, schedule_ctrl_path);
 	schedule_delay_bpf__destroy(sd_skel);
-	return err < 0 ? -err : 0;
-
-mq_delay_cleanup:
-	bpf_map__unpin(mq_ctrl_map, mq_ctrl_path);
-	ring_buffer__free(rb);
 	mq_delay_bpf__destroy(mq_skel);
-	return err < 0 ? -err : 0;
-
-mutrace_cleanup:
-	ring_buffer__free(rb);
 	mutrace_bpf__destroy(mu_skel);
+	lock_table_free(&lock_table);
+	ksyms__free(ksyms);
+	cgroup_names_free();
 	return err < 0 ? -err : 0;
 }
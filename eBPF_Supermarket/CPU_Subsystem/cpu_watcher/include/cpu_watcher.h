@@ -56,6 +56,18 @@ typedef __kernel_mqd_t mqd_t;
 		__uint(value_size, sizeof(type2)); \
 		__uint(max_entries, MAX_ENTRIES); \
 	} name SEC(".maps")
+/// @brief 创建一个指定名字和键值类型的ebpf LRU散列表，满时淘汰最久未使用的项
+/// @param name 新散列表的名字
+/// @param type1 键的类型
+/// @param type2 值的类型
+/// @param MAX_ENTRIES 哈希map容量
+#define BPF_LRU_HASH(name, type1, type2, MAX_ENTRIES) \
+	struct { \
+		__uint(type, BPF_MAP_TYPE_LRU_HASH); \
+		__uint(key_size, sizeof(type1)); \
+		__uint(value_size, sizeof(type2)); \
+		__uint(max_entries, MAX_ENTRIES); \
+	} name SEC(".maps")
 /// @brief 创建一个指定名字和键值类型的ebpf每CPU数组
 /// @param name 新散列表的名字
 /// @param type1 键的类型
@@ -130,29 +142,41 @@ struct schedule_event {
 	int count;//调度次数
 	unsigned long long enter_time;
 };
-//整个系统所有调度信息
-struct sum_schedule {
-	unsigned long long sum_count;
-	unsigned long long sum_delay;
-	unsigned long long max_delay;
-	unsigned long long min_delay;
-    char proc_name_max[TASK_COMM_LEN];
-	char proc_name_min[TASK_COMM_LEN];
+struct proc_info {
+    pid_t pid;
+    char comm[TASK_COMM_LEN];
 };
 
-struct proc_schedule {
-	struct proc_id id;
-	unsigned long long delay;
-	char proc_name[TASK_COMM_LEN];
+#define SCHED_HIST_SLOTS 32
+#define SCHED_CGROUP_ENTRIES 256
+#define SCHED_TAIL_PER_SEC 64 //每个CPU每秒最多输出的尾部事件数
+//调度延迟的log2直方图(ns)
+struct sched_hist {
+	u64 slots[SCHED_HIST_SLOTS];
+	u64 count;
+	u64 sum_delay;
 };
 
-struct proc_info {
-    pid_t pid;
-    char comm[TASK_COMM_LEN];
+//每CPU的调度统计与尾部事件采样状态
+struct sched_cpu_stat {
+	struct sched_hist hist;
+	u64 max_delay;
+	u64 max_epoch;//max_delay所属的周期，与sched_epoch不同时先清零
+	char max_proc_name[TASK_COMM_LEN];
+	struct proc_info last_prev;//本CPU上更早一次被换出的进程
+	u64 tail_window;//采样窗口的开始时间
+	u64 tail_events;//窗口内已输出的尾部事件数
+	u64 tail_dropped;//因限速或ring满而丢弃的尾部事件数
 };
 
-struct proc_history {
-    struct proc_info last[2]; // 存储最后两个调度的进程信息
+//调度延迟超过阈值时输出的尾部事件
+struct sched_tail_event {
+	int pid;
+	int cpu;
+	u64 delay;
+	u64 cgroup_id;
+	char comm[TASK_COMM_LEN];
+	struct proc_info prev[2];//本CPU上在其之前运行的两个进程
 };
 
 /*----------------------------------------------*/
@@ -169,34 +193,57 @@ struct mutex_info {
     u64 ptr;//地址
 };
 
-struct mutex_contention_event {
-	u64 ptr;//锁地址
-	pid_t owner_pid;//持有者pid
-    pid_t contender_pid;//抢占者pid
-    char contender_name[TASK_COMM_LEN];
-    char owner_name[TASK_COMM_LEN];
-	int owner_prio;
-	int contender_prio;
-};
-
 struct trylock_info {
     void *__mutex;
     u64 start_time;
 };
 
+#define LOCK_HIST_SLOTS 32
+#define MAX_STACK_DEPTH 20
+#define KMUTEX_STAT_ENTRIES 10240
+//按(锁地址, 争用者内核栈)聚合的争用统计
+struct lock_stat_key {
+	u64 ptr;
+	int stack_id;
+	u32 pad;
+};
+
+struct lock_stat {
+	u64 wait_total;//等待锁的总时间
+	u64 wait_max;//最长一次等待时间
+	u64 count;//争用次数
+	u64 slots[LOCK_HIST_SLOTS];//等待时间的log2直方图(ns)
+	pid_t last_owner;//最近一次争用时的持有者
+	char last_owner_name[TASK_COMM_LEN];
+};
+
+//进入慢路径时记录,返回时计算等待时间
+struct lock_wait {
+	u64 ptr;
+	u64 start_time;
+	int stack_id;
+	pid_t owner_pid;
+	char owner_name[TASK_COMM_LEN];
+};
+
 /*----------------------------------------------*/
 /*         mq_delay相关结构体                     */
 /*----------------------------------------------*/
-struct mq_events {
-    int send_pid;
+#define MQ_HIST_SLOTS 32
+#define MQ_QUEUE_ENTRIES 1024
+#define MQ_TOP_N 5
+//每个消息队列(以inode号标识)在内核中聚合的统计，避免逐条消息上报
+struct mq_queue_stat {
+    u64 slots[MQ_HIST_SLOTS];//发送进入到接收返回的端到端时延log2直方图(ns)
+    u64 count;
+    u64 sum_delay;
+    u64 max_delay;
+    u64 sends;
+    u64 depth_sum;//每次发送完成后采样的队列深度之和
+    u64 depth_max;
+    int send_pid;//最近一次配对的发送/接收进程
     int rcv_pid;
-    mqd_t mqdes;
-    size_t msg_len;
-    unsigned int msg_prio;
-    u64 send_enter_time;
-    u64 send_exit_time;
-    u64 rcv_enter_time;
-    u64 rcv_exit_time;
+    u64 last_ts;//最近一次配对的时间，用于在各CPU间选出最新的进程对
 };
 struct send_events {
     int send_pid;
@@ -206,6 +253,8 @@ struct send_events {
     unsigned int msg_prio;
     const char *u_msg_ptr;
     const void *src;
+    const void *mq_info;//队列的mqueue_inode_info，用于读取当前深度
+    u64 ino;//队列inode号，不同进程的mqdes可能不同
     u64 send_enter_time;
     u64 send_exit_time;
 };
@@ -220,6 +269,25 @@ struct rcv_events {
     u64 rcv_enter_time;
     u64 rcv_exit_time;
 };
+/*----------------------------------------------*/
+/*          sar每CPU统计结构体                    */
+/*----------------------------------------------*/
+//所有sar计数器合并为一个每CPU结构体，用户态一次查找即可读取全部CPU的数据
+struct sar_stats {
+	u64 cswch;        //进程切换数
+	u64 forks;        //total_forks的最新值(全局计数，取各CPU最大值)
+	u64 irq_time;     //硬中断累计时间
+	u64 softirq_time; //软中断累计时间
+	u64 idle_time;    //空闲累计时间
+	u64 kt_time;      //内核线程累计运行时间
+	u64 ut_time;      //用户线程累计运行时间
+	u64 tick_user;    //采样时处于用户态的次数
+	//以下为本CPU上的开始时间戳，硬中断与软中断在同一CPU上不会嵌套
+	u64 irq_enter;
+	u64 softirq_enter;
+	u64 idle_enter;
+};
+
 /*----------------------------------------------*/
 /*          cswch_args结构体                     */
 /*----------------------------------------------*/
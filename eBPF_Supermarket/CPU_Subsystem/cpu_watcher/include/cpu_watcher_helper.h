@@ -16,7 +16,15 @@
 #ifndef CPU_WATCHER_HELPER_H
 #define CPU_WATCHER_HELPER_H
 
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "cpu_watcher.h"
 
 #define SAR_WACTHER 10
@@ -27,6 +35,7 @@
 #define MQ_WACTHER 60
 #define MUTEX_WATCHER 70
 #define HASH_SIZE 1024
+#define CGROUP_ROOT "/sys/fs/cgroup"
 
 /*----------------------------------------------*/
 /*          ewma算法                            */
@@ -226,78 +235,355 @@ int update_mu_ctrl_map(struct mu_ctrl mu_ctrl){
 /*              mutex_count                     */
 /*----------------------------------------------*/
 
-typedef struct {
+//每个锁在用户态的累计统计,由内核中按(锁, 栈)聚合的数据合并而来
+struct lock_agg {
     uint64_t ptr;
+    uint64_t wait_total;
+    uint64_t wait_max;
     uint64_t count;
-} lock_count_t;
+    u64 slots[LOCK_HIST_SLOTS];
+    int top_stack_id;//等待时间最多的争用栈
+    uint64_t top_stack_wait;
+    pid_t last_owner;
+    char last_owner_name[TASK_COMM_LEN];
+};
 
-lock_count_t lock_counts[HASH_SIZE];
+//开放寻址哈希表,装载率超过3/4时容量翻倍
+struct lock_table {
+    struct lock_agg *entries;
+    size_t capacity;
+    size_t count;
+};
 
-static uint64_t hash(uint64_t ptr) {
-    return ptr % HASH_SIZE;
+static inline size_t lock_hash(uint64_t ptr, size_t capacity) {
+    return (ptr * 0x9E3779B97F4A7C15ULL >> 17) & (capacity - 1);
+}
+
+static struct lock_agg *lock_table_slot(struct lock_agg *entries, size_t capacity, uint64_t ptr) {
+    size_t h = lock_hash(ptr, capacity);
+    while (entries[h].ptr != 0 && entries[h].ptr != ptr) {
+        h = (h + 1) & (capacity - 1);
+    }
+    return &entries[h];
 }
 
-static void increment_lock_count(uint64_t ptr) {
-    uint64_t h = hash(ptr);
-    while (lock_counts[h].ptr != 0 && lock_counts[h].ptr != ptr) {
-        h = (h + 1) % HASH_SIZE;
+static int lock_table_grow(struct lock_table *table) {
+    size_t capacity = table->capacity ? table->capacity * 2 : HASH_SIZE;
+    struct lock_agg *entries = calloc(capacity, sizeof(*entries));
+    if (!entries) {
+        return -1;
     }
-    if (lock_counts[h].ptr == 0) {
-        lock_counts[h].ptr = ptr;
-        lock_counts[h].count = 1;
-    } else {
-        lock_counts[h].count++;
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->entries[i].ptr != 0) {
+            *lock_table_slot(entries, capacity, table->entries[i].ptr) = table->entries[i];
+        }
     }
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+    return 0;
 }
 
-static uint64_t get_lock_count(uint64_t ptr) {
-    uint64_t h = hash(ptr);
-    while (lock_counts[h].ptr != 0 && lock_counts[h].ptr != ptr) {
-        h = (h + 1) % HASH_SIZE;
+//查找锁对应的统计项,不存在时插入
+static struct lock_agg *lock_table_get(struct lock_table *table, uint64_t ptr) {
+    struct lock_agg *agg;
+    if ((table->count + 1) * 4 > table->capacity * 3 && lock_table_grow(table)) {
+        return NULL;
     }
-    if (lock_counts[h].ptr == 0) {
-        return 0;
-    } else {
-        return lock_counts[h].count;
+    agg = lock_table_slot(table->entries, table->capacity, ptr);
+    if (agg->ptr == 0) {
+        agg->ptr = ptr;
+        agg->top_stack_id = -1;
+        table->count++;
+    }
+    return agg;
+}
+
+//清空所有统计项,保留已分配的容量供下一周期使用
+static void lock_table_reset(struct lock_table *table) {
+    if (table->entries) {
+        memset(table->entries, 0, table->capacity * sizeof(*table->entries));
+    }
+    table->count = 0;
+}
+
+static void lock_table_free(struct lock_table *table) {
+    free(table->entries);
+    memset(table, 0, sizeof(*table));
+}
+
+/*----------------------------------------------*/
+/*                  kallsyms                    */
+/*----------------------------------------------*/
+struct ksym {
+    uint64_t addr;
+    char *name;
+};
+
+struct ksyms {
+    struct ksym *syms;
+    size_t count;
+};
+
+static int ksym_cmp(const void *a, const void *b) {
+    const struct ksym *x = a, *y = b;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+//一次读入/proc/kallsyms并按地址排序,之后用二分查找符号化
+static struct ksyms *ksyms__load(void) {
+    FILE *file = fopen("/proc/kallsyms", "r");
+    struct ksyms *ksyms;
+    size_t capacity = 0;
+    char name[256];
+    unsigned long long addr;
+    char type;
+
+    if (!file) {
+        return NULL;
+    }
+    ksyms = calloc(1, sizeof(*ksyms));
+    while (ksyms && fscanf(file, "%llx %c %255s%*[^\n]\n", &addr, &type, name) == 3) {
+        if (!addr) {
+            continue;
+        }
+        if (ksyms->count == capacity) {
+            size_t new_cap = capacity ? capacity * 2 : 4096;
+            struct ksym *syms = realloc(ksyms->syms, new_cap * sizeof(*syms));
+            if (!syms) {
+                break;
+            }
+            ksyms->syms = syms;
+            capacity = new_cap;
+        }
+        ksyms->syms[ksyms->count].addr = addr;
+        ksyms->syms[ksyms->count].name = strdup(name);
+        ksyms->count++;
+    }
+    fclose(file);
+    if (ksyms) {
+        qsort(ksyms->syms, ksyms->count, sizeof(*ksyms->syms), ksym_cmp);
+    }
+    return ksyms;
+}
+
+static void ksyms__free(struct ksyms *ksyms) {
+    if (!ksyms) {
+        return;
+    }
+    for (size_t i = 0; i < ksyms->count; i++) {
+        free(ksyms->syms[i].name);
+    }
+    free(ksyms->syms);
+    free(ksyms);
+}
+
+//返回地址所在的符号(地址不小于符号起始地址的最近一项)
+static const struct ksym *ksyms__search(const struct ksyms *ksyms, uint64_t addr) {
+    size_t lo = 0, hi;
+    if (!ksyms || !ksyms->count || addr < ksyms->syms[0].addr) {
+        return NULL;
+    }
+    hi = ksyms->count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ksyms->syms[mid].addr <= addr) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return &ksyms->syms[lo];
+}
+
+/*----------------------------------------------*/
+/*              batch map drain                 */
+/*----------------------------------------------*/
+#ifndef ENOTSUPP
+#define ENOTSUPP 524
+#endif
+
+//批量读取并删除hash map中的元素，内核不支持批量操作时逐个读取
+//返回读取到的元素个数或负的错误码
+static int lookup_and_delete_all(int fd, void *keys, void *values, __u32 capacity,
+                                 size_t key_size, size_t value_size) {
+    __u32 in, out, n, total = 0;
+    bool first = true;
+    int err;
+    LIBBPF_OPTS(bpf_map_batch_opts, opts);
+
+    for (;;) {
+        n = capacity - total;
+        err = bpf_map_lookup_and_delete_batch(fd, first ? NULL : &in, &out,
+                                              (char *)keys + total * key_size,
+                                              (char *)values + total * value_size, &n, &opts);
+        err = err ? -errno : 0;
+        if (err && err != -ENOENT && err != -ENOSPC) {
+            break;
+        }
+        total += n;
+        if (err || total == capacity) {
+            return total;
+        }
+        in = out;
+        first = false;
+    }
+    if (total || (err != -EINVAL && err != -ENOTSUPP && err != -EOPNOTSUPP)) {
+        return err;
+    }
+    while (total < capacity &&
+           !bpf_map_get_next_key(fd, NULL, (char *)keys + total * key_size)) {
+        void *key = (char *)keys + total * key_size;
+        if (!bpf_map_lookup_elem(fd, key, (char *)values + total * value_size)) {
+            total++;
+        }
+        bpf_map_delete_elem(fd, key);
+    }
+    return total;
+}
+
+/*----------------------------------------------*/
+/*                  histogram                   */
+/*----------------------------------------------*/
+
+//log2直方图(ns)的分位数(us)。第i个桶覆盖[2^i, 2^(i+1))，在目标所在桶内按计数线性插值，
+//结果不超过实测最大值max_ns(为0时不截断)
+static double hist_percentile_us(const u64 *slots, int nr_slots, u64 count, u64 max_ns,
+                                 double percentile) {
+    double target = count * percentile, sum = 0, ns = 0;
+    if (!count) {
+        return 0.0;
+    }
+    for (int i = 0; i < nr_slots; i++) {
+        if (!slots[i]) {
+            continue;
+        }
+        if (sum + slots[i] > target) {
+            double low = i ? (double)(1ULL << i) : 0.0;
+            double high = (double)(1ULL << (i + 1));
+            ns = low + (high - low) * (target - sum) / slots[i];
+            break;
+        }
+        sum += slots[i];
+        ns = (double)(1ULL << (i + 1));
+    }
+    if (max_ns && ns > max_ns) {
+        ns = max_ns;
     }
+    return ns / 1000.0;
 }
 
 /*----------------------------------------------*/
 /*                    hash                      */
 /*----------------------------------------------*/
 
+//cgroup id到路径的缓存，cgroup v2中id即为目录的inode号
+struct cgroup_name {
+    uint64_t id;
+    char *path;
+};
 
-struct output_entry {
-    int pid;
-    char comm[16];
-    long long delay;
+struct cgroup_names {
+    struct cgroup_name *entries;
+    size_t capacity;
+    size_t count;
 };
 
+static struct cgroup_names cgroup_names;
 
-struct output_entry seen_entries[MAX_ENTRIES];
-int seen_count = 0;
+static struct cgroup_name *cgroup_name_slot(struct cgroup_name *entries, size_t capacity, uint64_t id) {
+    size_t h = (id * 0x9E3779B97F4A7C15ULL >> 17) & (capacity - 1);
+    while (entries[h].id != 0 && entries[h].id != id) {
+        h = (h + 1) & (capacity - 1);
+    }
+    return &entries[h];
+}
 
+static int cgroup_name_add(uint64_t id, const char *path) {
+    struct cgroup_name *slot;
+    if ((cgroup_names.count + 1) * 4 > cgroup_names.capacity * 3) {
+        size_t capacity = cgroup_names.capacity ? cgroup_names.capacity * 2 : HASH_SIZE;
+        struct cgroup_name *entries = calloc(capacity, sizeof(*entries));
+        if (!entries) {
+            return -1;
+        }
+        for (size_t i = 0; i < cgroup_names.capacity; i++) {
+            if (cgroup_names.entries[i].id) {
+                *cgroup_name_slot(entries, capacity, cgroup_names.entries[i].id) = cgroup_names.entries[i];
+            }
+        }
+        free(cgroup_names.entries);
+        cgroup_names.entries = entries;
+        cgroup_names.capacity = capacity;
+    }
+    slot = cgroup_name_slot(cgroup_names.entries, cgroup_names.capacity, id);
+    if (slot->id) {
+        return 0;
+    }
+    slot->id = id;
+    slot->path = strdup(path);
+    cgroup_names.count++;
+    return 0;
+}
 
-bool entry_exists(int pid, const char *comm, long long delay) {
-    for (int i = 0; i < seen_count; i++) {
-        if (seen_entries[i].pid == pid &&
-            strcmp(seen_entries[i].comm, comm) == 0 &&
-            seen_entries[i].delay == delay) {
-            return true;
+//递归遍历cgroup目录，记录每个目录的inode号与相对路径
+static void cgroup_walk(char *path, size_t len, size_t size) {
+    struct dirent *de;
+    struct stat st;
+    DIR *dir;
+
+    if (stat(path, &st) == 0) {
+        cgroup_name_add(st.st_ino, len > sizeof(CGROUP_ROOT) - 1 ? path + sizeof(CGROUP_ROOT) - 1 : "/");
+    }
+    dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        size_t n;
+        if (de->d_type != DT_DIR || de->d_name[0] == '.') {
+            continue;
         }
+        n = snprintf(path + len, size - len, "/%s", de->d_name);
+        if (n < size - len) {
+            cgroup_walk(path, len + n, size);
+        }
+        path[len] = '\0';
     }
-    return false;
+    closedir(dir);
 }
 
+//查找cgroup路径，未命中时重新遍历cgroup文件系统，
+//但至少间隔CGROUP_RESCAN_SECS秒，已删除的cgroup不会使每个周期都遍历一次
+#define CGROUP_RESCAN_SECS 10
+static const char *cgroup_name_lookup(uint64_t id, bool rescan) {
+    static time_t last_scan;
+    struct cgroup_name *slot;
+    time_t now;
+    if (cgroup_names.capacity) {
+        slot = cgroup_name_slot(cgroup_names.entries, cgroup_names.capacity, id);
+        if (slot->id == id) {
+            return slot->path;
+        }
+    }
+    now = time(NULL);
+    if (!rescan || (last_scan && now - last_scan < CGROUP_RESCAN_SECS)) {
+        return NULL;
+    }
+    last_scan = now;
+    char path[PATH_MAX] = CGROUP_ROOT;
+    cgroup_walk(path, strlen(path), sizeof(path));
+    return cgroup_name_lookup(id, false);
+}
 
-void add_entry(int pid, const char *comm, long long delay) {
-    if (seen_count < MAX_ENTRIES) {
-        seen_entries[seen_count].pid = pid;
-        strncpy(seen_entries[seen_count].comm, comm, sizeof(seen_entries[seen_count].comm));
-        seen_entries[seen_count].delay = delay;
-        seen_count++;
+static void cgroup_names_free(void) {
+    for (size_t i = 0; i < cgroup_names.capacity; i++) {
+        free(cgroup_names.entries[i].path);
     }
+    free(cgroup_names.entries);
+    memset(&cgroup_names, 0, sizeof(cgroup_names));
 }
+
 /*----------------------------------------------*/
 /*                   uprobe                     */
 /*----------------------------------------------*/
@@ -88,8 +88,7 @@ int tracepoint__syscalls__sys_enter_execve(struct trace_event_raw_sys_enter* ctx
 
         event->type = 1;
         event->pid = pid;
-        if(kt_ctrl->target_tgid != -1)	event->tgid = tgid;
-		else	event->tgid = -1;
+        event->tgid = tgid;
         event->info_count = 0;
         event->info_size = 0;
         event->enable_char_info = true;
@@ -166,8 +165,7 @@ int tracepoint__syscalls__sys_exit_execve(struct trace_event_raw_sys_exit* ctx)
 
         event->type = 2;
         event->pid = pid;
-        if(kt_ctrl->target_tgid != -1)	event->tgid = tgid;
-		else	event->tgid = -1;
+        event->tgid = tgid;
         event->enable_char_info = false;
         event->info_count = 1;
         event->info[0] = ctx->ret;
@@ -194,7 +192,7 @@ int BPF_KRETPROBE(fork_exit,int ret)
     if((kt_ctrl->enable_myproc || tgid!=ignore_tgid) && ret!=0 && ((kt_ctrl->target_pid ==-1 && kt_ctrl->target_tgid==-1) || 
        (kt_ctrl->target_tgid!=-1 && tgid==kt_ctrl->target_tgid) || (kt_ctrl->target_pid!=-1 && pid==kt_ctrl->target_pid))){
         pid_t child_pid = ret;
-        child_create(4,child_pid,pid,&child,&keytime_rb,tgid,kt_ctrl->target_tgid);
+        child_create(4,child_pid,pid,&child,&keytime_rb,tgid);
     }
 
 	return 0;
@@ -217,7 +215,7 @@ int BPF_KRETPROBE(vfork_exit,int ret)
     if((kt_ctrl->enable_myproc || tgid!=ignore_tgid) && ((kt_ctrl->target_pid==-1 && kt_ctrl->target_tgid==-1) || 
        (kt_ctrl->target_pid!=-1 && ppid==kt_ctrl->target_pid)) || (kt_ctrl->target_tgid!=-1 && ptgid==kt_ctrl->target_tgid)){
         pid_t child_pid = BPF_CORE_READ(current,pid);
-        child_create(6,child_pid,ppid,&child,&keytime_rb,ptgid,kt_ctrl->target_tgid);
+        child_create(6,child_pid,ppid,&child,&keytime_rb,ptgid);
     }
 
 	return 0;
@@ -284,7 +282,7 @@ int tracepoint__syscalls__sys_exit_clone3(struct trace_event_raw_sys_exit* ctx)
             // 排除clone3错误返回的情况
             if(new_thread <= 0)	return 0;
 
-            child_create(8,new_thread,current,&child,&keytime_rb,tgid,kt_ctrl->target_tgid);
+            child_create(8,new_thread,current,&child,&keytime_rb,tgid);
         }
     }
 
@@ -312,8 +310,7 @@ int tracepoint__syscalls__sys_enter_exit_group(struct trace_event_raw_sys_enter*
         
         event->type = 3;
         event->pid = pid;
-        if(kt_ctrl->target_tgid != -1)	event->tgid = tgid;
-		else	event->tgid = -1;
+        event->tgid = tgid;
         event->enable_char_info = false;
         event->info_count = 1;
         event->info[0] = ctx->args[0];
@@ -348,8 +345,7 @@ int tracepoint__syscalls__sys_enter_exit(struct trace_event_raw_sys_enter* ctx)
         
         event->type = 3;
         event->pid = pid;
-        if(kt_ctrl->target_tgid != -1)	event->tgid = tgid;
-		else	event->tgid = -1;
+        event->tgid = tgid;
         event->enable_char_info = false;
         event->info_count = 1;
         event->info[0] = ctx->args[0];
@@ -388,8 +384,7 @@ int BPF_PROG(sched_switch, bool preempt, struct task_struct *prev, struct task_s
 
         event->type = 11;
         event->pid = prev_pid;
-        if(kt_ctrl->target_tgid != -1)	event->tgid = prev_tgid;
-		else	event->tgid = -1;
+        event->tgid = prev_tgid;
         event->offcpu_time = bpf_ktime_get_ns();
         event->kstack_sz = bpf_get_stack(ctx, event->kstack, sizeof(event->kstack), 0);
 
@@ -407,8 +402,7 @@ int BPF_PROG(sched_switch, bool preempt, struct task_struct *prev, struct task_s
 
         event->type = 10;
         event->pid = next_pid;
-        if(kt_ctrl->target_tgid != -1)	event->tgid = next_tgid;
-		else	event->tgid = -1;
+        event->tgid = next_tgid;
         event->enable_char_info = false;
         event->info_count = 1;
         event->info[0] = bpf_ktime_get_ns();
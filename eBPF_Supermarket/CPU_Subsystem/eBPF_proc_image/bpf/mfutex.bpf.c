@@ -79,12 +79,6 @@ struct {
 	__type(key, struct lock_record_key);
 	__type(value, struct per_request);
 } futex_wait_queue SEC(".maps");//记录futex陷入内核
-struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
-	__uint(max_entries, 10240);
-	__type(key, struct lock_record_key);
-	__type(value, struct per_request);
-} futex_wake_queue SEC(".maps");//记录futex陷入内核
 
 #define MUTEX_FLAG  1
 #define RWLOCK_FLAG  2
@@ -92,6 +86,22 @@ struct {
 #define RCU_FLAG  4
 #define FUTEX_FLAG  5
 const int ctrl_key = 0;
+//向用户态上报等待图事件，不再遍历map逐条打印
+static inline void mf_emit(int kind, int type, struct task_struct *task, int peer, u64 lock_ptr, u64 ts) {
+    struct mfutex_event *e = bpf_ringbuf_reserve(&mfutex_rb, sizeof(*e), 0);
+    if(!e)
+        return;
+    e->kind = kind;
+    e->type = type;
+    e->pid = BPF_CORE_READ(task, pid);
+    e->tgid = BPF_CORE_READ(task, tgid);
+    e->prio = BPF_CORE_READ(task, prio);
+    e->peer = peer;
+    e->lock_ptr = lock_ptr;
+    e->ts = ts;
+    bpf_ringbuf_submit(e, 0);
+}
+
 static inline struct mfutex_ctrl *get_mfutex_ctrl(void) {
     struct mfutex_ctrl *mfutex_ctrl;
     mfutex_ctrl = bpf_map_lookup_elem(&mfutex_ctrl_map, &ctrl_key);
@@ -128,10 +138,12 @@ int BPF_KPROBE(pthread_mutex_lock_enter, void *__mutex)//存申请锁的地址
     bpf_map_update_elem(&proc_lock, &proc_flag, &lock_ptr, BPF_ANY);
 
     /*2.对per_lock_info map中的信息进行读取更新或增加，包括cnt*/
+    int owner = 0;
     struct per_lock_event * per_lock_event = bpf_map_lookup_elem(&per_lock_info, &lock_ptr);
     if(per_lock_event){
         per_lock_event->cnt++;
         cnt = per_lock_event->cnt;
+        owner = per_lock_event->owner;
     }else{
         struct per_lock_event new_per_lock = {};
         new_per_lock.lock_ptr = lock_ptr;
@@ -148,7 +160,7 @@ int BPF_KPROBE(pthread_mutex_lock_enter, void *__mutex)//存申请锁的地址
     key.lock_ptr = lock_ptr;
     key.cnt = cnt;
     bpf_map_update_elem(&record_lock, &key, &per_request, BPF_ANY);
-    bpf_printk("Push_info:pid:%d ,lock_ptr:%lu, cnt:%d\n",per_request.pid,key.lock_ptr,key.cnt);
+    mf_emit(MF_REQUEST, MUTEX_FLAG, (struct task_struct *)bpf_get_current_task(), owner, lock_ptr, per_request.start_request_time);
     //用于通过lock_ptr 和pid 找到cnt
     struct lock_record_key key2 ={};
     key2.lock_ptr = lock_ptr;
@@ -214,21 +226,7 @@ int BPF_KRETPROBE(pthread_mutex_lock_exit,int ret)
     per_lock_event->start_hold_time = ts;
     bpf_map_update_elem(&per_lock_info, &temp_lock_ptr, per_lock_event, BPF_ANY);
 
-    //数据传送到ringbuf；
-    struct per_lock_event *e;
-    e = bpf_ringbuf_reserve(&mfutex_rb, sizeof(*e), 0);
-    if(!e)
-        return 0;
-    e->lock_ptr = per_lock_event->lock_ptr;
-    e->owner = per_lock_event->owner;
-    e->last_owner = per_lock_event->last_owner;
-    e->start_hold_time = per_lock_event->start_hold_time;
-    e->type = per_lock_event->type;
-    e->cnt = per_lock_event->cnt;
-    e->last_hold_delay = per_lock_event->last_hold_delay;
-    bpf_printk("In Push_to_rb lock_ptr %llu,per_cnt:%d,owner:%d,last_owner:%d,last_hold_time:%lu\n",e->lock_ptr,e->cnt,e->owner,
-                e->last_owner,e->last_hold_delay);
-    bpf_ringbuf_submit(e, 0);
+    mf_emit(MF_ACQUIRE, MUTEX_FLAG, (struct task_struct *)bpf_get_current_task(), 0, temp_lock_ptr, ts);
     return 0;
 }
 
@@ -265,9 +263,11 @@ int BPF_KPROBE(pthread_mutex_unlock_enter, void *__mutex)
     struct per_lock_event *per_lock_event = bpf_map_lookup_elem(&per_lock_info, &lock_ptr);
     if(!per_lock_event) return 0;
     per_lock_event->last_owner = pid;
+    per_lock_event->owner = 0;
     // per_lock_event->last_start_hold_time = ts;
     per_lock_event->last_hold_delay = ts - per_request->start_hold_time;//持有锁的时间
     bpf_map_update_elem(&per_lock_info, &lock_ptr, per_lock_event, BPF_ANY);
+    mf_emit(MF_RELEASE, MUTEX_FLAG, (struct task_struct *)bpf_get_current_task(), 0, lock_ptr, ts);
     return 0;
 }
 
@@ -320,6 +320,7 @@ int BPF_KPROBE(trace_futex_wait,
     key.lock_ptr = lock_ptr;
     key.pid = pid;
     bpf_map_update_elem(&futex_wait_queue, &key, &per_request, BPF_ANY);
+    mf_emit(MF_FUTEX_WAIT, FUTEX_FLAG, (struct task_struct *)bpf_get_current_task(), 0, lock_ptr, per_request.start_request_time);
     // bpf_printk("Push_info:pid:%d ,lock_ptr:%lu, cnt:%d\n",per_request.pid,key.lock_ptr,key.cnt);
     return 0;
 }
@@ -352,7 +353,7 @@ int BPF_KPROBE(trace_futex_wake_enter,
     return 0;
 }
 /*2.将线程加入唤醒队列，从等待队列中删除
- *2.2 将要被唤醒的线程加入唤醒队列，并从等待队列中删除掉；
+ *2.2 将要被唤醒的线程从等待队列中删除掉，并上报唤醒关系；
  */
 SEC("kprobe/futex_wake_mark")
 int BPF_KPROBE(trace_futex_wake_mark, struct wake_q_head *wake_q, struct futex_q *q) 
@@ -386,21 +387,10 @@ int BPF_KPROBE(trace_futex_wake_mark, struct wake_q_head *wake_q, struct futex_q
     key.lock_ptr = temp_lock_ptr;
     key.pid = BPF_CORE_READ(q,task,pid);
 
-    /*3.将线程从等待队列中删除*/
-    struct per_request *per_request;
-    per_request = bpf_map_lookup_elem(&futex_wait_queue, &key);
-    if(per_request) {//如果等待队列中找到该task 则尝试删除
-        bpf_map_delete_elem(&futex_wait_queue, &key);
-        per_request->start_hold_time = ts;
-        per_request->wait_delay = ts - per_request->start_hold_time;
-    }else{//如果没找到，说明该任务陷入阻塞时未记录，则创建per_request
-        struct per_request new_per_request = {};
-        new_per_request.pid = key.pid;
-        new_per_request.start_hold_time = ts;
-        per_request = &new_per_request;
-    }
-    /*4.将任务放到唤醒队列中*/
-    bpf_map_update_elem(&futex_wake_queue, &key, per_request, BPF_ANY);
+    /*3.将线程从等待队列中删除，等待时长由用户态等待图根据事件计算*/
+    bpf_map_delete_elem(&futex_wait_queue, &key);
+    /*4.上报唤醒关系：被唤醒者与唤醒者*/
+    mf_emit(MF_FUTEX_WAKE, FUTEX_FLAG, BPF_CORE_READ(q, task), pid, temp_lock_ptr, ts);
     return 0;
 }
 
@@ -422,27 +412,10 @@ int BPF_KRETPROBE(trace_futex_wake_exit)
         (mfutex_ctrl->target_tgid != -1 && tgid != mfutex_ctrl->target_tgid))//当前进程或线程非目标进程或线程
         return 0;
 
-    u64 *lock_ptr;
-    u64 temp_lock_ptr;
-    u64 ts = bpf_ktime_get_ns();
-
-    /*1.找到锁的地址*/
+    /*唤醒结束，清除执行futex_wake的线程与锁地址的对应关系*/
     struct proc_flag proc_flag = {};
     proc_flag.pid = pid;
     proc_flag.flag = FUTEX_FLAG;
-    lock_ptr = bpf_map_lookup_elem(&proc_unlock, &proc_flag);
-    if(!lock_ptr) return 0;
-    temp_lock_ptr = *lock_ptr;
     bpf_map_delete_elem(&proc_unlock, &proc_flag);
-
-    /*2.传入rb*/
-    struct per_lock_event *e;
-    e = bpf_ringbuf_reserve(&mfutex_rb, sizeof(*e), 0);
-    if(!e)
-        return 0;
-    e->lock_ptr = temp_lock_ptr;
-    e->start_hold_time = bpf_ktime_get_ns();
-    e->type = FUTEX_FLAG;
-    bpf_ringbuf_submit(e, 0);
-    return 0;   
-}
\ No newline at end of file
+    return 0;
+}
@@ -219,6 +219,7 @@ int sys_exit(struct trace_event_raw_sys_exit *args)
             
             e->pid = pid;
             e->tgid = tgid;
+            e->enter_time = syscall_seq->enter_time;
             e->sum_delay = syscall_seq->sum_delay;
             e->max_delay = syscall_seq->max_delay;
             e->min_delay = syscall_seq->min_delay;
@@ -44,8 +44,7 @@ static int record_lock_enter(pid_t ignore_tgid,int lock_status,int flag,void *__
 
         e->lock_status = lock_status;
         e->pid = pid;
-        if(lock_ctrl->target_tgid != -1)	e->tgid = tgid;
-        else	e->tgid = -1;
+        e->tgid = tgid;
         e->lock_ptr = lock_ptr;
         e->time = bpf_ktime_get_ns();
         
@@ -98,8 +97,7 @@ static int record_lock_exit(pid_t ignore_tgid,int lock_status,int flag,int ret,v
 
         e->lock_status = lock_status;
         e->pid = pid;
-        if(lock_ctrl->target_tgid != -1)	e->tgid = tgid;
-        else	e->tgid = -1;
+        e->tgid = tgid;
         e->ret = ret;
         e->lock_ptr = temp_lock_ptr;
         e->time = bpf_ktime_get_ns();
@@ -180,8 +178,7 @@ static int record_unlock_exit(pid_t ignore_tgid,int lock_status,int flag,void *l
         
         e->lock_status = lock_status;
         e->pid = pid;
-        if(lock_ctrl->target_tgid != -1)	e->tgid = tgid;
-        else	e->tgid = -1;
+        e->tgid = tgid;
         e->lock_ptr = temp_lock_ptr;
         e->time = bpf_ktime_get_ns();
         
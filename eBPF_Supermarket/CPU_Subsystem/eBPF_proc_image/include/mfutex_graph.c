@@ -0,0 +1,449 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: zhangziheng0525@163.com
+//
+// wait-for graph (waiter -> lock -> holder) over mfutex events, with
+// critical path, lock convoy and priority inversion analysis per window
+
+#include <linux/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mfutex_graph.h"
+#include "proc_image.h"
+#include "hashmap.h"
+
+//一条等待链：waiter -[locks[0]]-> pids[0] -[locks[1]]-> pids[1] ...
+struct mf_chain {
+	int len;
+	bool cycle;			// 链回到了自身，即死锁
+	int pids[MF_CHAIN_MAX];
+	int prios[MF_CHAIN_MAX];
+	u64 locks[MF_CHAIN_MAX];
+};
+
+struct mf_thread {
+	int pid;			// key
+	int tgid;
+	int prio;
+	int wait_type;
+	u64 wait_lock;			// 正在等待的锁，0表示未阻塞
+	u64 wait_start;
+	struct mf_chain chain;		// 开始等待时的等待链
+	/* 以下为窗口内的统计 */
+	bool active;
+	u64 waits;
+	u64 blocked;
+	u64 max_wait;
+	struct mf_chain max_chain;	// 最长一次等待的关键路径
+	u64 caused;			// 作为关键路径末端使其他线程阻塞的时间
+};
+
+struct mf_lock {
+	u64 lock_ptr;			// key
+	int type;
+	int owner;			// 0表示空闲或未知
+	int waiters;
+	/* 以下为窗口内的统计 */
+	u64 acquires;
+	u64 contended;
+	u64 handoffs;			// 释放时仍有线程在等待
+	u64 wait_total;
+	int max_waiters;
+};
+
+struct mf_inversion {
+	int pid;
+	int prio;
+	u64 wait;
+	struct mf_chain chain;
+};
+
+static struct hashmap *threads, *locks;
+static struct mf_inversion inversions[MF_INVERSION_MAX];
+static int nr_inversions;
+static u64 window_start;
+
+static uint64_t thread_hash(const void *item, uint64_t seed0, uint64_t seed1)
+{
+	const struct mf_thread *t = item;
+	return hashmap_murmur(&t->pid, sizeof(t->pid), seed0, seed1);
+}
+
+static int thread_compare(const void *a, const void *b, void *udata)
+{
+	const struct mf_thread *x = a, *y = b;
+	return x->pid - y->pid;
+}
+
+static uint64_t lock_hash(const void *item, uint64_t seed0, uint64_t seed1)
+{
+	const struct mf_lock *l = item;
+	return hashmap_murmur(&l->lock_ptr, sizeof(l->lock_ptr), seed0, seed1);
+}
+
+static int lock_compare(const void *a, const void *b, void *udata)
+{
+	const struct mf_lock *x = a, *y = b;
+	return x->lock_ptr < y->lock_ptr ? -1 : x->lock_ptr > y->lock_ptr;
+}
+
+int mf_graph_init(void)
+{
+	threads = hashmap_new(sizeof(struct mf_thread), 0, 0, 0, thread_hash, thread_compare, NULL, NULL);
+	locks = hashmap_new(sizeof(struct mf_lock), 0, 0, 0, lock_hash, lock_compare, NULL, NULL);
+	if (!threads || !locks) {
+		mf_graph_free();
+		return -1;
+	}
+	return 0;
+}
+
+void mf_graph_free(void)
+{
+	if (threads)
+		hashmap_free(threads);
+	if (locks)
+		hashmap_free(locks);
+	threads = locks = NULL;
+}
+
+static struct mf_thread *thread_find(int pid)
+{
+	return (struct mf_thread *)hashmap_get(threads, &(struct mf_thread){ .pid = pid });
+}
+
+static struct mf_thread *thread_get(int pid)
+{
+	struct mf_thread *t = thread_find(pid);
+	if (t)
+		return t;
+	hashmap_set(threads, &(struct mf_thread){ .pid = pid });
+	return thread_find(pid);
+}
+
+static struct mf_lock *lock_find(u64 lock_ptr)
+{
+	return (struct mf_lock *)hashmap_get(locks, &(struct mf_lock){ .lock_ptr = lock_ptr });
+}
+
+static struct mf_lock *lock_get(u64 lock_ptr, int type)
+{
+	struct mf_lock *l = lock_find(lock_ptr);
+	if (l)
+		return l;
+	hashmap_set(locks, &(struct mf_lock){ .lock_ptr = lock_ptr, .type = type });
+	return lock_find(lock_ptr);
+}
+
+/* 沿 等待者->锁->持有者 的边展开等待链，持有者自身也在等待时继续向下走 */
+static void build_chain(const struct mf_thread *t, u64 lock_ptr, struct mf_chain *chain)
+{
+	memset(chain, 0, sizeof(*chain));
+	while (chain->len < MF_CHAIN_MAX) {
+		struct mf_lock *l = lock_find(lock_ptr);
+		struct mf_thread *h;
+		if (!l || !l->owner)
+			break;
+		h = thread_find(l->owner);
+		chain->locks[chain->len] = lock_ptr;
+		chain->pids[chain->len] = l->owner;
+		chain->prios[chain->len] = h ? h->prio : 0;
+		chain->len++;
+		if (l->owner == t->pid) {
+			chain->cycle = true;
+			break;
+		}
+		for (int i = 0; i < chain->len - 1; i++) {
+			if (chain->pids[i] == l->owner) {
+				chain->cycle = true;
+				return;
+			}
+		}
+		if (!h || !h->wait_lock)
+			break;
+		lock_ptr = h->wait_lock;
+	}
+}
+
+//等待链上存在比等待者优先级低的持有者
+static bool chain_inverted(const struct mf_thread *t, const struct mf_chain *chain)
+{
+	for (int i = 0; i < chain->len; i++)
+		if (chain->prios[i] > t->prio)
+			return true;
+	return false;
+}
+
+static void wait_begin(struct mf_thread *t, const struct mfutex_event *e)
+{
+	struct mf_lock *l = lock_get(e->lock_ptr, e->type);
+	if (!l)
+		return;
+	//持有者在锁被跟踪之前就拿到了锁时，用申请时看到的持有者补全
+	if (e->peer && !l->owner)
+		l->owner = e->peer;
+	t->wait_lock = e->lock_ptr;
+	t->wait_type = e->type;
+	t->wait_start = e->ts;
+	build_chain(t, e->lock_ptr, &t->chain);
+	l->waiters++;
+	if (l->waiters > l->max_waiters)
+		l->max_waiters = l->waiters;
+}
+
+/* 一次等待结束：计入等待者的阻塞时间，并归因到关键路径末端的线程 */
+static void wait_end(struct mf_thread *t, u64 ts, int waker)
+{
+	struct mf_lock *l = lock_find(t->wait_lock);
+	u64 wait = ts > t->wait_start ? ts - t->wait_start : 0;
+	//跨窗口的等待在上个窗口的报告中已计入了窗口之前的部分，本窗口的累计值只从窗口起点算起，
+	//最长等待和优先级反转仍使用完整的等待时间
+	u64 start = t->wait_start > window_start ? t->wait_start : window_start;
+	u64 win = ts > start ? ts - start : 0;
+
+	if (l && l->waiters > 0)
+		l->waiters--;
+	//申请时锁空闲，是一次无竞争的获取，不计入阻塞
+	if (!t->chain.len && !waker && t->wait_type != FUTEX_FLAG) {
+		t->wait_lock = 0;
+		return;
+	}
+	//申请时不知道持有者(如单纯的futex等待)，以唤醒者作为链的末端
+	if (!t->chain.len && waker) {
+		struct mf_thread *w = thread_find(waker);
+		t->chain.len = 1;
+		t->chain.locks[0] = t->wait_lock;
+		t->chain.pids[0] = waker;
+		t->chain.prios[0] = w ? w->prio : 0;
+	}
+	if (t->chain.len) {
+		struct mf_thread *root = thread_get(t->chain.pids[t->chain.len - 1]);
+		t = thread_find(t->pid);//thread_get可能使哈希表扩容
+		if (root) {
+			root->caused += win;
+			root->active = true;
+		}
+		if (l)
+			l->contended++, l->wait_total += win;
+		if (chain_inverted(t, &t->chain) && nr_inversions < MF_INVERSION_MAX) {
+			struct mf_inversion *inv = &inversions[nr_inversions++];
+			inv->pid = t->pid;
+			inv->prio = t->prio;
+			inv->wait = wait;
+			inv->chain = t->chain;
+		}
+	}
+	t->waits++;
+	t->blocked += win;
+	if (wait >= t->max_wait) {
+		t->max_wait = wait;
+		t->max_chain = t->chain;
+	}
+	t->wait_lock = 0;
+}
+
+void mf_graph_event(const struct mfutex_event *e)
+{
+	struct mf_thread *t;
+	struct mf_lock *l;
+
+	if (!threads)
+		return;
+	if (!window_start)
+		window_start = e->ts;
+	t = thread_get(e->pid);
+	if (!t)
+		return;
+	t->tgid = e->tgid;
+	t->prio = e->prio;
+	t->active = true;
+
+	switch (e->kind) {
+	case MF_REQUEST:
+		wait_begin(t, e);
+		break;
+	case MF_FUTEX_WAIT:
+		//pthread互斥锁的慢路径也会在同一地址上futex_wait，已在等待中则不重复记录
+		if (t->wait_lock != e->lock_ptr)
+			wait_begin(t, e);
+		break;
+	case MF_ACQUIRE:
+		l = lock_get(e->lock_ptr, e->type);
+		if (!l)
+			break;
+		l->acquires++;
+		l->owner = e->pid;
+		if (t->wait_lock == e->lock_ptr)
+			wait_end(t, e->ts, 0);
+		break;
+	case MF_RELEASE:
+		l = lock_find(e->lock_ptr);
+		if (!l)
+			break;
+		if (l->waiters > 0)
+			l->handoffs++;
+		l->owner = 0;
+		break;
+	case MF_FUTEX_WAKE:
+		//互斥锁的等待在获得锁时结束，这里只处理单纯的futex等待
+		if (t->wait_lock == e->lock_ptr && t->wait_type == FUTEX_FLAG) {
+			l = lock_find(e->lock_ptr);
+			if (l)
+				l->acquires++;
+			wait_end(t, e->ts, e->peer);
+		}
+		break;
+	}
+}
+
+static void print_chain(int pid, const struct mf_chain *chain)
+{
+	printf("%d", pid);
+	for (int i = 0; i < chain->len; i++)
+		printf(" -[0x%llx]-> %d(%d)", chain->locks[i], chain->pids[i], chain->prios[i]);
+	if (chain->cycle)
+		printf("  DEADLOCK");
+	printf("\n");
+}
+
+static int cmp_blocked(const void *a, const void *b)
+{
+	const struct mf_thread *x = *(const struct mf_thread **)a, *y = *(const struct mf_thread **)b;
+	u64 wx = x->blocked + x->caused, wy = y->blocked + y->caused;
+	return wx < wy ? 1 : wx > wy ? -1 : 0;
+}
+
+static int cmp_wait_total(const void *a, const void *b)
+{
+	const struct mf_lock *x = *(const struct mf_lock **)a, *y = *(const struct mf_lock **)b;
+	return x->wait_total < y->wait_total ? 1 : x->wait_total > y->wait_total ? -1 : 0;
+}
+
+static void report(u64 now)
+{
+	size_t nt = hashmap_count(threads), nl = hashmap_count(locks), i = 0, n;
+	struct mf_thread **ts = calloc(nt ? nt : 1, sizeof(*ts));
+	struct mf_lock **ls = calloc(nl ? nl : 1, sizeof(*ls));
+	time_t wall = time(NULL);
+	struct tm *tm = localtime(&wall);
+	void *item;
+
+	if (!ts || !ls)
+		goto out;
+	printf("MFUTEX WAIT GRAPH %02d:%02d:%02d (last %llus) ----------------------------------------------------\n",
+	       tm->tm_hour, tm->tm_min, tm->tm_sec, MF_WINDOW_NS / 1000000000ULL);
+
+	n = 0;
+	while (hashmap_iter(threads, &i, &item)) {
+		struct mf_thread *t = item;
+		//仍在等待的线程把截至目前的等待时间也计入本窗口
+		if (t->wait_lock) {
+			u64 start = t->wait_start > window_start ? t->wait_start : window_start;
+			if (now > start)
+				t->blocked += now - start;
+			build_chain(t, t->wait_lock, &t->chain);
+		}
+		if (t->blocked || t->caused)
+			ts[n++] = t;
+	}
+	qsort(ts, n, sizeof(*ts), cmp_blocked);
+	printf("Critical path of blocked threads (CAUSED: time others spent blocked behind this thread):\n");
+	printf("  %-7s %-7s %-5s %-7s %-12s %-12s %-12s %s\n", "PID", "TGID", "PRIO", "WAITS",
+	       "BLOCKED(ms)", "MAX(ms)", "CAUSED(ms)", "CRITICAL PATH (pid(prio))");
+	for (size_t j = 0; j < n && j < MF_TOP_N; j++) {
+		struct mf_thread *t = ts[j];
+		const struct mf_chain *chain = t->wait_lock ? &t->chain : &t->max_chain;
+		printf("  %-7d %-7d %-5d %-7llu %-12.3lf %-12.3lf %-12.3lf %s", t->pid, t->tgid, t->prio,
+		       t->waits, t->blocked / 1e6, t->max_wait / 1e6, t->caused / 1e6,
+		       t->wait_lock ? "(blocked) " : "");
+		print_chain(t->pid, chain);
+	}
+
+	n = 0;
+	i = 0;
+	while (hashmap_iter(locks, &i, &item)) {
+		struct mf_lock *l = item;
+		if (l->max_waiters >= MF_CONVOY_WAITERS && l->contended * 2 >= l->acquires)
+			ls[n++] = l;
+	}
+	qsort(ls, n, sizeof(*ls), cmp_wait_total);
+	if (n) {
+		printf("Lock convoys:\n");
+		printf("  %-18s %-10s %-9s %-10s %-12s %-9s %s\n", "LOCK", "TYPE", "ACQUIRE", "CONTENDED",
+		       "MAX_WAITERS", "HANDOFFS", "WAIT(ms)");
+		for (size_t j = 0; j < n && j < MF_TOP_N; j++)
+			printf("  0x%-16llx %-10s %-9llu %-10llu %-12d %-9llu %.3lf\n", ls[j]->lock_ptr,
+			       ls[j]->type == FUTEX_FLAG ? "FUTEX" : "MUTEX", ls[j]->acquires,
+			       ls[j]->contended, ls[j]->max_waiters, ls[j]->handoffs, ls[j]->wait_total / 1e6);
+	}
+
+	if (nr_inversions) {
+		printf("Priority inversion chains:\n");
+		for (int j = 0; j < nr_inversions; j++) {
+			printf("  waited %-10.3lfms prio %-4d ", inversions[j].wait / 1e6, inversions[j].prio);
+			print_chain(inversions[j].pid, &inversions[j].chain);
+		}
+	}
+	printf("\n");
+out:
+	free(ts);
+	free(ls);
+}
+
+/* 清空窗口统计，回收本窗口内没有活动、也不处于等待或持有状态的线程和锁 */
+static void reset_window(void)
+{
+	size_t i = 0, n = 0, cap = hashmap_count(threads) + hashmap_count(locks);
+	int *dead_pids = calloc(cap ? cap : 1, sizeof(*dead_pids));
+	u64 *dead_locks = calloc(cap ? cap : 1, sizeof(*dead_locks));
+	void *item;
+
+	while (hashmap_iter(threads, &i, &item)) {
+		struct mf_thread *t = item;
+		if (!t->active && !t->wait_lock && dead_pids)
+			dead_pids[n++] = t->pid;
+		t->active = false;
+		t->waits = t->blocked = t->max_wait = t->caused = 0;
+		memset(&t->max_chain, 0, sizeof(t->max_chain));
+	}
+	for (size_t j = 0; j < n; j++)
+		hashmap_del(threads, &(struct mf_thread){ .pid = dead_pids[j] });
+
+	i = n = 0;
+	while (hashmap_iter(locks, &i, &item)) {
+		struct mf_lock *l = item;
+		if (!l->acquires && !l->owner && !l->waiters && dead_locks)
+			dead_locks[n++] = l->lock_ptr;
+		l->acquires = l->contended = l->handoffs = l->wait_total = 0;
+		l->max_waiters = l->waiters;
+	}
+	for (size_t j = 0; j < n; j++)
+		hashmap_del(locks, &(struct mf_lock){ .lock_ptr = dead_locks[j] });
+	nr_inversions = 0;
+	free(dead_pids);
+	free(dead_locks);
+}
+
+void mf_graph_tick(uint64_t now)
+{
+	if (!threads || !window_start || now - window_start < MF_WINDOW_NS)
+		return;
+	if (hashmap_count(threads))
+		report(now);
+	reset_window();
+	window_start = now;
+}
@@ -0,0 +1,38 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: zhangziheng0525@163.com
+//
+// wait-for graph built from mfutex events
+
+#ifndef __MFUTEX_GRAPH_H
+#define __MFUTEX_GRAPH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MF_WINDOW_NS (5 * 1000000000ULL)	// 每个统计窗口5s
+#define MF_CHAIN_MAX 8				// 等待链最多展开的层数
+#define MF_TOP_N 5
+#define MF_CONVOY_WAITERS 3			// 同时等待的线程数达到该值且多数获取需要等待时视为护航
+#define MF_INVERSION_MAX 16			// 每个窗口最多保留的优先级反转链
+
+struct mfutex_event;
+
+int mf_graph_init(void);
+void mf_graph_event(const struct mfutex_event *e);
+void mf_graph_tick(uint64_t now);
+void mf_graph_free(void);
+
+#endif /* __MFUTEX_GRAPH_H */
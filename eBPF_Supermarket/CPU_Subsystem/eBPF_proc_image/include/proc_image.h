@@ -153,6 +153,23 @@ struct per_lock_event{
 	u64 start_hold_time,last_hold_delay;//持有锁的时间；
 	int cnt;//等待锁+持有锁的数量；
 };
+
+// mfutex上报给用户态等待图的事件类型
+#define MF_REQUEST 1		// 开始申请锁，peer为此刻的持有者
+#define MF_ACQUIRE 2		// 获得锁
+#define MF_RELEASE 3		// 释放锁
+#define MF_FUTEX_WAIT 4		// 在futex上阻塞
+#define MF_FUTEX_WAKE 5		// 被futex唤醒，pid为被唤醒者，peer为唤醒者
+struct mfutex_event{
+	int kind;
+	int type;//MUTEX_FLAG/FUTEX_FLAG
+	int pid;
+	int tgid;
+	int prio;//pid对应线程的内核优先级，数值越小优先级越高
+	int peer;
+	u64 lock_ptr;
+	u64 ts;
+};
 struct sys_futex_args {
 	u64 pad;
 	int __syscall_nr;
@@ -0,0 +1,205 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: zhangziheng0525@163.com
+//
+// mmap based writer and reader of the syscall sequence trace file
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "sc_trace.h"
+
+#define SC_TRACE_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+static uint64_t clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int sc_trace_remap(struct sc_trace_writer *w, size_t cap)
+{
+	void *base;
+
+	if (w->base)
+		munmap(w->base, w->cap);
+	w->base = NULL;
+	if (ftruncate(w->fd, cap) < 0)
+		return -errno;
+	base = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+	if (base == MAP_FAILED)
+		return -errno;
+	w->base = base;
+	w->cap = cap;
+	return 0;
+}
+
+int sc_trace_open(struct sc_trace_writer *w, const char *path)
+{
+	struct sc_trace_hdr *hdr;
+	int err;
+
+	memset(w, 0, sizeof(*w));
+	w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (w->fd < 0)
+		return -errno;
+	err = sc_trace_remap(w, SC_TRACE_CHUNK);
+	if (err) {
+		close(w->fd);
+		w->fd = -1;
+		return err;
+	}
+	hdr = (struct sc_trace_hdr *)w->base;
+	memcpy(hdr->magic, SC_TRACE_MAGIC, sizeof(hdr->magic));
+	hdr->version = SC_TRACE_VERSION;
+	hdr->hdr_size = SC_TRACE_ALIGN(sizeof(*hdr));
+	hdr->start_realtime = clock_ns(CLOCK_REALTIME);
+	hdr->start_monotonic = clock_ns(CLOCK_MONOTONIC);
+	w->off = hdr->hdr_size;
+	w->last_flush = hdr->start_monotonic / 1000000;
+	return 0;
+}
+
+int sc_trace_append(struct sc_trace_writer *w, const struct sc_trace_rec *rec,
+		    const int *syscalls)
+{
+	size_t len = SC_TRACE_ALIGN(sizeof(*rec) + rec->count * sizeof(uint16_t));
+	struct sc_trace_rec *dst;
+	int err;
+
+	if (w->off + len > w->cap) {
+		// 扩展前先提交已写入的数据，再按块增长文件
+		err = sc_trace_flush(w, true);
+		if (err)
+			return err;
+		err = sc_trace_remap(w, w->cap + SC_TRACE_CHUNK);
+		if (err)
+			return err;
+	}
+	dst = (struct sc_trace_rec *)(w->base + w->off);
+	*dst = *rec;
+	dst->len = len;
+	for (uint32_t i = 0; i < rec->count; i++)
+		dst->syscalls[i] = syscalls[i];
+	w->off += len;
+	w->records++;
+	return 0;
+}
+
+int sc_trace_flush(struct sc_trace_writer *w, bool force)
+{
+	struct sc_trace_hdr *hdr = (struct sc_trace_hdr *)w->base;
+	uint64_t now = clock_ns(CLOCK_MONOTONIC) / 1000000;
+	size_t page = sysconf(_SC_PAGESIZE), start;
+
+	if (!w->base)
+		return 0;
+	if (!force && now - w->last_flush < SC_TRACE_FLUSH_MS)
+		return 0;
+	w->last_flush = now;
+	hdr->data_size = w->off - hdr->hdr_size;
+	hdr->records = w->records;
+	// 只回写上次刷新之后的页以及文件头所在的页
+	start = w->synced & ~(page - 1);
+	if (w->off > start && msync(w->base + start, w->off - start, MS_ASYNC) < 0)
+		return -errno;
+	if (start && msync(w->base, page, MS_ASYNC) < 0)
+		return -errno;
+	w->synced = w->off;
+	return 0;
+}
+
+void sc_trace_close(struct sc_trace_writer *w)
+{
+	if (w->base) {
+		sc_trace_flush(w, true);
+		msync(w->base, w->off, MS_SYNC);
+		munmap(w->base, w->cap);
+		w->base = NULL;
+	}
+	if (w->fd >= 0) {
+		// 截掉预分配但未使用的部分
+		if (ftruncate(w->fd, w->off) < 0)
+			perror("ftruncate");
+		close(w->fd);
+		w->fd = -1;
+	}
+}
+
+int sc_trace_map(struct sc_trace_reader *r, const char *path)
+{
+	struct stat st;
+	void *base;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = open(path, O_RDONLY);
+	if (r->fd < 0)
+		return -errno;
+	if (fstat(r->fd, &st) < 0 || (size_t)st.st_size < sizeof(struct sc_trace_hdr))
+		goto invalid;
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+	if (base == MAP_FAILED)
+		goto invalid;
+	r->base = base;
+	r->map_size = r->size = st.st_size;
+	r->hdr = base;
+	if (memcmp(r->hdr->magic, SC_TRACE_MAGIC, sizeof(r->hdr->magic)) ||
+	    r->hdr->version != SC_TRACE_VERSION || r->hdr->hdr_size > r->size) {
+		sc_trace_unmap(r);
+		return -EINVAL;
+	}
+	// 异常退出时文件头可能落后于实际写入量，以文件头记录的已提交部分为准
+	if (r->hdr->data_size < r->size - r->hdr->hdr_size)
+		r->size = r->hdr->hdr_size + r->hdr->data_size;
+	return 0;
+invalid:
+	close(r->fd);
+	r->fd = -1;
+	return -EINVAL;
+}
+
+const struct sc_trace_rec *sc_trace_rec_at(const struct sc_trace_reader *r, uint64_t off)
+{
+	const struct sc_trace_rec *rec;
+
+	if (off + sizeof(*rec) > r->size)
+		return NULL;
+	rec = (const struct sc_trace_rec *)(r->base + off);
+	if (rec->len < sizeof(*rec) + rec->count * sizeof(uint16_t) || rec->len & 7 ||
+	    off + rec->len > r->size)
+		return NULL;
+	return rec;
+}
+
+uint64_t sc_trace_realtime(const struct sc_trace_reader *r, uint64_t ts)
+{
+	return r->hdr->start_realtime + (ts - r->hdr->start_monotonic);
+}
+
+void sc_trace_unmap(struct sc_trace_reader *r)
+{
+	if (r->base)
+		munmap((void *)r->base, r->map_size);
+	if (r->fd >= 0)
+		close(r->fd);
+	r->base = NULL;
+	r->fd = -1;
+}
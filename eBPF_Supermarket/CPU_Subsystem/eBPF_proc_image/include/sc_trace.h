@@ -0,0 +1,89 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: zhangziheng0525@163.com
+//
+// binary trace file for syscall sequences
+
+#ifndef __SC_TRACE_H
+#define __SC_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SC_TRACE_MAGIC "SCTRACE1"
+#define SC_TRACE_VERSION 1
+#define SC_TRACE_CHUNK (16UL << 20)	// 文件每次扩展16MB
+#define SC_TRACE_FLUSH_MS 1000		// 周期性刷新间隔
+
+/* 文件头：data_size与records在每次刷新时更新，异常退出时只丢失最后一个周期 */
+struct sc_trace_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t hdr_size;
+	uint64_t start_realtime;	// 开始记录时的CLOCK_REALTIME(ns)
+	uint64_t start_monotonic;	// 同一时刻的CLOCK_MONOTONIC(ns)，与bpf_ktime_get_ns()同源
+	uint64_t data_size;		// 已提交的记录字节数
+	uint64_t records;
+};
+
+/* 变长记录：以长度开头，其后是count个16位系统调用号，按8字节对齐 */
+struct sc_trace_rec {
+	uint32_t len;
+	int32_t pid;
+	int32_t tgid;
+	uint32_t count;
+	uint64_t ts;			// 序列中最后一个系统调用的进入时间(CLOCK_MONOTONIC)
+	uint64_t sum_delay;
+	uint64_t max_delay;
+	uint64_t min_delay;
+	uint16_t syscalls[];
+};
+
+struct sc_trace_writer {
+	int fd;
+	char *base;
+	size_t cap;			// 文件与映射的大小
+	size_t off;			// 下一条记录的写入位置
+	size_t synced;			// 已交给msync的位置
+	uint64_t records;
+	uint64_t last_flush;		// 上次刷新的时间(ms)
+};
+
+struct sc_trace_reader {
+	int fd;
+	const char *base;
+	size_t map_size;
+	size_t size;			// 已提交数据的末尾
+	const struct sc_trace_hdr *hdr;
+};
+
+int sc_trace_open(struct sc_trace_writer *w, const char *path);
+int sc_trace_append(struct sc_trace_writer *w, const struct sc_trace_rec *rec,
+		    const int *syscalls);
+int sc_trace_flush(struct sc_trace_writer *w, bool force);
+void sc_trace_close(struct sc_trace_writer *w);
+
+int sc_trace_map(struct sc_trace_reader *r, const char *path);
+const struct sc_trace_rec *sc_trace_rec_at(const struct sc_trace_reader *r, uint64_t off);
+uint64_t sc_trace_realtime(const struct sc_trace_reader *r, uint64_t ts);
+void sc_trace_unmap(struct sc_trace_reader *r);
+
+#define sc_trace_for_each(r, off, rec)						\
+	for ((off) = (r)->hdr->hdr_size;					\
+	     ((rec) = sc_trace_rec_at((r), (off))) != NULL;			\
+	     (off) += (rec)->len)
+
+#endif /* __SC_TRACE_H */
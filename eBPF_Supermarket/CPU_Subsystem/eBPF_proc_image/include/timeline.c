@@ -0,0 +1,275 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: zhangziheng0525@163.com
+//
+// writer and reader of the shared memory timeline store
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "timeline.h"
+
+#define TL_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+struct tl_match {
+	uint64_t seq;
+	struct tl_event e;
+};
+
+static uint64_t clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 计算各列的偏移，返回文件总大小 */
+static size_t tl_layout(struct tl_hdr *hdr)
+{
+	size_t off = TL_ALIGN(sizeof(*hdr));
+
+	hdr->off_ts = off;
+	off += TL_ALIGN(TL_CAPACITY * sizeof(uint64_t));
+	hdr->off_pid = off;
+	off += TL_ALIGN(TL_CAPACITY * sizeof(int32_t));
+	hdr->off_tgid = off;
+	off += TL_ALIGN(TL_CAPACITY * sizeof(int32_t));
+	hdr->off_kind = off;
+	off += TL_ALIGN(TL_CAPACITY * sizeof(uint16_t));
+	hdr->off_sub = off;
+	off += TL_ALIGN(TL_CAPACITY * sizeof(uint16_t));
+	hdr->off_arg0 = off;
+	off += TL_ALIGN(TL_CAPACITY * sizeof(uint64_t));
+	hdr->off_arg1 = off;
+	off += TL_ALIGN(TL_CAPACITY * sizeof(uint64_t));
+	hdr->off_segs = off;
+	off += TL_ALIGN(TL_NR_SEGS * sizeof(struct tl_seg));
+	return off;
+}
+
+static void tl_bind(struct tl_store *s, void *base)
+{
+	char *p = base;
+
+	s->hdr = base;
+	s->ts = (uint64_t *)(p + s->hdr->off_ts);
+	s->pid = (int32_t *)(p + s->hdr->off_pid);
+	s->tgid = (int32_t *)(p + s->hdr->off_tgid);
+	s->kind = (uint16_t *)(p + s->hdr->off_kind);
+	s->sub = (uint16_t *)(p + s->hdr->off_sub);
+	s->arg0 = (uint64_t *)(p + s->hdr->off_arg0);
+	s->arg1 = (uint64_t *)(p + s->hdr->off_arg1);
+	s->segs = (struct tl_seg *)(p + s->hdr->off_segs);
+}
+
+int tl_create(struct tl_store *s, const char *path)
+{
+	struct tl_hdr hdr = {};
+	void *base;
+	int err;
+
+	memset(s, 0, sizeof(*s));
+	s->size = tl_layout(&hdr);
+	s->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (s->fd < 0)
+		return -errno;
+	if (ftruncate(s->fd, s->size) < 0)
+		goto err;
+	base = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+	if (base == MAP_FAILED)
+		goto err;
+	memcpy(hdr.magic, TL_MAGIC, sizeof(hdr.magic));
+	hdr.version = TL_VERSION;
+	hdr.capacity = TL_CAPACITY;
+	hdr.seg_size = TL_SEG_SIZE;
+	hdr.nr_segs = TL_NR_SEGS;
+	hdr.start_realtime = clock_ns(CLOCK_REALTIME);
+	hdr.start_monotonic = clock_ns(CLOCK_MONOTONIC);
+	memcpy(base, &hdr, sizeof(hdr));
+	tl_bind(s, base);
+	s->writable = true;
+	return 0;
+err:
+	err = -errno;
+	close(s->fd);
+	s->fd = -1;
+	return err;
+}
+
+/* 单写者：先写各列与段的时间范围，最后以release语义推进head */
+void tl_append(struct tl_store *s, const struct tl_event *e)
+{
+	uint64_t seq;
+	uint32_t slot;
+	struct tl_seg *seg;
+
+	if (!s->writable)
+		return;
+	seq = s->hdr->head;
+	slot = seq % TL_CAPACITY;
+	seg = &s->segs[(seq / TL_SEG_SIZE) % TL_NR_SEGS];
+	s->ts[slot] = e->ts;
+	s->pid[slot] = e->pid;
+	s->tgid[slot] = e->tgid;
+	s->kind[slot] = e->kind;
+	s->sub[slot] = e->sub;
+	s->arg0[slot] = e->arg0;
+	s->arg1[slot] = e->arg1;
+	if (seq % TL_SEG_SIZE == 0) {
+		seg->min_ts = seg->max_ts = e->ts;
+	} else {
+		if (e->ts < seg->min_ts)
+			seg->min_ts = e->ts;
+		if (e->ts > seg->max_ts)
+			seg->max_ts = e->ts;
+	}
+	__atomic_store_n(&s->hdr->head, seq + 1, __ATOMIC_RELEASE);
+}
+
+int tl_attach(struct tl_store *s, const char *path)
+{
+	struct tl_hdr hdr;
+	struct stat st;
+	void *base;
+
+	memset(s, 0, sizeof(*s));
+	s->fd = open(path, O_RDONLY);
+	if (s->fd < 0)
+		return -errno;
+	if (fstat(s->fd, &st) < 0 || (size_t)st.st_size < sizeof(hdr) ||
+	    pread(s->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		goto invalid;
+	if (memcmp(hdr.magic, TL_MAGIC, sizeof(hdr.magic)) || hdr.version != TL_VERSION ||
+	    hdr.capacity != TL_CAPACITY || hdr.seg_size != TL_SEG_SIZE || hdr.nr_segs != TL_NR_SEGS)
+		goto invalid;
+	s->size = tl_layout(&hdr);
+	if ((size_t)st.st_size < s->size)
+		goto invalid;
+	base = mmap(NULL, s->size, PROT_READ, MAP_SHARED, s->fd, 0);
+	if (base == MAP_FAILED)
+		goto invalid;
+	tl_bind(s, base);
+	return 0;
+invalid:
+	close(s->fd);
+	s->fd = -1;
+	return -EINVAL;
+}
+
+void tl_close(struct tl_store *s)
+{
+	if (s->hdr)
+		munmap(s->hdr, s->size);
+	if (s->fd >= 0)
+		close(s->fd);
+	s->hdr = NULL;
+	s->fd = -1;
+}
+
+static int cmp_match(const void *a, const void *b)
+{
+	const struct tl_match *x = a, *y = b;
+	if (x->e.ts != y->e.ts)
+		return x->e.ts < y->e.ts ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+int tl_query(const struct tl_store *s, int pid, int tgid, uint64_t t1, uint64_t t2,
+	     struct tl_event **out, size_t *n)
+{
+	uint64_t head = __atomic_load_n(&s->hdr->head, __ATOMIC_ACQUIRE);
+	uint64_t lo = head > TL_VISIBLE ? head - TL_VISIBLE : 0;
+	struct tl_match *m = NULL, *tmp;
+	size_t nr = 0, cap = 0, kept = 0;
+
+	*out = NULL;
+	*n = 0;
+	// 按段跳过时间范围不相交的部分，段内先比较pid列，命中后才读取其余各列
+	for (uint64_t start = lo; start < head; ) {
+		uint64_t end = (start / TL_SEG_SIZE + 1) * TL_SEG_SIZE;
+		const struct tl_seg *seg = &s->segs[(start / TL_SEG_SIZE) % TL_NR_SEGS];
+
+		if (end > head)
+			end = head;
+		if (seg->max_ts < t1 || seg->min_ts > t2) {
+			start = end;
+			continue;
+		}
+		for (uint64_t seq = start; seq < end; seq++) {
+			uint32_t slot = seq % TL_CAPACITY;
+			if ((pid != -1 && s->pid[slot] != pid) || (tgid != -1 && s->tgid[slot] != tgid))
+				continue;
+			if (s->ts[slot] < t1 || s->ts[slot] > t2)
+				continue;
+			if (nr == cap) {
+				cap = cap ? cap * 2 : 1024;
+				tmp = realloc(m, cap * sizeof(*m));
+				if (!tmp) {
+					free(m);
+					return -ENOMEM;
+				}
+				m = tmp;
+			}
+			m[nr].seq = seq;
+			m[nr].e = (struct tl_event){
+				.ts = s->ts[slot],
+				.pid = s->pid[slot],
+				.tgid = s->tgid[slot],
+				.kind = s->kind[slot],
+				.sub = s->sub[slot],
+				.arg0 = s->arg0[slot],
+				.arg1 = s->arg1[slot],
+			};
+			nr++;
+		}
+		start = end;
+	}
+
+	// 扫描期间写者可能已回收了最旧的段，丢弃这些可能被覆盖的结果
+	head = __atomic_load_n(&s->hdr->head, __ATOMIC_ACQUIRE);
+	lo = head > TL_VISIBLE ? head - TL_VISIBLE : 0;
+	for (size_t i = 0; i < nr; i++)
+		if (m[i].seq >= lo)
+			m[kept++] = m[i];
+	qsort(m, kept, sizeof(*m), cmp_match);
+
+	if (kept) {
+		*out = malloc(kept * sizeof(**out));
+		if (!*out) {
+			free(m);
+			return -ENOMEM;
+		}
+		for (size_t i = 0; i < kept; i++)
+			(*out)[i] = m[i].e;
+	}
+	*n = kept;
+	free(m);
+	return 0;
+}
+
+uint64_t tl_realtime(const struct tl_store *s, uint64_t ts)
+{
+	return s->hdr->start_realtime + (ts - s->hdr->start_monotonic);
+}
+
+uint64_t tl_monotonic(const struct tl_store *s, uint64_t realtime)
+{
+	return s->hdr->start_monotonic + (realtime - s->hdr->start_realtime);
+}
@@ -0,0 +1,104 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: zhangziheng0525@163.com
+//
+// per-process lifecycle timeline: a columnar event ring in shared memory
+
+#ifndef __TIMELINE_H
+#define __TIMELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TL_MAGIC "PROCTL01"
+#define TL_VERSION 1
+#define TL_DEFAULT_PATH "/dev/shm/proc_image.timeline"
+#define TL_SEG_SIZE 4096			// 每个时间段包含的事件数
+#define TL_NR_SEGS 256
+#define TL_CAPACITY (TL_SEG_SIZE * TL_NR_SEGS)	// 环中的槽位数
+/* 写者正在覆盖的段不对读者可见，读者能看到的最多是 TL_CAPACITY - TL_SEG_SIZE 个事件 */
+#define TL_VISIBLE (TL_CAPACITY - TL_SEG_SIZE)
+
+/* 合并进时间线的事件，sub/arg0/arg1 的含义随 kind 而定 */
+enum tl_kind {
+	TL_ONCPU = 1,		// 上CPU
+	TL_OFFCPU,		// 下CPU，arg0为内核栈顶地址
+	TL_SYSCALL,		// 一段系统调用序列，sub为最后一个系统调用号，arg0为个数，arg1为总时延
+	TL_LOCK,		// 用户态锁，sub为lock_status，arg0为锁地址，arg1为返回值
+	TL_MFUTEX,		// mfutex事件，sub为MF_*，arg0为锁地址，arg1为持有者/唤醒者
+	TL_KEYTIME,		// exec/exit/fork等关键时间点，sub为keytime类型，arg0为info[0]
+	TL_SCHEDULE,		// 调度时延采样，sub为prio，arg0为平均时延，arg1为最大时延
+	TL_RESOURCE,		// 资源采样，sub为cpu_id，arg0为周期内的CPU时间，arg1为内存
+	TL_KIND_MAX,
+};
+
+/* 每个段记录其中事件的时间范围，各数据流的时间戳并不单调，查询据此跳过整段 */
+struct tl_seg {
+	uint64_t min_ts;
+	uint64_t max_ts;
+};
+
+/* 文件头之后依次是各列与段表，列的偏移记录在文件头中 */
+struct tl_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t seg_size;
+	uint32_t nr_segs;
+	uint64_t start_realtime;	// 开始记录时的CLOCK_REALTIME(ns)
+	uint64_t start_monotonic;	// 同一时刻的CLOCK_MONOTONIC(ns)，与bpf_ktime_get_ns()同源
+	uint64_t head;			// 已写入的事件总数，事件seq存放在 seq % capacity
+	uint64_t off_ts, off_pid, off_tgid, off_kind, off_sub, off_arg0, off_arg1, off_segs;
+};
+
+struct tl_event {
+	uint64_t ts;
+	int32_t pid;
+	int32_t tgid;
+	uint16_t kind;
+	uint16_t sub;
+	uint64_t arg0;
+	uint64_t arg1;
+};
+
+struct tl_store {
+	int fd;
+	bool writable;
+	size_t size;
+	struct tl_hdr *hdr;
+	uint64_t *ts;
+	int32_t *pid;
+	int32_t *tgid;
+	uint16_t *kind;
+	uint16_t *sub;
+	uint64_t *arg0;
+	uint64_t *arg1;
+	struct tl_seg *segs;
+};
+
+int tl_create(struct tl_store *s, const char *path);
+void tl_append(struct tl_store *s, const struct tl_event *e);
+int tl_attach(struct tl_store *s, const char *path);
+void tl_close(struct tl_store *s);
+
+/* 查询pid(或tgid，pid为-1时)在[t1,t2]内的事件，结果按时间排序，由调用者free */
+int tl_query(const struct tl_store *s, int pid, int tgid, uint64_t t1, uint64_t t2,
+	     struct tl_event **out, size_t *n);
+
+uint64_t tl_realtime(const struct tl_store *s, uint64_t ts);
+uint64_t tl_monotonic(const struct tl_store *s, uint64_t realtime);
+
+#endif /* __TIMELINE_H */
@@ -36,6 +36,9 @@
 #include "schedule_image.skel.h"
 #include "mfutex.skel.h"
 #include "hashmap.h"
+#include "sc_trace.h"
+#include "mfutex_graph.h"
+#include "timeline.h"
 #include "helpers.h"
 #include "trace_helpers.h"
 
@@ -68,6 +71,8 @@ static struct env {
 	int sc_prev_tgid;
 	char hostname[64];
 	bool enable_mfutex;
+	const char *trace_file;
+	const char *timeline_file;
 } env = {
 	.output_resourse = false,
 	.output_schedule = false,
@@ -93,6 +98,8 @@ static struct env {
 	.sc_prev_tgid = 0,
 	.hostname = "",
 	.enable_mfutex = false,
+	.trace_file = NULL,
+	.timeline_file = NULL,
 };
 
 struct hashmap *map = NULL;
@@ -110,6 +117,8 @@ static int lockmap_fd;
 static int ktmap_fd;
 static int schedmap_fd;
 static int mfutexmap_fd;
+static struct sc_trace_writer sc_trace = { .fd = -1 };
+static struct tl_store timeline = { .fd = -1 };
 
 static struct timespec prevtime;
 static struct timespec currentime;
@@ -118,7 +127,6 @@ char *lock_status[] = {"", "mutex_req", "mutex_lock", "mutex_unlock",
 						   "rdlock_req", "rdlock_lock", "rdlock_unlock",
 						   "wrlock_req", "wrlock_lock", "wrlock_unlock",
 						   "spinlock_req", "spinlock_lock", "spinlock_unlock"};
-char *mfutex_type[] = {"","MUTEX","RW_LOCK","SPIN_LOCK","RCU_LOCK","FUTEX_LOCK"};
 
 char *keytime_type[] = {"", "exec_enter", "exec_exit", 
 						    "exit", 
@@ -146,6 +154,8 @@ static const struct argp_option opts[] = {
 	{ "keytime", 'k', NULL, 0, "Attach eBPF functions about keytime(but do not start)" },
 	{ "schedule", 'S', NULL, 0, "Attach eBPF functions about schedule (but do not start)" },
 	{ "mfutex", 'm', NULL, 0, "Attach eBPF functions about mfutex (but do not start)" },
+	{ "output", 'o', "FILE", 0, "Write syscall sequences to a binary trace file instead of the terminal (query it with sc_query)" },
+	{ "timeline", 't', "FILE", OPTION_ARG_OPTIONAL, "Also merge all image events into a shared memory timeline store (default " TL_DEFAULT_PATH ", query it with tl_query)" },
     { NULL, 'h', NULL, OPTION_HIDDEN, "show the full help" },
 	{},
 };
@@ -179,6 +189,12 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 		case 'm':
 				env.enable_mfutex = true;
 				break;		
+		case 'o':
+				env.trace_file = arg;
+				break;
+		case 't':
+				env.timeline_file = arg ? arg : TL_DEFAULT_PATH;
+				break;
 		case 'h':
 				argp_state_help(state, stderr, ARGP_HELP_STD_HELP);
 				break;
@@ -189,6 +205,21 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	return 0;
 }
 
+/* 把各画像的事件并入时间线，未启用时timeline不可写，直接返回 */
+static void timeline_add(u64 ts, int pid, int tgid, int kind, int sub, u64 arg0, u64 arg1)
+{
+	struct tl_event e = {
+		.ts = ts,
+		.pid = pid,
+		.tgid = tgid,
+		.kind = kind,
+		.sub = sub,
+		.arg0 = arg0,
+		.arg1 = arg1,
+	};
+	tl_append(&timeline, &e);
+}
+
 static int print_resource(struct bpf_map *map,int rscmap_fd)
 {
 	int err,key = 0;
@@ -256,6 +287,7 @@ static int print_resource(struct bpf_map *map,int rscmap_fd)
 		}
 		
 		if(pcpu<=100 && pmem<=100){
+			timeline_add(get_ktime_ns(),event.pid,event.tgid,TL_RESOURCE,event.cpu_id,event.time,event.memused);
 			printf("%02d:%02d:%02d  ",hour,min,sec);
 			if(rsc_ctrl.target_tgid != -1)	printf("%-6d  ",event.tgid);
 			printf("%-6d  %-6d  %-6.3f  %-6.3f  %-12.2lf  %-12.2lf\n",
@@ -347,6 +379,7 @@ static int print_schedule(struct bpf_map *proc_map,struct bpf_map *target_map,st
 			}
 			sys_avg_delay = sys_event.sum_delay/sys_event.sum_count;
 
+			timeline_add(get_ktime_ns(),proc_event.pid,proc_event.tgid,TL_SCHEDULE,proc_event.prio,proc_avg_delay,proc_event.max_delay);
 			printf("%02d:%02d:%02d  %-6d  %-4d  | %-15lf %-15lf | %-15lf %-15lf | %-15lf %-15lf |\n",
 					hour,min,sec,proc_event.pid,proc_event.prio,proc_avg_delay/1000000.0,sys_avg_delay/1000000.0,
 					proc_event.max_delay/1000000.0,sys_event.max_delay/1000000.0,proc_event.min_delay/1000000.0,sys_event.min_delay/1000000.0);
@@ -370,6 +403,7 @@ static int print_schedule(struct bpf_map *proc_map,struct bpf_map *target_map,st
 			}
 			sys_avg_delay = sys_event.sum_delay/sys_event.sum_count;
 
+			timeline_add(get_ktime_ns(),proc_event.pid,proc_event.tgid,TL_SCHEDULE,proc_event.prio,target_avg_delay,proc_event.max_delay);
 			printf("%02d:%02d:%02d  %-6d  %-4d  | %-15lf %-15lf | %-15lf %-15lf | %-15lf %-15lf |\n",
 					hour,min,sec,proc_event.pid,proc_event.prio,target_avg_delay/1000000.0,sys_avg_delay/1000000.0,
 					proc_event.max_delay/1000000.0,sys_event.max_delay/1000000.0,proc_event.min_delay/1000000.0,sys_event.min_delay/1000000.0);
@@ -390,6 +424,7 @@ static int print_schedule(struct bpf_map *proc_map,struct bpf_map *target_map,st
 			}
 			sys_avg_delay = sys_event.sum_delay/sys_event.sum_count;
 
+			timeline_add(get_ktime_ns(),proc_event.pid,proc_event.tgid,TL_SCHEDULE,proc_event.prio,proc_avg_delay,proc_event.max_delay);
 			printf("%02d:%02d:%02d  %-6d  %-6d  %-4d  | %-15lf %-15lf | %-15lf %-15lf | %-15lf %-15lf |\n",
 					hour,min,sec,proc_event.tgid,proc_event.pid,proc_event.prio,proc_avg_delay/1000000.0,sys_avg_delay/1000000.0,
 					proc_event.max_delay/1000000.0,sys_event.max_delay/1000000.0,proc_event.min_delay/1000000.0,sys_event.min_delay/1000000.0);
@@ -403,6 +438,24 @@ static int print_schedule(struct bpf_map *proc_map,struct bpf_map *target_map,st
 	return 0;
 }
 
+/* 以变长二进制记录写入trace文件，不占用终端，事后用sc_query建索引并回放 */
+static int write_syscall(const struct syscall_seq *e)
+{
+	struct sc_trace_rec rec = {
+		.pid = e->pid,
+		.tgid = e->tgid,
+		.count = e->count < MAX_SYSCALL_COUNT ? e->count : MAX_SYSCALL_COUNT,
+		.ts = e->enter_time,
+		.sum_delay = e->sum_delay,
+		.max_delay = e->max_delay,
+		.min_delay = e->min_delay,
+	};
+	int err = sc_trace_append(&sc_trace, &rec, e->record_syscall);
+	if (err)
+		fprintf(stderr, "Failed to write trace file: %s\n", strerror(-err));
+	return err;
+}
+
 static int print_syscall(void *ctx, void *data,unsigned long data_sz)
 {
 	int err,key = 0;
@@ -417,6 +470,16 @@ static int print_syscall(void *ctx, void *data,unsigned long data_sz)
 	
 	const struct syscall_seq *e = data;
 	u64 avg_delay;
+
+	if(e->count && ((sc_ctrl.target_pid==-1 && sc_ctrl.target_tgid==-1) || e->pid==sc_ctrl.target_pid || e->tgid==sc_ctrl.target_tgid))
+		timeline_add(e->enter_time,e->pid,e->tgid,TL_SYSCALL,e->record_syscall[(e->count<MAX_SYSCALL_COUNT ? e->count : MAX_SYSCALL_COUNT)-1],e->count,e->sum_delay);
+
+	if(env.trace_file){
+		if((sc_ctrl.target_pid==-1 && sc_ctrl.target_tgid==-1) || e->pid==sc_ctrl.target_pid || e->tgid==sc_ctrl.target_tgid)
+			return write_syscall(e);
+		return 0;
+	}
+
 	time_t now = time(NULL);
 	struct tm *localTime = localtime(&now);
     int hour = localTime->tm_hour;
@@ -498,15 +561,22 @@ static int print_syscall(void *ctx, void *data,unsigned long data_sz)
 static int print_lock(void *ctx, void *data,unsigned long data_sz)
 {
 	const struct lock_event *e = data;
-	int lock_cur_tgid = 0;
+	int lock_cur_tgid = 0,key = 0;
+	struct lock_ctrl lock_ctrl = {.target_tgid = -1};
+
+	// 内核总是记录真实的tgid(timeline按tgid查询)，只有指定了目标进程组时才输出TGID列
+	bpf_map_lookup_elem(lockmap_fd,&key,&lock_ctrl);
+	bool show_tgid = lock_ctrl.target_tgid != -1;
 
-	if(e->tgid != -1)	lock_cur_tgid = 2;
+	timeline_add(e->time,e->pid,e->tgid,TL_LOCK,e->lock_status,e->lock_ptr,e->ret);
+
+	if(show_tgid)	lock_cur_tgid = 2;
 	else	lock_cur_tgid = 1;
 	
 	if(prev_image != LOCK_IMAGE || env.lock_prev_tgid != lock_cur_tgid){
         printf("USERLOCK ------------------------------------------------------------------------------------------------\n");
         printf("%-15s  ","TIME");
-		if(e->tgid != -1){
+		if(show_tgid){
 			printf("%-6s  ","TGID");
 			env.lock_prev_tgid = 2;
 		} else {
@@ -517,7 +587,7 @@ static int print_lock(void *ctx, void *data,unsigned long data_sz)
     }
 
 	printf("%-15lld  ",e->time);
-	if(e->tgid != -1)	printf("%-6d  ",e->tgid);
+	if(show_tgid)	printf("%-6d  ",e->tgid);
 	printf("%-6d  %-15lld  ",e->pid,e->lock_ptr);
 	if(e->lock_status==2 || e->lock_status==5 || e->lock_status==8 || e->lock_status==11){
 		printf("%s-%d\n",lock_status[e->lock_status],e->ret);
@@ -530,106 +600,12 @@ static int print_lock(void *ctx, void *data,unsigned long data_sz)
 
 static int print_mfutex(void *ctx, void *data,unsigned long data_sz)
 {
-	const struct per_lock_event *e = data;
-	time_t now = time(NULL);// 获取当前时间
-	struct tm *localTime = localtime(&now);// 将时间转换为本地时间结构
-	printf("%02d:%02d:%02d   ",localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
-	int type = e->type;
-	if(type == MUTEX_FLAG){
-		printf("%-12s  0x%-8x  %-11llu  %-11lu  %-16llu  %-10d\n",mfutex_type[e->type],e->lock_ptr,e->last_owner,e->last_hold_delay,e->start_hold_time,e->owner);
-		printf("%-81s","");
-		int err,record_lock_fd =bpf_map__fd(mfutex_skel->maps.record_lock);
-		struct record_lock_key lookup_key1 = {-1,-1}, next_key;
-		while(!bpf_map_get_next_key(record_lock_fd, &lookup_key1, &next_key)){
-			// printf("next_key:%x target_ptr:%x\n",next_key,e->lock_ptr);
-			if(next_key.lock_ptr != e->lock_ptr) {
-				lookup_key1 = next_key;
-				continue;//不是目标锁，跳过 
-			}
-			struct per_request per_request = {};
-			err = bpf_map_lookup_elem(record_lock_fd,&next_key,&per_request);
-			if (err < 0) {
-				// printf(stderr, "failed to lookup info: %d\n", err);
-				lookup_key1 = next_key;
-				continue;//不是目标锁，跳过 
-			}
-			float wait_delay = (e->start_hold_time-per_request.start_request_time)/1000000000.0;
-			if(wait_delay<=0||wait_delay>=10000)
-				printf("%d(NULL)|",per_request.pid);
-			else printf("%d(%ds)|",per_request.pid,((e->start_hold_time-per_request.start_request_time)/1000000000));
-			lookup_key1 = next_key;
-		}
-	}else if(type == FUTEX_FLAG){
-		printf("%-12s  0x%-8x  %-11s  %-11s  %-16llu  ",mfutex_type[e->type],e->lock_ptr,"NULL","NULL",e->start_hold_time);
-		int err,futex_wake_queue_fd =bpf_map__fd(mfutex_skel->maps.futex_wake_queue);
-		struct lock_record_key lookup_key1 = {-1,-1}, next_key;
-		while(!bpf_map_get_next_key(futex_wake_queue_fd, &lookup_key1, &next_key)){
-			// printf("next_key:%x target_ptr:%x\n",next_key,e->lock_ptr);
-			if(next_key.lock_ptr != e->lock_ptr) {
-				lookup_key1 = next_key;
-				continue;//不是目标锁，跳过 
-			}
-			struct per_request per_request = {};
-			err = bpf_map_lookup_elem(futex_wake_queue_fd,&next_key,&per_request);
-			if (err < 0) {
-				// printf(stderr, "failed to lookup info: %d\n", err);
-				lookup_key1 = next_key;
-				continue;//不是目标锁，跳过 
-			}
-			
-			float wait_delay = (e->start_hold_time-per_request.start_request_time)/1000000000.0;
-			if(wait_delay<=0||wait_delay>=10000)
-				printf("%d(NULL)| ",per_request.pid);
-			else printf("%d(%ds)| ",per_request.pid,((e->start_hold_time-per_request.start_request_time)/1000000000));
-			err = bpf_map_delete_elem(futex_wake_queue_fd, &next_key);
-			if (err < 0) {
-				fprintf(stderr, "failed to cleanup infos: %d\n", err);
-				return -1;
-			}
-			lookup_key1 = next_key;
-		}
-		printf("\n%-81s","");
-		int err2,futex_wait_queue_fd =bpf_map__fd(mfutex_skel->maps.futex_wait_queue);
-		struct lock_record_key lookup_key2 = {-1,-1};
-		while(!bpf_map_get_next_key(futex_wait_queue_fd, &lookup_key2, &next_key)){
-			// printf("next_key:%x target_ptr:%x\n",next_key,e->lock_ptr);
-			if(next_key.lock_ptr != e->lock_ptr) {
-				lookup_key2 = next_key;
-				continue;//不是目标锁，跳过 
-			}
-			struct per_request per_request = {};
-			err2 = bpf_map_lookup_elem(futex_wait_queue_fd,&next_key,&per_request);
-			if (err2 < 0) {
-				// printf(stderr2, "failed to lookup info: %d\n", err2);
-				lookup_key2 = next_key;
-				continue;//不是目标锁，跳过 
-			}
-			
-			float wait_delay = (e->start_hold_time-per_request.start_request_time)/1000000000.0;
-			if(wait_delay<=0||wait_delay>=10000)
-				printf("%d(NULL)| ",per_request.pid);
-			else printf("%d(%ds)| ",per_request.pid,((e->start_hold_time-per_request.start_request_time)/1000000000));
-			lookup_key2 = next_key;
-		}
-		printf("\n");
-	}
-	printf("\n");
-	// struct record_lock_key key;
-	// key.lock_ptr = e->lock_ptr;
-	// key.cnt = 1;
-	// while(key.cnt<=e->cnt){
-	// 	struct per_request per_request;
-	// 	err = bpf_map_lookup_elem(record_lock_fd,&key,&per_request);
-	// 	if (err < 0) {
-	// 		// fprintf(stderr, "failed to lookup info: %d\n", err);
-	// 		printf("(%llu|%d) ",key.lock_ptr,key.cnt);
-	// 		key.cnt++;
-	// 		continue;//没找到，就去找下一个
-	// 	}
-	// 	printf("%d(%lu)| ",per_request.pid,per_request.wait_delay);
-	// 	key.cnt++;
-	// }
-	// printf("\n");
+	const struct mfutex_event *e = data;
+
+	// 事件只用于维护等待图，报告由mf_graph_tick按窗口输出
+	mf_graph_event(e);
+	timeline_add(e->ts,e->pid,e->tgid,TL_MFUTEX,e->kind,e->lock_ptr,e->peer);
+
 	return 0;
 }
 
@@ -701,19 +677,33 @@ static int print_keytime(void *ctx, void *data,unsigned long data_sz)
     int hour = localTime->tm_hour;
     int min = localTime->tm_min;
     int sec = localTime->tm_sec;
-	int kt_cur_tgid = 0;
+	int kt_cur_tgid = 0,key = 0;
+	struct kt_ctrl kt_ctrl = {.target_tgid = -1};
+
+	// 内核总是记录真实的tgid，只有指定了目标进程组时才输出TGID列
+	bpf_map_lookup_elem(ktmap_fd,&key,&kt_ctrl);
+	bool show_tgid = kt_ctrl.target_tgid != -1;
 
-	if(e->tgid != -1)	kt_cur_tgid = 2;
+	if(show_tgid)	kt_cur_tgid = 2;
 	else	kt_cur_tgid = 1;
 
 	if(e->type == 11){
 		is_offcpu = true;
 	}
+
+	// 上下CPU事件自带时间戳，其余关键时间点以收到事件的时刻为准
+	if(is_offcpu)
+		timeline_add(offcpu_event->offcpu_time,offcpu_event->pid,offcpu_event->tgid,TL_OFFCPU,0,
+					 offcpu_event->kstack_sz>0 ? offcpu_event->kstack[0] : 0,0);
+	else if(e->type == 10)
+		timeline_add(e->info[0],e->pid,e->tgid,TL_ONCPU,0,0,0);
+	else
+		timeline_add(get_ktime_ns(),e->pid,e->tgid,TL_KEYTIME,e->type,e->enable_char_info ? 0 : e->info[0],0);
 	
 	if(prev_image != KEYTIME_IMAGE || env.kt_prev_tgid != kt_cur_tgid){
         printf("KEYTIME -------------------------------------------------------------------------------------------------\n");
         printf("%-8s  ","TIME");
-		if(e->tgid != -1){
+		if(show_tgid){
 			printf("%-6s  ","TGID");
 			env.kt_prev_tgid = 2;
 		} else {
@@ -725,7 +715,7 @@ static int print_keytime(void *ctx, void *data,unsigned long data_sz)
     }
 
 	printf("%02d:%02d:%02d  ",hour,min,sec);
-	if(e->tgid != -1)	printf("%-6d  ",e->tgid);
+	if(show_tgid)	printf("%-6d  ",e->tgid);
 	if(!is_offcpu){
 		printf("%-6d  %-15s  ",e->pid,keytime_type[e->type]);
 		if(e->type==4 || e->type==5 || e->type==6 || e->type==7 || e->type==8 || e->type==9){
@@ -747,7 +737,7 @@ static int print_keytime(void *ctx, void *data,unsigned long data_sz)
 		if(env.stack_count < 100){
 			FILE *file = fopen("./.output/data/offcpu_stack.txt", "a");
 			fprintf(file, "TIME:%02d:%02d:%02d  ", hour,min,sec);
-			if(offcpu_event->tgid != -1)	fprintf(file, "TGID:%-6d  ",offcpu_event->tgid);
+			if(show_tgid)	fprintf(file, "TGID:%-6d  ",offcpu_event->tgid);
 			fprintf(file, "PID:%-6d  OFFCPU_TIME:%llu\n",offcpu_event->pid,offcpu_event->offcpu_time);
 			for(int i=0 ; i<count ; i++){
 				print_stack(offcpu_event->kstack[i],file);
@@ -758,7 +748,7 @@ static int print_keytime(void *ctx, void *data,unsigned long data_sz)
 		}else{
 			FILE *file = fopen("./.output/data/offcpu_stack.txt", "w");
 			fprintf(file, "TIME:%02d:%02d:%02d  ", hour,min,sec);
-			if(offcpu_event->tgid != -1)	fprintf(file, "TGID:%-6d  ",offcpu_event->tgid);
+			if(show_tgid)	fprintf(file, "TGID:%-6d  ",offcpu_event->tgid);
 			fprintf(file, "PID:%-6d  OFFCPU_TIME:%llu\n",offcpu_event->pid,offcpu_event->offcpu_time);
 			for(int i=0 ; i<count ; i++){
 				print_stack(offcpu_event->kstack[i],file);
@@ -909,6 +899,14 @@ int main(int argc, char **argv)
 	signal(SIGINT, sig_handler);
 	//signal(SIGTERM, sig_handler);
 
+	if(env.timeline_file){
+		err = tl_create(&timeline, env.timeline_file);
+		if (err) {
+			fprintf(stderr, "Failed to create timeline store %s: %s\n", env.timeline_file, strerror(-err));
+			return 1;
+		}
+	}
+
 	if(env.enable_resource){
 		resource_skel = resource_image_bpf__open();
 		if(!resource_skel) {
@@ -978,6 +976,14 @@ int main(int argc, char **argv)
 			goto cleanup;
 		}
 
+		if(env.trace_file){
+			err = sc_trace_open(&sc_trace, env.trace_file);
+			if (err) {
+				fprintf(stderr, "Failed to open trace file %s: %s\n", env.trace_file, strerror(-err));
+				goto cleanup;
+			}
+		}
+
 		/* 设置环形缓冲区轮询 */
 		//ring_buffer__new() API，允许在不使用额外选项数据结构下指定回调
 		syscall_rb = ring_buffer__new(bpf_map__fd(syscall_skel->maps.syscall_rb), print_syscall, NULL, NULL);
@@ -1074,8 +1080,12 @@ int main(int argc, char **argv)
 			fprintf(stderr, "Failed to create mfutex ring buffer\n");
 			goto cleanup;
 		}
+		err = mf_graph_init();
+		if (err) {
+			fprintf(stderr, "Failed to create mfutex wait graph\n");
+			goto cleanup;
+		}
 		printf("============================================ MFutex ============================================\n");
-		printf("%-8s   %-12s  %-10s  %-11s  %-11s  %-16s  %-15s\n","TIME","LOCK_TYPE","LOCK_Addr","Last_Holder","Last_Delay","HoldTime","Waker/Waiter");
 	}
 
 	if(env.enable_keytime){
@@ -1204,6 +1214,14 @@ int main(int argc, char **argv)
 				printf("Error polling syscall ring buffer: %d\n", err);
 				break;
 			}
+			// 周期性提交trace文件头，异常退出时最多丢失一个周期的数据
+			if(env.trace_file){
+				err = sc_trace_flush(&sc_trace, false);
+				if (err < 0) {
+					fprintf(stderr, "Failed to flush trace file: %s\n", strerror(-err));
+					break;
+				}
+			}
 		}
 
 		if(env.enable_lock){
@@ -1230,6 +1248,7 @@ int main(int argc, char **argv)
 				printf("Error polling mfutex ring buffer: %d\n", err);
 				break;
 			}
+			mf_graph_tick(get_ktime_ns());
 		}
 
 		if(env.enable_keytime){
@@ -1269,6 +1288,7 @@ cleanup:
 		bpf_map__unpin(sc_ctrl_map, sc_ctrl_path);
 		ring_buffer__free(syscall_rb);
 		hashmap_free(map);
+		sc_trace_close(&sc_trace);
 		syscall_image_bpf__destroy(syscall_skel);
 	}
 	if(env.enable_lock){
@@ -1280,6 +1300,7 @@ cleanup:
 		bpf_map__unpin(mfutex_ctrl_map, mfutex_ctrl_path);
 		ring_buffer__free(mfutex_rb);
 		mfutex_bpf__destroy(mfutex_skel);
+		mf_graph_free();
 	}
 	if(env.enable_keytime){
 		bpf_map__unpin(kt_ctrl_map, kt_ctrl_path);
@@ -1291,6 +1312,8 @@ cleanup:
 		bpf_map__unpin(sched_ctrl_map, sched_ctrl_path);
 		schedule_image_bpf__destroy(schedule_skel);
 	}
+	// 共享内存中的时间线在退出后保留，便于事后用tl_query查询
+	tl_close(&timeline);
 
 	return err < 0 ? -err : 0;
 }
\ No newline at end of file
@@ -0,0 +1,438 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: zhangziheng0525@163.com
+//
+// offline indexer and query tool for syscall trace files written by proc_image -o
+
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "sc_trace.h"
+
+#define SC_INDEX_MAGIC "SCINDEX1"
+#define SC_NR_MAX 65536
+
+/* 索引文件：文件头之后依次是pid表、系统调用表和记录偏移数组，两张表均按id排序 */
+struct sc_index_hdr {
+	char magic[8];
+	uint64_t data_size;		// 建索引时trace文件的已提交字节数，不一致时重建
+	uint32_t nr_pids;
+	uint32_t nr_syscalls;
+	uint64_t nr_offsets;
+};
+
+struct sc_index_ent {
+	int32_t id;			// pid或系统调用号
+	uint32_t count;			// 对应的记录数
+	uint64_t first;			// 在偏移数组中的起始下标
+};
+
+struct sc_index {
+	void *base;
+	size_t size;
+	const struct sc_index_hdr *hdr;
+	const struct sc_index_ent *pids;
+	const struct sc_index_ent *syscalls;
+	const uint64_t *offsets;
+};
+
+struct posting {
+	int32_t id;
+	uint64_t off;
+};
+
+static struct env {
+	const char *file;
+	bool rebuild;
+	bool list_pids;
+	bool list_syscalls;
+	int pid;
+	int nr;
+	double begin;
+	double end;
+} env = {
+	.pid = -1,
+	.nr = -1,
+	.begin = 0,
+	.end = -1,
+};
+
+const char argp_program_doc[] =
+"Index and query syscall trace files written by proc_image -o.\n"
+"\n"
+"EXAMPLES:\n"
+"    sc_query -f sc.trace -l              # list traced pids\n"
+"    sc_query -f sc.trace -p 1234         # replay the syscall history of pid 1234\n"
+"    sc_query -f sc.trace -p 1234 -b 60 -e 120   # only the second minute of the trace\n"
+"    sc_query -f sc.trace -n 257          # records that contain syscall 257\n";
+
+static const struct argp_option opts[] = {
+	{ "file", 'f', "FILE", 0, "Trace file to read" },
+	{ "index", 'i', NULL, 0, "Rebuild the index even if it is up to date" },
+	{ "list", 'l', NULL, 0, "List traced pids" },
+	{ "syscalls", 's', NULL, 0, "List syscalls and how many records contain them" },
+	{ "pid", 'p', "PID", 0, "Replay the syscall history of PID" },
+	{ "nr", 'n', "NR", 0, "Only records that contain syscall NR" },
+	{ "begin", 'b', "SEC", 0, "Skip records earlier than SEC seconds after trace start" },
+	{ "end", 'e', "SEC", 0, "Skip records later than SEC seconds after trace start" },
+	{ NULL, 'h', NULL, OPTION_HIDDEN, "show the full help" },
+	{},
+};
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state)
+{
+	switch (key) {
+		case 'f':
+				env.file = arg;
+				break;
+		case 'i':
+				env.rebuild = true;
+				break;
+		case 'l':
+				env.list_pids = true;
+				break;
+		case 's':
+				env.list_syscalls = true;
+				break;
+		case 'p':
+				env.pid = strtol(arg, NULL, 10);
+				break;
+		case 'n':
+				env.nr = strtol(arg, NULL, 10);
+				break;
+		case 'b':
+				env.begin = strtod(arg, NULL);
+				break;
+		case 'e':
+				env.end = strtod(arg, NULL);
+				break;
+		case 'h':
+				argp_state_help(state, stderr, ARGP_HELP_STD_HELP);
+				break;
+		default:
+				return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static int cmp_posting(const void *a, const void *b)
+{
+	const struct posting *x = a, *y = b;
+	if (x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	return x->off < y->off ? -1 : x->off > y->off;
+}
+
+static int cmp_ent(const void *key, const void *ent)
+{
+	int32_t id = *(const int32_t *)key;
+	const struct sc_index_ent *e = ent;
+	return id < e->id ? -1 : id > e->id;
+}
+
+static int push_posting(struct posting **arr, size_t *n, size_t *cap, int32_t id, uint64_t off)
+{
+	if (*n == *cap) {
+		size_t new_cap = *cap ? *cap * 2 : 4096;
+		struct posting *tmp = realloc(*arr, new_cap * sizeof(**arr));
+		if (!tmp)
+			return -ENOMEM;
+		*arr = tmp;
+		*cap = new_cap;
+	}
+	(*arr)[*n].id = id;
+	(*arr)[*n].off = off;
+	(*n)++;
+	return 0;
+}
+
+/* 把排好序的(id,偏移)对压缩为表项，偏移依次追加到offsets */
+static uint32_t emit_entries(FILE *fp, const struct posting *p, size_t n, uint64_t *first)
+{
+	uint32_t nr = 0;
+	for (size_t i = 0; i < n; ) {
+		struct sc_index_ent ent = { .id = p[i].id, .first = *first };
+		size_t j = i;
+		while (j < n && p[j].id == p[i].id)
+			j++;
+		ent.count = j - i;
+		fwrite(&ent, sizeof(ent), 1, fp);
+		*first += ent.count;
+		nr++;
+		i = j;
+	}
+	return nr;
+}
+
+static int build_index(const struct sc_trace_reader *r, const char *path)
+{
+	struct posting *pids = NULL, *scs = NULL;
+	size_t nr_pids = 0, cap_pids = 0, nr_scs = 0, cap_scs = 0;
+	static uint8_t seen[SC_NR_MAX / 8];
+	const struct sc_trace_rec *rec;
+	struct sc_index_hdr hdr = {};
+	uint64_t off, first = 0;
+	char tmp[PATH_MAX];
+	FILE *fp;
+	int err = 0;
+
+	// 一遍扫描收集(pid,偏移)与(系统调用号,偏移)，同一记录中重复的系统调用只记一次
+	sc_trace_for_each(r, off, rec) {
+		err = push_posting(&pids, &nr_pids, &cap_pids, rec->pid, off);
+		for (uint32_t i = 0; !err && i < rec->count; i++) {
+			uint16_t nr = rec->syscalls[i];
+			if (seen[nr / 8] & (1 << (nr % 8)))
+				continue;
+			seen[nr / 8] |= 1 << (nr % 8);
+			err = push_posting(&scs, &nr_scs, &cap_scs, nr, off);
+		}
+		for (uint32_t i = 0; i < rec->count; i++)
+			seen[rec->syscalls[i] / 8] = 0;
+		if (err)
+			goto out;
+	}
+	qsort(pids, nr_pids, sizeof(*pids), cmp_posting);
+	qsort(scs, nr_scs, sizeof(*scs), cmp_posting);
+
+	// 先写临时文件再改名，避免查询读到半个索引
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		err = -errno;
+		goto out;
+	}
+	memcpy(hdr.magic, SC_INDEX_MAGIC, sizeof(hdr.magic));
+	hdr.data_size = r->hdr->data_size;
+	hdr.nr_offsets = nr_pids + nr_scs;
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	hdr.nr_pids = emit_entries(fp, pids, nr_pids, &first);
+	hdr.nr_syscalls = emit_entries(fp, scs, nr_scs, &first);
+	for (size_t i = 0; i < nr_pids; i++)
+		fwrite(&pids[i].off, sizeof(uint64_t), 1, fp);
+	for (size_t i = 0; i < nr_scs; i++)
+		fwrite(&scs[i].off, sizeof(uint64_t), 1, fp);
+	rewind(fp);
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	if (ferror(fp) | fclose(fp)) {
+		err = -EIO;
+		unlink(tmp);
+		goto out;
+	}
+	if (rename(tmp, path) < 0)
+		err = -errno;
+	else
+		fprintf(stderr, "indexed %llu records: %u pids, %u syscalls\n",
+			(unsigned long long)r->hdr->records, hdr.nr_pids, hdr.nr_syscalls);
+out:
+	free(pids);
+	free(scs);
+	return err;
+}
+
+static int load_index(struct sc_index *idx, const char *path, uint64_t data_size)
+{
+	const struct sc_index_hdr *hdr;
+	struct stat st;
+	size_t need;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -EINVAL;
+	}
+	idx->base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (idx->base == MAP_FAILED) {
+		idx->base = NULL;
+		return -errno;
+	}
+	idx->size = st.st_size;
+	hdr = idx->hdr = idx->base;
+	need = sizeof(*hdr) + (size_t)(hdr->nr_pids + hdr->nr_syscalls) * sizeof(struct sc_index_ent) +
+	       hdr->nr_offsets * sizeof(uint64_t);
+	if (memcmp(hdr->magic, SC_INDEX_MAGIC, sizeof(hdr->magic)) || hdr->data_size != data_size ||
+	    need != idx->size) {
+		munmap(idx->base, idx->size);
+		idx->base = NULL;
+		return -ESTALE;
+	}
+	idx->pids = (const struct sc_index_ent *)(hdr + 1);
+	idx->syscalls = idx->pids + hdr->nr_pids;
+	idx->offsets = (const uint64_t *)(idx->syscalls + hdr->nr_syscalls);
+	return 0;
+}
+
+static const struct sc_index_ent *index_find(const struct sc_index_ent *ents, uint32_t n, int32_t id)
+{
+	return bsearch(&id, ents, n, sizeof(*ents), cmp_ent);
+}
+
+static void format_time(const struct sc_trace_reader *r, uint64_t ts, char *buf, size_t len)
+{
+	uint64_t real = sc_trace_realtime(r, ts);
+	time_t sec = real / 1000000000ULL;
+	struct tm *tm = localtime(&sec);
+	snprintf(buf, len, "%02d:%02d:%02d.%03llu", tm->tm_hour, tm->tm_min, tm->tm_sec,
+		 (unsigned long long)(real % 1000000000ULL / 1000000));
+}
+
+static bool in_range(const struct sc_trace_reader *r, const struct sc_trace_rec *rec)
+{
+	double sec = (double)(int64_t)(rec->ts - r->hdr->start_monotonic) / 1e9;
+	return sec >= env.begin && (env.end < 0 || sec <= env.end);
+}
+
+static bool has_syscall(const struct sc_trace_rec *rec, int nr)
+{
+	for (uint32_t i = 0; i < rec->count; i++)
+		if (rec->syscalls[i] == nr)
+			return true;
+	return false;
+}
+
+static void print_rec(const struct sc_trace_reader *r, const struct sc_trace_rec *rec)
+{
+	char ts[32];
+	format_time(r, rec->ts, ts, sizeof(ts));
+	printf("%-12s  %-6d  %-6d  %-15llu %-15llu %-15llu  ", ts, rec->tgid, rec->pid,
+	       (unsigned long long)(rec->count ? rec->sum_delay / rec->count : 0),
+	       (unsigned long long)rec->max_delay, (unsigned long long)rec->min_delay);
+	for (uint32_t i = 0; i < rec->count; i++)
+		printf(i == rec->count - 1 ? "%u" : "%u,", rec->syscalls[i]);
+	printf("\n");
+}
+
+static void print_rec_head(void)
+{
+	printf("%-12s  %-6s  %-6s  %-15s %-15s %-15s  %s\n", "TIME", "TGID", "PID",
+	       "AVG_DELAY(ns)", "MAX_DELAY(ns)", "MIN_DELAY(ns)", "SYSCALLS");
+}
+
+/* 按索引中的偏移回放记录，偏移按文件顺序即时间顺序排列 */
+static void replay(const struct sc_trace_reader *r, const struct sc_index *idx,
+		   const struct sc_index_ent *ent, int pid, int nr)
+{
+	print_rec_head();
+	for (uint32_t i = 0; i < ent->count; i++) {
+		const struct sc_trace_rec *rec = sc_trace_rec_at(r, idx->offsets[ent->first + i]);
+		if (!rec || !in_range(r, rec))
+			continue;
+		if ((pid != -1 && rec->pid != pid) || (nr != -1 && !has_syscall(rec, nr)))
+			continue;
+		print_rec(r, rec);
+	}
+}
+
+static void list_pids(const struct sc_trace_reader *r, const struct sc_index *idx)
+{
+	printf("%-6s  %-6s  %-10s  %-10s  %-12s  %-12s\n", "TGID", "PID", "RECORDS", "SYSCALLS",
+	       "FIRST", "LAST");
+	for (uint32_t i = 0; i < idx->hdr->nr_pids; i++) {
+		const struct sc_index_ent *ent = &idx->pids[i];
+		const struct sc_trace_rec *first = sc_trace_rec_at(r, idx->offsets[ent->first]);
+		const struct sc_trace_rec *last = sc_trace_rec_at(r, idx->offsets[ent->first + ent->count - 1]);
+		unsigned long long total = 0;
+		char t1[32], t2[32];
+		if (!first || !last)
+			continue;
+		for (uint32_t j = 0; j < ent->count; j++) {
+			const struct sc_trace_rec *rec = sc_trace_rec_at(r, idx->offsets[ent->first + j]);
+			if (rec)
+				total += rec->count;
+		}
+		format_time(r, first->ts, t1, sizeof(t1));
+		format_time(r, last->ts, t2, sizeof(t2));
+		printf("%-6d  %-6d  %-10u  %-10llu  %-12s  %-12s\n", first->tgid, ent->id, ent->count,
+		       total, t1, t2);
+	}
+}
+
+static void list_syscalls(const struct sc_index *idx)
+{
+	printf("%-6s  %-10s\n", "NR", "RECORDS");
+	for (uint32_t i = 0; i < idx->hdr->nr_syscalls; i++)
+		printf("%-6d  %-10u\n", idx->syscalls[i].id, idx->syscalls[i].count);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct argp argp = {
+		.options = opts,
+		.parser = parse_arg,
+		.doc = argp_program_doc,
+	};
+	struct sc_trace_reader r;
+	struct sc_index idx = {};
+	char idx_path[PATH_MAX];
+	int err;
+
+	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (err)
+		return err;
+	if (!env.file) {
+		fprintf(stderr, "Please specify a trace file with -f\n");
+		return 1;
+	}
+
+	err = sc_trace_map(&r, env.file);
+	if (err) {
+		fprintf(stderr, "Failed to open trace file %s: %s\n", env.file, strerror(-err));
+		return 1;
+	}
+
+	// 索引与trace文件放在一起，trace继续增长后自动重建
+	snprintf(idx_path, sizeof(idx_path), "%s.idx", env.file);
+	if (env.rebuild || load_index(&idx, idx_path, r.hdr->data_size)) {
+		err = build_index(&r, idx_path);
+		if (!err)
+			err = load_index(&idx, idx_path, r.hdr->data_size);
+		if (err) {
+			fprintf(stderr, "Failed to build index %s: %s\n", idx_path, strerror(-err));
+			goto cleanup;
+		}
+	}
+
+	if (env.list_pids)
+		list_pids(&r, &idx);
+	if (env.list_syscalls)
+		list_syscalls(&idx);
+	if (env.pid != -1 || env.nr != -1) {
+		// pid的记录数通常远少于某个系统调用的记录数，优先走pid索引
+		const struct sc_index_ent *ent = env.pid != -1 ?
+			index_find(idx.pids, idx.hdr->nr_pids, env.pid) :
+			index_find(idx.syscalls, idx.hdr->nr_syscalls, env.nr);
+		if (ent)
+			replay(&r, &idx, ent, env.pid, env.nr);
+		else
+			fprintf(stderr, "No records found\n");
+	}
+
+cleanup:
+	if (idx.base)
+		munmap(idx.base, idx.size);
+	sc_trace_unmap(&r);
+	return err < 0 ? -err : 0;
+}
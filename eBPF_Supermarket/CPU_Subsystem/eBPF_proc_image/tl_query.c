@@ -0,0 +1,311 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: zhangziheng0525@163.com
+//
+// query tool for the timeline store written by proc_image -t
+
+#include <argp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "timeline.h"
+
+static struct env {
+	const char *file;
+	int pid;
+	int tgid;
+	const char *begin;
+	const char *end;
+	bool summary;
+} env = {
+	.file = TL_DEFAULT_PATH,
+	.pid = -1,
+	.tgid = -1,
+};
+
+static const char *lock_status[] = {"", "mutex_req", "mutex_lock", "mutex_unlock",
+				    "rdlock_req", "rdlock_lock", "rdlock_unlock",
+				    "wrlock_req", "wrlock_lock", "wrlock_unlock",
+				    "spinlock_req", "spinlock_lock", "spinlock_unlock"};
+
+static const char *keytime_type[] = {"", "exec_enter", "exec_exit",
+				     "exit",
+				     "forkP_enter", "forkP_exit",
+				     "vforkP_enter", "vforkP_exit",
+				     "createT_enter", "createT_exit",
+				     "onCPU", "offCPU",};
+
+static const char *mfutex_kind[] = {"", "request", "acquire", "release", "futex_wait", "futex_wake"};
+
+#define NAME(arr, i) ((i) < sizeof(arr) / sizeof((arr)[0]) ? (arr)[i] : "unknown")
+
+const char argp_program_doc[] =
+"Query the per-process timeline recorded by proc_image -t.\n"
+"\n"
+"TIME is either HH:MM:SS[.frac] (today, local time) or -SEC (SEC seconds ago).\n"
+"\n"
+"EXAMPLES:\n"
+"    tl_query -p 1234                      # everything pid 1234 did that is still in the ring\n"
+"    tl_query -p 1234 -b -10               # the last 10 seconds of pid 1234\n"
+"    tl_query -P 1234 -b 10:21:03 -e 10:21:05 -s   # summary of all threads of tgid 1234\n";
+
+static const struct argp_option opts[] = {
+	{ "file", 'f', "FILE", 0, "Timeline store to read (default " TL_DEFAULT_PATH ")" },
+	{ "pid", 'p', "PID", 0, "Events of thread PID" },
+	{ "tgid", 'P', "TGID", 0, "Events of all threads of process TGID" },
+	{ "begin", 'b', "TIME", 0, "Skip events earlier than TIME" },
+	{ "end", 'e', "TIME", 0, "Skip events later than TIME" },
+	{ "summary", 's', NULL, 0, "Only print the summary" },
+	{ NULL, 'h', NULL, OPTION_HIDDEN, "show the full help" },
+	{},
+};
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state)
+{
+	switch (key) {
+		case 'f':
+				env.file = arg;
+				break;
+		case 'p':
+				env.pid = strtol(arg, NULL, 10);
+				break;
+		case 'P':
+				env.tgid = strtol(arg, NULL, 10);
+				break;
+		case 'b':
+				env.begin = arg;
+				break;
+		case 'e':
+				env.end = arg;
+				break;
+		case 's':
+				env.summary = true;
+				break;
+		case 'h':
+				argp_state_help(state, stderr, ARGP_HELP_STD_HELP);
+				break;
+		default:
+				return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static uint64_t clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 把TIME解析为CLOCK_REALTIME(ns) */
+static int parse_time(const char *arg, uint64_t *real)
+{
+	int hour, min;
+	double sec;
+
+	if (arg[0] == '-') {
+		*real = clock_ns(CLOCK_REALTIME) - (uint64_t)(strtod(arg + 1, NULL) * 1e9);
+		return 0;
+	}
+	if (sscanf(arg, "%d:%d:%lf", &hour, &min, &sec) == 3) {
+		time_t now = time(NULL);
+		struct tm tm;
+		localtime_r(&now, &tm);
+		tm.tm_hour = hour;
+		tm.tm_min = min;
+		tm.tm_sec = 0;
+		*real = (uint64_t)mktime(&tm) * 1000000000ULL + (uint64_t)(sec * 1e9);
+		return 0;
+	}
+	return -1;
+}
+
+static void format_time(const struct tl_store *s, uint64_t ts, char *buf, size_t len)
+{
+	uint64_t real = tl_realtime(s, ts);
+	time_t sec = real / 1000000000ULL;
+	struct tm tm;
+	localtime_r(&sec, &tm);
+	snprintf(buf, len, "%02d:%02d:%02d.%06llu", tm.tm_hour, tm.tm_min, tm.tm_sec,
+		 (unsigned long long)(real % 1000000000ULL / 1000));
+}
+
+static void print_event(const struct tl_store *s, const struct tl_event *e)
+{
+	char ts[32];
+
+	format_time(s, e->ts, ts, sizeof(ts));
+	printf("%-15s  %-6d  %-6d  ", ts, e->tgid, e->pid);
+	switch (e->kind) {
+	case TL_ONCPU:
+		printf("%-10s  %-15s\n", "CPU", "onCPU");
+		break;
+	case TL_OFFCPU:
+		printf("%-10s  %-15s  kstack:0x%llx\n", "CPU", "offCPU", (unsigned long long)e->arg0);
+		break;
+	case TL_SYSCALL:
+		printf("%-10s  %-15s  count:%llu last:%u avg_delay:%lluns\n", "SYSCALL", "sequence",
+		       (unsigned long long)e->arg0, e->sub,
+		       (unsigned long long)(e->arg0 ? e->arg1 / e->arg0 : 0));
+		break;
+	case TL_LOCK:
+		printf("%-10s  %-15s  lock:0x%llx ret:%d\n", "USERLOCK", NAME(lock_status, e->sub),
+		       (unsigned long long)e->arg0, (int)e->arg1);
+		break;
+	case TL_MFUTEX:
+		printf("%-10s  %-15s  lock:0x%llx peer:%d\n", "MFUTEX", NAME(mfutex_kind, e->sub),
+		       (unsigned long long)e->arg0, (int)e->arg1);
+		break;
+	case TL_KEYTIME:
+		printf("%-10s  %-15s  %llu\n", "KEYTIME", NAME(keytime_type, e->sub),
+		       (unsigned long long)e->arg0);
+		break;
+	case TL_SCHEDULE:
+		printf("%-10s  %-15s  prio:%u avg_delay:%.3lfms max_delay:%.3lfms\n", "SCHEDULE", "sample",
+		       e->sub, e->arg0 / 1e6, e->arg1 / 1e6);
+		break;
+	case TL_RESOURCE:
+		printf("%-10s  %-15s  cpu:%u cpu_time:%.3lfms memused:%llu pages\n", "RESOURCE", "sample",
+		       e->sub, e->arg0 / 1e6, (unsigned long long)e->arg1);
+		break;
+	default:
+		printf("%-10s  %u\n", "UNKNOWN", e->kind);
+		break;
+	}
+}
+
+/* 由上下CPU事件还原[t1,t2]内的运行/阻塞时间，并统计各类事件 */
+static void print_summary(const struct tl_event *ev, size_t n, uint64_t t1, uint64_t t2)
+{
+	uint64_t on = 0, off = 0, last = t1, syscalls = 0, sc_delay = 0;
+	uint64_t counts[TL_KIND_MAX] = {};
+	int state = 0;		// 1表示在CPU上，-1表示不在，0表示未知
+
+	for (size_t i = 0; i < n; i++) {
+		const struct tl_event *e = &ev[i];
+		if (e->kind < TL_KIND_MAX)
+			counts[e->kind]++;
+		if (e->kind == TL_SYSCALL) {
+			syscalls += e->arg0;
+			sc_delay += e->arg1;
+		}
+		// 多个线程的上下CPU事件交织在一起时无法还原单个线程的状态
+		if ((e->kind != TL_ONCPU && e->kind != TL_OFFCPU) || env.pid == -1)
+			continue;
+		// 区间开始时的状态由第一个上下CPU事件反推
+		if (!state)
+			state = e->kind == TL_OFFCPU ? 1 : -1;
+		if (state == 1 && e->kind == TL_OFFCPU)
+			on += e->ts - last;
+		else if (state == -1 && e->kind == TL_ONCPU)
+			off += e->ts - last;
+		state = e->kind == TL_ONCPU ? 1 : -1;
+		last = e->ts;
+	}
+	if (state == 1)
+		on += t2 - last;
+	else if (state == -1)
+		off += t2 - last;
+
+	printf("SUMMARY ------------------------------------------------------------------\n");
+	printf("window: %.3lfms  events: %zu\n", (t2 - t1) / 1e6, n);
+	if (state)
+		printf("on-CPU: %.3lfms  off-CPU: %.3lfms  switches: %llu\n", on / 1e6, off / 1e6,
+		       (unsigned long long)(counts[TL_ONCPU] + counts[TL_OFFCPU]));
+	if (counts[TL_SYSCALL])
+		printf("syscalls: %llu in %llu sequences, total delay %.3lfms\n",
+		       (unsigned long long)syscalls, (unsigned long long)counts[TL_SYSCALL], sc_delay / 1e6);
+	if (counts[TL_LOCK] || counts[TL_MFUTEX])
+		printf("lock events: %llu  mfutex events: %llu\n",
+		       (unsigned long long)counts[TL_LOCK], (unsigned long long)counts[TL_MFUTEX]);
+	if (counts[TL_KEYTIME])
+		printf("keytime events: %llu\n", (unsigned long long)counts[TL_KEYTIME]);
+	if (counts[TL_SCHEDULE] || counts[TL_RESOURCE])
+		printf("schedule samples: %llu  resource samples: %llu\n",
+		       (unsigned long long)counts[TL_SCHEDULE], (unsigned long long)counts[TL_RESOURCE]);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct argp argp = {
+		.options = opts,
+		.parser = parse_arg,
+		.doc = argp_program_doc,
+	};
+	struct tl_store s;
+	struct tl_event *ev;
+	uint64_t t1, t2, real, start, cost;
+	size_t n;
+	int err;
+
+	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (err)
+		return err;
+	if (env.pid == -1 && env.tgid == -1) {
+		fprintf(stderr, "Please specify a thread with -p or a process with -P\n");
+		return 1;
+	}
+
+	err = tl_attach(&s, env.file);
+	if (err) {
+		fprintf(stderr, "Failed to open timeline store %s: %s\n", env.file, strerror(-err));
+		return 1;
+	}
+
+	// 默认查询整个环，区间的上界不超过当前时刻
+	t1 = 0;
+	t2 = clock_ns(CLOCK_MONOTONIC);
+	if (env.begin) {
+		if (parse_time(env.begin, &real)) {
+			fprintf(stderr, "Invalid time: %s\n", env.begin);
+			err = 1;
+			goto cleanup;
+		}
+		t1 = tl_monotonic(&s, real);
+	}
+	if (env.end) {
+		if (parse_time(env.end, &real)) {
+			fprintf(stderr, "Invalid time: %s\n", env.end);
+			err = 1;
+			goto cleanup;
+		}
+		if (tl_monotonic(&s, real) < t2)
+			t2 = tl_monotonic(&s, real);
+	}
+
+	start = clock_ns(CLOCK_MONOTONIC);
+	err = tl_query(&s, env.pid, env.tgid, t1, t2, &ev, &n);
+	cost = clock_ns(CLOCK_MONOTONIC) - start;
+	if (err) {
+		fprintf(stderr, "Failed to query timeline: %s\n", strerror(-err));
+		goto cleanup;
+	}
+
+	if (!env.summary) {
+		printf("%-15s  %-6s  %-6s  %-10s  %-15s  %s\n", "TIME", "TGID", "PID", "IMAGE", "EVENT", "DETAILS");
+		for (size_t i = 0; i < n; i++)
+			print_event(&s, &ev[i]);
+	}
+	if (!t1)
+		t1 = n ? ev[0].ts : t2;
+	print_summary(ev, n, t1, t2);
+	fprintf(stderr, "query took %.3lfus\n", cost / 1e3);
+	free(ev);
+
+cleanup:
+	tl_close(&s);
+	return err < 0 ? -err : err;
+}
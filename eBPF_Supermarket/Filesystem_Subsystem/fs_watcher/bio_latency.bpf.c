@@ -0,0 +1,187 @@
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+#include "bio_latency.h"
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
+
+#define REQ_OP_MASK	((1 << 8) - 1)
+#define MKDEV(ma, mi)	((ma) << 20 | (mi))
+
+struct rq_start {
+    u64 ts;
+    u64 cgroup;
+    u32 dev;
+    u16 op;
+    u16 qd;     // 下发时该设备上未完成的请求数（含本请求）
+};
+
+// 已下发未完成的请求，键为 struct request 指针。完成事件丢失时遗留的表项由 LRU 淘汰
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, BIO_MAX_INFLIGHT);
+    __type(key, u64);
+    __type(value, struct rq_start);
+} start SEC(".maps");
+
+// 各设备上未完成的请求数，下发时采样作为队列深度
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, BIO_MAX_DEVS);
+    __type(key, u32);
+    __type(value, u64);
+} inflight SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, BIO_MAX_KEYS);
+    __type(key, struct bio_key);
+    __type(value, struct bio_hist);
+} bio_hists SEC(".maps");
+
+// 新表项的初始值，bio_hist 太大，不能放在栈上
+static struct bio_hist zero_hist;
+
+// 5.11 之前 block_rq_issue/block_rq_requeue 的第一个参数是 struct request_queue *，
+// 请求在第二个参数。由用户态根据内核 BTF 在加载前设置
+const volatile bool targ_single_arg = true;
+
+// 5.16 之前 gendisk 在 request 中
+struct request___old {
+    struct gendisk *rq_disk;
+} __attribute__((preserve_access_index));
+
+static __always_inline u32 log2_u32(u32 v) {
+    u32 r, shift;
+
+    r = (v > 0xFFFF) << 4; v >>= r;
+    shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+    shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+    shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+    r |= (v >> 1);
+    return r;
+}
+
+static __always_inline u32 log2_slot(u64 v, u32 nr_slots) {
+    u32 hi = v >> 32, slot;
+
+    slot = hi ? log2_u32(hi) + 32 : log2_u32(v);
+    return slot < nr_slots ? slot : nr_slots - 1;
+}
+
+static __always_inline u32 rq_dev(struct request *rq) {
+    struct request___old *old = (void *)rq;
+    struct gendisk *disk;
+
+    if (bpf_core_field_exists(old->rq_disk))
+        disk = BPF_CORE_READ(old, rq_disk);
+    else
+        disk = BPF_CORE_READ(rq, q, disk);
+    if (!disk)
+        return 0;
+    return MKDEV(BPF_CORE_READ(disk, major), BPF_CORE_READ(disk, first_minor));
+}
+
+static __always_inline void inflight_dec(u32 dev) {
+    u64 *cnt = bpf_map_lookup_elem(&inflight, &dev);
+
+    if (cnt)
+        __sync_fetch_and_add(cnt, -1);
+}
+
+static __always_inline int trace_rq_issue(struct request *rq) {
+    struct rq_start s = {}, *sp;
+    u64 key = (u64)rq, zero = 0, *cnt;
+    u32 op;
+
+    s.ts = bpf_ktime_get_ns();
+    // 同一个请求再次下发（没有经过 requeue）时只更新时间
+    sp = bpf_map_lookup_elem(&start, &key);
+    if (sp) {
+        sp->ts = s.ts;
+        return 0;
+    }
+
+    s.dev = rq_dev(rq);
+    op = BPF_CORE_READ(rq, cmd_flags) & REQ_OP_MASK;
+    s.op = op == REQ_OP_READ ? BIO_OP_READ : op == REQ_OP_WRITE ? BIO_OP_WRITE : BIO_OP_OTHER;
+    // 按发起 I/O 的 blkcg 归属，回写等由内核线程下发的请求也能算到原来的 cgroup；
+    // 未开启 CONFIG_BLK_CGROUP 的内核没有 bi_blkg，cgroup 记为 0
+    if (bpf_core_field_exists(rq->bio->bi_blkg))
+        s.cgroup = BPF_CORE_READ(rq, bio, bi_blkg, blkcg, css.cgroup, kn, id);
+
+    cnt = bpf_map_lookup_elem(&inflight, &s.dev);
+    if (!cnt) {
+        bpf_map_update_elem(&inflight, &s.dev, &zero, BPF_NOEXIST);
+        cnt = bpf_map_lookup_elem(&inflight, &s.dev);
+        if (!cnt)
+            return 0;
+    }
+    s.qd = __sync_fetch_and_add(cnt, 1) + 1;
+    if (bpf_map_update_elem(&start, &key, &s, BPF_NOEXIST))
+        __sync_fetch_and_add(cnt, -1);
+    return 0;
+}
+
+SEC("tp_btf/block_rq_issue")
+int bio_issue(u64 *ctx) {
+    if (targ_single_arg)
+        return trace_rq_issue((void *)ctx[0]);
+    return trace_rq_issue((void *)ctx[1]);
+}
+
+SEC("tp_btf/block_rq_complete")
+int BPF_PROG(bio_complete, struct request *rq, int error, unsigned int nr_bytes) {
+    u64 key = (u64)rq, delta;
+    struct rq_start *s;
+    struct bio_hist *h;
+    struct bio_key hk = {};
+    u32 qd;
+
+    s = bpf_map_lookup_elem(&start, &key);
+    if (!s)
+        return 0;   // 开始跟踪之前下发的请求
+    delta = (bpf_ktime_get_ns() - s->ts) / 1000;
+    hk.dev = s->dev;
+    hk.op = s->op;
+    hk.cgroup = s->cgroup;
+    qd = s->qd;
+    inflight_dec(s->dev);
+    bpf_map_delete_elem(&start, &key);
+
+    h = bpf_map_lookup_elem(&bio_hists, &hk);
+    if (!h) {
+        bpf_map_update_elem(&bio_hists, &hk, &zero_hist, BPF_NOEXIST);
+        h = bpf_map_lookup_elem(&bio_hists, &hk);
+        if (!h)
+            return 0;
+    }
+    h->count++;
+    h->bytes += nr_bytes;
+    h->lat_sum += delta;
+    h->lat[log2_slot(delta, BIO_LAT_SLOTS)]++;
+    h->size[log2_slot(nr_bytes >> 9, BIO_SIZE_SLOTS)]++;
+    h->qd[log2_slot(qd, BIO_QD_SLOTS)]++;
+    return 0;
+}
+
+// 重新排队的请求之后会再次下发，先不计入设备上的未完成请求
+static __always_inline int trace_rq_requeue(struct request *rq) {
+    u64 key = (u64)rq;
+    struct rq_start *s;
+
+    s = bpf_map_lookup_elem(&start, &key);
+    if (!s)
+        return 0;
+    inflight_dec(s->dev);
+    bpf_map_delete_elem(&start, &key);
+    return 0;
+}
+
+SEC("tp_btf/block_rq_requeue")
+int bio_requeue(u64 *ctx) {
+    if (targ_single_arg)
+        return trace_rq_requeue((void *)ctx[0]);
+    return trace_rq_requeue((void *)ctx[1]);
+}
@@ -0,0 +1,38 @@
+#ifndef __BIO_LATENCY_H
+#define __BIO_LATENCY_H
+
+/* 块设备请求从下发到完成的延迟。
+ * 下发时以请求指针为键记录时间戳、设备和 cgroup，完成时按 (设备, 操作, cgroup)
+ * 在 per-CPU 表中累加 log2 延迟、请求大小和下发时队列深度的直方图，不输出逐个请求的事件。
+ */
+
+#define BIO_MAX_INFLIGHT	10240
+#define BIO_MAX_KEYS		1024
+#define BIO_MAX_DEVS		256
+#define BIO_LAT_SLOTS		27	// 微秒，最后一档为 2^26us（约67秒）以上
+#define BIO_SIZE_SLOTS		16	// 以 512 字节为单位，最后一档为 16MB 以上
+#define BIO_QD_SLOTS		10	// 最后一档为 512 以上
+
+enum bio_op {
+	BIO_OP_READ,
+	BIO_OP_WRITE,
+	BIO_OP_OTHER,		// flush、discard 等
+	BIO_OP_MAX,
+};
+
+struct bio_key {
+	__u32 dev;
+	__u32 op;
+	__u64 cgroup;		// cgroup v2 的 id，没有 blkcg 信息时为0
+};
+
+struct bio_hist {
+	__u64 count;
+	__u64 bytes;
+	__u64 lat_sum;		// 微秒
+	__u64 lat[BIO_LAT_SLOTS];
+	__u64 size[BIO_SIZE_SLOTS];
+	__u64 qd[BIO_QD_SLOTS];
+};
+
+#endif /* __BIO_LATENCY_H */
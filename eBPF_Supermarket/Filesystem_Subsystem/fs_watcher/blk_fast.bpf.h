@@ -0,0 +1,32 @@
+#ifndef __BLK_FAST_BPF_H
+#define __BLK_FAST_BPF_H
+
+#include "fs_fast.h"
+
+/* 块设备快速模式（-F）的统计表，block_rq_issue 和 disk_io_visit 共用 */
+
+// 按块设备在各CPU上累加请求数和扇区数
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, FS_FAST_MAX_DEVS);
+	__type(key, u32);
+	__type(value, struct fs_blk_stat);
+} blk_stats SEC(".maps");
+
+static __always_inline void blk_account(u32 dev, u32 nr_sector, char rw)
+{
+	struct fs_blk_stat zero = {}, *st;
+	int dir = rw == 'R';
+
+	st = bpf_map_lookup_elem(&blk_stats, &dev);
+	if (!st) {
+		bpf_map_update_elem(&blk_stats, &dev, &zero, BPF_NOEXIST);
+		st = bpf_map_lookup_elem(&blk_stats, &dev);
+		if (!st)
+			return;
+	}
+	st->ops[dir]++;
+	st->sectors[dir] += nr_sector;
+}
+
+#endif /* __BLK_FAST_BPF_H */
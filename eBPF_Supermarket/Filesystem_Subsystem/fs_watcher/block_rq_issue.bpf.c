@@ -3,6 +3,7 @@
 #include <bpf/bpf_tracing.h>
 #include <bpf/bpf_core_read.h>
 #include "block_rq_issue.h"
+#include "blk_fast.bpf.h"
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
@@ -39,9 +40,6 @@ int tracepoint_block_rq_issue(struct trace_event_raw_block_rq_completion *ctx) {
     e->sector = ctx->sector;  
     e->nr_sectors = ctx->nr_sector;  
 
-    // 日志输出调试信息
-    bpf_printk("PID: %u, Sector: %d, nr_sectors: %d\n", pid, ctx->sector, ctx->nr_sector);
-
     // 查找或初始化该进程的 I/O 总大小
     size = bpf_map_lookup_elem(&io_size_map, &pid);
     if (size) {
@@ -59,11 +57,15 @@ int tracepoint_block_rq_issue(struct trace_event_raw_block_rq_completion *ctx) {
 
     e->total_io = total_size;
 
-    // 日志输出当前总 I/O 大小
-    bpf_printk("Updated Total I/O for PID %u: %llu\n", pid, total_size);
-
     // 提交事件
     bpf_ringbuf_submit(e, 0);
 
     return 0;
 }
+
+// 快速模式（fs_watcher -F 时才加载）：不输出事件，只按设备统计下发的请求
+SEC("?tracepoint/block/block_rq_issue")
+int tracepoint_block_rq_issue_fast(struct trace_event_raw_block_rq *ctx) {
+    blk_account(ctx->dev, ctx->nr_sector, ctx->rwbs[0]);
+    return 0;
+}
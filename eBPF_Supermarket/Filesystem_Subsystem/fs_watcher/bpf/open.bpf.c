@@ -3,6 +3,7 @@
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_tracing.h>
 #include <bpf/bpf_core_read.h>
+#include "fs_fast.bpf.h"
 
 #define TASK_COMM_LEN 100
 #define path_size 256
@@ -41,30 +42,23 @@ int do_syscall_trace(struct trace_event_raw_sys_enter *ctx)
 	struct task_struct *task = (struct task_struct *)bpf_get_current_task(),
 			   *real_parent;
 	if (task == NULL) {
-		bpf_printk("task\n");
 		bpf_ringbuf_discard(e, 0);
 		return 0;
 	}
-	int pid = bpf_get_current_pid_tgid() >> 32, tgid;
+	int pid = bpf_get_current_pid_tgid() >> 32;
 
     bpf_map_update_elem(&data, &pid, &comm, BPF_ANY);
 
-	int ppid = BPF_CORE_READ(task, real_parent, tgid);
-
 	bpf_probe_read_str(e->path_name_, sizeof(e->path_name_),
 			   (void *)(ctx->args[1]));
 
-	bpf_printk("path name: %s,pid:%d,ppid:%d\n", e->path_name_, pid, ppid);
-
 	struct fdtable *fdt = BPF_CORE_READ(task, files, fdt);
 	if (fdt == NULL) {
-		bpf_printk("fdt\n");
 		bpf_ringbuf_discard(e, 0);
 		return 0;
 	}
 
-	unsigned int i = 0, count = 0, n = BPF_CORE_READ(fdt, max_fds);
-	bpf_printk("n:%d\n", n);
+	unsigned int n = BPF_CORE_READ(fdt, max_fds);
 
 	e->n_ = n;
 	e->pid_ = pid;
@@ -74,4 +68,14 @@ int do_syscall_trace(struct trace_event_raw_sys_enter *ctx)
 	return 0;
 }
 
+// 快速模式（fs_watcher -F 时才加载）：不复制路径，按 (pid, inode) 统计打开次数。vfs_open 覆盖 open/openat/openat2
+SEC("?fexit/vfs_open")
+int BPF_PROG(fexit_open_fast, const struct path *path, struct file *file, int ret)
+{
+	if (ret)
+		return 0;
+	fs_fast_account(BPF_CORE_READ(path, dentry), 0);
+	return 0;
+}
+
 char LICENSE[] SEC("license") = "GPL";
\ No newline at end of file
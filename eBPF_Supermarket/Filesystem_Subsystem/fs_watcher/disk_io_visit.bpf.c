@@ -3,6 +3,7 @@
 #include <bpf/bpf_tracing.h>
 #include <bpf/bpf_core_read.h>
 #include "disk_io_visit.h"
+#include "blk_fast.bpf.h"
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
@@ -62,10 +63,16 @@ int tracepoint_block_visit(struct trace_event_raw_block_rq_completion *ctx) {
 
     // 复制进程名
     __builtin_memcpy(e->comm, comm, sizeof(comm));
-    bpf_printk("comm : %s\n",e->comm);
 
     // 提交事件
     bpf_ringbuf_submit(e, 0);
 
     return 0;
 }
+
+// 快速模式（fs_watcher -F 时才加载）：完成时可能处于中断上下文，当前进程名没有意义，只按设备统计
+SEC("?tracepoint/block/block_rq_complete")
+int tracepoint_block_visit_fast(struct trace_event_raw_block_rq_completion *ctx) {
+    blk_account(ctx->dev, ctx->nr_sector, ctx->rwbs[0]);
+    return 0;
+}
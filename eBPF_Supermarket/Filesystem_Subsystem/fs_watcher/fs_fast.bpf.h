@@ -0,0 +1,61 @@
+#ifndef __FS_FAST_BPF_H
+#define __FS_FAST_BPF_H
+
+#include "fs_fast.h"
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+	__uint(max_entries, FS_FAST_MAX_FILES);
+	__type(key, struct fs_file_key);
+	__type(value, struct fs_file_stat);
+} file_stats SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, FS_FAST_MAX_FILES);
+	__type(key, struct fs_inode_key);
+	__type(value, struct fs_name);
+} name_cache SEC(".maps");
+
+/* 缓存中已有该 inode 时只是一次查找，没有时才复制文件名 */
+static __always_inline void fs_fast_cache_name(struct dentry *dentry, struct fs_inode_key *ik)
+{
+	struct fs_name name;
+
+	if (bpf_map_lookup_elem(&name_cache, ik))
+		return;
+	if (bpf_probe_read_kernel_str(name.name, sizeof(name.name),
+				      BPF_CORE_READ(dentry, d_name.name)) < 0)
+		return;
+	bpf_map_update_elem(&name_cache, ik, &name, BPF_NOEXIST);
+}
+
+/* 在本CPU上累加当前进程对 dentry 对应文件的一次操作 */
+static __always_inline void fs_fast_account(struct dentry *dentry, __u64 bytes)
+{
+	struct fs_file_key key = {};
+	struct fs_file_stat zero = {}, *st;
+	struct inode *inode = BPF_CORE_READ(dentry, d_inode);
+
+	if (!inode)
+		return;
+	key.pid = bpf_get_current_pid_tgid() >> 32;
+	key.dev = BPF_CORE_READ(inode, i_sb, s_dev);
+	key.ino = BPF_CORE_READ(inode, i_ino);
+
+	st = bpf_map_lookup_elem(&file_stats, &key);
+	if (!st) {
+		// 本CPU上第一次见到这个 (pid, inode)，顺便确认文件名已缓存
+		struct fs_inode_key ik = { .dev = key.dev, .ino = key.ino };
+
+		fs_fast_cache_name(dentry, &ik);
+		bpf_map_update_elem(&file_stats, &key, &zero, BPF_NOEXIST);
+		st = bpf_map_lookup_elem(&file_stats, &key);
+		if (!st)
+			return;
+	}
+	st->ops++;
+	st->bytes += bytes;
+}
+
+#endif /* __FS_FAST_BPF_H */
@@ -0,0 +1,40 @@
+#ifndef __FS_FAST_H
+#define __FS_FAST_H
+
+/* 快速模式（-F）内核与用户态共享的结构。
+ * 热路径上只用 (dev, inode) 标识文件，在 per-CPU 表中累加次数和字节数，不输出逐次事件；
+ * 文件名只在某个 inode 第一次出现时复制一次，存入按 inode 索引的缓存，由用户态打印时查询。
+ */
+
+#define FS_FAST_MAX_FILES	10240
+#define FS_FAST_MAX_DEVS	256
+#define FS_NAME_LEN		64	// 更长的文件名被截断
+
+struct fs_inode_key {
+	__u32 dev;
+	__u32 pad;
+	__u64 ino;
+};
+
+struct fs_file_key {
+	__u32 pid;
+	__u32 dev;
+	__u64 ino;
+};
+
+struct fs_file_stat {
+	__u64 ops;
+	__u64 bytes;
+};
+
+struct fs_name {
+	char name[FS_NAME_LEN];
+};
+
+/* 按块设备统计，下标 0 为写，1 为读，与 rwbs 的约定相同 */
+struct fs_blk_stat {
+	__u64 ops[2];
+	__u64 sectors[2];
+};
+
+#endif /* __FS_FAST_H */
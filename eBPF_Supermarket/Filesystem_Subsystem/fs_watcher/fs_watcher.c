@@ -9,6 +9,7 @@
 #include <sys/resource.h>
 #include <bpf/libbpf.h>
 #include <bpf/bpf.h>
+#include <bpf/btf.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <inttypes.h>
@@ -20,7 +21,10 @@
 #include "write.skel.h"
 #include "disk_io_visit.skel.h"
 #include "block_rq_issue.skel.h"
+#include "bio_latency.skel.h"
 #include "fs_watcher.h"
+#include "fs_fast.h"
+#include "bio_latency.h"
 
 const char argp_program_doc[] = "fs_watcher is used to monitor various system calls and disk I/O events.\n\n"
            "Usage: fs_watcher [OPTION...]\n\n"
@@ -97,18 +101,43 @@ const char argp_program_doc[] = "fs_watcher is used to monitor various system ca
         }                                            \
     } while(0)
 
+/* 快速模式：加载 SEC("?...") 的程序代替逐次输出事件的程序，每秒取出并清空统计表 */
+#define LOAD_AND_ATTACH_FAST(skel, event, slow, fast) \
+    do {                                             \
+        bpf_program__set_autoload(skel->progs.slow, false); \
+        bpf_program__set_autoload(skel->progs.fast, true);  \
+        err = event##_bpf__load(skel);               \
+        if (err) {                                   \
+            fprintf(stderr, "Failed to load and verify BPF skeleton\n"); \
+            goto event##_fast_cleanup;                \
+        }                                            \
+                                                     \
+        err = event##_bpf__attach(skel);             \
+        if (err) {                                   \
+            fprintf(stderr, "Failed to attach BPF skeleton\n"); \
+            goto event##_fast_cleanup;                \
+        }                                            \
+    } while(0)
+
+#define FAST_TOP_N 20
+#define DRAIN_BATCH 256
+
 static struct env{
     bool open;
     bool read;
     bool write;
     bool disk_io_visit;
     bool block_rq_issue;
+    bool bio_latency;
+    bool fast;
 }env = {
     .open = false,
     .read = false,
     .write = false,
     .disk_io_visit = false,
     .block_rq_issue = false,
+    .bio_latency = false,
+    .fast = false,
 };
 
 static const struct argp_option opts[] = {
@@ -117,6 +146,8 @@ static const struct argp_option opts[] = {
     {"write", 'w', 0, 0, "Print write system call report"},
     {"disk_io_visit", 'd', 0, 0, "Print disk I/O visit report"},
     {"block_rq_issue", 'b', 0, 0, "Print block I/O request submission events. Reports when block I/O requests are submitted to device drivers."},
+    {"bio_latency", 'L', 0, 0, "Print block I/O latency, size and queue depth percentiles per device, operation and cgroup every second"},
+    {"fast", 'F', 0, 0, "Aggregate in the kernel instead of reporting every call: per pid and inode for open/read, per device for disk_io_visit/block_rq_issue"},
     {0} // 结束标记，用于指示选项列表的结束
 };
 
@@ -133,6 +164,10 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
         env.disk_io_visit = true;break;
         case 'b':
         env.block_rq_issue = true;break;
+        case 'L':
+        env.bio_latency = true;break;
+        case 'F':
+        env.fast = true;break;
         default: 
             return ARGP_ERR_UNKNOWN;
     }
@@ -171,6 +206,12 @@ static int process_read(struct read_bpf *skel_read);
 static int process_write(struct write_bpf *skel_write);
 static int process_disk_io_visit(struct disk_io_visit_bpf *skel_disk_io_visit);
 static int process_block_rq_issue(struct block_rq_issue_bpf *skel_block_rq_issue);
+static int process_bio_latency(struct bio_latency_bpf *skel_bio_latency);
+
+static int process_open_fast(struct open_bpf *skel_open);
+static int process_read_fast(struct read_bpf *skel_read);
+static int process_disk_io_visit_fast(struct disk_io_visit_bpf *skel_disk_io_visit);
+static int process_block_rq_issue_fast(struct block_rq_issue_bpf *skel_block_rq_issue);
 
 
 
@@ -182,6 +223,7 @@ int main(int argc,char **argv){
     struct write_bpf *skel_write;
     struct disk_io_visit_bpf *skel_disk_io_visit;
     struct block_rq_issue_bpf *skel_block_rq_issue;
+    struct bio_latency_bpf *skel_bio_latency;
 
 
     libbpf_set_strict_mode(LIBBPF_STRICT_ALL);
@@ -211,6 +253,8 @@ int main(int argc,char **argv){
         PROCESS_SKEL(skel_disk_io_visit,disk_io_visit);
     }else if(env.block_rq_issue){
         PROCESS_SKEL(skel_block_rq_issue,block_rq_issue);
+    }else if(env.bio_latency){
+        PROCESS_SKEL(skel_bio_latency,bio_latency);
     }else{
         fprintf(stderr, "No function selected. Use -h for help.\n");
         return 1;
@@ -301,6 +345,9 @@ static int handle_event_block_rq_issue(void *ctx, void *data,unsigned long data_
 static int process_open(struct open_bpf *skel_open){
     int err;
     struct ring_buffer *rb;
+
+    if (env.fast)
+        return process_open_fast(skel_open);
     
     LOAD_AND_ATTACH_SKELETON_MAP(skel_open,open);
 
@@ -317,6 +364,9 @@ open_cleanup:
 static int process_read(struct read_bpf *skel_read){
     int err;
     struct ring_buffer *rb;
+
+    if (env.fast)
+        return process_read_fast(skel_read);
     
     LOAD_AND_ATTACH_SKELETON(skel_read,read);
 
@@ -349,6 +399,9 @@ write_cleanup:
 static int process_disk_io_visit(struct disk_io_visit_bpf *skel_disk_io_visit){
     int err;
     struct ring_buffer *rb;
+
+    if (env.fast)
+        return process_disk_io_visit_fast(skel_disk_io_visit);
      
     LOAD_AND_ATTACH_SKELETON(skel_disk_io_visit,disk_io_visit);
     printf("%-18s %-7s %-7s %-4s %-7s %-16s\n","TIME", "DEV", "SECTOR", "RWBS", "COUNT", "COMM");
@@ -365,6 +418,9 @@ disk_io_visit_cleanup:
 static int process_block_rq_issue(struct block_rq_issue_bpf *skel_block_rq_issue){
     int err;
     struct ring_buffer *rb;
+
+    if (env.fast)
+        return process_block_rq_issue_fast(skel_block_rq_issue);
      
     LOAD_AND_ATTACH_SKELETON(skel_block_rq_issue,block_rq_issue);
     printf("%-18s %-7s %-7s %-4s %-16s %-5sn","TIME", "DEV", "SECTOR", "SECTORS","COMM","Total_Size");
@@ -376,4 +432,416 @@ block_rq_issue_cleanup:
 
     return err;
 
-}
\ No newline at end of file
+}
+
+/* 取出并清空 per-CPU 哈希表，各CPU的值求和后交给 fn，值的成员都是 __u64。
+ * 优先批量取出并删除，内核不支持时逐个取出。返回取出的表项数
+ */
+static int drain_percpu_hash(int fd, __u32 key_size, __u32 value_size,
+                             void (*fn)(const void *key, const __u64 *sum, void *ctx), void *ctx)
+{
+    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts);
+    int nr_cpus = libbpf_num_possible_cpus();
+    __u32 words = value_size / sizeof(__u64), count;
+    char *keys = malloc(DRAIN_BATCH * key_size);
+    __u64 *values = malloc((size_t)DRAIN_BATCH * nr_cpus * value_size);
+    __u64 *sum = malloc(value_size);
+    __u64 batch;
+    void *in = NULL;
+    int err, n = 0;
+
+    if (nr_cpus < 0 || !keys || !values || !sum) {
+        n = -ENOMEM;
+        goto out;
+    }
+
+    for (;;) {
+        count = DRAIN_BATCH;
+        err = bpf_map_lookup_and_delete_batch(fd, in, &batch, keys, values, &count, &opts);
+        if (err && errno != ENOENT)
+            break;
+        for (__u32 i = 0; i < count; i++) {
+            __u64 *v = values + (size_t)i * nr_cpus * words;
+
+            memset(sum, 0, value_size);
+            for (int cpu = 0; cpu < nr_cpus; cpu++, v += words)
+                for (__u32 w = 0; w < words; w++)
+                    sum[w] += v[w];
+            fn(keys + i * key_size, sum, ctx);
+            n++;
+        }
+        if (err)
+            goto out;   // ENOENT：已取空
+        in = &batch;
+    }
+
+    // 不支持批量操作（或一个桶中的表项超过 DRAIN_BATCH）时，逐个取出剩余的表项
+    while (!bpf_map_get_next_key(fd, NULL, keys)) {
+        if (!bpf_map_lookup_elem(fd, keys, values)) {
+            __u64 *v = values;
+
+            memset(sum, 0, value_size);
+            for (int cpu = 0; cpu < nr_cpus; cpu++, v += words)
+                for (__u32 w = 0; w < words; w++)
+                    sum[w] += v[w];
+            fn(keys, sum, ctx);
+            n++;
+        }
+        if (bpf_map_delete_elem(fd, keys))
+            break;
+    }
+out:
+    free(keys);
+    free(values);
+    free(sum);
+    return n;
+}
+
+struct file_row {
+    struct fs_file_key key;
+    struct fs_file_stat st;
+};
+
+struct file_rows {
+    struct file_row *rows;
+    int nr, cap;
+};
+
+static void collect_file(const void *key, const __u64 *sum, void *ctx)
+{
+    struct file_rows *r = ctx;
+
+    if (r->nr == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 256;
+        struct file_row *rows = realloc(r->rows, cap * sizeof(*rows));
+
+        if (!rows)
+            return;
+        r->rows = rows;
+        r->cap = cap;
+    }
+    memcpy(&r->rows[r->nr].key, key, sizeof(struct fs_file_key));
+    memcpy(&r->rows[r->nr].st, sum, sizeof(struct fs_file_stat));
+    r->nr++;
+}
+
+static int cmp_file_bytes(const void *a, const void *b)
+{
+    const struct file_row *x = a, *y = b;
+
+    if (x->st.bytes != y->st.bytes)
+        return x->st.bytes < y->st.bytes ? 1 : -1;
+    return x->st.ops < y->st.ops ? 1 : x->st.ops > y->st.ops ? -1 : 0;
+}
+
+static int cmp_file_ops(const void *a, const void *b)
+{
+    const struct file_row *x = a, *y = b;
+
+    return x->st.ops < y->st.ops ? 1 : x->st.ops > y->st.ops ? -1 : 0;
+}
+
+/* 输出上一秒内按 (pid, inode) 聚合的结果，只在这里按 inode 查询文件名缓存 */
+static void print_file_stats(int stats_fd, int names_fd, bool by_bytes)
+{
+    struct file_rows r = { 0 };
+    __u64 ops = 0, bytes = 0;
+    struct tm *tm;
+    char ts[32];
+    time_t t;
+
+    if (drain_percpu_hash(stats_fd, sizeof(struct fs_file_key), sizeof(struct fs_file_stat),
+                          collect_file, &r) < 0) {
+        fprintf(stderr, "Failed to drain file stats\n");
+        return;
+    }
+    time(&t);
+    tm = localtime(&t);
+    strftime(ts, sizeof(ts), "%H:%M:%S", tm);
+
+    qsort(r.rows, r.nr, sizeof(*r.rows), by_bytes ? cmp_file_bytes : cmp_file_ops);
+    for (int i = 0; i < r.nr; i++) {
+        ops += r.rows[i].st.ops;
+        bytes += r.rows[i].st.bytes;
+    }
+    printf("%-8s  %d files, %llu ops, %llu bytes\n", ts, r.nr, ops, bytes);
+    for (int i = 0; i < r.nr && i < FAST_TOP_N; i++) {
+        struct file_row *f = &r.rows[i];
+        struct fs_inode_key ik = { .dev = f->key.dev, .ino = f->key.ino };
+        struct fs_name name;
+
+        if (bpf_map_lookup_elem(names_fd, &ik, &name))
+            snprintf(name.name, sizeof(name.name), "[inode %llu]", f->key.ino);
+        printf("%-8s  %-7u %4u:%-4u %-12llu %10llu %14llu  %s\n", "", f->key.pid,
+               f->key.dev >> 20, f->key.dev & 0xfffff, f->key.ino,
+               f->st.ops, f->st.bytes, name.name);
+    }
+    free(r.rows);
+}
+
+static void print_blk_row(const void *key, const __u64 *sum, void *ctx)
+{
+    const struct fs_blk_stat *st = (const struct fs_blk_stat *)sum;
+    __u32 dev = *(const __u32 *)key;
+
+    printf("%-8s  %4u:%-4u %10llu %12llu %10llu %12llu\n", (char *)ctx,
+           dev >> 20, dev & 0xfffff, st->ops[1], st->sectors[1] * 512 / 1024,
+           st->ops[0], st->sectors[0] * 512 / 1024);
+}
+
+/* 输出上一秒内各块设备的请求数和数据量 */
+static void print_blk_stats(int stats_fd)
+{
+    struct tm *tm;
+    char ts[32];
+    time_t t;
+
+    time(&t);
+    tm = localtime(&t);
+    strftime(ts, sizeof(ts), "%H:%M:%S", tm);
+    if (drain_percpu_hash(stats_fd, sizeof(__u32), sizeof(struct fs_blk_stat),
+                          print_blk_row, ts) < 0)
+        fprintf(stderr, "Failed to drain block stats\n");
+}
+
+static int process_open_fast(struct open_bpf *skel_open){
+    int err;
+
+    LOAD_AND_ATTACH_FAST(skel_open, open, do_syscall_trace, fexit_open_fast);
+
+    printf("%-8s  %-7s %-9s %-12s %10s %14s  %s\n", "TIME", "PID", "DEV", "INODE", "OPENS", "", "FILE");
+    while (!exiting) {
+        sleep(1);
+        print_file_stats(bpf_map__fd(skel_open->maps.file_stats),
+                         bpf_map__fd(skel_open->maps.name_cache), false);
+    }
+
+open_fast_cleanup:
+    open_bpf__destroy(skel_open);
+    return err;
+}
+
+static int process_read_fast(struct read_bpf *skel_read){
+    int err;
+
+    LOAD_AND_ATTACH_FAST(skel_read, read, kprobe_enter_read, fexit_read_fast);
+
+    printf("%-8s  %-7s %-9s %-12s %10s %14s  %s\n", "TIME", "PID", "DEV", "INODE", "READS", "BYTES", "FILE");
+    while (!exiting) {
+        sleep(1);
+        print_file_stats(bpf_map__fd(skel_read->maps.file_stats),
+                         bpf_map__fd(skel_read->maps.name_cache), true);
+    }
+
+read_fast_cleanup:
+    read_bpf__destroy(skel_read);
+    return err;
+}
+
+static int process_disk_io_visit_fast(struct disk_io_visit_bpf *skel_disk_io_visit){
+    int err;
+
+    LOAD_AND_ATTACH_FAST(skel_disk_io_visit, disk_io_visit, tracepoint_block_visit,
+                         tracepoint_block_visit_fast);
+
+    printf("%-8s  %-9s %10s %12s %10s %12s\n", "TIME", "DEV", "READS", "READ_KB", "WRITES", "WRITE_KB");
+    while (!exiting) {
+        sleep(1);
+        print_blk_stats(bpf_map__fd(skel_disk_io_visit->maps.blk_stats));
+    }
+
+disk_io_visit_fast_cleanup:
+    disk_io_visit_bpf__destroy(skel_disk_io_visit);
+    return err;
+}
+
+static int process_block_rq_issue_fast(struct block_rq_issue_bpf *skel_block_rq_issue){
+    int err;
+
+    LOAD_AND_ATTACH_FAST(skel_block_rq_issue, block_rq_issue, tracepoint_block_rq_issue,
+                         tracepoint_block_rq_issue_fast);
+
+    printf("%-8s  %-9s %10s %12s %10s %12s\n", "TIME", "DEV", "READS", "READ_KB", "WRITES", "WRITE_KB");
+    while (!exiting) {
+        sleep(1);
+        print_blk_stats(bpf_map__fd(skel_block_rq_issue->maps.blk_stats));
+    }
+
+block_rq_issue_fast_cleanup:
+    block_rq_issue_bpf__destroy(skel_block_rq_issue);
+    return err;
+}
+
+struct bio_row {
+    struct bio_key key;
+    struct bio_hist h;
+};
+
+struct bio_rows {
+    struct bio_row *rows;
+    int nr, cap;
+};
+
+static void collect_bio(const void *key, const __u64 *sum, void *ctx)
+{
+    struct bio_rows *r = ctx;
+
+    if (r->nr == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 64;
+        struct bio_row *rows = realloc(r->rows, cap * sizeof(*rows));
+
+        if (!rows)
+            return;
+        r->rows = rows;
+        r->cap = cap;
+    }
+    memcpy(&r->rows[r->nr].key, key, sizeof(struct bio_key));
+    memcpy(&r->rows[r->nr].h, sum, sizeof(struct bio_hist));
+    r->nr++;
+}
+
+static int cmp_bio_key(const void *a, const void *b)
+{
+    const struct bio_key *x = a, *y = b;
+
+    if (x->dev != y->dev)
+        return x->dev < y->dev ? -1 : 1;
+    if (x->op != y->op)
+        return x->op < y->op ? -1 : 1;
+    return x->cgroup < y->cgroup ? -1 : x->cgroup > y->cgroup;
+}
+
+static void bio_hist_add(struct bio_hist *dst, const struct bio_hist *src)
+{
+    const __u64 *s = (const __u64 *)src;
+    __u64 *d = (__u64 *)dst;
+
+    for (size_t i = 0; i < sizeof(*dst) / sizeof(__u64); i++)
+        d[i] += s[i];
+}
+
+/* log2 直方图的近似分位数：第 i 档为 [2^i, 2^(i+1))（第0档含0），在档内线性插值 */
+static double log2_percentile(const __u64 *slots, int nr, __u64 total, double p)
+{
+    double target = p * total;
+    __u64 cum = 0;
+
+    for (int i = 0; i < nr; i++) {
+        if (!slots[i])
+            continue;
+        if (cum + slots[i] >= target) {
+            double lo = i ? (double)(1ULL << i) : 0, hi = (double)(1ULL << (i + 1));
+
+            return lo + (hi - lo) * (target - cum) / slots[i];
+        }
+        cum += slots[i];
+    }
+    return (double)(1ULL << nr);
+}
+
+static void print_bio_row(const char *ts, const char *dev, const char *op,
+                          const char *cg, const struct bio_hist *h)
+{
+    printf("%-8s  %-9s %-5s %-12s %8llu %10.0f %9.0f %9.0f %9.0f %6.0f %6.0f\n", ts, dev, op, cg,
+           h->count, h->bytes / 1024.0, (double)h->lat_sum / h->count,
+           log2_percentile(h->lat, BIO_LAT_SLOTS, h->count, 0.5),
+           log2_percentile(h->lat, BIO_LAT_SLOTS, h->count, 0.99),
+           log2_percentile(h->size, BIO_SIZE_SLOTS, h->count, 0.5) / 2,
+           log2_percentile(h->qd, BIO_QD_SLOTS, h->count, 0.5));
+}
+
+/* 每秒取出并清空直方图，先输出设备的合计，再按操作和 cgroup 分行 */
+static void print_bio_stats(int hists_fd)
+{
+    static const char *op_names[BIO_OP_MAX] = { "read", "write", "other" };
+    struct bio_rows r = { 0 };
+    struct bio_hist dev_total;
+    char ts[32], dev[16], cg[24];
+    struct tm *tm;
+    time_t t;
+    int i, j;
+
+    if (drain_percpu_hash(hists_fd, sizeof(struct bio_key), sizeof(struct bio_hist),
+                          collect_bio, &r) < 0) {
+        fprintf(stderr, "Failed to drain block I/O histograms\n");
+        return;
+    }
+    time(&t);
+    tm = localtime(&t);
+    strftime(ts, sizeof(ts), "%H:%M:%S", tm);
+
+    qsort(r.rows, r.nr, sizeof(*r.rows), cmp_bio_key);
+    for (i = 0; i < r.nr; i = j) {
+        memset(&dev_total, 0, sizeof(dev_total));
+        for (j = i; j < r.nr && r.rows[j].key.dev == r.rows[i].key.dev; j++)
+            bio_hist_add(&dev_total, &r.rows[j].h);
+        snprintf(dev, sizeof(dev), "%u:%u", r.rows[i].key.dev >> 20, r.rows[i].key.dev & 0xfffff);
+        print_bio_row(ts, dev, "all", "-", &dev_total);
+        for (int k = i; k < j; k++) {
+            struct bio_row *b = &r.rows[k];
+
+            if (b->key.cgroup)
+                snprintf(cg, sizeof(cg), "%llu", b->key.cgroup);
+            else
+                snprintf(cg, sizeof(cg), "-");
+            print_bio_row("", "", b->key.op < BIO_OP_MAX ? op_names[b->key.op] : "?", cg, &b->h);
+        }
+    }
+    free(r.rows);
+}
+
+/* 5.11 起 block_rq_issue/block_rq_requeue 去掉了 request_queue 参数。
+ * 按内核 BTF 中 btf_trace_block_rq_issue 的原型判断，第一个参数是 void *__data，
+ * 只有 struct request * 时原型共两个参数
+ */
+static bool block_rq_single_arg(void)
+{
+    const struct btf_type *t;
+    struct btf *btf;
+    bool ret = true;
+    int id;
+
+    btf = btf__load_vmlinux_btf();
+    if (!btf)
+        return ret;
+    id = btf__find_by_name_kind(btf, "btf_trace_block_rq_issue", BTF_KIND_TYPEDEF);
+    if (id > 0) {
+        t = btf__type_by_id(btf, id);
+        t = btf__type_by_id(btf, t->type);
+        if (btf_is_ptr(t)) {
+            t = btf__type_by_id(btf, t->type);
+            if (btf_is_func_proto(t))
+                ret = btf_vlen(t) == 2;
+        }
+    }
+    btf__free(btf);
+    return ret;
+}
+
+static int process_bio_latency(struct bio_latency_bpf *skel_bio_latency){
+    int err;
+
+    skel_bio_latency->rodata->targ_single_arg = block_rq_single_arg();
+    err = bio_latency_bpf__load(skel_bio_latency);
+    if (err) {
+        fprintf(stderr, "Failed to load and verify BPF skeleton\n");
+        goto bio_latency_cleanup;
+    }
+    err = bio_latency_bpf__attach(skel_bio_latency);
+    if (err) {
+        fprintf(stderr, "Failed to attach BPF skeleton\n");
+        goto bio_latency_cleanup;
+    }
+
+    // 延迟为下发到完成，不含在调度队列中等待的时间；SIZE 为请求大小的中位数
+    printf("%-8s  %-9s %-5s %-12s %8s %10s %9s %9s %9s %6s %6s\n", "TIME", "DEV", "OP", "CGROUP",
+           "IOS", "KB", "avg(us)", "p50(us)", "p99(us)", "SIZE_K", "QD");
+    while (!exiting) {
+        sleep(1);
+        print_bio_stats(bpf_map__fd(skel_bio_latency->maps.bio_hists));
+    }
+
+bio_latency_cleanup:
+    bio_latency_bpf__destroy(skel_bio_latency);
+    return err;
+}
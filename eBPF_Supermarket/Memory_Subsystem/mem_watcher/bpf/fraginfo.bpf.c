@@ -6,90 +6,78 @@
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
+/* 由用户态从 /proc/kallsyms 中解析，NUMA内核使用node_data[]，否则使用contig_page_data */
+const volatile u64 node_data_addr = 0;
+const volatile u64 contig_page_data_addr = 0;
+const volatile int nr_nodes = 1;
+
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
-	__uint(max_entries, 102400);
+	__uint(max_entries, MAX_FRAG_ZONES);
 	__type(key, u64);
 	__type(value, struct zone_info);
 } zones SEC(".maps");
 
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
-	__uint(max_entries, 102400);
+	__uint(max_entries, MAX_FRAG_NODES);
 	__type(key, u64);
 	__type(value, struct pgdat_info);
 } nodes SEC(".maps");
 
-struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
-	__uint(max_entries, 102400);
-	__type(key,struct order_zone);
-	__type(value, struct ctg_info);
-} orders SEC(".maps");
-
-static void fill_contig_page_info(struct zone *zone, unsigned int suitable_order,
-				  struct contig_page_info *info)
+static struct pglist_data *get_pgdat(int nid)
 {
-	unsigned int order;
-	info->free_pages = 0;
-	info->free_blocks_total = 0;
-	info->free_blocks_suitable = 0;
-	for (order = 0; order <= MAX_ORDER; order++) {
-		unsigned long blocks;
-		unsigned long nr_free;
-		nr_free = BPF_CORE_READ(&zone->free_area[order], nr_free);
-		blocks = nr_free;
-		info->free_blocks_total += blocks;
-		info->free_pages += blocks << order;
-		if (order >= suitable_order)
-			info->free_blocks_suitable += blocks << (order - suitable_order);
-	}
+	struct pglist_data *pgdat = NULL;
+
+	if (node_data_addr)
+		bpf_probe_read_kernel(&pgdat, sizeof(pgdat), (void *)(node_data_addr + nid * sizeof(pgdat)));
+	else if (nid == 0)
+		pgdat = (struct pglist_data *)contig_page_data_addr;
+	return pgdat;
 }
 
-SEC("kprobe/get_page_from_freelist")
-int BPF_KPROBE(get_page_from_freelist, gfp_t gfp_mask, unsigned int order, int alloc_flags,
-	       const struct alloc_context *ac)
+/* 由用户态通过 BPF_PROG_TEST_RUN 按需触发，遍历各节点的zone并记录每一阶的空闲块数，
+ * 页分配的热路径上不再挂载任何探针
+ */
+SEC("syscall")
+int frag_snapshot(void *ctx)
 {
-	// bpf_printk("1111");
 	struct pgdat_info node_info = {};
 	struct zone_info zone_data = {};
-
 	struct pglist_data *pgdat;
-	struct zoneref *zref;
 	struct zone *z;
-	int i;
-	unsigned int a_order;
+	unsigned int order;
+	int nid, i;
+
+	for (nid = 0; nid < MAX_FRAG_NODES && nid < nr_nodes; nid++) {
+		pgdat = get_pgdat(nid);
+		if (!pgdat)
+			continue;
+
+		node_info.node_id = BPF_CORE_READ(pgdat, node_id);
+		node_info.nr_zones = BPF_CORE_READ(pgdat, nr_zones);
+		node_info.pgdat_ptr = (u64)pgdat;
+		u64 key = (u64)pgdat;
+		bpf_map_update_elem(&nodes, &key, &node_info, BPF_ANY);
 
-	pgdat = BPF_CORE_READ(ac, preferred_zoneref, zone, zone_pgdat);
-	node_info.node_id = BPF_CORE_READ(pgdat, node_id);
-	node_info.nr_zones = BPF_CORE_READ(pgdat, nr_zones);
-	node_info.pgdat_ptr = (u64)pgdat;
-	u64 key = (u64)pgdat;
-    
-	bpf_map_update_elem(&nodes, &key, &node_info, BPF_ANY);
+		for (i = 0; i < __MAX_NR_ZONES; i++) {
+			z = (void *)pgdat + bpf_core_field_offset(struct pglist_data, node_zones) +
+			    i * bpf_core_type_size(struct zone);
+			zone_data.present_pages = BPF_CORE_READ(z, present_pages);
+			// 跳过没有物理页的zone，与 /proc/buddyinfo 一致
+			if (!zone_data.present_pages)
+				continue;
+			zone_data.zone_ptr = (u64)z;
+			u64 zone_key = (u64)z;
+			zone_data.node_id = node_info.node_id;
+			zone_data.zone_start_pfn = BPF_CORE_READ(z, zone_start_pfn);
+			zone_data.spanned_pages = BPF_CORE_READ(z, spanned_pages);
+			bpf_probe_read_kernel_str(zone_data.comm, sizeof(zone_data.comm), BPF_CORE_READ(z, name));
+			for (order = 0; order <= MAX_ORDER; order++)
+				zone_data.nr_free[order] = BPF_CORE_READ(&z->free_area[order], nr_free);
 
-	for (i = 0; i < __MAX_NR_ZONES; i++) {
-		zref = &pgdat->node_zonelists[0]._zonerefs[i];
-		z = BPF_CORE_READ(zref, zone);
-		if ((u64)z == 0) break;
-		zone_data.zone_ptr = (u64)z;
-		u64 zone_key = (u64)z;
-		zone_data.zone_start_pfn = BPF_CORE_READ(z, zone_start_pfn);
-		zone_data.spanned_pages = BPF_CORE_READ(z, spanned_pages);
-		zone_data.present_pages = BPF_CORE_READ(z, present_pages);
-		bpf_probe_read_kernel_str(zone_data.comm, sizeof(zone_data.comm), BPF_CORE_READ(z, name));
-		for (a_order = 0; a_order <= MAX_ORDER; ++a_order) {
-                    zone_data.order = a_order;
-					struct order_zone order_key = {};
-					order_key.order = a_order;
-					if ((u64)z == 0) break;
-					order_key.zone_ptr = (u64)z;
-                    struct contig_page_info ctg_info = {};
-                    fill_contig_page_info(z, a_order, &ctg_info);
-                    bpf_map_update_elem(&orders,&order_key,&ctg_info,BPF_ANY);
+			bpf_map_update_elem(&zones, &zone_key, &zone_data, BPF_ANY);
 		}
-                
-		bpf_map_update_elem(&zones, &zone_key, &zone_data, BPF_ANY);
 	}
 
 	return 0;
@@ -62,19 +62,15 @@ struct {
     __type(value, u64); // 用户态指针变量 memptr
 } memptrs SEC(".maps");
 
+/* 由 age_stat 按调用栈汇总 allocs 中各分配的存活时间 */
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
-    __type(key, u64); /* alloc return address */
-    __type(value, u64); /* timestamp */
-    __uint(max_entries, 10240);
-} addr_times SEC(".maps");
+    __uint(max_entries, COMBINED_ALLOCS_MAX_ENTRIES);
+    __type(key, u64); /* stack id */
+    __type(value, struct age_hist);
+} age_hists SEC(".maps");
 
-struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
-    __type(key, u64); /* alloc return address */
-    __type(value, u64); /* timestamp */
-    __uint(max_entries, 10240);
-} first_time SEC(".maps");
+u64 age_gen = 0;
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
@@ -98,6 +94,7 @@ static int gen_alloc_exit2(void *ctx, u64 address) {
 
     __builtin_memset(&info, 0, sizeof(info));
     info.size = *size;
+    info.timestamp_ns = bpf_ktime_get_ns();
 
     bpf_map_delete_elem(&sizes, &pid);
 
@@ -106,10 +103,6 @@ static int gen_alloc_exit2(void *ctx, u64 address) {
 
         bpf_map_update_elem(&allocs, &addr, &info, BPF_ANY);
 
-        // Initialize the addr_times map to 0
-        __u64 zero_ts = 0;
-        bpf_map_update_elem(&addr_times, &addr, &zero_ts, BPF_ANY);
-
         union combined_alloc_info add_cinfo = {
             .total_size = info.size,
             .number_of_allocs = 1
@@ -153,9 +146,78 @@ static int gen_free_enter(const void *address) {
 
     bpf_map_delete_elem(&allocs, &addr);
 
-    // Initialize the addr_times map to 0
-    __u64 zero_ts = 0;
-    bpf_map_update_elem(&addr_times, &addr, &zero_ts, BPF_ANY);
+    return 0;
+}
+
+struct age_ctx {
+    u64 now;
+    u64 gen;
+};
+
+static __always_inline int age_bucket(u64 age_ns) {
+    u64 secs = age_ns / 1000000000ULL;
+    int bucket = 0;
+
+    for (int i = 0; i < AGE_BUCKETS - 1 && secs; i++) {
+        secs >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static long account_age(struct bpf_map *map, u64 *addr, struct alloc_info *info, struct age_ctx *c) {
+    struct age_hist *hist;
+    u64 stack_id, age;
+    int bucket;
+
+    if (info->stack_id < 0)
+        return 0;
+
+    stack_id = info->stack_id;
+    hist = bpf_map_lookup_elem(&age_hists, &stack_id);
+    if (NULL == hist) {
+        struct age_hist zero = { .gen = c->gen };
+        bpf_map_update_elem(&age_hists, &stack_id, &zero, BPF_NOEXIST);
+        hist = bpf_map_lookup_elem(&age_hists, &stack_id);
+        if (NULL == hist)
+            return 0;
+    }
+    // 上一轮留下的表项，先清零再累加
+    if (hist->gen != c->gen) {
+        __builtin_memset(hist, 0, sizeof(*hist));
+        hist->gen = c->gen;
+    }
+
+    age = c->now > info->timestamp_ns ? c->now - info->timestamp_ns : 0;
+    bucket = age_bucket(age);
+    if (bucket < 0 || bucket >= AGE_BUCKETS)
+        return 0;
+    hist->count[bucket]++;
+    hist->size[bucket] += info->size;
+    if (age > hist->oldest_ns)
+        hist->oldest_ns = age;
+
+    return 0;
+}
+
+static long drop_stale_age(struct bpf_map *map, u64 *stack_id, struct age_hist *hist, struct age_ctx *c) {
+    if (hist->gen != c->gen)
+        bpf_map_delete_elem(map, stack_id);
+    return 0;
+}
+
+/* 由用户态通过 BPF_PROG_TEST_RUN 触发，在内核中遍历 allocs 并生成本轮的 age_hists，
+ * 用户态每个周期只需读取按调用栈汇总后的结果
+ */
+SEC("syscall")
+int age_stat(void *ctx) {
+    struct age_ctx c = {
+        .now = bpf_ktime_get_ns(),
+        .gen = ++age_gen,
+    };
+
+    bpf_for_each_map_elem(&allocs, account_age, &c, 0);
+    bpf_for_each_map_elem(&age_hists, drop_stale_age, &c, 0);
 
     return 0;
 }
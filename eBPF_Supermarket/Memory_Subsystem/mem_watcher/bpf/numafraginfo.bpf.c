@@ -6,28 +6,39 @@
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
+/* 由用户态从 /proc/kallsyms 中解析，NUMA内核使用node_data[]，否则使用contig_page_data */
+const volatile u64 node_data_addr = 0;
+const volatile u64 contig_page_data_addr = 0;
+const volatile int nr_nodes = 1;
+
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
-	__uint(max_entries, 102400);
+	__uint(max_entries, MAX_FRAG_NODES);
 	__type(key, u64);
 	__type(value, struct pgdat_info);
 } nodes SEC(".maps");
 
-SEC("kprobe/get_page_from_freelist")
-int BPF_KPROBE(get_page_from_freelist, gfp_t gfp_mask, unsigned int order, int alloc_flags,
-	       const struct alloc_context *ac)
+SEC("syscall")
+int frag_snapshot(void *ctx)
 {
 	struct pgdat_info node_info = {};
-
 	struct pglist_data *pgdat;
 
-	pgdat = BPF_CORE_READ(ac, preferred_zoneref, zone, zone_pgdat);
-	node_info.node_id = BPF_CORE_READ(pgdat, node_id);
-	node_info.nr_zones = BPF_CORE_READ(pgdat, nr_zones);
-	node_info.pgdat_ptr = (u64)pgdat;
-	u64 key = (u64)pgdat;
-    
-	bpf_map_update_elem(&nodes, &key, &node_info, BPF_NOEXIST);
+	for (int nid = 0; nid < MAX_FRAG_NODES && nid < nr_nodes; nid++) {
+		pgdat = NULL;
+		if (node_data_addr)
+			bpf_probe_read_kernel(&pgdat, sizeof(pgdat), (void *)(node_data_addr + nid * sizeof(pgdat)));
+		else if (nid == 0)
+			pgdat = (struct pglist_data *)contig_page_data_addr;
+		if (!pgdat)
+			continue;
+
+		node_info.node_id = BPF_CORE_READ(pgdat, node_id);
+		node_info.nr_zones = BPF_CORE_READ(pgdat, nr_zones);
+		node_info.pgdat_ptr = (u64)pgdat;
+		u64 key = (u64)pgdat;
+		bpf_map_update_elem(&nodes, &key, &node_info, BPF_ANY);
+	}
 
 	return 0;
 }
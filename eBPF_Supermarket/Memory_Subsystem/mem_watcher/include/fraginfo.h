@@ -2,6 +2,8 @@
 #define FRAGINFO_H
 
 #define MAX_ORDER 10
+#define MAX_FRAG_NODES 64   // 快照最多遍历的NUMA节点数
+#define MAX_FRAG_ZONES 256  // 快照最多记录的zone数
 typedef __u64 u64;
 struct order_zone{
     unsigned int order;
@@ -22,7 +24,9 @@ struct zone_info
     u64 spanned_pages;
     u64 present_pages;
     char comm[32];
-    unsigned int order;
+    int node_id;
+    // 各阶free_area中的空闲块数，用户态据此计算每一阶的碎片指数
+    long unsigned int nr_free[MAX_ORDER + 1];
 };
 
 struct pgdat_info
@@ -122,11 +122,24 @@ struct sysstat_event {
 #define ALLOCS_MAX_ENTRIES 1000000
 #define COMBINED_ALLOCS_MAX_ENTRIES 10240
  
+#define AGE_BUCKETS 16
+ 
 struct alloc_info {
     __u64 size;
+    __u64 timestamp_ns; // 分配时刻 bpf_ktime_get_ns()
     int stack_id;
 };
 
+/* 每个调用栈上未释放分配的存活时间分布
+ * 桶0为存活不足1秒，桶i(i>0)为存活[2^(i-1), 2^i)秒，最后一个桶不设上限
+ */
+struct age_hist {
+    __u64 gen;        // 由哪一轮统计写入，过期的表项会被删除
+    __u64 oldest_ns;  // 最老一次分配的存活时间
+    __u64 count[AGE_BUCKETS];
+    __u64 size[AGE_BUCKETS];
+};
+
 union combined_alloc_info {
     struct {
         __u64 total_size : 40;
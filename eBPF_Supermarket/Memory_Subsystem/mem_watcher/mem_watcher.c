@@ -22,6 +22,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <sys/resource.h>
 #include <bpf/libbpf.h>
@@ -115,6 +116,23 @@ struct allocation
 	__u64 size;
 	size_t count;
 };
+
+#define ALLOCS_BATCH 4096	 // 每次批量读取allocs的条目数
+#define STACK_HASH_BITS 15	 // 哈希表槽数不小于stack_traces容量的两倍
+#define STACK_HASH_SIZE (1 << STACK_HASH_BITS)
+#define TOP_STACKS 10
+
+// 按stack_id开放寻址，槽中存放allocs下标+1，0表示空槽
+static int stack_hash[STACK_HASH_SIZE];
+
+// 每个stack_id的符号化结果缓存，同一调用栈在后续周期中不再重复符号化
+struct sym_cache
+{
+	int stack_sz;
+	__u64 *stack;
+	const struct blaze_result *result;
+};
+static struct sym_cache *sym_cache;
 // ============================= fraginfo====================================
 struct order_entry
 {
@@ -269,7 +287,7 @@ static struct env
     bool vmasnap;        // 是否启用虚拟内存区域信息
     bool drsnoop;
     bool kernel_trace;   // 是否启用内核态跟踪
-    bool print_time;     // 是否打印地址申请时间
+    bool print_time;     // 是否打印未释放内存的存活时间分布
     int interval;        // 打印间隔，单位为秒
     int duration;        // 运行时长，单位为秒
     bool part2;          // 是否启用系统内存状态报告的扩展部分
@@ -289,7 +307,7 @@ static struct env
     .vmasnap = false,      // 默认关闭虚拟内存区域信息
     .drsnoop = false,
     .kernel_trace = true,  // 默认启用内核态跟踪
-    .print_time = false,   // 默认不打印地址申请时间
+    .print_time = false,   // 默认不打印存活时间分布
     .rss = false,          // 默认不打印进程页面信息
     .part2 = false,        // 默认关闭系统内存状态报告的扩展部分
     .oomkiller = false,    // 默认关闭oomkiller事件处理
@@ -323,8 +341,8 @@ static const struct argp_option opts[] = {
 	{0, 0, 0, 0, "memleak:", 8},
 	{"memleak", 'l', 0, 0, "print memleak (内核态内存泄漏检测)", 8},
 	{"choose_pid", 'P', "PID", 0, "选择进程号打印, print memleak (用户态内存泄漏检测)", 9},
-	{"print_time", 'm', 0, 0, "打印申请地址时间 (用户态)", 10},
-	{"print_time", 'f', 0, 0, "打印申请地址时间 (用户态)", 10},
+	{"print_time", 'm', 0, 0, "按调用栈打印未释放内存的存活时间分布 (用户态)", 10},
+	{"print_time", 'f', 0, 0, "按调用栈打印未释放内存的存活时间分布 (用户态)", 10},
 	{"time", 't', "TIME-SEC", 0, "Max Running Time(0 for infinite)", 11},
 
 	{0, 0, 0, 0, "fraginfo:", 12},
@@ -450,9 +468,7 @@ static int process_vmasnap(struct vmasnap_bpf *skel_vmasnap);
 static int process_drsnoop(struct drsnoop_bpf *skel_drsnoop);
 static int process_oomkiller(struct oomkiller_bpf *skel_oomkiller);  // 新增的oomkiller处理函数原型
 static int handle_event_oomkiller(void *ctx, void *data, size_t data_sz);  // 新增的oomkiller事件处理函数
-static __u64 adjust_time_to_program_start_time(__u64 first_query_time);
-static int update_addr_times(struct memleak_bpf *skel_memleak);
-static int print_time(struct memleak_bpf *skel_memleak);
+static int print_age_hists(struct memleak_bpf *skel_memleak, pid_t pid);
 static void print_find_event_data(int map_fd);
 static void print_insert_event_data(int map_fd);
 
@@ -520,7 +536,8 @@ int main(int argc, char **argv)
 
         strcpy(binary_path, "/lib/x86_64-linux-gnu/libc.so.6");
 
-        allocs = calloc(ALLOCS_MAX_ENTRIES, sizeof(*allocs));
+        // 不同调用栈的数量受 stack_traces 容量限制
+        allocs = calloc(stack_map_max_entries, sizeof(*allocs));
 
         skel_memleak = memleak_bpf__open();
         if (!skel_memleak)
@@ -596,13 +613,8 @@ static void print_frame(const char *name, uintptr_t input_addr, uintptr_t addr,
 	}
 }
 
-static void show_stack_trace(__u64 *stack, int stack_sz, pid_t pid)
+static const struct blaze_result *symbolize_stack(__u64 *stack, int stack_sz, pid_t pid)
 {
-	const struct blaze_symbolize_inlined_fn *inlined;
-	const struct blaze_result *result;
-	const struct blaze_sym *sym;
-	int i, j;
-
 	assert(sizeof(uintptr_t) == sizeof(uint64_t));
 
 	if (pid)
@@ -611,15 +623,22 @@ static void show_stack_trace(__u64 *stack, int stack_sz, pid_t pid)
 			.type_size = sizeof(src),
 			.pid = pid,
 		};
-		result = blaze_symbolize_process_abs_addrs(symbolizer, &src, (const uintptr_t *)stack, stack_sz);
+		return blaze_symbolize_process_abs_addrs(symbolizer, &src, (const uintptr_t *)stack, stack_sz);
 	}
 	else
 	{
 		struct blaze_symbolize_src_kernel src = {
 			.type_size = sizeof(src),
 		};
-		result = blaze_symbolize_kernel_abs_addrs(symbolizer, &src, (const uintptr_t *)stack, stack_sz);
+		return blaze_symbolize_kernel_abs_addrs(symbolizer, &src, (const uintptr_t *)stack, stack_sz);
 	}
+}
+
+static void print_stack_result(__u64 *stack, int stack_sz, const struct blaze_result *result)
+{
+	const struct blaze_symbolize_inlined_fn *inlined;
+	const struct blaze_sym *sym;
+	int i, j;
 
 	for (i = 0; i < stack_sz; i++)
 	{
@@ -638,34 +657,112 @@ static void show_stack_trace(__u64 *stack, int stack_sz, pid_t pid)
 			print_frame(sym->name, 0, 0, 0, &inlined->code_info);
 		}
 	}
+}
 
+static void show_stack_trace(__u64 *stack, int stack_sz, pid_t pid)
+{
+	const struct blaze_result *result = symbolize_stack(stack, stack_sz, pid);
+
+	print_stack_result(stack, stack_sz, result);
 	blaze_result_free(result);
 }
 
-int print_outstanding_allocs(struct memleak_bpf *skel)
+// stack_id 小于 stack_traces 的容量，直接作为缓存下标；栈内容变化时(stack_id被复用)重新符号化
+static void show_stack_trace_cached(int stack_id, __u64 *stack, int stack_sz, pid_t pid)
 {
-	const size_t allocs_key_size = bpf_map__key_size(skel->maps.allocs);
+	struct sym_cache *c;
 
-	time_t t = time(NULL);
-	struct tm *tm = localtime(&t);
+	if (!sym_cache)
+		sym_cache = calloc(stack_map_max_entries, sizeof(*sym_cache));
+	if (!sym_cache || stack_id < 0 || stack_id >= stack_map_max_entries)
+	{
+		show_stack_trace(stack, stack_sz, pid);
+		return;
+	}
+
+	c = &sym_cache[stack_id];
+	if (!c->stack || c->stack_sz != stack_sz || memcmp(c->stack, stack, stack_sz * sizeof(*stack)))
+	{
+		blaze_result_free(c->result);
+		free(c->stack);
+		c->stack = malloc(stack_sz * sizeof(*stack));
+		if (c->stack)
+			memcpy(c->stack, stack, stack_sz * sizeof(*stack));
+		c->stack_sz = stack_sz;
+		c->result = symbolize_stack(stack, stack_sz, pid);
+	}
+	print_stack_result(stack, stack_sz, c->result);
+}
+
+static void free_sym_cache(void)
+{
+	if (!sym_cache)
+		return;
+	for (int i = 0; i < stack_map_max_entries; i++)
+	{
+		blaze_result_free(sym_cache[i].result);
+		free(sym_cache[i].stack);
+	}
+	free(sym_cache);
+	sym_cache = NULL;
+}
+
+static int stack_depth(const __u64 *stack)
+{
+	int stack_sz = 0;
 
-	size_t nr_allocs = 0;
+	while (stack_sz < perf_max_stack_depth && stack[stack_sz])
+		stack_sz++;
+	return stack_sz;
+}
+
+// 把一次分配累加到其调用栈对应的表项中
+static void account_alloc(const struct alloc_info *info, size_t *nr_allocs)
+{
+	__u32 h = ((__u32)info->stack_id * 2654435761u) >> (32 - STACK_HASH_BITS);
+	struct allocation *alloc;
+
+	// filter invalid stacks
+	if (info->stack_id < 0)
+		return;
+
+	while (stack_hash[h])
+	{
+		alloc = &allocs[stack_hash[h] - 1];
+		if (alloc->stack_id == info->stack_id)
+		{
+			alloc->size += info->size;
+			alloc->count++;
+			return;
+		}
+		h = (h + 1) & (STACK_HASH_SIZE - 1);
+	}
+
+	// 不同的调用栈最多有 stack_map_max_entries 个
+	if (*nr_allocs >= (size_t)stack_map_max_entries)
+		return;
+	alloc = &allocs[*nr_allocs];
+	alloc->stack_id = info->stack_id;
+	alloc->size = info->size;
+	alloc->count = 1;
+	stack_hash[h] = ++*nr_allocs;
+}
+
+// 内核不支持批量操作时逐个读取
+static int collect_allocs_one_by_one(struct memleak_bpf *skel, size_t *nr_allocs)
+{
+	const size_t allocs_key_size = bpf_map__key_size(skel->maps.allocs);
 
-	// for each struct alloc_info "alloc_info" in the bpf map "allocs"
 	for (__u64 prev_key = 0, curr_key = 0;; prev_key = curr_key)
 	{
 		struct alloc_info alloc_info = {};
-		memset(&alloc_info, 0, sizeof(alloc_info));
 
 		if (bpf_map__get_next_key(skel->maps.allocs, &prev_key, &curr_key, allocs_key_size))
 		{
 			if (errno == ENOENT)
-			{
 				break; // no more keys, done
-			}
 
 			perror("map get next key error");
-
 			return -errno;
 		}
 
@@ -675,54 +772,109 @@ int print_outstanding_allocs(struct memleak_bpf *skel)
 				continue;
 
 			perror("map lookup error");
-
 			return -errno;
 		}
 
-		// filter invalid stacks
-		if (alloc_info.stack_id < 0)
+		account_alloc(&alloc_info, nr_allocs);
+	}
+
+	return 0;
+}
+
+// 每批读取 ALLOCS_BATCH 条，读到即累加，不保存整张表
+static int collect_allocs(struct memleak_bpf *skel, size_t *nr_allocs)
+{
+	static __u64 keys[ALLOCS_BATCH];
+	static struct alloc_info values[ALLOCS_BATCH];
+	int fd = bpf_map__fd(skel->maps.allocs);
+	__u64 batch, *in_batch = NULL;
+	__u32 count;
+	int err;
+	LIBBPF_OPTS(bpf_map_batch_opts, opts);
+
+	*nr_allocs = 0;
+	memset(stack_hash, 0, sizeof(stack_hash));
+
+	for (;;)
+	{
+		count = ALLOCS_BATCH;
+		err = bpf_map_lookup_batch(fd, in_batch, &batch, keys, values, &count, &opts);
+		if (err && err != -ENOENT)
 		{
-			continue;
+			if (!in_batch)
+				return collect_allocs_one_by_one(skel, nr_allocs);
+			fprintf(stderr, "map lookup batch error: %d\n", err);
+			return err;
 		}
 
-		// when the stack_id exists in the allocs array,
-		//   increment size with alloc_info.size
-		bool stack_exists = false;
+		for (__u32 i = 0; i < count; i++)
+			account_alloc(&values[i], nr_allocs);
 
-		for (size_t i = 0; !stack_exists && i < nr_allocs; ++i)
-		{
-			struct allocation *alloc = &allocs[i];
+		if (err == -ENOENT)
+			break; // no more keys, done
+		in_batch = &batch;
+	}
 
-			if (alloc->stack_id == alloc_info.stack_id)
-			{
-				alloc->size += alloc_info.size;
-				alloc->count++;
+	return 0;
+}
 
-				stack_exists = true;
-				break;
-			}
-		}
+static void sift_down(struct allocation *heap, size_t n, size_t i)
+{
+	for (;;)
+	{
+		size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+		struct allocation tmp;
+
+		if (l < n && heap[l].size < heap[min].size)
+			min = l;
+		if (r < n && heap[r].size < heap[min].size)
+			min = r;
+		if (min == i)
+			return;
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
 
-		if (stack_exists)
-			continue;
+// 用大小为k的小顶堆选出最大的k项并按降序放到数组开头，O(n log k)
+static size_t select_top_allocs(struct allocation *arr, size_t n, size_t k)
+{
+	if (k > n)
+		k = n;
 
-		// when the stack_id does not exist in the allocs array,
-		//   create a new entry in the array
-		struct allocation alloc = {
-			.stack_id = alloc_info.stack_id,
-			.size = alloc_info.size,
-			.count = 1,
-		};
+	for (size_t i = k / 2; i-- > 0;)
+		sift_down(arr, k, i);
 
-		memcpy(&allocs[nr_allocs], &alloc, sizeof(alloc));
-		nr_allocs++;
+	for (size_t i = k; i < n; i++)
+	{
+		if (arr[i].size > arr[0].size)
+		{
+			struct allocation tmp = arr[0];
+			arr[0] = arr[i];
+			arr[i] = tmp;
+			sift_down(arr, k, 0);
+		}
 	}
 
-	// sort the allocs array in descending order
-	qsort(allocs, nr_allocs, sizeof(allocs[0]), alloc_size_compare);
+	qsort(arr, k, sizeof(arr[0]), alloc_size_compare);
+	return k;
+}
+
+int print_outstanding_allocs(struct memleak_bpf *skel)
+{
+	time_t t = time(NULL);
+	struct tm *tm = localtime(&t);
+	size_t nr_allocs = 0, nr_allocs_to_show;
+	int err;
+
+	err = collect_allocs(skel, &nr_allocs);
+	if (err)
+		return err;
 
 	// get min of allocs we stored vs the top N requested stacks
-	size_t nr_allocs_to_show = nr_allocs < 10 ? nr_allocs : 10;
+	nr_allocs_to_show = select_top_allocs(allocs, nr_allocs, TOP_STACKS);
 
 	printf("[%d:%d:%d] Top %zu stacks with outstanding allocations:\n",
 		   tm->tm_hour, tm->tm_min, tm->tm_sec, nr_allocs_to_show);
@@ -735,9 +887,12 @@ int print_outstanding_allocs(struct memleak_bpf *skel)
 			perror("failed to lookup stack traces!");
 			return -errno;
 		}
-	}
 
-	show_stack_trace(g_stacks, nr_allocs_to_show, 0);
+		printf("stack_id=0x%x with outstanding allocations: total_size=%llu nr_allocs=%zu\n",
+			   allocs[i].stack_id, allocs[i].size, allocs[i].count);
+
+		show_stack_trace_cached(allocs[i].stack_id, g_stacks, stack_depth(g_stacks), 0);
+	}
 
 	return 0;
 }
@@ -788,120 +943,89 @@ int print_outstanding_combined_allocs(struct memleak_bpf *skel, pid_t pid)
 		printf("stack_id=0x%llx with outstanding allocations: total_size=%llu nr_allocs=%llu\n",
 			   curr_key, (__u64)cinfo.total_size, (__u64)cinfo.number_of_allocs);
 
-		int stack_sz = 0;
-		for (int i = 0; i < perf_max_stack_depth; i++)
-		{
-			if (g_stacks[i] == 0)
-			{
-				break;
-			}
-			stack_sz++;
-			// printf("[%3d] 0x%llx\n", i, g_stacks[i]);
-		}
-
-		show_stack_trace(g_stacks, stack_sz, pid);
+		show_stack_trace_cached(curr_key, g_stacks, stack_depth(g_stacks), pid);
 	}
 
 	return 0;
 }
 
-// 在更新时间之前获取当前时间并调整为相对于程序启动时的时间
-static __u64 adjust_time_to_program_start_time(__u64 first_query_time)
+// 桶的下界(秒)，与 memleak.bpf.c 中 age_bucket() 的划分一致
+static __u64 age_bucket_low(int bucket)
 {
-	struct timespec current_time;
-	clock_gettime(CLOCK_MONOTONIC, &current_time);
-	// printf("current_time: %ld\n", current_time.tv_sec);
-	__u64 adjusted_time;
-	adjusted_time = current_time.tv_sec - first_query_time;
-
-	// printf("adjusted_time: %lld\n", adjusted_time);
-	return adjusted_time;
+	return bucket ? 1ULL << (bucket - 1) : 0;
 }
 
-// 在更新时间时，先将时间调整为相对于程序启动的时间
-static int update_addr_times(struct memleak_bpf *skel)
+// 触发 age_stat 在内核中按调用栈统计存活时间，再逐个调用栈打印直方图
+static int print_age_hists(struct memleak_bpf *skel, pid_t pid)
 {
-	const size_t addr_times_key_size = bpf_map__key_size(skel->maps.addr_times);
-	const size_t first_time_key_size = bpf_map__key_size(skel->maps.first_time);
+	LIBBPF_OPTS(bpf_test_run_opts, topts);
+	const size_t age_hists_key_size = bpf_map__key_size(skel->maps.age_hists);
+	const size_t stack_traces_key_size = bpf_map__key_size(skel->maps.stack_traces);
+
+	if (bpf_prog_test_run_opts(bpf_program__fd(skel->progs.age_stat), &topts))
+	{
+		perror("failed to run age_stat!");
+		return -errno;
+	}
+
 	for (__u64 prev_key = 0, curr_key = 0;; prev_key = curr_key)
 	{
-		if (bpf_map__get_next_key(skel->maps.addr_times, &prev_key, &curr_key, addr_times_key_size))
+		struct age_hist hist;
+		__u64 nr_allocs = 0, total_size = 0;
+
+		if (bpf_map__get_next_key(skel->maps.age_hists, &prev_key, &curr_key, age_hists_key_size))
 		{
 			if (errno == ENOENT)
 			{
 				break; // no more keys, done!
 			}
-
 			perror("map get next key failed!");
 			return -errno;
 		}
 
-		// Check if the address exists in the first_time map
-		__u64 first_query_time;
-		if (bpf_map__lookup_elem(skel->maps.first_time, &curr_key, first_time_key_size, &first_query_time, sizeof(first_query_time), 0))
-		{
-			// Address doesn't exist in the first_time map, add it with the current time
-			struct timespec first_time_alloc;
-			clock_gettime(CLOCK_MONOTONIC, &first_time_alloc);
-			if (bpf_map__update_elem(skel->maps.first_time, &curr_key, first_time_key_size, &first_time_alloc.tv_sec, sizeof(first_time_alloc.tv_sec), 0))
-			{
-				perror("map update failed!");
-				return -errno;
-			}
-		}
-		else
+		if (bpf_map__lookup_elem(skel->maps.age_hists, &curr_key, age_hists_key_size, &hist, sizeof(hist), 0))
 		{
-			// Address exists in the first_time map
-			// This is the first time updating timestamp
-			__u64 adjusted_time = adjust_time_to_program_start_time(first_query_time);
-			// printf("update_addr_times adjusted_time: %lld\n", adjusted_time);
-
-			// Save the adjusted time to addr_times map
-			__u64 timestamp = adjusted_time;
-
-			// write the updated timestamp back to the map
-			if (bpf_map__update_elem(skel->maps.addr_times, &curr_key, addr_times_key_size, &timestamp, sizeof(timestamp), 0))
+			if (errno == ENOENT)
 			{
-				perror("map update failed!");
-				return -errno;
+				continue;
 			}
+			perror("map lookup failed!");
+			return -errno;
 		}
-	}
-	return 0;
-}
-
-// 在打印时间时，先将时间调整为相对于程序启动的时间
-int print_time(struct memleak_bpf *skel)
-{
-	const size_t addr_times_key_size = bpf_map__key_size(skel->maps.addr_times);
-
-	printf("%-16s %12s\n", "AL_ADDR", "AL_Time(s)");
 
-	// Iterate over the addr_times map to print address and time
-	for (__u64 prev_key = 0, curr_key = 0;; prev_key = curr_key)
-	{
-		if (bpf_map__get_next_key(skel->maps.addr_times, &prev_key, &curr_key, addr_times_key_size))
+		for (int i = 0; i < AGE_BUCKETS; i++)
 		{
-			if (errno == ENOENT)
-			{
-				break; // no more keys, done!
-			}
-			perror("map get next key failed!");
-			return -errno;
+			nr_allocs += hist.count[i];
+			total_size += hist.size[i];
 		}
+		if (!nr_allocs)
+			continue;
 
-		// Read the timestamp for the current address
-		__u64 timestamp;
-		if (bpf_map__lookup_elem(skel->maps.addr_times, &curr_key, addr_times_key_size, &timestamp, sizeof(timestamp), 0) == 0)
+		printf("stack_id=0x%llx with outstanding allocations: total_size=%llu nr_allocs=%llu oldest=%.3fs\n",
+			   curr_key, total_size, nr_allocs, hist.oldest_ns / 1e9);
+		printf("%16s %12s %12s\n", "AGE(s)", "NR_ALLOCS", "SIZE");
+		for (int i = 0; i < AGE_BUCKETS; i++)
 		{
-			printf("0x%-16llx %lld\n", curr_key, timestamp);
+			char range[32];
+
+			if (!hist.count[i])
+				continue;
+			if (i == AGE_BUCKETS - 1)
+				snprintf(range, sizeof(range), "%llu+", age_bucket_low(i));
+			else
+				snprintf(range, sizeof(range), "%llu -> %llu", age_bucket_low(i), 1ULL << i);
+			printf("%16s %12llu %12llu\n", range, hist.count[i], hist.size[i]);
 		}
-		else
+
+		if (bpf_map__lookup_elem(skel->maps.stack_traces,
+								 &curr_key, stack_traces_key_size, g_stacks, g_stacks_size, 0))
 		{
-			perror("map lookup failed!");
-			return -errno;
+			// 调用栈可能已被替换，只输出直方图
+			continue;
 		}
+		show_stack_trace_cached(curr_key, g_stacks, stack_depth(g_stacks), pid);
 	}
+
 	return 0;
 }
 
@@ -1271,6 +1395,9 @@ static int process_memleak(struct memleak_bpf *skel_memleak, struct env env)
 
 	if (!env.kernel_trace)
 		disable_kernel_tracepoints(skel_memleak);
+	// age_stat 依赖 BPF_PROG_TYPE_SYSCALL(5.14+)，只在需要存活时间分布时加载
+	if (env.kernel_trace || !env.print_time)
+		bpf_program__set_autoload(skel_memleak->progs.age_stat, false);
 
 	int err = memleak_bpf__load(skel_memleak);
 	if (err)
@@ -1320,8 +1447,7 @@ static int process_memleak(struct memleak_bpf *skel_memleak, struct env env)
 			if (env.print_time)
 			{
 				system("clear");
-				update_addr_times(skel_memleak);
-				print_time(skel_memleak);
+				print_age_hists(skel_memleak, attach_pid);
 			}
 			else
 				print_outstanding_combined_allocs(skel_memleak, attach_pid);
@@ -1348,6 +1474,7 @@ static int process_memleak(struct memleak_bpf *skel_memleak, struct env env)
 
 memleak_cleanup:
 	memleak_bpf__destroy(skel_memleak);
+	free_sym_cache();
 	if (symbolizer)
 		blaze_symbolizer_free(symbolizer);
 	if (g_stacks)
@@ -1438,19 +1565,40 @@ void print_nodes(int fd)
 		key = next_key;
 	}
 }
+static void fill_contig_page_info(const struct zone_info *zinfo, unsigned int suitable_order,
+								  struct ctg_info *info)
+{
+	info->free_pages = 0;
+	info->free_blocks_total = 0;
+	info->free_blocks_suitable = 0;
+	for (unsigned int order = 0; order <= MAX_ORDER; order++)
+	{
+		unsigned long blocks = zinfo->nr_free[order];
+
+		info->free_blocks_total += blocks;
+		info->free_pages += blocks << order;
+		if (order >= suitable_order)
+			info->free_blocks_suitable += blocks << (order - suitable_order);
+	}
+}
 void print_orders(int fd)
 {
-	struct order_zone okey = {};
-	struct ctg_info oinfo;
-	struct order_entry entries[256];
+	struct zone_info zinfo;
+	static struct order_entry entries[MAX_FRAG_ZONES * (MAX_ORDER + 1)];
+	__u64 key = 0, next_key;
 	int entry_count = 0;
 
-	while (bpf_map_get_next_key(fd, &okey, &okey) == 0)
+	// 每个zone只记录了各阶的空闲块数，在这里展开成每一阶的统计
+	while (bpf_map_get_next_key(fd, &key, &next_key) == 0 && entry_count < MAX_FRAG_ZONES * (MAX_ORDER + 1))
 	{
-		if (bpf_map_lookup_elem(fd, &okey, &oinfo) == 0)
+		key = next_key;
+		if (bpf_map_lookup_elem(fd, &next_key, &zinfo))
+			continue;
+		for (unsigned int order = 0; order <= MAX_ORDER; order++)
 		{
-			entries[entry_count].okey = okey;
-			entries[entry_count].oinfo = oinfo;
+			entries[entry_count].okey.order = order;
+			entries[entry_count].okey.zone_ptr = zinfo.zone_ptr;
+			fill_contig_page_info(&zinfo, order, &entries[entry_count].oinfo);
 			entry_count++;
 		}
 	}
@@ -1474,30 +1622,107 @@ void print_orders(int fd)
 	}
 }
 
-static int process_fraginfo(struct fraginfo_bpf *skel_fraginfo)
+// 从 /proc/kallsyms 中查找内核符号的地址
+static int get_ksym_addr(const char *name, __u64 *addr)
 {
+	FILE *file = fopen(KALLSYMS_PATH, "r");
+	char line[256], symbol[256];
+	unsigned long address;
 
-	int err = fraginfo_bpf__load(skel_fraginfo);
-	if (err)
+	if (!file)
+		return -1;
+	while (fgets(line, sizeof(line), file))
 	{
-		fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-		goto fraginfo_cleanup;
+		if (sscanf(line, "%lx %*s %255s", &address, symbol) == 2 && strcmp(symbol, name) == 0)
+		{
+			*addr = address;
+			fclose(file);
+			return 0;
+		}
+	}
+	fclose(file);
+	return -1;
+}
+
+// 节点号的上界，取自 /sys/devices/system/node/possible 中的最大值
+static int get_nr_nodes(void)
+{
+	FILE *file = fopen("/sys/devices/system/node/possible", "r");
+	char buf[256], *p;
+	int nr = 1;
+
+	if (!file)
+		return nr;
+	if (fgets(buf, sizeof(buf), file))
+	{
+		p = buf + strcspn(buf, "\n");
+		while (p > buf && (p[-1] >= '0' && p[-1] <= '9'))
+			p--;
+		nr = atoi(p) + 1;
 	}
+	fclose(file);
+	return nr;
+}
 
-	err = fraginfo_bpf__attach(skel_fraginfo);
+// 确定快照程序遍历 pglist_data 的方式：NUMA内核为node_data[]，否则为contig_page_data
+static int get_pgdat_syms(__u64 *node_data_addr, __u64 *contig_page_data_addr, int *nr_nodes)
+{
+	*node_data_addr = *contig_page_data_addr = 0;
+	*nr_nodes = 1;
+	if (get_ksym_addr("node_data", node_data_addr) == 0)
+	{
+		*nr_nodes = get_nr_nodes();
+		return 0;
+	}
+	if (get_ksym_addr("contig_page_data", contig_page_data_addr) == 0)
+		return 0;
+
+	fprintf(stderr, "Failed to find node_data or contig_page_data in %s\n", KALLSYMS_PATH);
+	return -1;
+}
+
+static int run_frag_snapshot(struct bpf_program *prog)
+{
+	LIBBPF_OPTS(bpf_test_run_opts, topts);
+
+	if (bpf_prog_test_run_opts(bpf_program__fd(prog), &topts))
+	{
+		perror("failed to run frag_snapshot");
+		return -errno;
+	}
+	return 0;
+}
+
+static int process_fraginfo(struct fraginfo_bpf *skel_fraginfo)
+{
+	__u64 node_data_addr, contig_page_data_addr;
+	int nr_nodes;
+	int err = get_pgdat_syms(&node_data_addr, &contig_page_data_addr, &nr_nodes);
+	if (err)
+		goto fraginfo_cleanup;
+	skel_fraginfo->rodata->node_data_addr = node_data_addr;
+	skel_fraginfo->rodata->contig_page_data_addr = contig_page_data_addr;
+	skel_fraginfo->rodata->nr_nodes = nr_nodes;
+
+	err = fraginfo_bpf__load(skel_fraginfo);
 	if (err)
 	{
-		fprintf(stderr, "Failed to attach BPF skeleton\n");
+		fprintf(stderr, "Failed to load and verify BPF skeleton\n");
 		goto fraginfo_cleanup;
 	}
+
+	// 没有需要挂载的探针，每个周期触发一次快照
 	while (1)
 	{
 		sleep(env.interval);
+		err = run_frag_snapshot(skel_fraginfo->progs.frag_snapshot);
+		if (err)
+			break;
 		print_nodes(bpf_map__fd(skel_fraginfo->maps.nodes));
 		printf("\n");
 		print_zones(bpf_map__fd(skel_fraginfo->maps.zones));
 		printf("\n");
-		print_orders(bpf_map__fd(skel_fraginfo->maps.orders));
+		print_orders(bpf_map__fd(skel_fraginfo->maps.zones));
 		printf("\n");
 	}
 
@@ -1508,23 +1733,28 @@ fraginfo_cleanup:
 // =========================================numafraginfo=================================================
 static int process_numafraginfo(struct numafraginfo_bpf *skel_numafraginfo)
 {
-
-	int err = numafraginfo_bpf__load(skel_numafraginfo);
+	__u64 node_data_addr, contig_page_data_addr;
+	int nr_nodes;
+	int err = get_pgdat_syms(&node_data_addr, &contig_page_data_addr, &nr_nodes);
 	if (err)
-	{
-		fprintf(stderr, "Failed to load and verify BPF skeleton\n");
 		goto numafraginfo_cleanup;
-	}
+	skel_numafraginfo->rodata->node_data_addr = node_data_addr;
+	skel_numafraginfo->rodata->contig_page_data_addr = contig_page_data_addr;
+	skel_numafraginfo->rodata->nr_nodes = nr_nodes;
 
-	err = numafraginfo_bpf__attach(skel_numafraginfo);
+	err = numafraginfo_bpf__load(skel_numafraginfo);
 	if (err)
 	{
-		fprintf(stderr, "Failed to attach BPF skeleton\n");
+		fprintf(stderr, "Failed to load and verify BPF skeleton\n");
 		goto numafraginfo_cleanup;
 	}
+
 	while (1)
 	{
 		sleep(env.interval);
+		err = run_frag_snapshot(skel_numafraginfo->progs.frag_snapshot);
+		if (err)
+			break;
 		print_nodes(bpf_map__fd(skel_numafraginfo->maps.nodes));
 		printf("\n");
 		break;
@@ -6,6 +6,7 @@
 
 #define FILE_MAXSIZE 128 
 #define IF_NAMESIZE 16 
+#define MAX_SOCK_CGROUPS 8
 
 struct config {
 	enum xdp_attach_mode attach_mode;
@@ -41,7 +42,16 @@ struct config {
 	char *router_file;
 	char router_file_buf[FILE_MAXSIZE];
 	bool print_info;
+	int metrics_port;                       //遥测指标端点端口，0 为不导出
 	bool socketmap_flag;
+	char *sock_cgroups[MAX_SOCK_CGROUPS];	//sockmap 挂载的 cgroup
+	int nr_sock_cgroups;
+	char *sock_ports;                       //sockmap 端口白名单
+	bool xsk;             //AF_XDP 慢路径
+	bool xsk_busy_poll;
+	bool xsk_inspect_miss;
+	char *xsk_file;
+	char xsk_file_buf[FILE_MAXSIZE];
 };
 
 /* Defined in common_params.o */
@@ -151,7 +151,7 @@ void parse_cmdline_args(int argc, char **argv,
 	}
 
 	/* 解析命令行参数 */
-	while ((opt = getopt_long(argc, argv, "hd:r:L:R:ASNFUMQ:czpq:i:m:k:g:n:tTf",
+	while ((opt = getopt_long(argc, argv, "hd:r:L:R:ASNFUMQ:czpq:i:m:k:g:n:tTfx:B",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'd':
@@ -320,6 +320,44 @@ void parse_cmdline_args(int argc, char **argv,
 			// 设置打印的标志
 			cfg->socketmap_flag = true;
 			break;
+		case 'x':
+			cfg->xsk = true;
+			// 检查文件路径长度是否超出限制
+			if (strlen(optarg) >= FILE_MAXSIZE) {
+				fprintf(stderr, "ERR: --xsk file name too long\n");
+				goto error;
+			}
+			// 设置检查规则文件路径
+			cfg->xsk_file = (char *)&cfg->xsk_file_buf;
+			strncpy(cfg->xsk_file, optarg, FILE_MAXSIZE);
+			break;
+		case 'B':
+			// AF_XDP 套接字忙轮询
+			cfg->xsk_busy_poll = true;
+			break;
+		case 5: /* --inspect-miss */
+			// 未命中 ACL 规则的报文也送往 AF_XDP
+			cfg->xsk_inspect_miss = true;
+			break;
+		case 6: /* --cgroup */
+			// sockmap 挂载的 cgroup，可以指定多个
+			if (cfg->nr_sock_cgroups >= MAX_SOCK_CGROUPS) {
+				fprintf(stderr, "ERR: more than %d --cgroup\n", MAX_SOCK_CGROUPS);
+				goto error;
+			}
+			cfg->sock_cgroups[cfg->nr_sock_cgroups++] = optarg;
+			break;
+		case 7: /* --sock-ports */
+			cfg->sock_ports = optarg;
+			break;
+		case 8: /* --metrics */
+			// 遥测指标的本地 HTTP 端口
+			cfg->metrics_port = atoi(optarg);
+			if (cfg->metrics_port <= 0 || cfg->metrics_port > 65535) {
+				fprintf(stderr, "ERR: --metrics port %s is invalid\n", optarg);
+				goto error;
+			}
+			break;
 		error:
 		default:
 			// 打印使用信息并退出
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* Used *ONLY* by BPF-prog running kernel side. */
+#ifndef __XACL_IPV4_KERN_H
+#define __XACL_IPV4_KERN_H
+
+#include "xacl_ipv4_kern_user.h"
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, XACL_META_MAX);
+} xacl_ipv4_meta SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct xacl_ipv4_tuple);
+	__uint(max_entries, 2 * XACL_MAX_TUPLES);
+} xacl_ipv4_tuples SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__type(key, struct xacl_lpm_key);
+	__type(value, struct xacl_lpm_val);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__uint(max_entries, 2 * XACL_MAX_RULES);
+} xacl_ipv4_src SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__type(key, struct xacl_lpm_key);
+	__type(value, struct xacl_lpm_val);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__uint(max_entries, 2 * XACL_MAX_RULES);
+} xacl_ipv4_dst SEC(".maps");
+
+/* 每个端口所命中的端口前缀长度集合，下标为 bank * XACL_NR_PORTS + 端口 */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, 2 * XACL_NR_PORTS);
+} xacl_ipv4_sport SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, 2 * XACL_NR_PORTS);
+} xacl_ipv4_dport SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, struct xacl_ipv4_key);
+	__type(value, struct xacl_ipv4_val);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__uint(max_entries, 2 * XACL_MAX_ENTRIES);
+} xacl_ipv4_rules SEC(".maps");
+
+static __always_inline __u32 xacl_addr_mask(__u8 len)
+{
+	return len ? 0xFFFFFFFFU << (32 - len) : 0;
+}
+
+static __always_inline __u16 xacl_port_mask(__u8 len)
+{
+	return len ? (__u16)(0xFFFFU << (16 - len)) : 0;
+}
+
+static __always_inline __u64 xacl_lpm_lens(void *trie, __u32 bank, __u32 addr)
+{
+	struct xacl_lpm_key key = {
+		.prefixlen = 8 + 32,
+		.data = { bank, addr >> 24, addr >> 16, addr >> 8, addr },
+	};
+	struct xacl_lpm_val *val = bpf_map_lookup_elem(trie, &key);
+
+	return val ? val->lens : 0;
+}
+
+static __always_inline __u32 xacl_port_lens(void *map, __u32 bank, __u16 port)
+{
+	__u32 key = bank * XACL_NR_PORTS + port;
+	__u32 *lens = bpf_map_lookup_elem(map, &key);
+
+	return lens ? *lens : 0;
+}
+
+/* 对主机序的五元组分类，返回命中规则的动作，未命中返回 XDP_PASS。
+ * 命中规则的序号写入 *rule，未命中为 XACL_NO_RULE。
+ */
+static __always_inline
+xdp_act xacl_ipv4_classify(__u32 saddr, __u32 daddr, __u16 sport, __u16 dport,
+			   __u16 ip_proto, __u32 *rule)
+{
+	struct xacl_ipv4_key key = {};
+	struct xacl_ipv4_tuple *t;
+	struct xacl_ipv4_val *v;
+	xdp_act action = XDP_PASS;
+	__u32 best = XACL_NO_RULE;
+	__u32 idx, bank, nr_tuples, *p;
+	__u64 slens, dlens;
+	__u32 splens, dplens;
+
+	*rule = XACL_NO_RULE;
+	idx = XACL_META_ACTIVE;
+	p = bpf_map_lookup_elem(&xacl_ipv4_meta, &idx);
+	if (!p)
+		return action;
+	bank = *p & 1;
+	p = bpf_map_lookup_elem(&xacl_ipv4_meta, &bank);
+	if (!p || !*p)
+		return action;
+	nr_tuples = *p;
+
+	// 先求出各字段可能命中的前缀长度，不可能命中的元组不必查表
+	slens = xacl_lpm_lens(&xacl_ipv4_src, bank, saddr);
+	dlens = xacl_lpm_lens(&xacl_ipv4_dst, bank, daddr);
+	splens = xacl_port_lens(&xacl_ipv4_sport, bank, sport);
+	dplens = xacl_port_lens(&xacl_ipv4_dport, bank, dport);
+	if (!slens || !dlens || !splens || !dplens)
+		return action;
+
+	for (__u32 i = 0; i < XACL_MAX_TUPLES; i++) {
+		if (i >= nr_tuples)
+			break;
+		idx = bank * XACL_MAX_TUPLES + i;
+		t = bpf_map_lookup_elem(&xacl_ipv4_tuples, &idx);
+		if (!t)
+			break;
+		// 元组按其中最优先的规则排序，后面的元组不可能再胜出
+		if (t->min_prio >= best)
+			break;
+		if (t->saddr_len > 32 || t->daddr_len > 32 || t->sport_len > 16 || t->dport_len > 16)
+			continue;
+		if (!((slens >> t->saddr_len) & 1) || !((dlens >> t->daddr_len) & 1) ||
+		    !((splens >> t->sport_len) & 1) || !((dplens >> t->dport_len) & 1))
+			continue;
+
+		key.tuple = idx;
+		key.saddr = saddr & xacl_addr_mask(t->saddr_len);
+		key.daddr = daddr & xacl_addr_mask(t->daddr_len);
+		key.sport = sport & xacl_port_mask(t->sport_len);
+		key.dport = dport & xacl_port_mask(t->dport_len);
+		key.ip_proto = t->has_proto ? ip_proto : 0;
+		v = bpf_map_lookup_elem(&xacl_ipv4_rules, &key);
+		if (v && v->prio < best) {
+			best = v->prio;
+			action = v->action;
+		}
+	}
+
+	*rule = best;
+	return action;
+}
+
+#endif /* __XACL_IPV4_KERN_H */
@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* IPv4 ACL 分类器，内核与用户态共享的结构
+ *
+ * 规则按 (源前缀长度, 目的前缀长度, 源端口前缀长度, 目的端口前缀长度, 是否指定协议)
+ * 划分为若干元组空间，同一元组内的规则按掩码后的五元组放进同一个哈希表，
+ * 每个包只需对每个可能命中的元组做一次哈希查找，查找次数与规则数无关。
+ * 端口范围在用户态被拆成若干对齐的前缀块。
+ *
+ * 所有表都分为两个bank，用户态写入未生效的bank后再切换，规则重载期间不会漏匹配。
+ */
+#ifndef __XACL_IPV4_KERN_USER_H
+#define __XACL_IPV4_KERN_USER_H
+
+#include <linux/types.h>
+
+#define XACL_MAX_RULES		131072	// 单次加载的规则数上限
+#define XACL_MAX_ENTRIES	262144	// 每个bank中端口范围展开后的表项数上限
+#define XACL_MAX_TUPLES		128	// 每个bank中的元组空间数上限
+#define XACL_NR_PORTS		65536
+#define XACL_NO_RULE		0xFFFFFFFFU
+
+/* xacl_ipv4_meta 的下标：0/1 为对应bank的元组数，2 为当前生效的bank */
+#define XACL_META_ACTIVE	2
+#define XACL_META_MAX		3
+
+struct xacl_ipv4_tuple {
+	__u8  saddr_len;
+	__u8  daddr_len;
+	__u8  sport_len;	// 0~16，16为精确端口，0为任意端口
+	__u8  dport_len;
+	__u8  has_proto;
+	__u8  pad[3];
+	__u32 min_prio;		// 元组内优先级最高(序号最小)的规则，元组按它升序排列
+};
+
+/* 前缀查找的键，data 依次为 bank 和网络序的 IPv4 地址 */
+struct xacl_lpm_key {
+	__u32 prefixlen;
+	__u8  data[5];
+} __attribute__((packed));
+
+/* 地址所命中的前缀长度集合，第 L 位表示存在长度为 L 的规则前缀包含该地址 */
+struct xacl_lpm_val {
+	__u64 lens;
+};
+
+struct xacl_ipv4_key {
+	__u32 tuple;		// bank * XACL_MAX_TUPLES + 元组下标
+	__u32 saddr;		// 以下字段均已按元组的掩码截断
+	__u32 daddr;
+	__u16 sport;
+	__u16 dport;
+	__u32 ip_proto;
+};
+
+struct xacl_ipv4_val {
+	__u32 prio;		// 规则在配置文件中的序号，越小越优先
+	__u32 action;
+};
+
+#endif /* __XACL_IPV4_KERN_USER_H */
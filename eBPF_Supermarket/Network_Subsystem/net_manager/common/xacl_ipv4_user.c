@@ -0,0 +1,581 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+
+#include "common_defines.h"
+#include "common_user_bpf_xdp.h"
+#include "xacl_ipv4_user.h"
+
+#define TUPLE_HASH_SIZE		256	// 2 * XACL_MAX_TUPLES
+#define ENTRY_HASH_SIZE		(2 * XACL_MAX_ENTRIES)
+#define MAX_PORT_BLOCKS		32
+
+struct port_block {
+	__u16 value;
+	__u8  len;
+};
+
+struct tuple_slot {
+	__u32 sig;
+	__u32 min_prio;
+};
+
+struct entry {
+	struct xacl_ipv4_key key;	// key.tuple 暂存编译期的元组下标
+	struct xacl_ipv4_val val;
+};
+
+/* 编译期的状态，规则数较多时这些数组都比较大，统一放在堆上 */
+struct compiler {
+	struct tuple_slot tuples[XACL_MAX_TUPLES];
+	int tuple_hash[TUPLE_HASH_SIZE];	// 元组下标 + 1
+	__u32 nr_tuples;
+
+	struct entry *entries;
+	__u32 *entry_hash;			// 表项下标 + 1
+	__u32 nr_entries;
+
+	__u64 *src_set, *dst_set;		// 出现过的 (地址 << 8 | 前缀长度) + 1
+	__u8 *sport_start, *dport_start;	// [len][value >> (16 - len)]
+};
+
+static __u32 addr_mask(__u8 len)
+{
+	return len ? 0xFFFFFFFFU << (32 - len) : 0;
+}
+
+static int parse_ports(const char *s, __u16 *min, __u16 *max)
+{
+	unsigned int lo, hi;
+
+	if (sscanf(s, "%u-%u", &lo, &hi) == 2) {
+		if (lo > hi || hi > 65535)
+			return -1;
+	} else if (sscanf(s, "%u", &lo) == 1) {
+		if (lo > 65535)
+			return -1;
+		hi = lo ? lo : 65535;	// 0 匹配所有端口
+	} else {
+		return -1;
+	}
+	*min = lo;
+	*max = hi;
+	return 0;
+}
+
+static int parse_cidr(const char *s, __u32 *addr, __u8 *len)
+{
+	unsigned int a[4], l;
+
+	if (sscanf(s, "%u.%u.%u.%u/%u", &a[0], &a[1], &a[2], &a[3], &l) != 5 ||
+	    a[0] > 255 || a[1] > 255 || a[2] > 255 || a[3] > 255 || l > 32)
+		return -1;
+	*len = l;
+	*addr = ((a[0] << 24) | (a[1] << 16) | (a[2] << 8) | a[3]) & addr_mask(l);
+	return 0;
+}
+
+int xacl_ipv4_parse_rule(const char *line, struct xacl_ipv4_rule *rule)
+{
+	char src[32], dst[32], sport[16], dport[16], proto[10], action[10];
+	int n;
+
+	memset(rule, 0, sizeof(*rule));
+	n = sscanf(line, "%31s %31s %15s %15s %9s %9s", src, dst, sport, dport, proto, action);
+	if (n <= 0 || src[0] == '#')
+		return 1;
+	if (n != 6 || parse_cidr(src, &rule->saddr, &rule->saddr_len) ||
+	    parse_cidr(dst, &rule->daddr, &rule->daddr_len) ||
+	    parse_ports(sport, &rule->sport_min, &rule->sport_max) ||
+	    parse_ports(dport, &rule->dport_min, &rule->dport_max))
+		return -1;
+
+	if (strcmp("TCP", proto) == 0)
+		rule->ip_proto = IPPROTO_TCP;
+	else if (strcmp("UDP", proto) == 0)
+		rule->ip_proto = IPPROTO_UDP;
+	else if (strcmp("ICMP", proto) == 0)
+		rule->ip_proto = IPPROTO_ICMP;
+	else
+		rule->ip_proto = 0;
+
+	if (strcmp("ALLOW", action) == 0)
+		rule->action = XDP_PASS;
+	else if (strcmp("DENY", action) == 0)
+		rule->action = XDP_DROP;
+	else if (strcmp("INSPECT", action) == 0)
+		rule->action = XDP_REDIRECT;	// 送往 AF_XDP 慢路径，见 xsk_kern_user.h
+	else
+		rule->action = XDP_ABORTED;
+
+	return 0;
+}
+
+int xacl_ipv4_read_rules(const char *path, struct xacl_ipv4_rule **rules, __u32 *nr)
+{
+	struct xacl_ipv4_rule *r = NULL, *tmp;
+	__u32 n = 0, cap = 0, lineno = 0;
+	char line[256];
+	FILE *file;
+	int err;
+
+	file = fopen(path, "r");
+	if (!file) {
+		perror("Error opening file");
+		return -errno;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		lineno++;
+		if (n == cap) {
+			cap = cap ? cap * 2 : 256;
+			tmp = realloc(r, cap * sizeof(*r));
+			if (!tmp) {
+				err = -ENOMEM;
+				goto err;
+			}
+			r = tmp;
+		}
+		err = xacl_ipv4_parse_rule(line, &r[n]);
+		if (err < 0) {
+			fprintf(stderr, "ERR: %s:%u: invalid rule: %s", path, lineno, line);
+			err = -EINVAL;
+			goto err;
+		}
+		if (err == 0)
+			n++;
+		if (n > XACL_MAX_RULES) {
+			fprintf(stderr, "ERR: more than %d rules in %s\n", XACL_MAX_RULES, path);
+			err = -E2BIG;
+			goto err;
+		}
+	}
+	fclose(file);
+	*rules = r;
+	*nr = n;
+	return 0;
+err:
+	fclose(file);
+	free(r);
+	return err;
+}
+
+int xacl_ipv4_open_maps(const char *pin_dir, struct xacl_ipv4_maps *maps)
+{
+	maps->meta = open_bpf_map_file(pin_dir, "xacl_ipv4_meta", NULL);
+	maps->tuples = open_bpf_map_file(pin_dir, "xacl_ipv4_tuples", NULL);
+	maps->src = open_bpf_map_file(pin_dir, "xacl_ipv4_src", NULL);
+	maps->dst = open_bpf_map_file(pin_dir, "xacl_ipv4_dst", NULL);
+	maps->sport = open_bpf_map_file(pin_dir, "xacl_ipv4_sport", NULL);
+	maps->dport = open_bpf_map_file(pin_dir, "xacl_ipv4_dport", NULL);
+	maps->rules = open_bpf_map_file(pin_dir, "xacl_ipv4_rules", NULL);
+	if (maps->meta < 0 || maps->tuples < 0 || maps->src < 0 || maps->dst < 0 ||
+	    maps->sport < 0 || maps->dport < 0 || maps->rules < 0)
+		return -1;
+	return 0;
+}
+
+/* 把端口区间拆成对齐的前缀块，最多 30 个 */
+static int port_blocks(__u16 min, __u16 max, struct port_block *out)
+{
+	__u32 lo = min, hi = max;
+	int n = 0;
+
+	while (lo <= hi) {
+		int bits = 0;
+
+		while (bits < 16 && !(lo & ((2U << bits) - 1)) && lo + (2U << bits) - 1 <= hi)
+			bits++;
+		out[n].value = lo;
+		out[n].len = 16 - bits;
+		n++;
+		lo += 1U << bits;
+	}
+	return n;
+}
+
+static __u32 hash_bytes(const void *data, size_t len)
+{
+	const __u8 *p = data;
+	__u32 h = 2166136261U;
+
+	while (len--)
+		h = (h ^ *p++) * 16777619U;
+	return h;
+}
+
+static void set_add(__u64 *set, __u64 v)
+{
+	__u32 h = hash_bytes(&v, sizeof(v)) & (2 * XACL_MAX_RULES - 1);
+
+	while (set[h] && set[h] != v + 1)
+		h = (h + 1) & (2 * XACL_MAX_RULES - 1);
+	set[h] = v + 1;
+}
+
+static int set_has(const __u64 *set, __u64 v)
+{
+	__u32 h = hash_bytes(&v, sizeof(v)) & (2 * XACL_MAX_RULES - 1);
+
+	while (set[h]) {
+		if (set[h] == v + 1)
+			return 1;
+		h = (h + 1) & (2 * XACL_MAX_RULES - 1);
+	}
+	return 0;
+}
+
+static int get_tuple(struct compiler *c, __u32 sig, __u32 prio)
+{
+	__u32 h = hash_bytes(&sig, sizeof(sig)) & (TUPLE_HASH_SIZE - 1);
+	int idx;
+
+	while (c->tuple_hash[h]) {
+		idx = c->tuple_hash[h] - 1;
+		if (c->tuples[idx].sig == sig)
+			return idx;
+		h = (h + 1) & (TUPLE_HASH_SIZE - 1);
+	}
+	if (c->nr_tuples >= XACL_MAX_TUPLES)
+		return -1;
+	idx = c->nr_tuples++;
+	c->tuples[idx].sig = sig;
+	c->tuples[idx].min_prio = prio;
+	c->tuple_hash[h] = idx + 1;
+	return idx;
+}
+
+/* 同一元组内掩码后相同的表项只保留最先出现的规则，后面的规则被它完全遮蔽 */
+static int add_entry(struct compiler *c, const struct xacl_ipv4_key *key, __u32 prio, __u16 action)
+{
+	__u32 h = hash_bytes(key, sizeof(*key)) & (ENTRY_HASH_SIZE - 1);
+	struct entry *e;
+
+	while (c->entry_hash[h]) {
+		if (!memcmp(&c->entries[c->entry_hash[h] - 1].key, key, sizeof(*key)))
+			return 0;
+		h = (h + 1) & (ENTRY_HASH_SIZE - 1);
+	}
+	if (c->nr_entries >= XACL_MAX_ENTRIES)
+		return -1;
+	e = &c->entries[c->nr_entries];
+	e->key = *key;
+	e->val.prio = prio;
+	e->val.action = action;
+	c->entry_hash[h] = ++c->nr_entries;
+	return 0;
+}
+
+static int compile_rule(struct compiler *c, const struct xacl_ipv4_rule *r, __u32 prio)
+{
+	struct port_block sb[MAX_PORT_BLOCKS], db[MAX_PORT_BLOCKS];
+	int nr_sb = port_blocks(r->sport_min, r->sport_max, sb);
+	int nr_db = port_blocks(r->dport_min, r->dport_max, db);
+	struct xacl_ipv4_key key = {};
+
+	set_add(c->src_set, (__u64)r->saddr << 8 | r->saddr_len);
+	set_add(c->dst_set, (__u64)r->daddr << 8 | r->daddr_len);
+	for (int i = 0; i < nr_sb; i++)
+		c->sport_start[(1 << sb[i].len) + (sb[i].value >> (16 - sb[i].len))] = 1;
+	for (int i = 0; i < nr_db; i++)
+		c->dport_start[(1 << db[i].len) + (db[i].value >> (16 - db[i].len))] = 1;
+
+	for (int i = 0; i < nr_sb; i++) {
+		for (int j = 0; j < nr_db; j++) {
+			__u32 sig = r->saddr_len | r->daddr_len << 6 | sb[i].len << 12 |
+				    db[j].len << 17 | (r->ip_proto ? 1 : 0) << 22;
+			int t = get_tuple(c, sig, prio);
+
+			if (t < 0) {
+				fprintf(stderr, "ERR: rules need more than %d tuple spaces\n", XACL_MAX_TUPLES);
+				return -E2BIG;
+			}
+			key.tuple = t;
+			key.saddr = r->saddr;
+			key.daddr = r->daddr;
+			key.sport = sb[i].value;
+			key.dport = db[j].value;
+			key.ip_proto = r->ip_proto;
+			if (add_entry(c, &key, prio, r->action)) {
+				fprintf(stderr, "ERR: rules expand to more than %d entries\n", XACL_MAX_ENTRIES);
+				return -E2BIG;
+			}
+		}
+	}
+	return 0;
+}
+
+static void free_compiler(struct compiler *c)
+{
+	if (!c)
+		return;
+	free(c->entries);
+	free(c->entry_hash);
+	free(c->src_set);
+	free(c->dst_set);
+	free(c->sport_start);
+	free(c->dport_start);
+	free(c);
+}
+
+static struct compiler *new_compiler(void)
+{
+	struct compiler *c = calloc(1, sizeof(*c));
+
+	if (!c)
+		return NULL;
+	c->entries = calloc(XACL_MAX_ENTRIES, sizeof(*c->entries));
+	c->entry_hash = calloc(ENTRY_HASH_SIZE, sizeof(*c->entry_hash));
+	c->src_set = calloc(2 * XACL_MAX_RULES, sizeof(*c->src_set));
+	c->dst_set = calloc(2 * XACL_MAX_RULES, sizeof(*c->dst_set));
+	c->sport_start = calloc(2 << 16, 1);
+	c->dport_start = calloc(2 << 16, 1);
+	if (!c->entries || !c->entry_hash || !c->src_set || !c->dst_set ||
+	    !c->sport_start || !c->dport_start) {
+		free_compiler(c);
+		return NULL;
+	}
+	return c;
+}
+
+static int update_elems(int fd, const void *keys, size_t key_size,
+			const void *values, size_t value_size, __u32 count)
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
+		.elem_flags = 0,
+		.flags = 0,
+	);
+	__u32 n = count;
+
+	if (!count || !bpf_map_update_batch(fd, keys, values, &n, &opts))
+		return 0;
+	// 内核不支持批量操作时逐个更新
+	for (__u32 i = 0; i < count; i++) {
+		if (bpf_map_update_elem(fd, (const char *)keys + i * key_size,
+					(const char *)values + i * value_size, BPF_ANY)) {
+			fprintf(stderr, "ERR: updating map: %s\n", strerror(errno));
+			return -errno;
+		}
+	}
+	return 0;
+}
+
+/* 删除某个bank的全部表项，先收集再删除，避免边遍历边删除 */
+static int clear_bank(int fd, size_t key_size, __u32 max_entries,
+		      int (*in_bank)(const void *key, __u32 bank), __u32 bank)
+{
+	char *keys = malloc((size_t)max_entries * key_size);
+	char cur[64], *prev = NULL;
+	__u32 n = 0;
+
+	if (!keys)
+		return -ENOMEM;
+	while (n < max_entries && !bpf_map_get_next_key(fd, prev, cur)) {
+		if (in_bank(cur, bank))
+			memcpy(keys + (size_t)n++ * key_size, cur, key_size);
+		prev = cur;
+	}
+	for (__u32 i = 0; i < n; i++)
+		bpf_map_delete_elem(fd, keys + i * key_size);
+	free(keys);
+	return n;
+}
+
+static int rule_in_bank(const void *key, __u32 bank)
+{
+	return ((const struct xacl_ipv4_key *)key)->tuple / XACL_MAX_TUPLES == bank;
+}
+
+static int lpm_in_bank(const void *key, __u32 bank)
+{
+	return ((const struct xacl_lpm_key *)key)->data[0] == bank;
+}
+
+static int clear_bank_all(const struct xacl_ipv4_maps *maps, __u32 bank)
+{
+	int n = 0, err;
+	__u32 zero = 0;
+
+	bpf_map_update_elem(maps->meta, &bank, &zero, BPF_ANY);
+	err = clear_bank(maps->rules, sizeof(struct xacl_ipv4_key), 2 * XACL_MAX_ENTRIES, rule_in_bank, bank);
+	if (err < 0)
+		return err;
+	n += err;
+	err = clear_bank(maps->src, sizeof(struct xacl_lpm_key), 2 * XACL_MAX_RULES, lpm_in_bank, bank);
+	if (err < 0)
+		return err;
+	err = clear_bank(maps->dst, sizeof(struct xacl_lpm_key), 2 * XACL_MAX_RULES, lpm_in_bank, bank);
+	if (err < 0)
+		return err;
+	return n;
+}
+
+/* 每个前缀对应的值是包含它的所有规则前缀的长度集合，最长前缀匹配命中它时，
+ * 这正是包含该地址的所有规则前缀的长度
+ */
+static int write_lpm(int fd, const __u64 *set, __u32 bank)
+{
+	for (__u32 i = 0; i < 2 * XACL_MAX_RULES; i++) {
+		struct xacl_lpm_key key = {};
+		struct xacl_lpm_val val = {};
+		__u32 addr;
+		__u8 len;
+
+		if (!set[i])
+			continue;
+		addr = (set[i] - 1) >> 8;
+		len = (set[i] - 1) & 0xFF;
+		for (__u8 l = 0; l <= len; l++)
+			if (set_has(set, (__u64)(addr & addr_mask(l)) << 8 | l))
+				val.lens |= 1ULL << l;
+
+		key.prefixlen = 8 + len;
+		key.data[0] = bank;
+		key.data[1] = addr >> 24;
+		key.data[2] = addr >> 16;
+		key.data[3] = addr >> 8;
+		key.data[4] = addr;
+		if (bpf_map_update_elem(fd, &key, &val, BPF_ANY)) {
+			fprintf(stderr, "ERR: updating prefix map: %s\n", strerror(errno));
+			return -errno;
+		}
+	}
+	return 0;
+}
+
+static int write_ports(int fd, const __u8 *start, __u32 bank)
+{
+	__u32 *keys = malloc(XACL_NR_PORTS * sizeof(*keys));
+	__u32 *lens = calloc(XACL_NR_PORTS, sizeof(*lens));
+	int err = -ENOMEM;
+
+	if (!keys || !lens)
+		goto out;
+	for (__u32 port = 0; port < XACL_NR_PORTS; port++) {
+		keys[port] = bank * XACL_NR_PORTS + port;
+		for (int len = 0; len <= 16; len++)
+			if (start[(1 << len) + (port >> (16 - len))])
+				lens[port] |= 1U << len;
+	}
+	err = update_elems(fd, keys, sizeof(*keys), lens, sizeof(*lens), XACL_NR_PORTS);
+out:
+	free(keys);
+	free(lens);
+	return err;
+}
+
+static int cmp_tuple(const void *a, const void *b)
+{
+	const struct xacl_ipv4_tuple *x = a, *y = b;
+
+	return x->min_prio < y->min_prio ? -1 : x->min_prio > y->min_prio;
+}
+
+int xacl_ipv4_load(const struct xacl_ipv4_maps *maps,
+		   const struct xacl_ipv4_rule *rules, __u32 nr)
+{
+	struct xacl_ipv4_tuple tuples[XACL_MAX_TUPLES] = {};
+	__u32 remap[XACL_MAX_TUPLES], tuple_keys[XACL_MAX_TUPLES];
+	struct xacl_ipv4_key *keys = NULL;
+	struct xacl_ipv4_val *vals = NULL;
+	__u32 active = 0, bank, key = XACL_META_ACTIVE;
+	struct compiler *c;
+	int err;
+
+	if (nr > XACL_MAX_RULES)
+		return -E2BIG;
+	c = new_compiler();
+	if (!c)
+		return -ENOMEM;
+	for (__u32 i = 0; i < nr; i++) {
+		err = compile_rule(c, &rules[i], i);
+		if (err)
+			goto out;
+	}
+
+	// 元组按其中最优先的规则排序，内核据此提前结束查找
+	for (__u32 i = 0; i < c->nr_tuples; i++) {
+		__u32 sig = c->tuples[i].sig;
+
+		tuples[i].saddr_len = sig & 0x3F;
+		tuples[i].daddr_len = (sig >> 6) & 0x3F;
+		tuples[i].sport_len = (sig >> 12) & 0x1F;
+		tuples[i].dport_len = (sig >> 17) & 0x1F;
+		tuples[i].has_proto = (sig >> 22) & 1;
+		tuples[i].pad[0] = i;	// 暂存编译期下标
+		tuples[i].min_prio = c->tuples[i].min_prio;
+	}
+	qsort(tuples, c->nr_tuples, sizeof(tuples[0]), cmp_tuple);
+
+	bpf_map_lookup_elem(maps->meta, &key, &active);
+	bank = !(active & 1);
+	err = clear_bank_all(maps, bank);
+	if (err < 0)
+		goto out;
+
+	for (__u32 i = 0; i < c->nr_tuples; i++) {
+		remap[tuples[i].pad[0]] = i;
+		tuples[i].pad[0] = 0;
+		tuple_keys[i] = bank * XACL_MAX_TUPLES + i;
+	}
+	err = update_elems(maps->tuples, tuple_keys, sizeof(tuple_keys[0]),
+			   tuples, sizeof(tuples[0]), c->nr_tuples);
+	if (err)
+		goto out;
+
+	keys = malloc((size_t)c->nr_entries * sizeof(*keys));
+	vals = malloc((size_t)c->nr_entries * sizeof(*vals));
+	if (c->nr_entries && (!keys || !vals)) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (__u32 i = 0; i < c->nr_entries; i++) {
+		keys[i] = c->entries[i].key;
+		keys[i].tuple = bank * XACL_MAX_TUPLES + remap[keys[i].tuple];
+		vals[i] = c->entries[i].val;
+	}
+	err = update_elems(maps->rules, keys, sizeof(*keys), vals, sizeof(*vals), c->nr_entries);
+	if (err)
+		goto out;
+
+	err = write_lpm(maps->src, c->src_set, bank);
+	if (!err)
+		err = write_lpm(maps->dst, c->dst_set, bank);
+	if (!err)
+		err = write_ports(maps->sport, c->sport_start, bank);
+	if (!err)
+		err = write_ports(maps->dport, c->dport_start, bank);
+	if (err)
+		goto out;
+
+	// 新bank写完后才切换，旧bank随后清空
+	if (bpf_map_update_elem(maps->meta, &bank, &c->nr_tuples, BPF_ANY) ||
+	    bpf_map_update_elem(maps->meta, &key, &bank, BPF_ANY)) {
+		err = -errno;
+		goto out;
+	}
+	printf("%u rules compiled into %u tuple spaces, %u entries\n", nr, c->nr_tuples, c->nr_entries);
+	err = clear_bank_all(maps, !bank);
+	if (err > 0)
+		err = 0;
+out:
+	free(keys);
+	free(vals);
+	free_compiler(c);
+	return err;
+}
+
+int xacl_ipv4_clear(const struct xacl_ipv4_maps *maps)
+{
+	int n0 = clear_bank_all(maps, 0);
+	int n1 = clear_bank_all(maps, 1);
+
+	if (n0 < 0)
+		return n0;
+	if (n1 < 0)
+		return n1;
+	return n0 + n1;
+}
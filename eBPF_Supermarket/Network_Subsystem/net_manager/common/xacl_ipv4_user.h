@@ -0,0 +1,49 @@
+/* IPv4 ACL 分类器的用户态部分：解析规则并编译成元组空间写入BPF映射 */
+#ifndef __XACL_IPV4_USER_H
+#define __XACL_IPV4_USER_H
+
+#include <linux/types.h>
+#include "xacl_ipv4_kern_user.h"
+
+/* 配置文件中的一条规则，地址为主机序，端口为闭区间 */
+struct xacl_ipv4_rule {
+	__u32 saddr;
+	__u32 daddr;
+	__u8  saddr_len;
+	__u8  daddr_len;
+	__u16 sport_min;
+	__u16 sport_max;
+	__u16 dport_min;
+	__u16 dport_max;
+	__u16 ip_proto;		// 0 为任意协议
+	__u16 action;
+};
+
+struct xacl_ipv4_maps {
+	int meta;
+	int tuples;
+	int src;
+	int dst;
+	int sport;
+	int dport;
+	int rules;
+};
+
+/* 解析一行 "SRC/LEN DST/LEN SPORT DPORT PROTO ACTION"，端口可写成 LO-HI，0 为任意端口。
+ * 成功返回0，空行或注释返回1，格式错误返回-1
+ */
+int xacl_ipv4_parse_rule(const char *line, struct xacl_ipv4_rule *rule);
+
+/* 读取整个配置文件，*rules 由调用者 free */
+int xacl_ipv4_read_rules(const char *path, struct xacl_ipv4_rule **rules, __u32 *nr);
+
+int xacl_ipv4_open_maps(const char *pin_dir, struct xacl_ipv4_maps *maps);
+
+/* 把规则编译到未生效的bank中，再原子地切换过去 */
+int xacl_ipv4_load(const struct xacl_ipv4_maps *maps,
+		   const struct xacl_ipv4_rule *rules, __u32 nr);
+
+/* 清空两个bank，返回被删除的表项数 */
+int xacl_ipv4_clear(const struct xacl_ipv4_maps *maps);
+
+#endif /* __XACL_IPV4_USER_H */
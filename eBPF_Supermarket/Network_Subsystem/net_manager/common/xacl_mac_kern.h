@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* Used *ONLY* by BPF-prog running kernel side. */
+#ifndef __XACL_MAC_KERN_H
+#define __XACL_MAC_KERN_H
+
+#include "xacl_mac_kern_user.h"
+
+/* 唯一的一项为当前生效的bank */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, 1);
+} xacl_mac_meta SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct xacl_mac_bank);
+	__uint(max_entries, 2);
+} xacl_mac_banks SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, struct xacl_mac_key);
+	__type(value, struct xacl_mac_class);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__uint(max_entries, 2 * XACL_MAC_MAX_RULES);
+} xacl_mac_src SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, struct xacl_mac_key);
+	__type(value, struct xacl_mac_class);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__uint(max_entries, 2 * XACL_MAC_MAX_RULES);
+} xacl_mac_dst SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, struct xacl_mac_pair_key);
+	__type(value, struct xacl_mac_val);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__uint(max_entries, 2 * XACL_MAC_MAX_PAIRS);
+} xacl_mac_pairs SEC(".maps");
+
+/* 先按精确地址查找，未命中且该 bank 有 OUI 表项时再按 OUI 查找 */
+static __always_inline
+struct xacl_mac_class *xacl_mac_lookup(void *map, __u32 bank, const __u8 *mac, int has_oui)
+{
+	struct xacl_mac_key key = { .bank = bank };
+	struct xacl_mac_class *c;
+
+	__builtin_memcpy(key.mac, mac, 6);
+	c = bpf_map_lookup_elem(map, &key);
+	if (c || !has_oui)
+		return c;
+	key.oui = 1;
+	key.mac[3] = 0;
+	key.mac[4] = 0;
+	key.mac[5] = 0;
+	return bpf_map_lookup_elem(map, &key);
+}
+
+/* 返回命中规则的动作，未命中返回 XDP_PASS。
+ * 命中规则的序号写入 *rule，未命中为 XACL_MAC_NO_RULE。
+ */
+static __always_inline
+xdp_act xacl_mac_classify(const __u8 *src, const __u8 *dst, __u32 *rule)
+{
+	struct xacl_mac_pair_key pk;
+	struct xacl_mac_class *s, *d;
+	struct xacl_mac_bank *b;
+	struct xacl_mac_val *p;
+	xdp_act action = XDP_PASS;
+	__u32 idx = 0, bank, best, *active;
+
+	*rule = XACL_MAC_NO_RULE;
+	active = bpf_map_lookup_elem(&xacl_mac_meta, &idx);
+	if (!active)
+		return action;
+	bank = *active & 1;
+	b = bpf_map_lookup_elem(&xacl_mac_banks, &bank);
+	if (!b)
+		return action;
+	best = XACL_MAC_NO_RULE;
+	if (b->flags & XACL_MAC_F_DEFAULT) {
+		best = b->def_prio;
+		action = b->def_action;
+	}
+
+	s = xacl_mac_lookup(&xacl_mac_src, bank, src, b->flags & XACL_MAC_F_SRC_OUI);
+	d = xacl_mac_lookup(&xacl_mac_dst, bank, dst, b->flags & XACL_MAC_F_DST_OUI);
+	if (s && s->prio < best) {
+		best = s->prio;
+		action = s->action;
+	}
+	if (d && d->prio < best) {
+		best = d->prio;
+		action = d->action;
+	}
+	if (s && d && s->pairs && d->pairs) {
+		pk.src = s->id;
+		pk.dst = d->id;
+		p = bpf_map_lookup_elem(&xacl_mac_pairs, &pk);
+		if (p && p->prio < best) {
+			best = p->prio;
+			action = p->action;
+		}
+	}
+	*rule = best;
+	return action;
+}
+
+#endif /* __XACL_MAC_KERN_H */
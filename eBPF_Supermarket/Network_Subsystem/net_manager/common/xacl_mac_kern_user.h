@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* MAC ACL，内核与用户态共享的结构
+ *
+ * 规则的源、目的 MAC 各自可以是精确地址、OUI（后三个字节为0，匹配同一厂商前缀）
+ * 或任意地址（全0）。用户态把规则编译成三张精确匹配的哈希表：
+ *   - 源表、目的表：每个出现过的源/目的地址或 OUI 一项，值为另一端为任意地址的规则中
+ *     最优先的一条（已考虑覆盖它的 OUI 规则）；
+ *   - 地址对表：源、目的都指定的规则，按 (源表项, 目的表项) 展开；
+ * 两端都为任意地址的规则放在 bank 的描述中。报文在源表、目的表中各查一次，
+ * 两者都命中且都有地址对时再查一次地址对表，取序号最小的规则，查找次数与规则数无关。
+ * 只有配置了 OUI 规则时，精确地址未命中才会再按 OUI 查一次。
+ *
+ * 所有表都分为两个bank，用户态写入未生效的bank后再切换，规则重载期间不会漏匹配。
+ */
+#ifndef __XACL_MAC_KERN_USER_H
+#define __XACL_MAC_KERN_USER_H
+
+#include <linux/types.h>
+
+#define XACL_MAC_MAX_RULES	16384	// 单次加载的规则数上限
+#define XACL_MAC_MAX_PAIRS	65536	// 每个bank中地址对表项数上限
+#define XACL_MAC_NO_RULE	0xFFFFFFFFU
+#define XACL_MAC_BANK_SHIFT	31	// 表项编号的最高位为 bank
+
+/* xacl_mac_bank.flags */
+#define XACL_MAC_F_SRC_OUI	0x1	// 源表中有 OUI 表项
+#define XACL_MAC_F_DST_OUI	0x2
+#define XACL_MAC_F_DEFAULT	0x4	// def_prio/def_action 有效
+
+struct xacl_mac_bank {
+	__u32 def_prio;		// 源、目的都为任意地址的规则
+	__u32 def_action;
+	__u32 flags;
+	__u32 pad;
+};
+
+/* 源表、目的表的键 */
+struct xacl_mac_key {
+	__u8 bank;
+	__u8 oui;		// 1 表示 OUI 表项，mac 的后三个字节为0
+	__u8 mac[6];
+};
+
+struct xacl_mac_class {
+	__u32 id;		// 地址对表中使用的编号，含 bank
+	__u32 prio;		// 规则在配置文件中的序号，越小越优先
+	__u32 action;
+	__u32 pairs;		// 非0表示地址对表中有该表项参与的项
+};
+
+struct xacl_mac_pair_key {
+	__u32 src;		// 源表项编号
+	__u32 dst;		// 目的表项编号
+};
+
+struct xacl_mac_val {
+	__u32 prio;
+	__u32 action;
+};
+
+#endif /* __XACL_MAC_KERN_USER_H */
@@ -0,0 +1,488 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+
+#include "common_defines.h"
+#include "common_user_bpf_xdp.h"
+#include "xacl_mac_user.h"
+
+enum {
+	SEL_ANY = 0,
+	SEL_OUI,
+	SEL_EXACT,
+};
+
+/* 源或目的一侧出现过的一个精确地址或 OUI */
+struct mac_class {
+	__u8 mac[6];
+	__u8 oui;
+	struct xacl_mac_class val;
+};
+
+struct pair_ent {
+	__u32 src;		// 编译期的表项下标
+	__u32 dst;
+	struct xacl_mac_val val;
+};
+
+static const __u8 zero_mac[6];
+
+static int sel_kind(const __u8 *mac)
+{
+	if (!memcmp(mac, zero_mac, 6))
+		return SEL_ANY;
+	if (!memcmp(mac + 3, zero_mac, 3))
+		return SEL_OUI;
+	return SEL_EXACT;
+}
+
+static int parse_mac(const char *s, __u8 *mac)
+{
+	char c;
+
+	return sscanf(s, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx%c", &mac[0], &mac[1], &mac[2],
+		      &mac[3], &mac[4], &mac[5], &c) == 6 ? 0 : -1;
+}
+
+int xacl_mac_parse_rule(const char *line, struct xacl_mac_rule *rule)
+{
+	char src[32], dst[32], action[10];
+	const char *act;
+	int n;
+
+	memset(rule, 0, sizeof(*rule));
+	n = sscanf(line, "%31s %31s %9s", src, dst, action);
+	if (n <= 0 || src[0] == '#')
+		return 1;
+	if (n < 2 || parse_mac(src, rule->src))
+		return -1;
+	if (n == 2) {
+		act = dst;	// 省略目的地址
+	} else {
+		if (parse_mac(dst, rule->dst))
+			return -1;
+		act = action;
+	}
+
+	if (strcmp("ALLOW", act) == 0)
+		rule->action = XDP_PASS;
+	else if (strcmp("DENY", act) == 0)
+		rule->action = XDP_DROP;
+	else
+		rule->action = XDP_ABORTED;
+
+	return 0;
+}
+
+int xacl_mac_read_rules(const char *path, struct xacl_mac_rule **rules, __u32 *nr)
+{
+	struct xacl_mac_rule *r = NULL, *tmp;
+	__u32 n = 0, cap = 0, lineno = 0;
+	char line[256];
+	FILE *file;
+	int err;
+
+	file = fopen(path, "r");
+	if (!file) {
+		perror("Error opening file");
+		return -errno;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		lineno++;
+		if (n == cap) {
+			cap = cap ? cap * 2 : 256;
+			tmp = realloc(r, cap * sizeof(*r));
+			if (!tmp) {
+				err = -ENOMEM;
+				goto err;
+			}
+			r = tmp;
+		}
+		err = xacl_mac_parse_rule(line, &r[n]);
+		if (err < 0) {
+			fprintf(stderr, "ERR: %s:%u: invalid rule: %s", path, lineno, line);
+			err = -EINVAL;
+			goto err;
+		}
+		if (err == 0)
+			n++;
+		if (n > XACL_MAC_MAX_RULES) {
+			fprintf(stderr, "ERR: more than %d rules in %s\n", XACL_MAC_MAX_RULES, path);
+			err = -E2BIG;
+			goto err;
+		}
+	}
+	fclose(file);
+	*rules = r;
+	*nr = n;
+	return 0;
+err:
+	fclose(file);
+	free(r);
+	return err;
+}
+
+int xacl_mac_open_maps(const char *pin_dir, struct xacl_mac_maps *maps)
+{
+	maps->meta = open_bpf_map_file(pin_dir, "xacl_mac_meta", NULL);
+	maps->banks = open_bpf_map_file(pin_dir, "xacl_mac_banks", NULL);
+	maps->src = open_bpf_map_file(pin_dir, "xacl_mac_src", NULL);
+	maps->dst = open_bpf_map_file(pin_dir, "xacl_mac_dst", NULL);
+	maps->pairs = open_bpf_map_file(pin_dir, "xacl_mac_pairs", NULL);
+	if (maps->meta < 0 || maps->banks < 0 || maps->src < 0 || maps->dst < 0 ||
+	    maps->pairs < 0)
+		return -1;
+	return 0;
+}
+
+static int cmp_class(const void *a, const void *b)
+{
+	return memcmp(((const struct mac_class *)a)->mac, ((const struct mac_class *)b)->mac, 6);
+}
+
+static int cmp_pair(const void *a, const void *b)
+{
+	const struct pair_ent *x = a, *y = b;
+
+	if (x->src != y->src)
+		return x->src < y->src ? -1 : 1;
+	if (x->dst != y->dst)
+		return x->dst < y->dst ? -1 : 1;
+	return x->val.prio < y->val.prio ? -1 : x->val.prio > y->val.prio;
+}
+
+/* 收集一侧出现过的地址和 OUI，按地址排序去重。同一 OUI 下的地址排在该 OUI 之后 */
+static struct mac_class *collect_classes(const struct xacl_mac_rule *rules, __u32 nr,
+					 int dst, __u32 *n)
+{
+	struct mac_class *c = calloc(nr ? nr : 1, sizeof(*c));
+	__u32 cnt = 0;
+
+	if (!c)
+		return NULL;
+	for (__u32 i = 0; i < nr; i++) {
+		const __u8 *mac = dst ? rules[i].dst : rules[i].src;
+		int kind = sel_kind(mac);
+
+		if (kind == SEL_ANY)
+			continue;
+		memcpy(c[cnt].mac, mac, 6);
+		c[cnt].oui = kind == SEL_OUI;
+		cnt++;
+	}
+	qsort(c, cnt, sizeof(*c), cmp_class);
+	*n = 0;
+	for (__u32 i = 0; i < cnt; i++) {
+		if (*n && !cmp_class(&c[*n - 1], &c[i]))
+			continue;
+		c[*n] = c[i];
+		c[*n].val.prio = XACL_MAC_NO_RULE;
+		c[*n].val.action = XDP_PASS;
+		(*n)++;
+	}
+	return c;
+}
+
+/* 选择器覆盖的表项下标范围 [*lo, *hi)：精确地址只覆盖自己，OUI 覆盖自己和其下的地址 */
+static void cover_range(const struct mac_class *c, __u32 n, const __u8 *mac,
+			__u32 *lo, __u32 *hi)
+{
+	struct mac_class key;
+	const struct mac_class *found;
+
+	memcpy(key.mac, mac, 6);
+	found = bsearch(&key, c, n, sizeof(*c), cmp_class);
+	*lo = found - c;
+	*hi = *lo + 1;
+	if (found->oui) {
+		while (*hi < n && !memcmp(c[*hi].mac, mac, 3))
+			(*hi)++;
+	}
+}
+
+static int update_elems(int fd, const void *keys, size_t key_size,
+			const void *values, size_t value_size, __u32 count)
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
+		.elem_flags = 0,
+		.flags = 0,
+	);
+	__u32 n = count;
+
+	if (!count || !bpf_map_update_batch(fd, keys, values, &n, &opts))
+		return 0;
+	// 内核不支持批量操作时逐个更新
+	for (__u32 i = 0; i < count; i++) {
+		if (bpf_map_update_elem(fd, (const char *)keys + i * key_size,
+					(const char *)values + i * value_size, BPF_ANY)) {
+			fprintf(stderr, "ERR: updating map: %s\n", strerror(errno));
+			return -errno;
+		}
+	}
+	return 0;
+}
+
+/* 删除某个bank的全部表项，先收集再删除，避免边遍历边删除 */
+static int clear_bank(int fd, size_t key_size, __u32 max_entries,
+		      int (*in_bank)(const void *key, __u32 bank), __u32 bank)
+{
+	char *keys = malloc((size_t)max_entries * key_size);
+	char cur[16], *prev = NULL;
+	__u32 n = 0;
+
+	if (!keys)
+		return -ENOMEM;
+	while (n < max_entries && !bpf_map_get_next_key(fd, prev, cur)) {
+		if (in_bank(cur, bank))
+			memcpy(keys + (size_t)n++ * key_size, cur, key_size);
+		prev = cur;
+	}
+	for (__u32 i = 0; i < n; i++)
+		bpf_map_delete_elem(fd, keys + i * key_size);
+	free(keys);
+	return n;
+}
+
+static int class_in_bank(const void *key, __u32 bank)
+{
+	return ((const struct xacl_mac_key *)key)->bank == bank;
+}
+
+static int pair_in_bank(const void *key, __u32 bank)
+{
+	return ((const struct xacl_mac_pair_key *)key)->src >> XACL_MAC_BANK_SHIFT == bank;
+}
+
+static int clear_bank_all(const struct xacl_mac_maps *maps, __u32 bank)
+{
+	int n = 0, err;
+
+	err = clear_bank(maps->pairs, sizeof(struct xacl_mac_pair_key), 2 * XACL_MAC_MAX_PAIRS,
+			 pair_in_bank, bank);
+	if (err < 0)
+		return err;
+	n += err;
+	err = clear_bank(maps->src, sizeof(struct xacl_mac_key), 2 * XACL_MAC_MAX_RULES,
+			 class_in_bank, bank);
+	if (err < 0)
+		return err;
+	n += err;
+	err = clear_bank(maps->dst, sizeof(struct xacl_mac_key), 2 * XACL_MAC_MAX_RULES,
+			 class_in_bank, bank);
+	if (err < 0)
+		return err;
+	return n + err;
+}
+
+static int write_classes(int fd, struct mac_class *c, __u32 n, __u32 bank, __u32 *flags,
+			 __u32 oui_flag)
+{
+	struct xacl_mac_key *keys = calloc(n ? n : 1, sizeof(*keys));
+	struct xacl_mac_class *vals = calloc(n ? n : 1, sizeof(*vals));
+	int err = -ENOMEM;
+
+	if (!keys || !vals)
+		goto out;
+	for (__u32 i = 0; i < n; i++) {
+		keys[i].bank = bank;
+		keys[i].oui = c[i].oui;
+		memcpy(keys[i].mac, c[i].mac, 6);
+		vals[i] = c[i].val;
+		vals[i].id = bank << XACL_MAC_BANK_SHIFT | i;
+		if (c[i].oui)
+			*flags |= oui_flag;
+	}
+	err = update_elems(fd, keys, sizeof(*keys), vals, sizeof(*vals), n);
+out:
+	free(keys);
+	free(vals);
+	return err;
+}
+
+/* 把两端都指定的规则展开到所覆盖的 (源表项, 目的表项)，同一地址对只保留最优先的规则 */
+static struct pair_ent *expand_pairs(const struct xacl_mac_rule *rules, __u32 nr,
+				     struct mac_class *src, __u32 nr_src,
+				     struct mac_class *dst, __u32 nr_dst, __u32 *n)
+{
+	struct pair_ent *p = NULL, *tmp;
+	__u32 cnt = 0, cap = 0, out = 0;
+
+	for (__u32 i = 0; i < nr; i++) {
+		__u32 slo, shi, dlo, dhi;
+
+		if (sel_kind(rules[i].src) == SEL_ANY || sel_kind(rules[i].dst) == SEL_ANY)
+			continue;
+		cover_range(src, nr_src, rules[i].src, &slo, &shi);
+		cover_range(dst, nr_dst, rules[i].dst, &dlo, &dhi);
+		for (__u32 s = slo; s < shi; s++) {
+			for (__u32 d = dlo; d < dhi; d++) {
+				if (cnt == cap) {
+					// 去重前的展开结果也要有上限，避免 OUI 规则过多时耗尽内存
+					if (cap >= 4 * XACL_MAC_MAX_PAIRS)
+						goto too_big;
+					cap = cap ? cap * 2 : 256;
+					tmp = realloc(p, cap * sizeof(*p));
+					if (!tmp)
+						goto err;
+					p = tmp;
+				}
+				p[cnt].src = s;
+				p[cnt].dst = d;
+				p[cnt].val.prio = i;
+				p[cnt].val.action = rules[i].action;
+				cnt++;
+				src[s].val.pairs = 1;
+				dst[d].val.pairs = 1;
+			}
+		}
+	}
+	if (!p)
+		p = calloc(1, sizeof(*p));
+	if (!p)
+		goto err;
+
+	qsort(p, cnt, sizeof(*p), cmp_pair);
+	for (__u32 i = 0; i < cnt; i++) {
+		if (out && p[out - 1].src == p[i].src && p[out - 1].dst == p[i].dst)
+			continue;
+		p[out++] = p[i];
+	}
+	if (out > XACL_MAC_MAX_PAIRS)
+		goto too_big;
+	*n = out;
+	return p;
+too_big:
+	fprintf(stderr, "ERR: rules expand to more than %d address pairs\n", XACL_MAC_MAX_PAIRS);
+	errno = E2BIG;
+	free(p);
+	return NULL;
+err:
+	errno = ENOMEM;
+	free(p);
+	return NULL;
+}
+
+static int write_pairs(int fd, const struct pair_ent *p, __u32 n, __u32 bank)
+{
+	struct xacl_mac_pair_key *keys = calloc(n ? n : 1, sizeof(*keys));
+	struct xacl_mac_val *vals = calloc(n ? n : 1, sizeof(*vals));
+	int err = -ENOMEM;
+
+	if (!keys || !vals)
+		goto out;
+	for (__u32 i = 0; i < n; i++) {
+		keys[i].src = bank << XACL_MAC_BANK_SHIFT | p[i].src;
+		keys[i].dst = bank << XACL_MAC_BANK_SHIFT | p[i].dst;
+		vals[i] = p[i].val;
+	}
+	err = update_elems(fd, keys, sizeof(*keys), vals, sizeof(*vals), n);
+out:
+	free(keys);
+	free(vals);
+	return err;
+}
+
+int xacl_mac_load(const struct xacl_mac_maps *maps,
+		  const struct xacl_mac_rule *rules, __u32 nr)
+{
+	struct xacl_mac_bank b = { .def_action = XDP_PASS };
+	struct mac_class *src = NULL, *dst = NULL;
+	struct pair_ent *pairs = NULL;
+	__u32 nr_src, nr_dst, nr_pairs = 0;
+	__u32 active = 0, bank, key = 0;
+	int err = -ENOMEM;
+
+	if (nr > XACL_MAC_MAX_RULES)
+		return -E2BIG;
+	src = collect_classes(rules, nr, 0, &nr_src);
+	dst = collect_classes(rules, nr, 1, &nr_dst);
+	if (!src || !dst)
+		goto out;
+
+	// 一端为任意地址的规则按顺序写入另一端所覆盖的表项，先写入的更优先
+	for (__u32 i = 0; i < nr; i++) {
+		int skind = sel_kind(rules[i].src), dkind = sel_kind(rules[i].dst);
+		struct mac_class *c;
+		__u32 lo, hi;
+
+		if (skind == SEL_ANY && dkind == SEL_ANY) {
+			if (!(b.flags & XACL_MAC_F_DEFAULT)) {
+				b.flags |= XACL_MAC_F_DEFAULT;
+				b.def_prio = i;
+				b.def_action = rules[i].action;
+			}
+			continue;
+		}
+		if (skind != SEL_ANY && dkind != SEL_ANY)
+			continue;
+		if (skind != SEL_ANY) {
+			c = src;
+			cover_range(src, nr_src, rules[i].src, &lo, &hi);
+		} else {
+			c = dst;
+			cover_range(dst, nr_dst, rules[i].dst, &lo, &hi);
+		}
+		for (__u32 j = lo; j < hi; j++) {
+			if (c[j].val.prio == XACL_MAC_NO_RULE) {
+				c[j].val.prio = i;
+				c[j].val.action = rules[i].action;
+			}
+		}
+	}
+	pairs = expand_pairs(rules, nr, src, nr_src, dst, nr_dst, &nr_pairs);
+	if (!pairs) {
+		err = -errno;
+		goto out;
+	}
+
+	bpf_map_lookup_elem(maps->meta, &key, &active);
+	bank = !(active & 1);
+	err = clear_bank_all(maps, bank);
+	if (err < 0)
+		goto out;
+
+	err = write_classes(maps->src, src, nr_src, bank, &b.flags, XACL_MAC_F_SRC_OUI);
+	if (!err)
+		err = write_classes(maps->dst, dst, nr_dst, bank, &b.flags, XACL_MAC_F_DST_OUI);
+	if (!err)
+		err = write_pairs(maps->pairs, pairs, nr_pairs, bank);
+	if (err)
+		goto out;
+
+	// 新bank写完后才切换，旧bank随后清空
+	if (bpf_map_update_elem(maps->banks, &bank, &b, BPF_ANY) ||
+	    bpf_map_update_elem(maps->meta, &key, &bank, BPF_ANY)) {
+		err = -errno;
+		goto out;
+	}
+	printf("%u rules compiled into %u source, %u destination, %u pair entries\n",
+	       nr, nr_src, nr_dst, nr_pairs);
+	err = clear_bank_all(maps, !bank);
+	if (err > 0)
+		err = 0;
+out:
+	free(src);
+	free(dst);
+	free(pairs);
+	return err;
+}
+
+int xacl_mac_clear(const struct xacl_mac_maps *maps)
+{
+	struct xacl_mac_bank b = { .def_action = XDP_PASS };
+	int n0, n1;
+
+	// 两端都为任意地址的规则不在哈希表中，也要清掉
+	for (__u32 bank = 0; bank < 2; bank++)
+		bpf_map_update_elem(maps->banks, &bank, &b, BPF_ANY);
+	n0 = clear_bank_all(maps, 0);
+	n1 = clear_bank_all(maps, 1);
+	if (n0 < 0)
+		return n0;
+	if (n1 < 0)
+		return n1;
+	return n0 + n1;
+}
@@ -0,0 +1,40 @@
+/* MAC ACL 的用户态部分：解析规则，编译成源、目的、地址对三张哈希表写入BPF映射 */
+#ifndef __XACL_MAC_USER_H
+#define __XACL_MAC_USER_H
+
+#include <linux/types.h>
+#include "xacl_mac_kern_user.h"
+
+/* 配置文件中的一条规则，全0为任意地址，后三个字节为0为 OUI */
+struct xacl_mac_rule {
+	__u8  src[6];
+	__u8  dst[6];
+	__u32 action;
+};
+
+struct xacl_mac_maps {
+	int meta;
+	int banks;
+	int src;
+	int dst;
+	int pairs;
+};
+
+/* 解析一行 "SRC_MAC [DST_MAC] ACTION"，省略 DST_MAC 时为任意地址。
+ * 成功返回0，空行或注释返回1，格式错误返回-1
+ */
+int xacl_mac_parse_rule(const char *line, struct xacl_mac_rule *rule);
+
+/* 读取整个配置文件，*rules 由调用者 free */
+int xacl_mac_read_rules(const char *path, struct xacl_mac_rule **rules, __u32 *nr);
+
+int xacl_mac_open_maps(const char *pin_dir, struct xacl_mac_maps *maps);
+
+/* 编译规则并写入未生效的bank，写完后切换并清空旧bank */
+int xacl_mac_load(const struct xacl_mac_maps *maps,
+		  const struct xacl_mac_rule *rules, __u32 nr);
+
+/* 清空两个bank，返回被删除的表项数 */
+int xacl_mac_clear(const struct xacl_mac_maps *maps);
+
+#endif /* __XACL_MAC_USER_H */
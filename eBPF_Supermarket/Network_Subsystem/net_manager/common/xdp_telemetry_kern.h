@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* Used *ONLY* by BPF-prog running kernel side. */
+#ifndef __XDP_TELEMETRY_KERN_H
+#define __XDP_TELEMETRY_KERN_H
+
+#include "xdp_telemetry_kern_user.h"
+
+#define TELE_NSEC_PER_SEC	1000000000ULL
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct tele_config);
+	__uint(max_entries, 1);
+} tele_config_map SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, __u64);
+	__uint(max_entries, TELE_CNT_MAX);
+} tele_counters SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct tele_rule_stat);
+	__uint(max_entries, TELE_MAX_RULES + 1);
+} tele_rule_stats SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, __u64);
+	__uint(max_entries, TELE_NR_ACTIONS * TELE_SIZE_BUCKETS);
+} tele_size_hist SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct tele_if_stat);
+	__uint(max_entries, TELE_MAX_IFACES);
+} tele_if_stats SEC(".maps");
+
+/* 每个CPU的采样令牌，按秒为窗口重置 */
+struct tele_bucket {
+	__u64 window_ns;
+	__u32 seen;
+	__u32 sampled;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct tele_bucket);
+	__uint(max_entries, 1);
+} tele_buckets SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, TELE_RINGBUF_SIZE);
+} tele_samples SEC(".maps");
+
+static __always_inline void tele_count(__u32 idx)
+{
+	__u64 *cnt = bpf_map_lookup_elem(&tele_counters, &idx);
+
+	if (cnt)
+		(*cnt)++;
+}
+
+static __always_inline void tele_rule_hit(__u32 rule, __u64 bytes)
+{
+	struct tele_rule_stat *st;
+
+	if (rule > TELE_MAX_RULES)
+		rule = TELE_MAX_RULES;
+	st = bpf_map_lookup_elem(&tele_rule_stats, &rule);
+	if (st) {
+		st->hits++;
+		st->bytes += bytes;
+	}
+}
+
+/* 每个报文在得出最终动作后调用一次，累加包长直方图和入接口统计 */
+static __always_inline void tele_record_action(struct xdp_md *ctx, __u32 action, __u64 bytes)
+{
+	struct tele_if_stat *st;
+	__u32 idx;
+	__u64 *cnt;
+
+	if (action >= TELE_NR_ACTIONS)
+		return;
+	idx = action * TELE_SIZE_BUCKETS + tele_size_bucket(bytes);
+	cnt = bpf_map_lookup_elem(&tele_size_hist, &idx);
+	if (cnt)
+		(*cnt)++;
+
+	idx = ctx->ingress_ifindex;
+	if (idx >= TELE_MAX_IFACES)
+		idx = 0;
+	st = bpf_map_lookup_elem(&tele_if_stats, &idx);
+	if (st) {
+		st->packets[action]++;
+		st->bytes[action] += bytes;
+	}
+}
+
+/* 决定是否采样，需要采样时返回已填好公共字段的记录，由调用者填完后 tele_sample_submit。
+ * 未开启采样时只有一次数组查找。
+ */
+static __always_inline
+struct tele_sample *tele_sample_reserve(struct xdp_md *ctx, __u8 event)
+{
+	struct tele_sample *s;
+	struct tele_config *cfg;
+	struct tele_bucket *b;
+	__u32 zero = 0;
+	__u64 now;
+
+	cfg = bpf_map_lookup_elem(&tele_config_map, &zero);
+	if (!cfg || !cfg->enabled)
+		return NULL;
+	b = bpf_map_lookup_elem(&tele_buckets, &zero);
+	if (!b)
+		return NULL;
+
+	now = bpf_ktime_get_ns();
+	if (now - b->window_ns >= TELE_NSEC_PER_SEC) {
+		b->window_ns = now;
+		b->seen = 0;
+		b->sampled = 0;
+	}
+	if (cfg->sample_every > 1 && b->seen++ % cfg->sample_every)
+		return NULL;
+	if (b->sampled >= cfg->max_per_sec) {
+		tele_count(TELE_CNT_SAMPLE_LIMITED);
+		return NULL;
+	}
+
+	s = bpf_ringbuf_reserve(&tele_samples, sizeof(*s), 0);
+	if (!s) {
+		tele_count(TELE_CNT_SAMPLE_LOST);
+		return NULL;
+	}
+	b->sampled++;
+
+	__builtin_memset(s, 0, sizeof(*s));
+	s->ts_ns = now;
+	s->event = event;
+	s->ifindex = ctx->ingress_ifindex;
+	return s;
+}
+
+static __always_inline
+void tele_sample_flow(struct tele_sample *s, __u32 saddr, __u32 daddr,
+		      __u16 sport, __u16 dport, __u8 proto)
+{
+	s->saddr = saddr;
+	s->daddr = daddr;
+	s->sport = sport;
+	s->dport = dport;
+	s->proto = proto;
+}
+
+static __always_inline void tele_sample_submit(struct tele_sample *s)
+{
+	bpf_ringbuf_submit(s, 0);
+}
+
+#endif /* __XDP_TELEMETRY_KERN_H */
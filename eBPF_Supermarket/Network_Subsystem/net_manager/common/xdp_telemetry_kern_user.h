@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* XDP 程序的结构化遥测，内核与用户态共享的结构
+ *
+ * 快速路径上只更新per-CPU计数器，匹配到的流按采样率和每CPU每秒上限写入环形缓冲区，
+ * 代替逐包 bpf_printk（trace_pipe 全局加锁，会把XDP程序拖到线速的一小部分）。
+ * 每个报文还按动作累加包长直方图和入接口统计，都是per-CPU数组，用户态每个周期
+ * 对每张表做一次批量查找后在各CPU间求和，数据路径上没有原子操作。
+ */
+#ifndef __XDP_TELEMETRY_KERN_USER_H
+#define __XDP_TELEMETRY_KERN_USER_H
+
+#include <linux/types.h>
+
+#define TELE_MAX_RULES		16384	// 单独计数的规则数，序号更大的规则合并计入最后一项
+#define TELE_RINGBUF_SIZE	(256 * 1024)
+#define TELE_DEFAULT_SAMPLE_EVERY	1
+#define TELE_DEFAULT_MAX_PER_SEC	1000
+#define TELE_NR_ACTIONS		5	// XDP_ABORTED ~ XDP_REDIRECT
+#define TELE_SIZE_BUCKETS	8
+#define TELE_MAX_IFACES		64	// ifindex 不小于该值的接口合并计入第0项
+
+/* tele_counters 的下标 */
+enum {
+	TELE_CNT_ACL_HIT = 0,
+	TELE_CNT_ACL_MISS,
+	TELE_CNT_CONN_NEW,
+	TELE_CNT_CONN_UPDATE,
+	TELE_CNT_CONN_RST,
+	TELE_CNT_CONN_INVALID,		// 不属于跟踪连接或不合法的状态转换
+	TELE_CNT_CONN_EXPIRED,		// 数据路径发现的超时连接
+	TELE_CNT_ROUTE_FAST,
+	TELE_CNT_ROUTE_SLOW,
+	TELE_CNT_XSK_REDIRECT,		// 送往 AF_XDP 慢路径
+	TELE_CNT_XSK_VERDICT,		// 按慢路径写回的判定结果处理
+	TELE_CNT_SAMPLE_LIMITED,	// 超过每秒上限而未采样
+	TELE_CNT_SAMPLE_LOST,		// 环形缓冲区已满
+	TELE_CNT_MAX,
+};
+
+enum {
+	TELE_EV_ACL_HIT = 0,
+	TELE_EV_CONN_NEW,
+	TELE_EV_CONN_UPDATE,
+	TELE_EV_CONN_RST,
+	TELE_EV_UDP,
+	TELE_EV_ICMP,
+	TELE_EV_ROUTE_FAST,
+	TELE_EV_ROUTE_SLOW,
+};
+
+/* tele_config_map 中唯一的一项，由用户态写入 */
+struct tele_config {
+	__u32 enabled;		// 0 时不采样，只计数
+	__u32 sample_every;	// 每 N 个事件采样一个
+	__u32 max_per_sec;	// 每个CPU每秒最多采样数
+};
+
+struct tele_rule_stat {
+	__u64 hits;
+	__u64 bytes;
+};
+
+/* tele_if_stats 的值，按 XDP 动作分别计数 */
+struct tele_if_stat {
+	__u64 packets[TELE_NR_ACTIONS];
+	__u64 bytes[TELE_NR_ACTIONS];
+};
+
+/* 包长直方图的档位，上界分别为 64/128/256/512/1024/1518/4096 字节，最后一档为更大的报文。
+ * tele_size_hist 的下标为 action * TELE_SIZE_BUCKETS + 档位
+ */
+static inline __u32 tele_size_bucket(__u64 len)
+{
+	if (len <= 64)
+		return 0;
+	if (len <= 128)
+		return 1;
+	if (len <= 256)
+		return 2;
+	if (len <= 512)
+		return 3;
+	if (len <= 1024)
+		return 4;
+	if (len <= 1518)
+		return 5;
+	if (len <= 4096)
+		return 6;
+	return 7;
+}
+
+/* 环形缓冲区中的一条采样，地址和端口均为主机序 */
+struct tele_sample {
+	__u64 ts_ns;
+	__u32 saddr;
+	__u32 daddr;
+	__u16 sport;
+	__u16 dport;
+	__u8  proto;
+	__u8  event;
+	__u8  state;		// TELE_EV_CONN_*/UDP/ICMP: CT_S_*
+	__u8  action;		// ACL/ROUTE: XDP 动作；连接事件: 1 发起方发出，0 应答方发出
+	__u32 aux;		// ACL: 规则序号；ROUTE: 出接口；UDP: 报文长度；ICMP: type << 8 | code
+	__u32 ifindex;		// 入接口
+};
+
+#endif /* __XDP_TELEMETRY_KERN_USER_H */
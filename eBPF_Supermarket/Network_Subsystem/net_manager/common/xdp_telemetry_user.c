@@ -0,0 +1,203 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "xdp_telemetry_user.h"
+
+static int tele_read_percpu_array(int fd, __u32 nr, __u32 value_size, int nr_cpus, void *out)
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	size_t stride = (size_t)value_size * nr_cpus;
+	__u32 count = nr, out_batch, *keys;
+	int err;
+
+	keys = malloc(nr * sizeof(*keys));
+	if (!keys)
+		return -ENOMEM;
+	// 数组的批量查找按键的顺序返回，读满 nr 项时 values 正好按 [key][cpu] 排列
+	err = bpf_map_lookup_batch(fd, NULL, &out_batch, keys, out, &count, &opts);
+	free(keys);
+	if ((!err || errno == ENOENT) && count == nr)
+		return 0;
+
+	for (__u32 key = 0; key < nr; key++) {
+		if (bpf_map_lookup_elem(fd, &key, (char *)out + key * stride))
+			return -errno;
+	}
+	return 0;
+}
+
+int tele_sum_percpu_array(int fd, __u32 nr, __u32 value_size, void *sum)
+{
+	int nr_cpus = libbpf_num_possible_cpus();
+	__u32 words = value_size / sizeof(__u64);
+	__u64 *values, *out = sum;
+	int err;
+
+	if (nr_cpus < 0)
+		return nr_cpus;
+	if (!nr || value_size % sizeof(__u64))
+		return -EINVAL;
+	values = malloc((size_t)nr * nr_cpus * value_size);
+	if (!values)
+		return -ENOMEM;
+	err = tele_read_percpu_array(fd, nr, value_size, nr_cpus, values);
+	if (!err) {
+		memset(out, 0, (size_t)nr * value_size);
+		for (__u32 key = 0; key < nr; key++) {
+			__u64 *v = values + (size_t)key * nr_cpus * words;
+
+			for (int cpu = 0; cpu < nr_cpus; cpu++, v += words) {
+				for (__u32 w = 0; w < words; w++)
+					out[(size_t)key * words + w] += v[w];
+			}
+		}
+	}
+	free(values);
+	return err;
+}
+
+/* 只有一个发布者（统计线程）和一个读者（端点线程），用序号加双缓冲代替锁：
+ * 发布者写入 buf[(seq + 1) & 1] 后再递增 seq，读者复制 buf[seq & 1]，
+ * 复制后 seq 发生变化说明缓冲区可能被改写，重新复制
+ */
+struct tele_http {
+	int fd;
+	pthread_t thread;
+	unsigned int seq;
+	size_t len[2];
+	char buf[2][TELE_HTTP_MAX_BODY];
+	char snap[TELE_HTTP_MAX_BODY];	// 端点线程的私有副本
+};
+
+static size_t tele_http_snapshot(struct tele_http *h)
+{
+	unsigned int seq;
+	size_t len;
+
+	do {
+		seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+		len = __atomic_load_n(&h->len[seq & 1], __ATOMIC_RELAXED);
+		memcpy(h->snap, h->buf[seq & 1], len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&h->seq, __ATOMIC_RELAXED) != seq);
+	return len;
+}
+
+static void send_all(int fd, const char *p, size_t len)
+{
+	while (len) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+		if (n <= 0)
+			return;
+		p += n;
+		len -= n;
+	}
+}
+
+static void tele_http_serve(struct tele_http *h, int fd)
+{
+	struct timeval tv = { .tv_sec = 1 };
+	char req[1024], hdr[128];
+	size_t len;
+	int n;
+
+	// 请求内容不影响应答，只读掉请求头；客户端太慢时不能阻塞后续请求
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if (recv(fd, req, sizeof(req), 0) <= 0)
+		return;
+
+	len = tele_http_snapshot(h);
+	n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+		     "Content-Type: text/plain; version=0.0.4\r\n"
+		     "Content-Length: %zu\r\n\r\n", len);
+	send_all(fd, hdr, n);
+	send_all(fd, h->snap, len);
+}
+
+static void *tele_http_loop(void *arg)
+{
+	struct tele_http *h = arg;
+	int fd;
+
+	for (;;) {
+		fd = accept(h->fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;	// tele_http_stop 关闭了监听套接字
+		}
+		tele_http_serve(h, fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+struct tele_http *tele_http_start(int port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	struct tele_http *h = calloc(1, sizeof(*h));
+	int one = 1, err;
+
+	if (!h)
+		return NULL;
+	h->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (h->fd < 0)
+		goto err_free;
+	setsockopt(h->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(h->fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(h->fd, 16))
+		goto err_close;
+	err = pthread_create(&h->thread, NULL, tele_http_loop, h);
+	if (err) {
+		errno = err;
+		goto err_close;
+	}
+	return h;
+
+err_close:
+	err = errno;
+	close(h->fd);
+	errno = err;
+err_free:
+	free(h);
+	return NULL;
+}
+
+void tele_http_publish(struct tele_http *h, const char *text, size_t len)
+{
+	unsigned int seq = __atomic_load_n(&h->seq, __ATOMIC_RELAXED) + 1;
+
+	if (len > TELE_HTTP_MAX_BODY)
+		len = TELE_HTTP_MAX_BODY;
+	// 上一次发布的 seq 必须先于本次的写入可见，读者才能发现自己读到了正在改写的缓冲区
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	memcpy(h->buf[seq & 1], text, len);
+	__atomic_store_n(&h->len[seq & 1], len, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->seq, seq, __ATOMIC_RELEASE);
+}
+
+void tele_http_stop(struct tele_http *h)
+{
+	if (!h)
+		return;
+	shutdown(h->fd, SHUT_RDWR);
+	pthread_join(h->thread, NULL);
+	close(h->fd);
+	free(h);
+}
@@ -0,0 +1,26 @@
+/* XDP 遥测的用户态部分：批量读取 per-CPU 统计，通过本地 HTTP 端点导出指标 */
+#ifndef __XDP_TELEMETRY_USER_H
+#define __XDP_TELEMETRY_USER_H
+
+#include <stddef.h>
+#include <linux/types.h>
+#include "xdp_telemetry_kern_user.h"
+
+#define TELE_HTTP_MAX_BODY	(256 * 1024)	// 超出部分被截断
+
+struct tele_http;
+
+/* 用一次批量查找读出 per-CPU 数组的前 nr 项并按CPU求和，内核不支持批量查找时退回逐项查找。
+ * 值的成员必须都是 __u64，sum 为 nr 个值，大小为 nr * value_size
+ */
+int tele_sum_percpu_array(int fd, __u32 nr, __u32 value_size, void *sum);
+
+/* 在 127.0.0.1:port 上启动 HTTP 端点，任意请求都返回最近一次发布的文本 */
+struct tele_http *tele_http_start(int port);
+
+/* 发布新的指标文本。端点线程只读取已发布的副本，两者之间不加锁 */
+void tele_http_publish(struct tele_http *h, const char *text, size_t len);
+
+void tele_http_stop(struct tele_http *h);
+
+#endif /* __XDP_TELEMETRY_USER_H */
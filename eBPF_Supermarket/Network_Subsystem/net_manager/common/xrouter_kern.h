@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* Used *ONLY* by BPF-prog running kernel side. */
+#ifndef __XROUTER_KERN_H
+#define __XROUTER_KERN_H
+
+#include "xrouter_kern_user.h"
+
+#define XRT_NO_ROUTE		-1
+#define XRT_NSEC_PER_SEC	1000000000ULL
+#define XRT_AF_INET		2
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, XRT_META_MAX);
+} xrt_meta SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__type(key, struct xrt_lpm_key);
+	__type(value, struct xrt_route);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__uint(max_entries, 2 * XRT_MAX_ROUTES);
+} xrt_routes SEC(".maps");
+
+/* 用户态配置的静态邻居，放在普通哈希表中，不会被学习到的表项挤出 */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, struct xrt_neigh_key);
+	__type(value, struct xrt_neigh);
+	__uint(max_entries, XRT_MAX_NEIGH);
+} xrt_neigh_static SEC(".maps");
+
+/* 数据路径通过 bpf_fib_lookup 学习的邻居 */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__type(key, struct xrt_neigh_key);
+	__type(value, struct xrt_neigh);
+	__uint(max_entries, XRT_MAX_NEIGH);
+} xrt_neigh SEC(".maps");
+
+/* 按五元组哈希选择下一跳。分片报文只按地址哈希，保证同一报文的各个分片走同一条路径 */
+static __always_inline __u32 xrt_flow_hash(struct iphdr *iph, void *data_end)
+{
+	__u32 h = iph->saddr ^ (iph->daddr * 0x9E3779B1U) ^ iph->protocol;
+
+	if (!(iph->frag_off & bpf_htons(0x3FFF)) &&
+	    (iph->protocol == IPPROTO_TCP || iph->protocol == IPPROTO_UDP)) {
+		__u32 *ports = (void *)iph + iph->ihl * 4;
+
+		if ((void *)(ports + 1) <= data_end)
+			h ^= *ports * 0x85EBCA6BU;
+	}
+	// murmur3 的最终混合，使低位也均匀
+	h ^= h >> 16;
+	h *= 0x85EBCA6BU;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35U;
+	h ^= h >> 16;
+	return h;
+}
+
+/* 查找下一跳的MAC地址，先查静态邻居，再查学习到的邻居，
+ * 没有或已过期时用内核的FIB和邻居表解析并缓存。
+ * 解析失败时返回旧表项，没有旧表项返回 NULL。
+ */
+static __always_inline
+struct xrt_neigh *xrt_resolve(struct xdp_md *ctx, struct iphdr *iph,
+			      struct xrt_neigh_key *nk, struct xrt_neigh *buf)
+{
+	struct xrt_neigh *n = bpf_map_lookup_elem(&xrt_neigh_static, nk);
+	struct bpf_fib_lookup fib = {};
+	__u64 now;
+
+	if (n)
+		return n;
+	n = bpf_map_lookup_elem(&xrt_neigh, nk);
+	now = bpf_ktime_get_ns();
+	if (n && now - n->learned_ns < XRT_NEIGH_TTL_SEC * XRT_NSEC_PER_SEC)
+		return n;
+
+	fib.family = XRT_AF_INET;
+	fib.tos = iph->tos;
+	fib.l4_protocol = iph->protocol;
+	fib.tot_len = bpf_ntohs(iph->tot_len);
+	fib.ipv4_src = iph->saddr;
+	fib.ipv4_dst = nk->addr;
+	fib.ifindex = nk->ifindex;
+	if (bpf_fib_lookup(ctx, &fib, sizeof(fib),
+			   BPF_FIB_LOOKUP_DIRECT | BPF_FIB_LOOKUP_OUTPUT) != BPF_FIB_LKUP_RET_SUCCESS)
+		return n;
+
+	__builtin_memset(buf, 0, sizeof(*buf));
+	__builtin_memcpy(buf->dmac, fib.dmac, 6);
+	__builtin_memcpy(buf->smac, fib.smac, 6);
+	buf->learned_ns = now;
+	bpf_map_update_elem(&xrt_neigh, nk, buf, BPF_ANY);
+	return buf;
+}
+
+static __always_inline void xrt_decrease_ttl(struct iphdr *iph)
+{
+	__u32 check = iph->check;
+
+	check += bpf_htons(0x0100);
+	iph->check = (__u16)(check + (check >= 0xFFFF));
+	iph->ttl--;
+}
+
+/* 按路由表转发 IPv4 报文。命中时改写MAC、递减TTL并返回重定向的结果，
+ * 黑洞路由返回 XDP_DROP，TTL 耗尽或邻居未解析时返回 XDP_PASS 交给协议栈，
+ * 没有匹配的路由返回 XRT_NO_ROUTE。选中的下一跳写入 *nh。
+ */
+static __always_inline
+int xrt_forward(struct xdp_md *ctx, struct ethhdr *eth, struct iphdr *iph,
+		struct xrt_nexthop *nh)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	struct xrt_lpm_key key = { .prefixlen = 8 + 32 };
+	struct xrt_neigh_key nk;
+	struct xrt_neigh buf, *n;
+	struct xrt_route *rt;
+	__u32 idx = XRT_META_ACTIVE, path = 0, *bank;
+
+	bank = bpf_map_lookup_elem(&xrt_meta, &idx);
+	if (!bank)
+		return XRT_NO_ROUTE;
+	key.data[0] = *bank & 1;
+	__builtin_memcpy(&key.data[1], &iph->daddr, 4);
+	rt = bpf_map_lookup_elem(&xrt_routes, &key);
+	if (!rt)
+		return XRT_NO_ROUTE;
+	if (!rt->nr_paths)
+		return XDP_DROP;
+	// 由协议栈回复 ICMP 超时
+	if (iph->ttl <= 1)
+		return XDP_PASS;
+
+	if (rt->nr_paths > 1)
+		path = xrt_flow_hash(iph, data_end) % rt->nr_paths;
+	*nh = rt->paths[path & (XRT_MAX_PATHS - 1)];
+
+	nk.ifindex = nh->ifindex;
+	nk.addr = nh->gateway ? nh->gateway : iph->daddr;
+	n = xrt_resolve(ctx, iph, &nk, &buf);
+	if (!n)
+		return XDP_PASS;	// 由协议栈发起ARP请求，之后的报文即可解析
+
+	xrt_decrease_ttl(iph);
+	__builtin_memcpy(eth->h_dest, n->dmac, 6);
+	__builtin_memcpy(eth->h_source, n->smac, 6);
+	return bpf_redirect(nh->ifindex, 0);
+}
+
+#endif /* __XROUTER_KERN_H */
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* XDP IPv4 路由引擎，内核与用户态共享的结构
+ *
+ * 路由前缀放在LPM树中，查找开销只与地址位数有关，与路由条数无关。
+ * 一条路由最多有 XRT_MAX_PATHS 个下一跳（ECMP），按流的五元组哈希选择，
+ * 同一条流总是走同一个下一跳。下一跳的MAC地址放在单独的邻居缓存中，
+ * 多条路由共用同一个下一跳时只需解析一次。
+ *
+ * 路由表分为两个bank，用户态写入未生效的bank后再切换，重载期间不会查到半张表。
+ */
+#ifndef __XROUTER_KERN_USER_H
+#define __XROUTER_KERN_USER_H
+
+#include <linux/types.h>
+
+#define XRT_MAX_ROUTES		131072	// 每个bank的路由条数上限
+#define XRT_MAX_PATHS		8	// 每条路由的下一跳数上限，必须是2的幂
+#define XRT_MAX_NEIGH		16384
+#define XRT_NEIGH_TTL_SEC	30	// 学习到的邻居表项过期后重新解析
+
+/* xrt_meta 的下标 */
+#define XRT_META_ACTIVE		0	// 当前生效的bank
+#define XRT_META_MAX		1
+
+/* 路由查找的键，data 依次为 bank 和网络序的 IPv4 地址 */
+struct xrt_lpm_key {
+	__u32 prefixlen;
+	__u8  data[5];
+} __attribute__((packed));
+
+struct xrt_nexthop {
+	__u32 gateway;		// 网络序，0 表示直连，下一跳就是目的地址
+	__u32 ifindex;		// 出接口
+};
+
+struct xrt_route {
+	__u32 nr_paths;		// 0 表示黑洞路由
+	__u32 pad;
+	struct xrt_nexthop paths[XRT_MAX_PATHS];
+};
+
+struct xrt_neigh_key {
+	__u32 ifindex;
+	__u32 addr;		// 网络序
+};
+
+struct xrt_neigh {
+	__u8  dmac[6];
+	__u8  smac[6];		// 出接口的MAC地址
+	__u32 pad;
+	__u64 learned_ns;	// 数据路径学习的时间，静态表项为 0
+};
+
+#endif /* __XROUTER_KERN_USER_H */
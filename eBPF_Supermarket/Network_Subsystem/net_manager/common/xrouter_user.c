@@ -0,0 +1,448 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+
+#include "common_defines.h"
+#include "common_user_bpf_xdp.h"
+#include "xrouter_user.h"
+
+static int parse_addr(const char *s, __u32 *addr)
+{
+	unsigned int a[4];
+	char c;
+
+	if (sscanf(s, "%u.%u.%u.%u%c", &a[0], &a[1], &a[2], &a[3], &c) != 4 ||
+	    a[0] > 255 || a[1] > 255 || a[2] > 255 || a[3] > 255)
+		return -1;
+	*addr = (a[0] << 24) | (a[1] << 16) | (a[2] << 8) | a[3];
+	return 0;
+}
+
+static int parse_prefix(const char *s, __u32 *prefix, __u8 *len)
+{
+	char buf[32], *slash;
+	unsigned int l = 32;
+
+	if (strcmp(s, "default") == 0) {
+		*prefix = 0;
+		*len = 0;
+		return 0;
+	}
+	snprintf(buf, sizeof(buf), "%s", s);
+	slash = strchr(buf, '/');
+	if (slash) {
+		*slash = '\0';
+		if (sscanf(slash + 1, "%u", &l) != 1 || l > 32)
+			return -1;
+	}
+	if (parse_addr(buf, prefix))
+		return -1;
+	*len = l;
+	*prefix &= l ? 0xFFFFFFFFU << (32 - l) : 0;
+	return 0;
+}
+
+static int parse_dev(const char *s, __u32 *ifindex)
+{
+	*ifindex = if_nametoindex(s);
+	if (!*ifindex) {
+		fprintf(stderr, "ERR: unknown device %s\n", s);
+		return -1;
+	}
+	return 0;
+}
+
+/* 按需扩容，*cap 为0时从64开始 */
+static void *grow(void *p, __u32 nr, __u32 *cap, size_t size)
+{
+	void *tmp;
+
+	if (nr < *cap)
+		return p;
+	tmp = realloc(p, (size_t)(*cap ? *cap * 2 : 64) * size);
+	if (tmp)
+		*cap = *cap ? *cap * 2 : 64;
+	return tmp;
+}
+
+static int parse_neigh(char **tok, int n, struct xrt_config *cfg)
+{
+	struct xrt_neigh_cfg ne = {};
+	int has_dev = 0, has_mac = 0;
+	void *p;
+
+	if (n < 2 || parse_addr(tok[1], &ne.addr))
+		return -1;
+	for (int i = 2; i + 1 < n; i += 2) {
+		if (strcmp(tok[i], "dev") == 0) {
+			if (parse_dev(tok[i + 1], &ne.ifindex))
+				return -1;
+			has_dev = 1;
+		} else if (strcmp(tok[i], "lladdr") == 0) {
+			if (sscanf(tok[i + 1], "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+				   &ne.lladdr[0], &ne.lladdr[1], &ne.lladdr[2],
+				   &ne.lladdr[3], &ne.lladdr[4], &ne.lladdr[5]) != 6)
+				return -1;
+			has_mac = 1;
+		} else {
+			return -1;
+		}
+	}
+	if (!has_dev || !has_mac)
+		return -1;
+
+	p = grow(cfg->neighs, cfg->nr_neighs, &cfg->cap_neighs, sizeof(ne));
+	if (!p)
+		return -1;
+	cfg->neighs = p;
+	cfg->neighs[cfg->nr_neighs++] = ne;
+	return 0;
+}
+
+int xrt_parse_line(const char *line, struct xrt_config *cfg)
+{
+	struct xrt_route_cfg rt = {};
+	char buf[256], *tok[8], *save = NULL;
+	int n = 0, i = 0, has_dev = 0;
+	void *p;
+
+	snprintf(buf, sizeof(buf), "%s", line);
+	for (char *t = strtok_r(buf, " \t\r\n", &save); t && n < 8;
+	     t = strtok_r(NULL, " \t\r\n", &save))
+		tok[n++] = t;
+	if (!n || tok[0][0] == '#')
+		return 1;
+
+	if (strcmp(tok[0], "neigh") == 0)
+		return parse_neigh(tok, n, cfg);
+	if (strcmp(tok[0], "blackhole") == 0) {
+		rt.blackhole = 1;
+		i = 1;
+		if (n != 2)
+			return -1;
+	}
+	if (i >= n || parse_prefix(tok[i], &rt.prefix, &rt.len))
+		return -1;
+	for (i++; i + 1 < n; i += 2) {
+		if (strcmp(tok[i], "via") == 0) {
+			if (parse_addr(tok[i + 1], &rt.gateway))
+				return -1;
+		} else if (strcmp(tok[i], "dev") == 0) {
+			if (parse_dev(tok[i + 1], &rt.ifindex))
+				return -1;
+			has_dev = 1;
+		} else {
+			return -1;
+		}
+	}
+	if (i != n || (!rt.blackhole && !has_dev))
+		return -1;
+
+	p = grow(cfg->routes, cfg->nr_routes, &cfg->cap_routes, sizeof(rt));
+	if (!p)
+		return -1;
+	cfg->routes = p;
+	cfg->routes[cfg->nr_routes++] = rt;
+	return 0;
+}
+
+int xrt_read_config(const char *path, struct xrt_config *cfg)
+{
+	__u32 lineno = 0;
+	char line[256];
+	FILE *file;
+
+	memset(cfg, 0, sizeof(*cfg));
+	file = fopen(path, "r");
+	if (!file) {
+		perror("Error opening file");
+		return -errno;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		lineno++;
+		if (xrt_parse_line(line, cfg) < 0) {
+			fprintf(stderr, "ERR: %s:%u: invalid route: %s", path, lineno, line);
+			fclose(file);
+			xrt_free_config(cfg);
+			return -EINVAL;
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+void xrt_free_config(struct xrt_config *cfg)
+{
+	free(cfg->routes);
+	free(cfg->neighs);
+	memset(cfg, 0, sizeof(*cfg));
+}
+
+int xrt_open_maps(const char *pin_dir, struct xrt_maps *maps)
+{
+	maps->meta = open_bpf_map_file(pin_dir, "xrt_meta", NULL);
+	maps->routes = open_bpf_map_file(pin_dir, "xrt_routes", NULL);
+	maps->neigh = open_bpf_map_file(pin_dir, "xrt_neigh", NULL);
+	maps->neigh_static = open_bpf_map_file(pin_dir, "xrt_neigh_static", NULL);
+	if (maps->meta < 0 || maps->routes < 0 || maps->neigh < 0 || maps->neigh_static < 0)
+		return -1;
+	return 0;
+}
+
+static int update_elems(int fd, const void *keys, size_t key_size,
+			const void *values, size_t value_size, __u32 count)
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
+		.elem_flags = 0,
+		.flags = 0,
+	);
+	__u32 n = count;
+
+	if (!count || !bpf_map_update_batch(fd, keys, values, &n, &opts))
+		return 0;
+	// 内核或该类型的映射不支持批量操作时逐个更新
+	for (__u32 i = 0; i < count; i++) {
+		if (bpf_map_update_elem(fd, (const char *)keys + i * key_size,
+					(const char *)values + i * value_size, BPF_ANY)) {
+			fprintf(stderr, "ERR: updating map: %s\n", strerror(errno));
+			return -errno;
+		}
+	}
+	return 0;
+}
+
+/* 删除某个bank的全部路由，先收集再删除，避免边遍历边删除 */
+static int clear_bank(int fd, __u32 bank)
+{
+	struct xrt_lpm_key *keys, cur, prev;
+	__u32 n = 0;
+	int first = 1;
+
+	keys = malloc((size_t)2 * XRT_MAX_ROUTES * sizeof(*keys));
+	if (!keys)
+		return -ENOMEM;
+	while (n < 2 * XRT_MAX_ROUTES && !bpf_map_get_next_key(fd, first ? NULL : &prev, &cur)) {
+		first = 0;
+		prev = cur;
+		if (cur.data[0] == bank)
+			keys[n++] = cur;
+	}
+	for (__u32 i = 0; i < n; i++)
+		bpf_map_delete_elem(fd, &keys[i]);
+	free(keys);
+	return n;
+}
+
+static int cmp_route(const void *a, const void *b)
+{
+	const struct xrt_route_cfg *x = a, *y = b;
+
+	if (x->len != y->len)
+		return x->len < y->len ? -1 : 1;
+	if (x->prefix != y->prefix)
+		return x->prefix < y->prefix ? -1 : 1;
+	return 0;
+}
+
+static int get_ifmac(__u32 ifindex, __u8 *mac)
+{
+	char name[IF_NAMESIZE];
+	struct ifreq ifr = {};
+	int fd, err = 0;
+
+	if (!if_indextoname(ifindex, name))
+		return -errno;
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -errno;
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0)
+		err = -errno;
+	else
+		memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+	close(fd);
+	return err;
+}
+
+static int has_static_neigh(const struct xrt_config *cfg, const struct xrt_neigh_key *k)
+{
+	for (__u32 i = 0; i < cfg->nr_neighs; i++) {
+		if (cfg->neighs[i].ifindex == k->ifindex && htonl(cfg->neighs[i].addr) == k->addr)
+			return 1;
+	}
+	return 0;
+}
+
+/* 写入配置中的静态邻居，再删除不在配置中的旧静态邻居。学习到的表项在另一张表中，保持不变 */
+static int load_neighs(int fd, const struct xrt_config *cfg)
+{
+	struct xrt_neigh_key cur, prev, *stale = NULL;
+	struct xrt_neigh val;
+	__u32 n = 0, cap = 0;
+	int first = 1;
+
+	for (__u32 i = 0; i < cfg->nr_neighs; i++) {
+		struct xrt_neigh_key key = {
+			.ifindex = cfg->neighs[i].ifindex,
+			.addr = htonl(cfg->neighs[i].addr),
+		};
+
+		memset(&val, 0, sizeof(val));
+		memcpy(val.dmac, cfg->neighs[i].lladdr, 6);
+		if (get_ifmac(key.ifindex, val.smac)) {
+			fprintf(stderr, "ERR: reading MAC address of ifindex %u\n", key.ifindex);
+			return -EINVAL;
+		}
+		if (bpf_map_update_elem(fd, &key, &val, BPF_ANY))
+			return -errno;
+	}
+
+	while (!bpf_map_get_next_key(fd, first ? NULL : &prev, &cur)) {
+		first = 0;
+		prev = cur;
+		if (has_static_neigh(cfg, &cur))
+			continue;
+		void *p = grow(stale, n, &cap, sizeof(*stale));
+
+		if (!p) {
+			free(stale);
+			return -ENOMEM;
+		}
+		stale = p;
+		stale[n++] = cur;
+	}
+	for (__u32 i = 0; i < n; i++)
+		bpf_map_delete_elem(fd, &stale[i]);
+	free(stale);
+	return 0;
+}
+
+int xrt_load(const struct xrt_maps *maps, const struct xrt_config *cfg)
+{
+	struct xrt_route_cfg *sorted = NULL;
+	struct xrt_lpm_key *keys = NULL;
+	struct xrt_route *vals = NULL;
+	__u32 active = 0, bank, meta_key = XRT_META_ACTIVE, nr = 0, dropped = 0;
+	int err;
+
+	sorted = malloc((size_t)cfg->nr_routes * sizeof(*sorted) + 1);
+	keys = malloc((size_t)cfg->nr_routes * sizeof(*keys) + 1);
+	vals = calloc(cfg->nr_routes + 1, sizeof(*vals));
+	if (!sorted || !keys || !vals) {
+		err = -ENOMEM;
+		goto out;
+	}
+	memcpy(sorted, cfg->routes, (size_t)cfg->nr_routes * sizeof(*sorted));
+	qsort(sorted, cfg->nr_routes, sizeof(*sorted), cmp_route);
+
+	// 前缀相同的路由合并成一条，各下一跳组成 ECMP
+	for (__u32 i = 0; i < cfg->nr_routes; i++) {
+		const struct xrt_route_cfg *r = &sorted[i];
+		struct xrt_route *v;
+
+		if (!nr || cmp_route(r, &sorted[i - 1])) {
+			if (nr == XRT_MAX_ROUTES) {
+				err = -E2BIG;
+				goto out;
+			}
+			keys[nr].prefixlen = 8 + r->len;
+			keys[nr].data[0] = 0;
+			keys[nr].data[1] = r->prefix >> 24;
+			keys[nr].data[2] = r->prefix >> 16;
+			keys[nr].data[3] = r->prefix >> 8;
+			keys[nr].data[4] = r->prefix;
+			nr++;
+		}
+		v = &vals[nr - 1];
+		if (r->blackhole || v->pad) {
+			// 黑洞路由优先，同一前缀的其他下一跳忽略
+			v->nr_paths = 0;
+			v->pad = 1;
+			continue;
+		}
+		if (v->nr_paths == XRT_MAX_PATHS) {
+			dropped++;
+			continue;
+		}
+		v->paths[v->nr_paths].gateway = htonl(r->gateway);
+		v->paths[v->nr_paths].ifindex = r->ifindex;
+		v->nr_paths++;
+	}
+	if (dropped)
+		fprintf(stderr, "WARN: %u next hops beyond %d per prefix ignored\n", dropped, XRT_MAX_PATHS);
+
+	bpf_map_lookup_elem(maps->meta, &meta_key, &active);
+	bank = !(active & 1);
+	err = clear_bank(maps->routes, bank);
+	if (err < 0)
+		goto out;
+	for (__u32 i = 0; i < nr; i++) {
+		keys[i].data[0] = bank;
+		vals[i].pad = 0;
+	}
+	err = update_elems(maps->routes, keys, sizeof(*keys), vals, sizeof(*vals), nr);
+	if (err)
+		goto out;
+	err = load_neighs(maps->neigh_static, cfg);
+	if (err)
+		goto out;
+
+	// 新bank写完后才切换，旧bank随后清空
+	if (bpf_map_update_elem(maps->meta, &meta_key, &bank, BPF_ANY)) {
+		err = -errno;
+		goto out;
+	}
+	printf("%u routes merged into %u prefixes, %u static neighbors\n",
+	       cfg->nr_routes, nr, cfg->nr_neighs);
+	err = clear_bank(maps->routes, !bank);
+	err = err < 0 ? err : (int)nr;
+out:
+	free(sorted);
+	free(keys);
+	free(vals);
+	return err;
+}
+
+/* 删除邻居表中的全部表项，返回删除的数量 */
+static int clear_neighs(int fd)
+{
+	struct xrt_neigh_key cur, *keys;
+	__u32 n = 0;
+
+	keys = malloc(XRT_MAX_NEIGH * sizeof(*keys));
+	if (!keys)
+		return -ENOMEM;
+	while (n < XRT_MAX_NEIGH && !bpf_map_get_next_key(fd, n ? &keys[n - 1] : NULL, &cur))
+		keys[n++] = cur;
+	for (__u32 i = 0; i < n; i++)
+		bpf_map_delete_elem(fd, &keys[i]);
+	free(keys);
+	return n;
+}
+
+int xrt_clear(const struct xrt_maps *maps)
+{
+	int n0, n1, n2, n3;
+
+	n0 = clear_bank(maps->routes, 0);
+	n1 = clear_bank(maps->routes, 1);
+	if (n0 < 0)
+		return n0;
+	if (n1 < 0)
+		return n1;
+	n2 = clear_neighs(maps->neigh);
+	if (n2 < 0)
+		return n2;
+	n3 = clear_neighs(maps->neigh_static);
+	if (n3 < 0)
+		return n3;
+	return n0 + n1 + n2 + n3;
+}
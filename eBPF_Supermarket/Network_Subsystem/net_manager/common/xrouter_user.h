@@ -0,0 +1,61 @@
+/* IPv4 路由引擎的用户态部分：解析路由配置，写入未生效的bank后原子切换 */
+#ifndef __XROUTER_USER_H
+#define __XROUTER_USER_H
+
+#include <linux/types.h>
+#include "xrouter_kern_user.h"
+
+/* 配置文件中的一条路由，地址均为主机序。前缀相同的多条路由组成 ECMP */
+struct xrt_route_cfg {
+	__u32 prefix;
+	__u8  len;
+	__u8  blackhole;
+	__u16 pad;
+	__u32 gateway;		// 0 表示直连
+	__u32 ifindex;
+};
+
+/* 静态邻居，smac 在加载时从出接口读取 */
+struct xrt_neigh_cfg {
+	__u32 addr;
+	__u32 ifindex;
+	__u8  lladdr[6];
+};
+
+struct xrt_config {
+	struct xrt_route_cfg *routes;
+	__u32 nr_routes;
+	__u32 cap_routes;
+	struct xrt_neigh_cfg *neighs;
+	__u32 nr_neighs;
+	__u32 cap_neighs;
+};
+
+struct xrt_maps {
+	int meta;
+	int routes;
+	int neigh;		// 学习到的邻居
+	int neigh_static;	// 配置的静态邻居
+};
+
+/* 解析一行并追加到 cfg，支持与 ip route / ip neigh 相同的写法：
+ *   PREFIX[/LEN] [via GATEWAY] dev IFNAME
+ *   blackhole PREFIX[/LEN]
+ *   neigh ADDR dev IFNAME lladdr MAC
+ * PREFIX 可写成 default。成功返回0，空行或注释返回1，格式错误返回-1
+ */
+int xrt_parse_line(const char *line, struct xrt_config *cfg);
+
+int xrt_read_config(const char *path, struct xrt_config *cfg);
+
+void xrt_free_config(struct xrt_config *cfg);
+
+int xrt_open_maps(const char *pin_dir, struct xrt_maps *maps);
+
+/* 把路由写入未生效的bank再切换，并替换静态邻居。返回写入的前缀数 */
+int xrt_load(const struct xrt_maps *maps, const struct xrt_config *cfg);
+
+/* 清空两个bank和邻居缓存，返回被删除的表项数 */
+int xrt_clear(const struct xrt_maps *maps);
+
+#endif /* __XROUTER_USER_H */
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* Used *ONLY* by BPF-prog running kernel side. */
+#ifndef __XSK_KERN_H
+#define __XSK_KERN_H
+
+#include "xsk_kern_user.h"
+
+#define XSK_NSEC_PER_SEC	1000000000ULL
+
+struct {
+	__uint(type, BPF_MAP_TYPE_XSKMAP);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, XSK_MAX_QUEUES);
+} xsk_map SEC(".maps");
+
+/* 用户态写入的判定结果，LRU 淘汰长期不活动的流 */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__type(key, struct xsk_flow_key);
+	__type(value, struct xsk_verdict);
+	__uint(max_entries, XSK_MAX_VERDICTS);
+} xsk_verdicts SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct xsk_config);
+	__uint(max_entries, 1);
+} xsk_config_map SEC(".maps");
+
+static __always_inline struct xsk_config *xsk_get_config(void)
+{
+	__u32 zero = 0;
+
+	return bpf_map_lookup_elem(&xsk_config_map, &zero);
+}
+
+/* 已有判定时返回判定的动作，否则重定向到本队列的 AF_XDP 套接字，
+ * 队列上没有套接字时返回 XDP_PASS。*verdict 表示是否命中了判定结果。
+ */
+static __always_inline
+xdp_act xsk_steer(struct xdp_md *ctx, __u32 saddr, __u32 daddr,
+		  __u16 sport, __u16 dport, __u8 proto, int *verdict)
+{
+	struct xsk_flow_key key = {
+		.saddr = saddr,
+		.daddr = daddr,
+		.sport = sport,
+		.dport = dport,
+		.proto = proto,
+	};
+	struct xsk_verdict *v;
+
+	v = bpf_map_lookup_elem(&xsk_verdicts, &key);
+	if (v && bpf_ktime_get_ns() - v->updated_ns <
+		 XSK_VERDICT_TTL_SEC * XSK_NSEC_PER_SEC) {
+		*verdict = 1;
+		return v->action;
+	}
+	*verdict = 0;
+	return bpf_redirect_map(&xsk_map, ctx->rx_queue_index, XDP_PASS);
+}
+
+#endif /* __XSK_KERN_H */
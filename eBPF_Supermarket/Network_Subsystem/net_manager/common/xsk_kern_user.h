@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* AF_XDP 慢路径，内核与用户态共享的结构
+ *
+ * XDP 无法判定的流（ACL 规则动作为 INSPECT，或开启 inspect_miss 时未命中任何规则）
+ * 按收包队列重定向到 xsk_map 中对应的 AF_XDP 套接字，由用户态每个队列一个的工作线程
+ * 做深度检查。判定结果写回 xsk_verdicts，同一条流之后的报文在 XDP 中直接按结果处理，
+ * 只有流的前几个报文会离开 XDP。某个队列没有绑定套接字时报文照常交给协议栈。
+ */
+#ifndef __XSK_KERN_USER_H
+#define __XSK_KERN_USER_H
+
+#include <linux/types.h>
+#include <linux/bpf.h>
+
+#define XSK_MAX_QUEUES		64
+#define XSK_MAX_VERDICTS	65536
+#define XSK_VERDICT_TTL_SEC	300	// 判定结果过期后重新检查，规则变化后能重新生效
+
+/* ACL 规则中的 INSPECT 动作。ACL 本身不会重定向，借用 XDP_REDIRECT 表示送往用户态 */
+#define XSK_ACTION_INSPECT	XDP_REDIRECT
+
+/* 单方向的流，地址和端口均为主机序 */
+struct xsk_flow_key {
+	__u32 saddr;
+	__u32 daddr;
+	__u16 sport;
+	__u16 dport;
+	__u8  proto;
+	__u8  pad[3];
+};
+
+struct xsk_verdict {
+	__u32 action;		// XDP_PASS 或 XDP_DROP
+	__u32 pad;
+	__u64 updated_ns;	// 与 bpf_ktime_get_ns 同一时钟
+};
+
+/* xsk_config_map 中唯一的一项 */
+struct xsk_config {
+	__u32 enabled;		// 0 时 INSPECT 按 XDP_PASS 处理
+	__u32 inspect_miss;	// 非0时未命中任何 ACL 规则的报文也送往用户态
+};
+
+#endif /* __XSK_KERN_USER_H */
@@ -0,0 +1,500 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/ethtool.h>
+#include <linux/if_ether.h>
+#include <linux/if_tun.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/sockios.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <bpf/bpf.h>
+#include <xdp/xsk.h>
+
+#include "common_defines.h"
+#include "common_user_bpf_xdp.h"
+#include "xsk_user.h"
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL	69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET	70
+#endif
+
+#define XSK_NUM_FRAMES		XSK_RING_PROD__DEFAULT_NUM_DESCS
+#define XSK_FRAME_SIZE		XSK_UMEM__DEFAULT_FRAME_SIZE
+#define XSK_RX_BATCH		64
+#define XSK_BUSY_POLL_USEC	20
+#define XSK_ERR_INTERVAL_NS	1000000000ULL
+
+struct xsk_worker {
+	struct xsk_pool *pool;
+	__u32 queue;
+	void *buffer;
+	struct xsk_umem *umem;
+	struct xsk_ring_prod fq;
+	struct xsk_ring_cons cq;
+	struct xsk_ring_cons rx;
+	struct xsk_socket *xsk;
+	pthread_t thread;
+	bool started;
+	struct xsk_pool_stats stats;	// 只由本线程写
+	__u64 err_ns;			// 上次输出错误的时间，每秒最多输出一次
+	__u64 err_suppressed;
+};
+
+struct xsk_pool {
+	struct xsk_pool_opts opts;
+	int verdicts_fd;
+	int tun_fd;
+	volatile bool stop;
+	int nr_workers;
+	struct xsk_worker workers[];
+};
+
+static __u64 xsk_now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (__u64)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int nr_rx_queues(const char *ifname)
+{
+	struct ethtool_channels ch = { .cmd = ETHTOOL_GCHANNELS };
+	struct ifreq ifr = { 0 };
+	int fd, n = 1;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return 1;
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	ifr.ifr_data = (void *)&ch;
+	// 不支持查询通道数的设备只有一个队列
+	if (!ioctl(fd, SIOCETHTOOL, &ifr))
+		n = ch.combined_count ? ch.combined_count : ch.rx_count;
+	close(fd);
+	if (n < 1)
+		n = 1;
+	return n < XSK_MAX_QUEUES ? n : XSK_MAX_QUEUES;
+}
+
+/* 放行的报文写入 TUN 设备，由协议栈当作从该设备收到的报文处理。
+ * 设备按网卡的 ifindex 命名，网卡名再长也不会截断成相同的名字
+ */
+static int open_tun(const char *ifname)
+{
+	struct ifreq ifr = { 0 };
+	unsigned int ifindex;
+	int fd, sock;
+
+	ifindex = if_nametoindex(ifname);
+	if (!ifindex)
+		return -errno;
+	fd = open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+	snprintf(ifr.ifr_name, IFNAMSIZ, "xsk%u", ifindex);
+	if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+		goto err;
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+		goto err;
+	ifr.ifr_flags = IFF_UP;
+	if (ioctl(sock, SIOCSIFFLAGS, &ifr) < 0) {
+		close(sock);
+		goto err;
+	}
+	close(sock);
+	return fd;
+err:
+	close(fd);
+	return -errno;
+}
+
+static int worker_setup(struct xsk_worker *w, int xsk_map_fd)
+{
+	const struct xsk_pool_opts *opts = &w->pool->opts;
+	struct xsk_socket_config cfg = {
+		.rx_size      = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+		.tx_size      = 0,
+		.libxdp_flags = XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD,
+		.bind_flags   = opts->bind_flags | XDP_USE_NEED_WAKEUP,
+	};
+	__u64 size = (__u64)XSK_NUM_FRAMES * XSK_FRAME_SIZE;
+	__u32 idx, i;
+	int err, fd, opt;
+
+	if (posix_memalign(&w->buffer, getpagesize(), size))
+		return -ENOMEM;
+	err = xsk_umem__create(&w->umem, w->buffer, size, &w->fq, &w->cq, NULL);
+	if (err)
+		return err;
+	err = xsk_socket__create(&w->xsk, opts->ifname, w->queue, w->umem,
+				 &w->rx, NULL, &cfg);
+	if (err)
+		return err;
+	err = xsk_socket__update_xskmap(w->xsk, xsk_map_fd);
+	if (err)
+		return err;
+
+	if (xsk_ring_prod__reserve(&w->fq, XSK_NUM_FRAMES, &idx) != XSK_NUM_FRAMES)
+		return -ENOMEM;
+	for (i = 0; i < XSK_NUM_FRAMES; i++)
+		*xsk_ring_prod__fill_addr(&w->fq, idx++) = (__u64)i * XSK_FRAME_SIZE;
+	xsk_ring_prod__submit(&w->fq, XSK_NUM_FRAMES);
+
+	if (!opts->busy_poll)
+		return 0;
+	// 由本线程在 recvfrom 中驱动 NAPI，而不是等待软中断
+	fd = xsk_socket__fd(w->xsk);
+	opt = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &opt, sizeof(opt)))
+		return -errno;
+	opt = XSK_BUSY_POLL_USEC;
+	if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &opt, sizeof(opt)))
+		return -errno;
+	opt = XSK_RX_BATCH;
+	if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &opt, sizeof(opt)))
+		return -errno;
+	return 0;
+}
+
+static void worker_teardown(struct xsk_worker *w)
+{
+	if (w->xsk)
+		xsk_socket__delete(w->xsk);
+	if (w->umem)
+		xsk_umem__delete(w->umem);
+	free(w->buffer);
+}
+
+/* 解析 IPv4 报文，填写流并返回负载的偏移，无法解析时返回 -1 */
+static int parse_flow(const __u8 *pkt, __u32 len, struct xsk_flow_key *flow)
+{
+	const struct ethhdr *eth = (const void *)pkt;
+	const struct iphdr *iph;
+	__u32 off = sizeof(*eth), hlen;
+
+	if (len < off + sizeof(*iph) || eth->h_proto != htons(ETH_P_IP))
+		return -1;
+	iph = (const void *)(pkt + off);
+	hlen = iph->ihl * 4;
+	if (hlen < sizeof(*iph) || len < off + hlen)
+		return -1;
+	off += hlen;
+
+	memset(flow, 0, sizeof(*flow));
+	flow->saddr = ntohl(iph->saddr);
+	flow->daddr = ntohl(iph->daddr);
+	flow->proto = iph->protocol;
+	// 非首个分片没有传输层头部，端口记为0，与内核侧 xdp_entry_ipv4 的规则一致
+	if (iph->frag_off & htons(0x1FFF))
+		return off;
+
+	switch (iph->protocol) {
+	case IPPROTO_TCP: {
+		const struct tcphdr *th = (const void *)(pkt + off);
+
+		if (len < off + sizeof(*th) || th->doff * 4 < sizeof(*th) ||
+		    len < off + th->doff * 4)
+			return -1;
+		flow->sport = ntohs(th->source);
+		flow->dport = ntohs(th->dest);
+		return off + th->doff * 4;
+	}
+	case IPPROTO_UDP: {
+		const struct udphdr *uh = (const void *)(pkt + off);
+
+		if (len < off + sizeof(*uh))
+			return -1;
+		flow->sport = ntohs(uh->source);
+		flow->dport = ntohs(uh->dest);
+		return off + sizeof(*uh);
+	}
+	case IPPROTO_ICMP:
+		return len < off + 8 ? -1 : (int)off + 8;
+	default:
+		return off;
+	}
+}
+
+static void handle_packet(struct xsk_worker *w, const __u8 *pkt, __u32 len)
+{
+	struct xsk_pool *pool = w->pool;
+	struct xsk_flow_key flow;
+	struct xsk_verdict v = { 0 };
+	int off, action;
+
+	w->stats.rx++;
+	off = parse_flow(pkt, len, &flow);
+	action = off < 0 ? XSK_UNDECIDED :
+		 pool->opts.inspect(&flow, pkt + off, len - off, pool->opts.ctx);
+	if (action == XSK_UNDECIDED) {
+		w->stats.undecided++;
+	} else {
+		v.action = action;
+		v.updated_ns = xsk_now_ns();
+		if (bpf_map_update_elem(pool->verdicts_fd, &flow, &v, BPF_ANY)) {
+			int err = errno;
+
+			if (v.updated_ns - w->err_ns < XSK_ERR_INTERVAL_NS) {
+				w->err_suppressed++;
+			} else {
+				fprintf(stderr, "ERR: queue %u writing verdict: %s (%llu suppressed)\n",
+					w->queue, strerror(err), (unsigned long long)w->err_suppressed);
+				w->err_ns = v.updated_ns;
+				w->err_suppressed = 0;
+			}
+		}
+		if (action == XDP_DROP) {
+			w->stats.drop++;
+			return;
+		}
+		w->stats.pass++;
+	}
+
+	if (len < sizeof(struct ethhdr) || pool->tun_fd < 0 ||
+	    write(pool->tun_fd, pkt + sizeof(struct ethhdr), len - sizeof(struct ethhdr)) < 0)
+		w->stats.inject_err++;
+}
+
+static void worker_rx(struct xsk_worker *w)
+{
+	__u32 idx_rx = 0, idx_fq = 0, rcvd, i;
+	int fd = xsk_socket__fd(w->xsk);
+
+	rcvd = xsk_ring_cons__peek(&w->rx, XSK_RX_BATCH, &idx_rx);
+	if (!rcvd) {
+		if (w->pool->opts.busy_poll || xsk_ring_prod__needs_wakeup(&w->fq))
+			recvfrom(fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+		return;
+	}
+
+	// 报文处理完即归还，填充队列一定有 rcvd 个空位
+	while (xsk_ring_prod__reserve(&w->fq, rcvd, &idx_fq) != rcvd) {
+		if (w->pool->stop)
+			return;
+	}
+	for (i = 0; i < rcvd; i++) {
+		const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&w->rx, idx_rx++);
+		__u64 orig = xsk_umem__extract_addr(desc->addr);
+		__u64 addr = xsk_umem__add_offset_to_addr(desc->addr);
+
+		handle_packet(w, xsk_umem__get_data(w->buffer, addr), desc->len);
+		*xsk_ring_prod__fill_addr(&w->fq, idx_fq++) = orig;
+	}
+	xsk_ring_prod__submit(&w->fq, rcvd);
+	xsk_ring_cons__release(&w->rx, rcvd);
+}
+
+static void *worker_loop(void *arg)
+{
+	struct xsk_worker *w = arg;
+	struct pollfd pfd = {
+		.fd     = xsk_socket__fd(w->xsk),
+		.events = POLLIN,
+	};
+
+	while (!w->pool->stop) {
+		if (!w->pool->opts.busy_poll && poll(&pfd, 1, 100) <= 0)
+			continue;
+		worker_rx(w);
+	}
+	return NULL;
+}
+
+struct xsk_pool *xsk_pool_start(const struct xsk_pool_opts *opts)
+{
+	struct xsk_pool *pool;
+	int xsk_map_fd, nr, err, i;
+
+	nr = opts->queue >= 0 ? 1 : nr_rx_queues(opts->ifname);
+	pool = calloc(1, sizeof(*pool) + nr * sizeof(pool->workers[0]));
+	if (!pool)
+		return NULL;
+	pool->opts = *opts;
+	pool->nr_workers = nr;
+	pool->tun_fd = -1;
+
+	xsk_map_fd = open_bpf_map_file(opts->pin_dir, "xsk_map", NULL);
+	pool->verdicts_fd = open_bpf_map_file(opts->pin_dir, "xsk_verdicts", NULL);
+	if (xsk_map_fd < 0 || pool->verdicts_fd < 0)
+		goto err;
+
+	pool->tun_fd = open_tun(opts->ifname);
+	if (pool->tun_fd < 0)
+		fprintf(stderr, "WARN: creating tun device: %s, passed packets will be dropped\n",
+			strerror(-pool->tun_fd));
+
+	for (i = 0; i < nr; i++) {
+		struct xsk_worker *w = &pool->workers[i];
+
+		w->pool = pool;
+		w->queue = opts->queue >= 0 ? opts->queue : i;
+		err = worker_setup(w, xsk_map_fd);
+		if (err) {
+			fprintf(stderr, "ERR: AF_XDP socket on %s queue %u: %s\n",
+				opts->ifname, w->queue, strerror(-err));
+			goto err;
+		}
+	}
+	for (i = 0; i < nr; i++) {
+		err = pthread_create(&pool->workers[i].thread, NULL, worker_loop, &pool->workers[i]);
+		if (err) {
+			fprintf(stderr, "ERR: starting AF_XDP worker: %s\n", strerror(err));
+			goto err;
+		}
+		pool->workers[i].started = true;
+	}
+	close(xsk_map_fd);
+	return pool;
+err:
+	if (xsk_map_fd >= 0)
+		close(xsk_map_fd);
+	xsk_pool_stop(pool);
+	return NULL;
+}
+
+void xsk_pool_stats(struct xsk_pool *pool, struct xsk_pool_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	for (int i = 0; i < pool->nr_workers; i++) {
+		const struct xsk_pool_stats *s = &pool->workers[i].stats;
+
+		stats->rx += s->rx;
+		stats->pass += s->pass;
+		stats->drop += s->drop;
+		stats->undecided += s->undecided;
+		stats->inject_err += s->inject_err;
+	}
+}
+
+int xsk_pool_nr_queues(struct xsk_pool *pool)
+{
+	return pool->nr_workers;
+}
+
+void xsk_pool_stop(struct xsk_pool *pool)
+{
+	if (!pool)
+		return;
+	pool->stop = true;
+	for (int i = 0; i < pool->nr_workers; i++) {
+		if (pool->workers[i].started)
+			pthread_join(pool->workers[i].thread, NULL);
+		worker_teardown(&pool->workers[i]);
+	}
+	if (pool->verdicts_fd >= 0)
+		close(pool->verdicts_fd);
+	if (pool->tun_fd >= 0)
+		close(pool->tun_fd);
+	free(pool);
+}
+
+static int parse_pattern(const char *s, struct xsk_pattern *p)
+{
+	unsigned int c;
+	__u32 n = 0;
+
+	while (*s && n < XSK_PATTERN_MAX) {
+		if (s[0] == '\\' && s[1] == 'x' && sscanf(s + 2, "%2x", &c) == 1) {
+			p->str[n++] = c;
+			s += 4;
+		} else {
+			p->str[n++] = *s++;
+		}
+	}
+	if (*s || !n)
+		return -1;
+	p->len = n;
+	return 0;
+}
+
+int xsk_read_patterns(const char *path, struct xsk_patterns *p)
+{
+	struct xsk_pattern *tmp;
+	__u32 cap = 0, lineno = 0;
+	char line[256], action[16];
+	int pos;
+	FILE *file;
+
+	memset(p, 0, sizeof(*p));
+	file = fopen(path, "r");
+	if (!file) {
+		perror("Error opening file");
+		return -errno;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (sscanf(line, " %15s %n", action, &pos) != 1 || action[0] == '#')
+			continue;
+
+		if (p->nr == cap) {
+			cap = cap ? cap * 2 : 16;
+			tmp = realloc(p->rules, cap * sizeof(*tmp));
+			if (!tmp)
+				goto err;
+			p->rules = tmp;
+		}
+		tmp = &p->rules[p->nr];
+		if (strcmp(action, "ALLOW") == 0)
+			tmp->action = XDP_PASS;
+		else if (strcmp(action, "DENY") == 0)
+			tmp->action = XDP_DROP;
+		else
+			goto bad;
+		if (parse_pattern(line + pos, tmp))
+			goto bad;
+		p->nr++;
+	}
+	fclose(file);
+	return 0;
+bad:
+	fprintf(stderr, "ERR: %s:%u: invalid pattern \"%s\"\n", path, lineno, line);
+	errno = EINVAL;
+err:
+	fclose(file);
+	xsk_free_patterns(p);
+	return -errno;
+}
+
+void xsk_free_patterns(struct xsk_patterns *p)
+{
+	free(p->rules);
+	p->rules = NULL;
+	p->nr = 0;
+}
+
+int xsk_inspect_patterns(const struct xsk_flow_key *flow,
+			 const __u8 *payload, __u32 len, void *ctx)
+{
+	const struct xsk_patterns *p = ctx;
+
+	if (!len)
+		return XSK_UNDECIDED;
+	for (__u32 i = 0; i < p->nr; i++) {
+		const struct xsk_pattern *r = &p->rules[i];
+
+		if (len >= r->len && memmem(payload, len, r->str, r->len))
+			return r->action;
+	}
+	return XDP_PASS;
+}
@@ -0,0 +1,70 @@
+/* AF_XDP 慢路径的用户态部分：每个收包队列一个工作线程，检查送上来的报文，
+ * 把判定结果写回 xsk_verdicts，放行的报文经 TUN 设备重新注入协议栈
+ */
+#ifndef __XSK_USER_H
+#define __XSK_USER_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+#include "xsk_kern_user.h"
+
+#define XSK_UNDECIDED		-1
+#define XSK_PATTERN_MAX		64
+
+/* 检查一个报文，返回 XDP_PASS/XDP_DROP，需要看后续报文时返回 XSK_UNDECIDED */
+typedef int (*xsk_inspect_fn)(const struct xsk_flow_key *flow,
+			      const __u8 *payload, __u32 len, void *ctx);
+
+struct xsk_pool_opts {
+	const char *ifname;
+	const char *pin_dir;	// 打开 xsk_map 和 xsk_verdicts
+	int queue;		// 只绑定这个队列，-1 为网卡的所有队列
+	__u16 bind_flags;	// XDP_COPY / XDP_ZEROCOPY，0 由内核选择
+	bool busy_poll;		// 忙轮询，不在 poll() 中睡眠
+	xsk_inspect_fn inspect;
+	void *ctx;
+};
+
+struct xsk_pool_stats {
+	__u64 rx;		// 收到的报文
+	__u64 pass;		// 判定为放行的流
+	__u64 drop;		// 判定为丢弃的流
+	__u64 undecided;	// 尚未判定、先放行的报文
+	__u64 inject_err;	// 重新注入协议栈失败的报文
+};
+
+struct xsk_pool;
+
+struct xsk_pool *xsk_pool_start(const struct xsk_pool_opts *opts);
+
+/* 汇总所有工作线程的计数 */
+void xsk_pool_stats(struct xsk_pool *pool, struct xsk_pool_stats *stats);
+
+int xsk_pool_nr_queues(struct xsk_pool *pool);
+
+void xsk_pool_stop(struct xsk_pool *pool);
+
+/* 按负载内容匹配的检查规则，第一条包含 str 的规则决定动作 */
+struct xsk_pattern {
+	__u32 action;
+	__u32 len;
+	char str[XSK_PATTERN_MAX];
+};
+
+struct xsk_patterns {
+	struct xsk_pattern *rules;
+	__u32 nr;
+};
+
+/* 读取 "ALLOW|DENY 内容" 格式的规则文件，内容可含空格，支持 \xHH 转义 */
+int xsk_read_patterns(const char *path, struct xsk_patterns *p);
+
+void xsk_free_patterns(struct xsk_patterns *p);
+
+/* xsk_inspect_fn 的默认实现，ctx 为 struct xsk_patterns。
+ * 没有负载的报文（握手、纯 ACK）不判定，第一个有负载的报文没有命中任何规则时放行
+ */
+int xsk_inspect_patterns(const struct xsk_flow_key *flow,
+			 const __u8 *payload, __u32 len, void *ctx);
+
+#endif /* __XSK_USER_H */
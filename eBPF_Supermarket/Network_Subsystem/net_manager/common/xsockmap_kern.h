@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* Used *ONLY* by BPF-prog running kernel side. */
+#ifndef __XSOCKMAP_KERN_H
+#define __XSOCKMAP_KERN_H
+
+#include "xsockmap_kern_user.h"
+
+#define FORCE_READ(x) (*(volatile typeof(x) *)&(x))
+
+struct {
+	__uint(type, BPF_MAP_TYPE_SOCKHASH);
+	__type(key, struct sock_key);
+	__type(value, int);
+	__uint(max_entries, SOCKMAP_MAX_ENTRIES);
+} sock_ops_map SEC(".maps");
+
+/* 端口白名单，主机字节序 */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, __u16);
+	__type(value, __u8);
+	__uint(max_entries, SOCKMAP_MAX_PORTS);
+} sockmap_ports SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct sockmap_config);
+	__uint(max_entries, 1);
+} sockmap_config_map SEC(".maps");
+
+/* socket 关闭时删除，LRU 兜底未收到关闭事件的表项 */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+	__type(key, struct sock_key);
+	__type(value, struct sockmap_sock_stats);
+	__uint(max_entries, SOCKMAP_MAX_ENTRIES);
+} sockmap_sock_stats SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, __u64);
+	__uint(max_entries, SOCKMAP_CNT_MAX);
+} sockmap_counters SEC(".maps");
+
+static __always_inline void sockmap_count(__u32 idx, __u64 n)
+{
+	__u64 *cnt = bpf_map_lookup_elem(&sockmap_counters, &idx);
+
+	if (cnt)
+		*cnt += n;
+}
+
+static __always_inline
+void extract_key4_from_msg(struct sk_msg_md *msg, struct sock_key *key)
+{
+	key->sip4 = msg->remote_ip4;
+	key->dip4 = msg->local_ip4;
+	key->family = 1;
+
+	key->dport = (bpf_htonl(msg->local_port) >> 16);
+	key->sport = FORCE_READ(msg->remote_port) >> 16;
+}
+
+static __always_inline
+void extract_key4_from_ops(struct bpf_sock_ops *ops, struct sock_key *key)
+{
+	// keep ip and port in network byte order
+	key->dip4 = ops->remote_ip4;
+	key->sip4 = ops->local_ip4;
+	key->family = 1;
+
+	// local_port is in host byte order, and remote_port is in network byte order
+	key->sport = (bpf_htonl(ops->local_port) >> 16);
+	key->dport = FORCE_READ(ops->remote_port) >> 16;
+}
+
+static __always_inline int sockmap_port_allowed(const struct sock_key *key)
+{
+	__u16 lport = bpf_ntohs((__u16)key->sport);
+	__u16 rport = bpf_ntohs((__u16)key->dport);
+
+	return bpf_map_lookup_elem(&sockmap_ports, &lport) ||
+	       bpf_map_lookup_elem(&sockmap_ports, &rport);
+}
+
+/* 建连时按策略加入 sock_ops_map，并订阅状态变化以便关闭时清理统计 */
+static __always_inline void sockmap_sock_established(struct bpf_sock_ops *skops)
+{
+	struct sockmap_config *cfg;
+	struct sock_key key = {};
+	__u32 zero = 0;
+
+	cfg = bpf_map_lookup_elem(&sockmap_config_map, &zero);
+	if (!cfg || !cfg->enabled)
+		return;
+
+	extract_key4_from_ops(skops, &key);
+	if (cfg->port_filter && !sockmap_port_allowed(&key)) {
+		sockmap_count(SOCKMAP_CNT_SKIP, 1);
+		return;
+	}
+	if (bpf_sock_hash_update(skops, &sock_ops_map, &key, BPF_NOEXIST)) {
+		sockmap_count(SOCKMAP_CNT_INSERT_ERR, 1);
+		return;
+	}
+	sockmap_count(SOCKMAP_CNT_INSERT, 1);
+	bpf_sock_ops_cb_flags_set(skops, skops->bpf_sock_ops_cb_flags | BPF_SOCK_OPS_STATE_CB_FLAG);
+}
+
+/* socket 关闭时内核会自动把它从 sock_ops_map 中删除，这里只删除统计 */
+static __always_inline void sockmap_sock_closed(struct bpf_sock_ops *skops)
+{
+	struct sock_key key = {};
+
+	extract_key4_from_ops(skops, &key);
+	bpf_map_delete_elem(&sockmap_sock_stats, &key);
+	sockmap_count(SOCKMAP_CNT_CLOSE, 1);
+}
+
+/* key 为对端的键，统计记在本端的键下，即交换源和目的 */
+static __always_inline void sockmap_account(const struct sock_key *peer, __u32 bytes, int redirected)
+{
+	struct sockmap_sock_stats *st, zero = {};
+	struct sock_key key = {
+		.sip4 = peer->dip4,
+		.dip4 = peer->sip4,
+		.family = peer->family,
+		.sport = peer->dport,
+		.dport = peer->sport,
+	};
+
+	st = bpf_map_lookup_elem(&sockmap_sock_stats, &key);
+	if (!st) {
+		bpf_map_update_elem(&sockmap_sock_stats, &key, &zero, BPF_NOEXIST);
+		st = bpf_map_lookup_elem(&sockmap_sock_stats, &key);
+		if (!st)
+			return;
+	}
+	if (redirected) {
+		st->redir_bytes += bytes;
+		st->redir_msgs++;
+		sockmap_count(SOCKMAP_CNT_REDIR, 1);
+		sockmap_count(SOCKMAP_CNT_REDIR_BYTES, bytes);
+	} else {
+		st->pass_bytes += bytes;
+		st->pass_msgs++;
+		sockmap_count(SOCKMAP_CNT_PASS, 1);
+		sockmap_count(SOCKMAP_CNT_PASS_BYTES, bytes);
+	}
+}
+
+#endif /* __XSOCKMAP_KERN_H */
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* 同主机 socket 加速（sockmap），内核与用户态共享的结构
+ *
+ * sockops 程序在 TCP 建连时把 socket 写入 sock_ops_map，sk_msg 程序在 sendmsg 时
+ * 按对端的键查找 sock_ops_map，找到则把数据直接放入对端 socket 的接收队列，绕过
+ * TCP/IP 协议栈；找不到（对端不在本机或未加速）时照常走协议栈。
+ * 只有 sockops 程序挂载的 cgroup 中的 socket 会被处理，配置了端口白名单时
+ * 还要求本端或对端端口在白名单中。
+ */
+#ifndef __XSOCKMAP_KERN_USER_H
+#define __XSOCKMAP_KERN_USER_H
+
+#include <linux/types.h>
+
+#define SOCKMAP_MAX_ENTRIES	65535
+#define SOCKMAP_MAX_PORTS	1024
+#define SOCKMAP_PIN_DIR		"/sys/fs/bpf/sockmap"
+
+/* IP 和端口都是网络字节序 */
+struct sock_key {
+	__u32 sip4;    // 源 IP
+	__u32 dip4;    // 目的 IP
+	__u8  family;  // 协议类型
+	__u8  pad1;    // this padding required for 64bit alignment
+	__u16 pad2;    // else ebpf kernel verifier rejects loading of the program
+	__u32 pad3;
+	__u32 sport;   // 源端口
+	__u32 dport;   // 目的端口
+} __attribute__((packed));
+
+struct sockmap_config {
+	__u32 enabled;		// 0 时新建连接不再加入 sock_ops_map
+	__u32 port_filter;	// 非0时只加速端口在 sockmap_ports 中的连接
+};
+
+/* 每个 socket 发送方向的统计，键为本端在 sock_ops_map 中的键 */
+struct sockmap_sock_stats {
+	__u64 redir_bytes;	// 绕过协议栈直接送到对端的字节数
+	__u64 redir_msgs;
+	__u64 pass_bytes;	// 对端不在 sock_ops_map 中，走协议栈
+	__u64 pass_msgs;
+};
+
+enum {
+	SOCKMAP_CNT_INSERT = 0,		// 加入 sock_ops_map 的 socket
+	SOCKMAP_CNT_INSERT_ERR,
+	SOCKMAP_CNT_SKIP,		// 不在端口白名单中
+	SOCKMAP_CNT_CLOSE,
+	SOCKMAP_CNT_REDIR,
+	SOCKMAP_CNT_REDIR_BYTES,
+	SOCKMAP_CNT_PASS,
+	SOCKMAP_CNT_PASS_BYTES,
+	SOCKMAP_CNT_MAX,
+};
+
+#endif /* __XSOCKMAP_KERN_USER_H */
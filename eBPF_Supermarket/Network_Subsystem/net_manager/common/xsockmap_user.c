@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "xsockmap_user.h"
+
+int sockmap_parse_ports(const char *list, __u16 *ports, int max)
+{
+	const char *p = list;
+	char *end;
+	int n = 0;
+
+	while (*p) {
+		unsigned long port = strtoul(p, &end, 10);
+
+		if (end == p || port == 0 || port > 65535 || n >= max)
+			return -1;
+		ports[n++] = port;
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return -1;
+		p = end;
+	}
+	return n;
+}
+
+int sockmap_configure(int config_fd, int ports_fd, const __u16 *ports, int nr)
+{
+	struct sockmap_config cfg = { .enabled = 1, .port_filter = nr > 0 };
+	__u8 one = 1;
+	__u32 zero = 0;
+
+	for (int i = 0; i < nr; i++) {
+		if (bpf_map_update_elem(ports_fd, &ports[i], &one, BPF_ANY))
+			return -errno;
+	}
+	// 白名单写完后才打开，避免短暂地加速所有连接
+	if (bpf_map_update_elem(config_fd, &zero, &cfg, BPF_ANY))
+		return -errno;
+	return 0;
+}
+
+int sockmap_attach(struct sockmap_links *l, char * const *cgroups, int nr)
+{
+	int err;
+
+	l->nr_cgroups = 0;
+	l->cgroup_fd = calloc(nr ? nr : 1, sizeof(*l->cgroup_fd));
+	if (!l->cgroup_fd)
+		return -ENOMEM;
+
+	// sk_msg 先挂上，sockops 一旦开始把 socket 加入 sock_ops_map 就能重定向
+	if (bpf_prog_attach(l->msg_fd, l->map_fd, BPF_SK_MSG_VERDICT, 0)) {
+		err = -errno;
+		fprintf(stderr, "ERR: attaching sk_msg program: %s\n", strerror(errno));
+		goto err;
+	}
+	for (int i = 0; i < nr; i++) {
+		int fd = open(cgroups[i], O_RDONLY);
+
+		if (fd < 0) {
+			err = -errno;
+			fprintf(stderr, "ERR: opening cgroup %s: %s\n", cgroups[i], strerror(errno));
+			goto err_detach;
+		}
+		if (bpf_prog_attach(l->sockops_fd, fd, BPF_CGROUP_SOCK_OPS, 0)) {
+			err = -errno;
+			fprintf(stderr, "ERR: attaching sockops program to %s: %s\n",
+				cgroups[i], strerror(errno));
+			close(fd);
+			goto err_detach;
+		}
+		l->cgroup_fd[l->nr_cgroups++] = fd;
+	}
+	return 0;
+
+err_detach:
+	sockmap_detach(l);
+	return err;
+err:
+	free(l->cgroup_fd);
+	l->cgroup_fd = NULL;
+	return err;
+}
+
+void sockmap_detach(struct sockmap_links *l)
+{
+	for (int i = 0; i < l->nr_cgroups; i++) {
+		bpf_prog_detach2(l->sockops_fd, l->cgroup_fd[i], BPF_CGROUP_SOCK_OPS);
+		close(l->cgroup_fd[i]);
+	}
+	bpf_prog_detach2(l->msg_fd, l->map_fd, BPF_SK_MSG_VERDICT);
+	free(l->cgroup_fd);
+	l->cgroup_fd = NULL;
+	l->nr_cgroups = 0;
+}
+
+int sockmap_read_counters(int fd, __u64 *cnt)
+{
+	int nr_cpus = libbpf_num_possible_cpus();
+	__u64 *vals;
+
+	if (nr_cpus < 0)
+		return nr_cpus;
+	vals = calloc(nr_cpus, sizeof(*vals));
+	if (!vals)
+		return -ENOMEM;
+	for (__u32 i = 0; i < SOCKMAP_CNT_MAX; i++) {
+		cnt[i] = 0;
+		if (bpf_map_lookup_elem(fd, &i, vals))
+			continue;
+		for (int c = 0; c < nr_cpus; c++)
+			cnt[i] += vals[c];
+	}
+	free(vals);
+	return 0;
+}
+
+static int cmp_sock(const void *a, const void *b)
+{
+	const struct sockmap_sock *x = a, *y = b;
+
+	if (x->st.redir_bytes != y->st.redir_bytes)
+		return x->st.redir_bytes > y->st.redir_bytes ? -1 : 1;
+	return 0;
+}
+
+int sockmap_top_socks(int fd, struct sockmap_sock *top, int max, int *nr_top)
+{
+	int nr_cpus = libbpf_num_possible_cpus();
+	struct sockmap_sock_stats *vals;
+	struct sock_key cur, prev;
+	int n = 0, first = 1;
+
+	*nr_top = 0;
+	if (nr_cpus < 0)
+		return nr_cpus;
+	vals = calloc(nr_cpus, sizeof(*vals));
+	if (!vals)
+		return -ENOMEM;
+	while (!bpf_map_get_next_key(fd, first ? NULL : &prev, &cur)) {
+		struct sockmap_sock s = { .key = cur };
+
+		first = 0;
+		prev = cur;
+		if (bpf_map_lookup_elem(fd, &cur, vals))
+			continue;
+		for (int c = 0; c < nr_cpus; c++) {
+			s.st.redir_bytes += vals[c].redir_bytes;
+			s.st.redir_msgs += vals[c].redir_msgs;
+			s.st.pass_bytes += vals[c].pass_bytes;
+			s.st.pass_msgs += vals[c].pass_msgs;
+		}
+		n++;
+		// top 保持有序，新的 socket 比最后一个大时替换它
+		if (*nr_top < max) {
+			top[(*nr_top)++] = s;
+		} else if (max > 0 && s.st.redir_bytes > top[max - 1].st.redir_bytes) {
+			top[max - 1] = s;
+		} else {
+			continue;
+		}
+		qsort(top, *nr_top, sizeof(*top), cmp_sock);
+	}
+	free(vals);
+	return n;
+}
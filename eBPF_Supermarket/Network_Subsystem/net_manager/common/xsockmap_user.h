@@ -0,0 +1,43 @@
+/* 同主机 socket 加速的用户态部分：挂载到 cgroup、配置端口白名单、读取统计 */
+#ifndef __XSOCKMAP_USER_H
+#define __XSOCKMAP_USER_H
+
+#include <linux/types.h>
+#include "xsockmap_kern_user.h"
+
+struct sockmap_links {
+	int sockops_fd;		// bpf_sockmap
+	int msg_fd;		// bpf_redir
+	int map_fd;		// sock_ops_map
+	int *cgroup_fd;		// sockops 程序挂载到的 cgroup
+	int nr_cgroups;
+};
+
+struct sockmap_sock {
+	struct sock_key key;
+	struct sockmap_sock_stats st;	// 各 CPU 之和
+};
+
+/* 解析逗号分隔的端口列表，返回端口数，格式错误返回-1 */
+int sockmap_parse_ports(const char *list, __u16 *ports, int max);
+
+/* 写入端口白名单并打开加速，nr 为0时不按端口过滤 */
+int sockmap_configure(int config_fd, int ports_fd, const __u16 *ports, int nr);
+
+/* 把 sk_msg 程序挂到 sock_ops_map，再把 sockops 程序挂到各 cgroup。
+ * 失败时撤销已完成的挂载
+ */
+int sockmap_attach(struct sockmap_links *l, char * const *cgroups, int nr);
+
+/* 从 cgroup 和 sock_ops_map 上卸载，已建立的加速连接随之恢复走协议栈 */
+void sockmap_detach(struct sockmap_links *l);
+
+/* 读取 sockmap_counters 各 CPU 之和，cnt 至少 SOCKMAP_CNT_MAX 项 */
+int sockmap_read_counters(int fd, __u64 *cnt);
+
+/* 遍历 sockmap_sock_stats，按绕过协议栈的字节数取前 max 个写入 top。
+ * 返回 socket 总数，*nr_top 为写入的个数
+ */
+int sockmap_top_socks(int fd, struct sockmap_sock *top, int max, int *nr_top);
+
+#endif /* __XSOCKMAP_USER_H */
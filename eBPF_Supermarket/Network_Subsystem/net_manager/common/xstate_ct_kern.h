@@ -0,0 +1,291 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* Used *ONLY* by BPF-prog running kernel side. */
+#ifndef __XSTATE_CT_KERN_H
+#define __XSTATE_CT_KERN_H
+
+#include "xstate_ct_kern_user.h"
+
+#define CT_NSEC_PER_SEC		1000000000ULL
+
+/* 已建立的连接，以及收到回应的 UDP 流 */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__type(key, struct ct_key);
+	__type(value, struct ct_entry);
+	__uint(map_flags, BPF_F_NO_COMMON_LRU);
+	__uint(max_entries, CT_MAX_ENTRIES);
+} ct_table SEC(".maps");
+
+/* 握手中的 TCP 连接、未收到回应的 UDP 流和 ICMP 回显 */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__type(key, struct ct_key);
+	__type(value, struct ct_entry);
+	__uint(map_flags, BPF_F_NO_COMMON_LRU);
+	__uint(max_entries, CT_MAX_EMBRYONIC);
+} ct_embryonic SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct ct_config);
+	__uint(max_entries, 1);
+} ct_config_map SEC(".maps");
+
+struct ct_result {
+	__u8 verdict;		// CT_V_*
+	__u8 state;		// 处理后的连接状态
+	__u8 dir;		// 本报文的方向
+	__u8 orig_dir;
+	__u8 expired;		// 查找时发现原表项已超时
+};
+
+static __always_inline int ct_enforce(void)
+{
+	__u32 zero = 0;
+	struct ct_config *cfg = bpf_map_lookup_elem(&ct_config_map, &zero);
+
+	return cfg && cfg->enforce;
+}
+
+static __always_inline
+__u8 ct_make_key(struct ct_key *k, __u32 saddr, __u32 daddr,
+		 __u16 sport, __u16 dport, __u8 proto)
+{
+	__u8 dir = saddr > daddr || (saddr == daddr && sport > dport);
+
+	k->addr[dir] = saddr;
+	k->addr[!dir] = daddr;
+	k->port[dir] = sport;
+	k->port[!dir] = dport;
+	k->proto = proto;
+	return dir;
+}
+
+static __always_inline int ct_expired(const struct ct_entry *e, __u64 now)
+{
+	return now - e->last_seen_ns > (__u64)ct_timeout_sec(e->state) * CT_NSEC_PER_SEC;
+}
+
+/* TCP 状态转换，返回 CT_S_NONE 表示不是合法的转换。
+ * 握手阶段严格按方向推进：SYN_SENT 只在应答方向的 SYN-ACK 后离开，
+ * SYN_RECV 只在与 SYN-ACK 相反方向(发起方)的 ACK 或 FIN 后离开，
+ * 伪造或乱序的 ACK 不能把半连接提升到连接表。
+ */
+static __always_inline
+__u8 ct_tcp_next(struct ct_entry *e, __u8 dir, __u8 flags)
+{
+	__u8 st = e->state;
+
+	if (flags & CT_TCP_RST)
+		return CT_S_CLOSE;
+
+	if (flags & CT_TCP_SYN) {
+		if (flags & CT_TCP_ACK) {
+			if (st == CT_S_SYN_SENT && dir != e->orig_dir)
+				return CT_S_SYN_RECV;
+			if (st == CT_S_SYN_RECV)
+				return st;
+			return CT_S_NONE;
+		}
+		// SYN 重传
+		if (st == CT_S_SYN_SENT && dir == e->orig_dir)
+			return st;
+		return CT_S_NONE;
+	}
+
+	if (flags & CT_TCP_FIN) {
+		switch (st) {
+		case CT_S_SYN_RECV:
+			if (dir != e->orig_dir)
+				return CT_S_NONE;
+			e->fin_dir = dir + 1;
+			return CT_S_FIN_WAIT;
+		case CT_S_ESTABLISHED:
+			e->fin_dir = dir + 1;
+			return CT_S_FIN_WAIT;
+		case CT_S_FIN_WAIT:
+		case CT_S_CLOSE_WAIT:
+			return e->fin_dir != dir + 1 ? CT_S_LAST_ACK : st;
+		case CT_S_LAST_ACK:
+		case CT_S_TIME_WAIT:
+			return st;
+		default:
+			return CT_S_NONE;
+		}
+	}
+
+	if (flags & CT_TCP_ACK) {
+		switch (st) {
+		case CT_S_SYN_SENT:
+			// 还没有看到 SYN-ACK
+			return CT_S_NONE;
+		case CT_S_SYN_RECV:
+			// 发起方确认 SYN-ACK
+			return dir == e->orig_dir ? CT_S_ESTABLISHED : CT_S_NONE;
+		case CT_S_FIN_WAIT:
+			return e->fin_dir != dir + 1 ? CT_S_CLOSE_WAIT : st;
+		case CT_S_LAST_ACK:
+			// 先发 FIN 的一端确认了对端的 FIN
+			return e->fin_dir == dir + 1 ? CT_S_TIME_WAIT : st;
+		default:
+			return st;
+		}
+	}
+
+	return CT_S_NONE;
+}
+
+/* 新连接的初始状态，返回 CT_S_NONE 表示该报文不能新建连接 */
+static __always_inline
+__u8 ct_initial_state(__u8 proto, __u8 flags, __u8 icmp_type, __u8 dir, __u8 *orig_dir)
+{
+	*orig_dir = dir;
+	switch (proto) {
+	case IPPROTO_TCP:
+		flags &= CT_TCP_SYN | CT_TCP_ACK | CT_TCP_RST | CT_TCP_FIN;
+		if (flags == CT_TCP_SYN)
+			return CT_S_SYN_SENT;
+		if (flags == (CT_TCP_SYN | CT_TCP_ACK)) {
+			// SYN 由本机发出，没有经过本接口
+			*orig_dir = !dir;
+			return CT_S_SYN_RECV;
+		}
+		return CT_S_NONE;
+	case IPPROTO_UDP:
+		return CT_S_UDP_UNREPLIED;
+	case IPPROTO_ICMP:
+		// 与 SYN-ACK 相同，本机发出的回显请求没有经过本接口
+		if (icmp_type == ICMP_ECHOREPLY)
+			*orig_dir = !dir;
+		return CT_S_ICMP;
+	default:
+		return CT_S_NONE;
+	}
+}
+
+static __always_inline
+__u8 ct_next_state(struct ct_entry *e, __u8 proto, __u8 flags, __u8 dir)
+{
+	switch (proto) {
+	case IPPROTO_TCP:
+		return ct_tcp_next(e, dir, flags);
+	case IPPROTO_UDP:
+		return dir != e->orig_dir ? CT_S_UDP_REPLIED : e->state;
+	default:
+		return e->state;
+	}
+}
+
+/* 完成握手的连接从半连接表移到连接表 */
+static __always_inline int ct_confirmed(__u8 state)
+{
+	return (state >= CT_S_ESTABLISHED && state <= CT_S_TIME_WAIT) ||
+	       state == CT_S_UDP_REPLIED;
+}
+
+/* 跟踪一个主机序的报文。TCP 传入 CT_TCP_* 标志，ICMP 的 sport/dport 传回显标识符，
+ * icmp_type 只对 ICMP 有意义。
+ */
+static __always_inline
+void ct_process(__u32 saddr, __u32 daddr, __u16 sport, __u16 dport, __u8 proto,
+		__u8 flags, __u8 icmp_type, __u32 bytes, struct ct_result *res)
+{
+	struct ct_key key = {};
+	struct ct_entry *e, new_e = {};
+	int embryonic = 0, stale = 0;
+	__u64 now;
+	__u8 next;
+
+	__builtin_memset(res, 0, sizeof(*res));
+	if (proto != IPPROTO_TCP && proto != IPPROTO_UDP && proto != IPPROTO_ICMP) {
+		res->verdict = CT_V_UNTRACKED;
+		return;
+	}
+	if (proto == IPPROTO_ICMP && icmp_type != ICMP_ECHO && icmp_type != ICMP_ECHOREPLY) {
+		res->verdict = CT_V_UNTRACKED;
+		return;
+	}
+
+	res->dir = ct_make_key(&key, saddr, daddr, sport, dport, proto);
+	now = bpf_ktime_get_ns();
+
+	e = bpf_map_lookup_elem(&ct_table, &key);
+	if (!e) {
+		embryonic = 1;
+		e = bpf_map_lookup_elem(&ct_embryonic, &key);
+	}
+	if (e && ct_expired(e, now)) {
+		res->expired = 1;
+		stale = 1;
+	} else if (e && proto == IPPROTO_TCP &&
+		   (flags & (CT_TCP_SYN | CT_TCP_ACK)) == CT_TCP_SYN &&
+		   (e->state == CT_S_TIME_WAIT || e->state == CT_S_CLOSE)) {
+		// 已关闭的连接收到新的 SYN，按新连接处理
+		stale = 1;
+	}
+	if (stale) {
+		if (embryonic)
+			bpf_map_delete_elem(&ct_embryonic, &key);
+		else
+			bpf_map_delete_elem(&ct_table, &key);
+		e = NULL;
+	}
+
+	if (!e) {
+		new_e.state = ct_initial_state(proto, flags, icmp_type, res->dir, &new_e.orig_dir);
+		if (new_e.state == CT_S_NONE) {
+			res->verdict = CT_V_INVALID;
+			return;
+		}
+		new_e.last_seen_ns = now;
+		if (res->dir) {
+			new_e.packets[1] = 1;
+			new_e.bytes[1] = bytes;
+		} else {
+			new_e.packets[0] = 1;
+			new_e.bytes[0] = bytes;
+		}
+		bpf_map_update_elem(&ct_embryonic, &key, &new_e, BPF_ANY);
+		res->verdict = CT_V_NEW;
+		res->state = new_e.state;
+		res->orig_dir = new_e.orig_dir;
+		return;
+	}
+
+	res->orig_dir = e->orig_dir;
+	next = ct_next_state(e, proto, flags, res->dir);
+	if (next == CT_S_NONE) {
+		res->verdict = CT_V_IGNORED;
+		res->state = e->state;
+		return;
+	}
+
+	// 多个CPU并发更新同一连接时计数可能略有偏差，状态只是单字节写入
+	e->last_seen_ns = now;
+	if (res->dir) {
+		e->packets[1]++;
+		e->bytes[1] += bytes;
+	} else {
+		e->packets[0]++;
+		e->bytes[0] += bytes;
+	}
+	res->state = next;
+	if (next == e->state) {
+		res->verdict = CT_V_SAME;
+		return;
+	}
+
+	res->verdict = CT_V_UPDATE;
+	if (embryonic && ct_confirmed(next)) {
+		new_e = *e;
+		new_e.state = next;
+		bpf_map_update_elem(&ct_table, &key, &new_e, BPF_ANY);
+		bpf_map_delete_elem(&ct_embryonic, &key);
+	} else {
+		e->state = next;
+	}
+}
+
+#endif /* __XSTATE_CT_KERN_H */
@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* XDP 连接跟踪，内核与用户态共享的结构
+ *
+ * 连接按规范化的双向键存放：地址端口较小的一端放在前面，两个方向的报文命中同一表项。
+ * 未完成握手的连接放在单独的半连接表中，SYN 洪泛只会在半连接表内互相淘汰，
+ * 不会挤掉已建立的连接。两张表都是LRU，不会被填满；每个状态有各自的超时，
+ * 数据路径在查找时检查超时，用户态周期性清理过期表项回收空间。
+ */
+#ifndef __XSTATE_CT_KERN_USER_H
+#define __XSTATE_CT_KERN_USER_H
+
+#include <linux/types.h>
+
+#define CT_MAX_ENTRIES		(1 << 21)	// 已建立连接表
+#define CT_MAX_EMBRYONIC	(1 << 18)	// 半连接表
+
+enum {
+	CT_S_NONE = 0,
+	CT_S_SYN_SENT,
+	CT_S_SYN_RECV,
+	CT_S_ESTABLISHED,
+	CT_S_FIN_WAIT,		// 一端发出了 FIN
+	CT_S_CLOSE_WAIT,	// 对端确认了第一个 FIN
+	CT_S_LAST_ACK,		// 两端都发出了 FIN
+	CT_S_TIME_WAIT,
+	CT_S_CLOSE,		// 收到 RST
+	CT_S_UDP_UNREPLIED,
+	CT_S_UDP_REPLIED,
+	CT_S_ICMP,
+	CT_S_MAX,
+};
+
+/* ct_process 的结果 */
+enum {
+	CT_V_NEW = 0,		// 新建了连接
+	CT_V_UPDATE,		// 连接状态发生变化
+	CT_V_SAME,		// 属于已跟踪的连接，状态不变
+	CT_V_IGNORED,		// 属于已跟踪的连接，但不是合法的状态转换，不更新连接
+	CT_V_INVALID,		// 不属于任何连接，也不能新建连接
+	CT_V_UNTRACKED,		// 不跟踪的协议或报文类型
+};
+
+#define CT_TCP_FIN	0x01
+#define CT_TCP_SYN	0x02
+#define CT_TCP_RST	0x04
+#define CT_TCP_ACK	0x10
+
+/* 各状态的超时（秒），与 nf_conntrack 的默认值接近 */
+static inline __u32 ct_timeout_sec(__u8 state)
+{
+	switch (state) {
+	case CT_S_SYN_SENT:
+	case CT_S_SYN_RECV:
+		return 60;
+	case CT_S_ESTABLISHED:
+		return 5 * 24 * 3600;
+	case CT_S_FIN_WAIT:
+	case CT_S_CLOSE_WAIT:
+	case CT_S_TIME_WAIT:
+		return 120;
+	case CT_S_LAST_ACK:
+		return 30;
+	case CT_S_CLOSE:
+		return 10;
+	case CT_S_UDP_UNREPLIED:
+	case CT_S_ICMP:
+		return 30;
+	case CT_S_UDP_REPLIED:
+		return 180;
+	default:
+		return 0;
+	}
+}
+
+/* addr[0]:port[0] 为较小的一端；ICMP 用回显标识符作为 port[0]，port[1] 为 0 */
+struct ct_key {
+	__u32 addr[2];
+	__u16 port[2];
+	__u8  proto;
+	__u8  pad[3];
+};
+
+struct ct_entry {
+	__u64 last_seen_ns;
+	__u64 packets[2];	// 下标为方向：0 表示从 addr[0] 发往 addr[1]
+	__u64 bytes[2];
+	__u8  state;
+	__u8  orig_dir;		// 发起连接的一端所在的方向
+	__u8  fin_dir;		// 第一个 FIN 的方向 + 1，0 表示还没有 FIN
+	__u8  pad[5];
+};
+
+/* ct_config_map 中唯一的一项 */
+struct ct_config {
+	__u32 enforce;		// 非0时丢弃不属于任何跟踪连接、也不能新建连接的报文
+};
+
+#endif /* __XSTATE_CT_KERN_USER_H */
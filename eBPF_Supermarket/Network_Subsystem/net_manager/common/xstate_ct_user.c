@@ -0,0 +1,122 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+
+#include "xstate_ct_user.h"
+
+#define CT_SWEEP_BATCH		4096
+
+__u64 ct_now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (__u64)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int ct_entry_expired(const struct ct_entry *e, __u64 now)
+{
+	// 数据路径可能在读取之后刚刚更新了该连接，now 早于 last_seen 时不算超时
+	return now > e->last_seen_ns &&
+	       now - e->last_seen_ns > (__u64)ct_timeout_sec(e->state) * 1000000000ULL;
+}
+
+/* 处理一批读出的表项：记录存活连接的状态，删除超时的 */
+static int ct_sweep_chunk(int fd, struct ct_key *keys, struct ct_entry *vals,
+			  __u32 n, __u64 now, struct ct_summary *sum)
+{
+	__u32 nr_expired = 0;
+
+	for (__u32 i = 0; i < n; i++) {
+		if (ct_entry_expired(&vals[i], now)) {
+			keys[nr_expired++] = keys[i];
+		} else if (vals[i].state < CT_S_MAX) {
+			sum->states[vals[i].state]++;
+		}
+	}
+	if (!nr_expired)
+		return 0;
+
+	// 删除时表项可能已被 LRU 淘汰，批量删除遇到不存在的键会中止，逐个补删剩下的
+	__u32 count = nr_expired;
+	if (bpf_map_delete_batch(fd, keys, &count, NULL))
+		for (__u32 i = count; i < nr_expired; i++)
+			bpf_map_delete_elem(fd, &keys[i]);
+	sum->expired += nr_expired;
+	return nr_expired;
+}
+
+/* 不支持批量操作的内核上逐个遍历。遍历中删除当前键会让 get_next_key 从头开始，
+ * 所以先收集超时的键，遍历结束后再删除
+ */
+static int ct_sweep_slow(int fd, __u64 now, struct ct_summary *sum)
+{
+	struct ct_key cur, prev, *expired = NULL, *tmp;
+	struct ct_entry val;
+	__u32 n = 0, cap = 0;
+	int first = 1;
+
+	while (!bpf_map_get_next_key(fd, first ? NULL : &prev, &cur)) {
+		first = 0;
+		prev = cur;
+		if (bpf_map_lookup_elem(fd, &cur, &val))
+			continue;
+		if (!ct_entry_expired(&val, now)) {
+			if (val.state < CT_S_MAX)
+				sum->states[val.state]++;
+			continue;
+		}
+		if (n == cap) {
+			cap = cap ? 2 * cap : CT_SWEEP_BATCH;
+			tmp = realloc(expired, cap * sizeof(*expired));
+			if (!tmp) {
+				free(expired);
+				return -ENOMEM;
+			}
+			expired = tmp;
+		}
+		expired[n++] = cur;
+	}
+	for (__u32 i = 0; i < n; i++)
+		bpf_map_delete_elem(fd, &expired[i]);
+	free(expired);
+	sum->expired += n;
+	return n;
+}
+
+int ct_sweep(int fd, __u64 now, struct ct_summary *sum)
+{
+	struct ct_key *keys = malloc(CT_SWEEP_BATCH * sizeof(*keys));
+	struct ct_entry *vals = malloc(CT_SWEEP_BATCH * sizeof(*vals));
+	__u32 in_batch, out_batch, count;
+	void *in = NULL;
+	int err, total = 0;
+
+	if (!keys || !vals) {
+		total = -ENOMEM;
+		goto out;
+	}
+
+	do {
+		count = CT_SWEEP_BATCH;
+		err = bpf_map_lookup_batch(fd, in, &out_batch, keys, vals, &count, NULL);
+		if (err && errno != ENOENT) {
+			if (!in && errno == EINVAL) {
+				total = ct_sweep_slow(fd, now, sum);
+				goto out;
+			}
+			total = -errno;
+			goto out;
+		}
+		total += ct_sweep_chunk(fd, keys, vals, count, now, sum);
+		in_batch = out_batch;
+		in = &in_batch;
+	} while (!err);
+out:
+	free(keys);
+	free(vals);
+	return total;
+}
@@ -0,0 +1,21 @@
+/* 连接跟踪的用户态部分：清理过期连接并统计各状态的连接数 */
+#ifndef __XSTATE_CT_USER_H
+#define __XSTATE_CT_USER_H
+
+#include <linux/types.h>
+#include "xstate_ct_kern_user.h"
+
+struct ct_summary {
+	__u64 states[CT_S_MAX];	// 清理后仍存活的连接数
+	__u64 expired;		// 本次清理删除的连接数
+};
+
+/* 与 bpf_ktime_get_ns 同一时钟的当前时间 */
+__u64 ct_now_ns(void);
+
+/* 删除 fd 指向的连接表中超时的表项，并把存活连接按状态累加到 sum。
+ * 返回删除的表项数，出错返回负的错误码
+ */
+int ct_sweep(int fd, __u64 now, struct ct_summary *sum);
+
+#endif /* __XSTATE_CT_USER_H */
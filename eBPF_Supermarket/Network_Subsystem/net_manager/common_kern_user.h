@@ -12,9 +12,6 @@ typedef __u32 xdp_act;
 #define ALERT_ERR_STR "[XACL] ERROR:"
 
 
-#define MAX_RULES 256
-
-
 #ifndef PATH_MAX
 #define PATH_MAX	4096
 #endif
@@ -33,69 +30,9 @@ struct conn_ipv4 {
 	__u16 ip_proto;
 };
 
-struct rules_ipv4 {
-	__u32 saddr;
-	__u32 daddr;
-	__u8  saddr_mask;
-	__u8  daddr_mask;
-	__u16 sport;
-	__u16 dport;
-	__u16 ip_proto;
-	__u16 action;
-	__u16 prev_rule;
-	__u16 next_rule;
-};
-
-struct conn_mac {
-	unsigned char dest[ETH_ALEN];
-	unsigned char source[ETH_ALEN];
-};
-
-struct rules_mac {
-	unsigned char dest[ETH_ALEN];
-	unsigned char source[ETH_ALEN];
-	__u16 action;
-	__u16 prev_rule;
-	__u16 next_rule;
-};
-// 转发表项
-struct rt_item {
-	__u32 saddr;
-	__u8 eth_source[ETH_ALEN]; // 封装帧的源MAC地址。
-	__u8 eth_dest[ETH_ALEN]; // 封装帧的目标MAC地址。
-};
-
-// mac 过滤
-struct mac_addr {
-    __u8 addr[ETH_ALEN];
-};
-
-
-// 会话保持
-struct conn_ipv4_key {
-	__u32 saddr;
-	__u32 daddr;
-	__u16 sport;
-	__u16 dport;
-	__u16 proto;
-};
-
-struct conn_ipv4_val {
-	__u32 tcp_state;
-	__u32 rid;
-};
-
-enum {
-	TCP_S_NONE = 0U,
-	TCP_S_ESTABLISHED,
-	TCP_S_SYN_SENT,
-	TCP_S_SYN_RECV,
-	TCP_S_FIN_WAIT1,
-	TCP_S_FIN_WAIT2,
-	TCP_S_CLOSE_WAIT,
-	TCP_S_CLOSE,
-};
+// MAC 过滤：规则结构见 common/xacl_mac_kern_user.h
 
+// 会话保持：连接跟踪结构见 common/xstate_ct_kern_user.h
 
 
 #ifndef XDP_ACTION_MAX
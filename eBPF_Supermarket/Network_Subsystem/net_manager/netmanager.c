@@ -23,9 +23,17 @@ static const char *__doc__ = "XDP loader\n"
 #include <linux/if_link.h> /* depend on kernel-headers installed */
 #include <signal.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include "./common/common_params.h"
 #include "./common/common_user_bpf_xdp.h"
 #include "./common/common_libbpf.h"
+#include "./common/xacl_ipv4_user.h"
+#include "./common/xacl_mac_user.h"
+#include "./common/xdp_telemetry_user.h"
+#include "./common/xstate_ct_user.h"
+#include "./common/xrouter_user.h"
+#include "./common/xsk_user.h"
+#include "./common/xsockmap_user.h"
 #include "common_kern_user.h"
 #include "netmanager_kern.skel.h"
 static const char *default_filename = "netmanager_kern.o";
@@ -71,15 +79,45 @@ static const struct option_wrapper long_options[] = {
 
 	{{"router",      required_argument,       NULL, 'k' },
 	 "package_router"},
+
+	{{"state",       no_argument,       NULL, 'g' },
+	 "Drop packets not belonging to a tracked connection (xdp_entry_state)"},
 	
 	{{"clear",       no_argument,       NULL, 'n' },
 	 "clear_map"},
 	
 	{{"config",       no_argument,       NULL, 'T' },
-	 "config from user to kernel"},
+	 "Sample matched flows and show per-rule telemetry"},
+
+	{{"metrics",     required_argument, NULL,  8  },
+	 "Export telemetry totals and rates on http://127.0.0.1:<port>/metrics", "<port>"},
 
 	{{"socketmap_flag",       no_argument,       NULL, 'f' },
-	 "socketmap_flag"},
+	 "Accelerate same-host TCP with sockmap, bypassing the TCP/IP stack"},
+
+	{{"cgroup",      required_argument, NULL,  6  },
+	 "Attach sockmap to cgroup <path>, repeatable (default: /sys/fs/cgroup/foo)", "<path>"},
+
+	{{"sock-ports",  required_argument, NULL,  7  },
+	 "Only accelerate connections whose local or remote port is in <list>", "<p1,p2,...>"},
+
+	{{"xsk",         required_argument, NULL, 'x' },
+	 "Inspect INSPECT-rule flows on AF_XDP sockets, payload patterns from <file>", "<file>"},
+
+	{{"inspect-miss", no_argument,      NULL,  5  },
+	 "Also send packets matching no IP filter rule to AF_XDP"},
+
+	{{"queue",       required_argument, NULL, 'Q' },
+	 "Bind AF_XDP socket to queue <n> only (default: all queues)", "<n>"},
+
+	{{"busy-poll",   no_argument,       NULL, 'B' },
+	 "Busy-poll AF_XDP sockets instead of sleeping in poll()"},
+
+	{{"zero-copy",   no_argument,       NULL, 'z' },
+	 "Force AF_XDP zero-copy mode"},
+
+	{{"copy",        no_argument,       NULL, 'c' },
+	 "Force AF_XDP copy mode"},
 	{{0, 0, NULL,  0 }, NULL, false}
 };
 
@@ -253,14 +291,439 @@ static void stats_collect(int map_fd, __u32 map_type,
 			  struct stats_record *stats_rec)
 {
 	/* Collect all XDP actions stats  */
+	struct datarec values[XDP_ACTION_MAX];
 	__u32 key;
 
+	// per-CPU 表用一次批量查找读出所有动作
+	if (map_type == BPF_MAP_TYPE_PERCPU_ARRAY &&
+	    !tele_sum_percpu_array(map_fd, XDP_ACTION_MAX, sizeof(struct datarec), values)) {
+		__u64 now = gettime();
+
+		for (key = 0; key < XDP_ACTION_MAX; key++) {
+			stats_rec->stats[key].timestamp = now;
+			stats_rec->stats[key].total = values[key];
+		}
+		return;
+	}
 	for (key = 0; key < XDP_ACTION_MAX; key++) {
 		map_collect(map_fd, map_type, key, &stats_rec->stats[key]);
 	}
 }
 
-static void stats_poll(int map_fd, __u32 map_type, int interval)
+/* 遥测：per-CPU计数器与采样环形缓冲区，代替内核中的 bpf_printk。
+ * 每个周期对每张表做一次批量查找，-T 时输出到终端，--metrics 时发布到本地端点
+ */
+struct telemetry {
+	int counters_fd;
+	int rules_fd;
+	int hist_fd;
+	int ifs_fd;
+	struct ring_buffer *rb;
+	struct tele_http *http;
+	bool print;
+	__u64 counters[TELE_CNT_MAX];
+	__u64 *rule_hits;	// 上一次读取时各规则的命中数
+	__u64 hist[TELE_NR_ACTIONS * TELE_SIZE_BUCKETS];
+	struct tele_if_stat ifs[TELE_MAX_IFACES];
+};
+
+static __u32 nr_acl_rules;
+
+static const char *tele_size_names[TELE_SIZE_BUCKETS] = {
+	"<=64", "<=128", "<=256", "<=512", "<=1024", "<=1518", "<=4096", ">4096",
+};
+
+static const char *tele_counter_names[TELE_CNT_MAX] = {
+	[TELE_CNT_ACL_HIT]        = "acl_hit",
+	[TELE_CNT_ACL_MISS]       = "acl_miss",
+	[TELE_CNT_CONN_NEW]       = "conn_new",
+	[TELE_CNT_CONN_UPDATE]    = "conn_update",
+	[TELE_CNT_CONN_RST]       = "conn_rst",
+	[TELE_CNT_CONN_INVALID]   = "conn_invalid",
+	[TELE_CNT_CONN_EXPIRED]   = "conn_expired",
+	[TELE_CNT_ROUTE_FAST]     = "route_fast",
+	[TELE_CNT_ROUTE_SLOW]     = "route_slow",
+	[TELE_CNT_XSK_REDIRECT]   = "xsk_redirect",
+	[TELE_CNT_XSK_VERDICT]    = "xsk_verdict",
+	[TELE_CNT_SAMPLE_LIMITED] = "sample_limited",
+	[TELE_CNT_SAMPLE_LOST]    = "sample_lost",
+};
+
+static const char *ct_state_names[CT_S_MAX] = {
+	[CT_S_NONE]          = "NONE",
+	[CT_S_SYN_SENT]      = "SYN_SENT",
+	[CT_S_SYN_RECV]      = "SYN_RECV",
+	[CT_S_ESTABLISHED]   = "ESTABLISHED",
+	[CT_S_FIN_WAIT]      = "FIN_WAIT",
+	[CT_S_CLOSE_WAIT]    = "CLOSE_WAIT",
+	[CT_S_LAST_ACK]      = "LAST_ACK",
+	[CT_S_TIME_WAIT]     = "TIME_WAIT",
+	[CT_S_CLOSE]         = "CLOSE",
+	[CT_S_UDP_UNREPLIED] = "UDP_UNREPLIED",
+	[CT_S_UDP_REPLIED]   = "UDP_REPLIED",
+	[CT_S_ICMP]          = "ICMP",
+};
+
+static const char *ct_state_str(__u8 state)
+{
+	return state < CT_S_MAX ? ct_state_names[state] : "";
+}
+
+static char *fmt_ipv4(char *buf, __u32 addr)
+{
+	sprintf(buf, "%u.%u.%u.%u", addr >> 24, (addr >> 16) & 0xFF,
+		(addr >> 8) & 0xFF, addr & 0xFF);
+	return buf;
+}
+
+static int handle_sample(void *ctx, void *data, size_t size)
+{
+	const struct tele_sample *s = data;
+	char src[16], dst[16];
+
+	if (size < sizeof(*s))
+		return 0;
+	fmt_ipv4(src, s->saddr);
+	fmt_ipv4(dst, s->daddr);
+
+	switch (s->event) {
+	case TELE_EV_ACL_HIT:
+		printf("acl   %s:%u -> %s:%u proto:%u action:%s rule:%u\n",
+		       src, s->sport, dst, s->dport, s->proto,
+		       action2str(s->action), s->aux);
+		break;
+	case TELE_EV_CONN_NEW:
+	case TELE_EV_CONN_UPDATE:
+	case TELE_EV_CONN_RST:
+		printf("conn  %s:%u -> %s:%u proto:%u state:%s,%s\n",
+		       src, s->sport, dst, s->dport, s->proto,
+		       s->event == TELE_EV_CONN_RST ? "RST" : ct_state_str(s->state),
+		       s->action ? "original" : "reply");
+		break;
+	case TELE_EV_UDP:
+		printf("udp   %s:%u -> %s:%u len=%u state:%s\n",
+		       src, s->sport, dst, s->dport, s->aux, ct_state_str(s->state));
+		break;
+	case TELE_EV_ICMP:
+		printf("icmp  %s -> %s type=%u code=%u id=%u\n",
+		       src, dst, s->aux >> 8, s->aux & 0xFF, s->sport);
+		break;
+	case TELE_EV_ROUTE_FAST:
+	case TELE_EV_ROUTE_SLOW:
+		printf("route %s -> %s %s path to ifindex %u action:%s\n", src, dst,
+		       s->event == TELE_EV_ROUTE_FAST ? "fast" : "slow", s->aux,
+		       action2str(s->event == TELE_EV_ROUTE_FAST ? s->action : XDP_REDIRECT));
+		break;
+	}
+	return 0;
+}
+
+/* metrics_port 非0时在该端口上导出指标 */
+static struct telemetry *telemetry_open(const char *dir, bool print, int metrics_port)
+{
+	struct telemetry *tele = calloc(1, sizeof(*tele));
+	int samples_fd;
+
+	if (!tele)
+		return NULL;
+	tele->print = print;
+	tele->counters_fd = open_bpf_map_file(dir, "tele_counters", NULL);
+	tele->rules_fd = open_bpf_map_file(dir, "tele_rule_stats", NULL);
+	tele->hist_fd = open_bpf_map_file(dir, "tele_size_hist", NULL);
+	tele->ifs_fd = open_bpf_map_file(dir, "tele_if_stats", NULL);
+	samples_fd = open_bpf_map_file(dir, "tele_samples", NULL);
+	tele->rule_hits = calloc(TELE_MAX_RULES + 1, sizeof(*tele->rule_hits));
+	if (tele->counters_fd < 0 || tele->rules_fd < 0 || tele->hist_fd < 0 ||
+	    tele->ifs_fd < 0 || samples_fd < 0 || !tele->rule_hits)
+		goto err;
+	tele->rb = ring_buffer__new(samples_fd, handle_sample, NULL, NULL);
+	if (!tele->rb) {
+		fprintf(stderr, "ERR: creating ring buffer\n");
+		goto err;
+	}
+	if (metrics_port) {
+		tele->http = tele_http_start(metrics_port);
+		if (!tele->http) {
+			fprintf(stderr, "ERR: metrics endpoint on port %d: %s\n",
+				metrics_port, strerror(errno));
+			ring_buffer__free(tele->rb);
+			goto err;
+		}
+		printf("metrics on http://127.0.0.1:%d/metrics\n", metrics_port);
+	}
+	return tele;
+err:
+	free(tele->rule_hits);
+	free(tele);
+	return NULL;
+}
+
+static const char *tele_ifname(__u32 idx, char *buf)
+{
+	if (!idx)
+		return "other";	// ifindex 超出 TELE_MAX_IFACES 的接口
+	if (!if_indextoname(idx, buf))
+		sprintf(buf, "if%u", idx);
+	return buf;
+}
+
+/* 读取本周期的计数，m 不为空时同时写入 Prometheus 文本格式的指标 */
+static void telemetry_print(struct telemetry *tele, double period, FILE *m)
+{
+	struct tele_if_stat ifs[TELE_MAX_IFACES];
+	__u64 hist[TELE_NR_ACTIONS * TELE_SIZE_BUCKETS];
+	__u64 counters[TELE_CNT_MAX];
+	struct tele_rule_stat *rules;
+	__u32 top[10], nr_top = 0;
+	__u64 delta[10];
+	char ifbuf[IF_NAMESIZE];
+	bool print = tele->print;
+	__u32 key, nr;
+
+	if (!tele_sum_percpu_array(tele->counters_fd, TELE_CNT_MAX, sizeof(__u64), counters)) {
+		if (print)
+			printf("%-16s %14s %12s\n", "telemetry", "total", "per-sec");
+		if (m)
+			fprintf(m, "# TYPE netmanager_events_total counter\n");
+		for (key = 0; key < TELE_CNT_MAX; key++) {
+			double rate = period > 0 ? (counters[key] - tele->counters[key]) / period : 0;
+
+			if (print)
+				printf("%-16s %'14llu %'12.0f\n", tele_counter_names[key],
+				       counters[key], rate);
+			if (m)
+				fprintf(m, "netmanager_events_total{event=\"%s\"} %llu\n"
+					"netmanager_events_rate{event=\"%s\"} %.1f\n",
+					tele_counter_names[key], counters[key],
+					tele_counter_names[key], rate);
+		}
+		memcpy(tele->counters, counters, sizeof(counters));
+	}
+
+	// 只读取已加载的规则，按本周期命中数取前10条
+	nr = nr_acl_rules < TELE_MAX_RULES ? nr_acl_rules : TELE_MAX_RULES + 1;
+	rules = nr ? calloc(nr, sizeof(*rules)) : NULL;
+	if (rules && !tele_sum_percpu_array(tele->rules_fd, nr, sizeof(*rules), rules)) {
+		if (m)
+			fprintf(m, "# TYPE netmanager_rule_hits_total counter\n");
+		for (key = 0; key < nr; key++) {
+			__u64 hits = rules[key].hits, d;
+			__u32 pos;
+
+			d = hits - tele->rule_hits[key];
+			tele->rule_hits[key] = hits;
+			if (m && hits)
+				fprintf(m, "netmanager_rule_hits_total{rule=\"%u\"} %llu\n"
+					"netmanager_rule_bytes_total{rule=\"%u\"} %llu\n"
+					"netmanager_rule_hits_rate{rule=\"%u\"} %.1f\n",
+					key, hits, key, rules[key].bytes,
+					key, period > 0 ? d / period : 0);
+			if (!d)
+				continue;
+			if (nr_top == 10 && delta[9] >= d)
+				continue;
+			pos = nr_top < 10 ? nr_top++ : 9;
+			for (; pos > 0 && delta[pos - 1] < d; pos--) {
+				top[pos] = top[pos - 1];
+				delta[pos] = delta[pos - 1];
+			}
+			top[pos] = key;
+			delta[pos] = d;
+		}
+	}
+	free(rules);
+	for (__u32 i = 0; print && i < nr_top; i++) {
+		if (top[i] == TELE_MAX_RULES)
+			printf("  rules >= %-6u %'14llu hits %'10.0f hits/s\n", top[i],
+			       tele->rule_hits[top[i]], period > 0 ? delta[i] / period : 0);
+		else
+			printf("  rule %-10u %'14llu hits %'10.0f hits/s\n", top[i],
+			       tele->rule_hits[top[i]], period > 0 ? delta[i] / period : 0);
+	}
+
+	// 包长直方图，只输出出现过的动作
+	if (!tele_sum_percpu_array(tele->hist_fd, TELE_NR_ACTIONS * TELE_SIZE_BUCKETS,
+				   sizeof(__u64), hist)) {
+		if (print) {
+			printf("%-16s", "packet size");
+			for (int b = 0; b < TELE_SIZE_BUCKETS; b++)
+				printf(" %10s", tele_size_names[b]);
+			printf("\n");
+		}
+		if (m)
+			fprintf(m, "# TYPE netmanager_packet_size_total counter\n");
+		for (__u32 a = 0; a < TELE_NR_ACTIONS; a++) {
+			__u64 *h = &hist[a * TELE_SIZE_BUCKETS], sum = 0;
+
+			for (int b = 0; b < TELE_SIZE_BUCKETS; b++)
+				sum += h[b];
+			if (!sum)
+				continue;
+			if (print) {
+				printf("  %-14s", action2str(a));
+				for (int b = 0; b < TELE_SIZE_BUCKETS; b++)
+					printf(" %'10llu", h[b]);
+				printf("\n");
+			}
+			for (int b = 0; m && b < TELE_SIZE_BUCKETS; b++)
+				fprintf(m, "netmanager_packet_size_total{action=\"%s\",size=\"%s\"} %llu\n",
+					action2str(a), tele_size_names[b], h[b]);
+		}
+		memcpy(tele->hist, hist, sizeof(hist));
+	}
+
+	// 各入接口按动作的报文数、速率
+	if (!tele_sum_percpu_array(tele->ifs_fd, TELE_MAX_IFACES, sizeof(*ifs), ifs)) {
+		if (m)
+			fprintf(m, "# TYPE netmanager_if_packets_total counter\n");
+		for (__u32 i = 0; i < TELE_MAX_IFACES; i++) {
+			for (__u32 a = 0; a < TELE_NR_ACTIONS; a++) {
+				__u64 pkts = ifs[i].packets[a], bytes = ifs[i].bytes[a];
+				double pps, bps;
+
+				if (!pkts)
+					continue;
+				pps = period > 0 ? (pkts - tele->ifs[i].packets[a]) / period : 0;
+				bps = period > 0 ? (bytes - tele->ifs[i].bytes[a]) * 8 / period : 0;
+				tele_ifname(i, ifbuf);
+				if (print)
+					printf("  %-10s %-12s %'14llu pkts %'12.0f pps %10.2f Mbit/s\n",
+					       ifbuf, action2str(a), pkts, pps, bps / 1e6);
+				if (m)
+					fprintf(m, "netmanager_if_packets_total{ifname=\"%s\",action=\"%s\"} %llu\n"
+						"netmanager_if_bytes_total{ifname=\"%s\",action=\"%s\"} %llu\n"
+						"netmanager_if_packets_rate{ifname=\"%s\",action=\"%s\"} %.1f\n"
+						"netmanager_if_bits_rate{ifname=\"%s\",action=\"%s\"} %.1f\n",
+						ifbuf, action2str(a), pkts, ifbuf, action2str(a), bytes,
+						ifbuf, action2str(a), pps, ifbuf, action2str(a), bps);
+			}
+		}
+		memcpy(tele->ifs, ifs, sizeof(ifs));
+	}
+	if (print)
+		printf("\n");
+}
+
+/* 读取并输出遥测，--metrics 时把同一次读取的结果发布到本地端点 */
+static void telemetry_update(struct telemetry *tele, double period)
+{
+	char *text = NULL;
+	size_t len = 0;
+	FILE *m = NULL;
+
+	if (tele->http)
+		m = open_memstream(&text, &len);
+	telemetry_print(tele, period, m);
+	if (m) {
+		fclose(m);
+		tele_http_publish(tele->http, text, len);
+		free(text);
+	}
+}
+
+/* 连接跟踪表，常驻时周期性清理超时连接 */
+struct conntrack {
+	int table_fd;
+	int embryonic_fd;
+};
+
+static struct conntrack *conntrack_open(const char *dir)
+{
+	struct conntrack *ct = calloc(1, sizeof(*ct));
+
+	if (!ct)
+		return NULL;
+	ct->table_fd = open_bpf_map_file(dir, "ct_table", NULL);
+	ct->embryonic_fd = open_bpf_map_file(dir, "ct_embryonic", NULL);
+	if (ct->table_fd < 0 || ct->embryonic_fd < 0) {
+		free(ct);
+		return NULL;
+	}
+	return ct;
+}
+
+static void conntrack_sweep(struct conntrack *ct)
+{
+	struct ct_summary sum = { 0 };
+	__u64 now = ct_now_ns();
+	__u64 total = 0;
+
+	if (ct_sweep(ct->table_fd, now, &sum) < 0 ||
+	    ct_sweep(ct->embryonic_fd, now, &sum) < 0) {
+		fprintf(stderr, "ERR: sweeping conntrack: %s\n", strerror(errno));
+		return;
+	}
+	for (int i = 0; i < CT_S_MAX; i++)
+		total += sum.states[i];
+	printf("conntrack: %llu entries, %llu expired\n", total, sum.expired);
+	for (int i = CT_S_NONE + 1; i < CT_S_MAX; i++) {
+		if (sum.states[i])
+			printf("  %-16s %'14llu\n", ct_state_names[i], sum.states[i]);
+	}
+	printf("\n");
+}
+
+static void xsk_print(struct xsk_pool *xsk)
+{
+	struct xsk_pool_stats st;
+
+	xsk_pool_stats(xsk, &st);
+	printf("xsk: %d queues, %'llu packets, %'llu flows passed, %'llu flows dropped, "
+	       "%'llu undecided, %'llu inject errors\n\n", xsk_pool_nr_queues(xsk),
+	       st.rx, st.pass, st.drop, st.undecided, st.inject_err);
+}
+
+static void sockmap_print(int cnt_fd, int stats_fd, __u64 *prev, int interval)
+{
+	struct sockmap_sock top[10];
+	__u64 cnt[SOCKMAP_CNT_MAX];
+	char sbuf[16], dbuf[16];
+	int n, nr_top;
+
+	if (sockmap_read_counters(cnt_fd, cnt) < 0)
+		return;
+	printf("sockmap: %'llu sockets added, %'llu skipped by port filter, %'llu insert errors, %'llu closed\n",
+	       cnt[SOCKMAP_CNT_INSERT], cnt[SOCKMAP_CNT_SKIP], cnt[SOCKMAP_CNT_INSERT_ERR],
+	       cnt[SOCKMAP_CNT_CLOSE]);
+	printf("  bypassed %'llu msgs %'llu bytes (%.2f MB/s), via stack %'llu msgs %'llu bytes\n",
+	       cnt[SOCKMAP_CNT_REDIR], cnt[SOCKMAP_CNT_REDIR_BYTES],
+	       (cnt[SOCKMAP_CNT_REDIR_BYTES] - prev[SOCKMAP_CNT_REDIR_BYTES]) / (interval * 1e6),
+	       cnt[SOCKMAP_CNT_PASS], cnt[SOCKMAP_CNT_PASS_BYTES]);
+	memcpy(prev, cnt, sizeof(cnt));
+
+	n = sockmap_top_socks(stats_fd, top, 10, &nr_top);
+	if (n > 0)
+		printf("  %d sockets sending, top by bypassed bytes:\n", n);
+	for (int i = 0; i < nr_top; i++) {
+		struct sock_key *k = &top[i].key;
+
+		printf("  %15s:%-5u -> %15s:%-5u bypassed %'14llu B %'10llu msgs, via stack %'14llu B\n",
+		       fmt_ipv4(sbuf, ntohl(k->sip4)), ntohs((__u16)k->sport),
+		       fmt_ipv4(dbuf, ntohl(k->dip4)), ntohs((__u16)k->dport),
+		       top[i].st.redir_bytes, top[i].st.redir_msgs, top[i].st.pass_bytes);
+	}
+	printf("\n");
+}
+
+/* 等待一个统计周期，期间持续消费采样 */
+static void poll_wait(struct telemetry *tele, int interval)
+{
+	__u64 deadline = gettime() + (__u64)interval * NANOSEC_PER_SEC;
+	__u64 now;
+
+	if (!tele) {
+		sleep(interval);
+		return;
+	}
+	while ((now = gettime()) < deadline) {
+		if (ring_buffer__poll(tele->rb, (deadline - now) / 1000000 + 1) < 0)
+			break;
+	}
+}
+
+/* map_fd 为负时只输出遥测、连接跟踪和 AF_XDP 慢路径 */
+static void stats_poll(int map_fd, __u32 map_type, int interval,
+		       struct telemetry *tele, struct conntrack *ct, struct xsk_pool *xsk)
 {
 	struct stats_record prev, record = { 0 };
 
@@ -268,14 +731,25 @@ static void stats_poll(int map_fd, __u32 map_type, int interval)
 	setlocale(LC_NUMERIC, "en_US");
 
 	/* Get initial reading quickly */
-	stats_collect(map_fd, map_type, &record);
+	if (map_fd >= 0)
+		stats_collect(map_fd, map_type, &record);
+	if (tele)
+		telemetry_update(tele, 0);
 	usleep(1000000/4);
 
 	while (1) {
-		prev = record; /* struct copy */
-		stats_collect(map_fd, map_type, &record);
-		stats_print(&record, &prev);
-		sleep(interval);
+		if (map_fd >= 0) {
+			prev = record; /* struct copy */
+			stats_collect(map_fd, map_type, &record);
+			stats_print(&record, &prev);
+		}
+		if (tele)
+			telemetry_update(tele, interval);
+		if (ct)
+			conntrack_sweep(ct);
+		if (xsk)
+			xsk_print(xsk);
+		poll_wait(tele, interval);
 	}
 }
 
@@ -318,9 +792,9 @@ int pin_maps_in_bpf_object(struct bpf_object *bpf_obj)
 
 
 char *ifname;
-int rules_ipv4_map;
-int rtcache_map4;
-int rules_mac_map;
+struct xacl_ipv4_maps ipv4_maps;
+struct xrt_maps rt_maps;
+struct xacl_mac_maps mac_maps;
 
 int print_usage(int id){
     switch(id){
@@ -335,50 +809,26 @@ int print_usage(int id){
 }
 
 
-int open_map(const char *ifname, const char *map_name){
-    int len;
-    char pin_dir[PATH_MAX];
-    const char *pin_basedir =  "/sys/fs/bpf";
-    struct bpf_map_info info = { 0 };
-
-    /* Use the --dev name as subdir for finding pinned maps */
-    len = snprintf(pin_dir, PATH_MAX, "%s/%s", pin_basedir, ifname);
-    if (len < 0) {
-        fprintf(stderr, "ERR: creating pin dirname\n");
-        return -1;
-    }
-
-    int fd = open_bpf_map_file(pin_dir, map_name, &info);
-    if (fd < 0) {
-        fprintf(stderr, "ERR: Failed to open map file: %s\n", map_name);
-        return -1;
-    }
-    printf("Opened BPF map\n");
-    printf(" - BPF map (bpf_map_type:%d) fd: %d id:%d name:%s"
-           " key_size:%d value_size:%d max_entries:%d\n",
-           info.type, fd, info.id, info.name,
-           info.key_size, info.value_size, info.max_entries);
-
-    return fd;
-}
-
-
 int load_bpf_map(){
-    rules_ipv4_map = open_map(ifname, "rules_ipv4_map");
-    rtcache_map4 = open_map(ifname, "rtcache_map4");
-    rules_mac_map = open_map(ifname, "rules_mac_map");
+    char ipv4_pin_dir[PATH_MAX];
+    int ipv4_err, rt_err, mac_err;
+
+    snprintf(ipv4_pin_dir, PATH_MAX, "/sys/fs/bpf/%s", ifname);
+    ipv4_err = xacl_ipv4_open_maps(ipv4_pin_dir, &ipv4_maps);
+    rt_err = xrt_open_maps(ipv4_pin_dir, &rt_maps);
+    mac_err = xacl_mac_open_maps(ipv4_pin_dir, &mac_maps);
     // Check if any map failed to open
-    if (rules_ipv4_map < 0) {
-        fprintf(stderr, "Failed to open rules_ipv4_map\n");
+    if (ipv4_err < 0) {
+        fprintf(stderr, "Failed to open xacl_ipv4 maps\n");
     }
-    if (rtcache_map4 < 0) {
-        fprintf(stderr, "Failed to open rtcache_map4\n");
+    if (rt_err < 0) {
+        fprintf(stderr, "Failed to open xrt maps\n");
     }
-    if (rules_mac_map < 0) {
-        fprintf(stderr, "Failed to open rules_mac_map\n");
+    if (mac_err < 0) {
+        fprintf(stderr, "Failed to open xacl_mac maps\n");
     }
 
-    if (rules_ipv4_map < 0 || rtcache_map4 < 0 || rules_mac_map < 0) {
+    if (ipv4_err < 0 || rt_err < 0 || mac_err < 0) {
         fprintf(stderr, "load bpf map error, check device name\n");
         return -1;
     }
@@ -387,31 +837,14 @@ int load_bpf_map(){
 }
 
 
-static __u32 ip_to_u32(__u8 *ip_u8) {
-    __u32 ip_u32 = 0;
-    ip_u32 = (ip_u8[0]<<24) | (ip_u8[1]<<16) | (ip_u8[2]<<8) | (ip_u8[3]);
-    //printf("%hhu.%hhu.%hhu.%hhu,%u\n",ip_u8[0],ip_u8[1],ip_u8[2],ip_u8[3],ip_u32);
-    return ip_u32;
-}
-
 int clear_map(){
-    __u16 keys[MAX_RULES];
-    for(int i=0; i<MAX_RULES; i++){
-        keys[i] = i;
-    }
+    int count;
 
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
+    xacl_ipv4_clear(&ipv4_maps);
+    xrt_clear(&rt_maps);
+    count = xacl_mac_clear(&mac_maps);
 
-    __u32 count = MAX_RULES - 1;
-
-    bpf_map_delete_batch(rules_ipv4_map, &keys, &count, &opts);
-    bpf_map_delete_batch(rtcache_map4, &keys, &count, &opts);
-    bpf_map_delete_batch(rules_mac_map, &keys, &count, &opts);
-
-    return count;
+    return count < 0 ? 0 : count;
 }
 
 
@@ -424,51 +857,18 @@ int load_handler_router(char * router_file){
 
     char *path = router_file;
     printf("loading config file:%s\n",path);
-    
-    FILE *file = fopen(path, "r");
-    if (file == NULL) {
-        perror("Error opening file");
-        return 1;
-    }
-
-
-    __u32 keys[MAX_RULES];
-    struct rt_item rules[MAX_RULES];
-
-    __u32 i = 0;
-    keys[0] = 0;
-    char line[MAX_RULES];
 
-    while (fgets(line, sizeof(line), file) != NULL) {
-        line[strcspn(line, "\n")] = '\0';
-
-        __u8 saddr[4];
-        __u8 eth_source[ETH_ALEN];
-        __u8 eth_dest[ETH_ALEN];
-        
-
-        sscanf(line, "%hhu.%hhu.%hhu.%hhu %hhx:%hhx:%hhx:%hhx:%hhx:%hhx %hhx:%hhx:%hhx:%hhx:%hhx:%hhx" ,
-            &saddr[0] ,&saddr[1] ,&saddr[2] ,&saddr[3],
-            &eth_source[0], &eth_source[1], &eth_source[2], &eth_source[3], &eth_source[4], &eth_source[5], 
-            &eth_dest[0], &eth_dest[1], &eth_dest[2], &eth_dest[3], &eth_dest[4], &eth_dest[5]);
-
-        rules[i].saddr = ip_to_u32(saddr);
-        memcpy(rules[i].eth_source, eth_source, ETH_ALEN);
-        memcpy(rules[i].eth_dest, eth_dest, ETH_ALEN);
-
-        keys[i] = i;
-        i += 1;
-       
-    } 
-    printf("%d rules loaded\n",i);
-
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
-    clear_map();
+    struct xrt_config rt_cfg;
+    if(xrt_read_config(path, &rt_cfg) < 0)
+        return 1;
 
-    bpf_map_update_batch(rtcache_map4, keys, rules, &i, &opts);
+    // 路由写入未生效的bank后原子切换，重载期间转发不受影响
+    int ret = xrt_load(&rt_maps, &rt_cfg);
+    xrt_free_config(&rt_cfg);
+    if(ret < 0){
+        fprintf(stderr, "load routes error: %s\n", strerror(-ret));
+        return 1;
+    }
     return 0;  
 }
 
@@ -482,84 +882,31 @@ int load_handler_ipv4(char* ip_filter_file){
 
     char *path = ip_filter_file;
     printf("loading config file:%s\n",path);
-    
-    FILE *file = fopen(path, "r");
-    if (file == NULL) {
-        perror("Error opening file");
-        return 1;
-    }
-
-    __u16 keys[MAX_RULES];
-    struct rules_ipv4 rules[MAX_RULES];
-
-    __u32 i = 1;
-    keys[0] = 0;
-    char line[256];
-	printf("-----------------------------------------------------------------------------------------------\n");
-    while (fgets(line, sizeof(line), file) != NULL) {
-        line[strcspn(line, "\n")] = '\0';
-
-        __u8 saddr[4];
-        __u8 daddr[4];
-        char proto[10];
-        char action[10];
-        sscanf(line, "%hhu.%hhu.%hhu.%hhu/%hhu %hhu.%hhu.%hhu.%hhu/%hhu %hu %hu %s %s",
-           &saddr[0] ,&saddr[1] ,&saddr[2] ,&saddr[3] ,&rules[i].saddr_mask, 
-           &daddr[0] ,&daddr[1] ,&daddr[2] ,&daddr[3] ,&rules[i].daddr_mask, 
-           &rules[i].sport, &rules[i].dport, proto, action);
-
-        rules[i].saddr = ip_to_u32(saddr);
-        rules[i].daddr = ip_to_u32(daddr);
-
-        if(strcmp("TCP", proto) == 0){
-            rules[i].ip_proto = IPPROTO_TCP;
-        }else if(strcmp("UDP", proto) == 0){
-            rules[i].ip_proto = IPPROTO_UDP;
-        }else if(strcmp("ICMP", proto) == 0){
-            rules[i].ip_proto = IPPROTO_ICMP;
-        }else{
-            rules[i].ip_proto = 0;
-        }
 
-        if(strcmp("ALLOW", action) == 0){
-            rules[i].action = XDP_PASS;
-        }else if(strcmp("DENY", action) == 0){
-            rules[i].action = XDP_DROP;
-        }else{
-            rules[i].action = XDP_ABORTED;
-        }
-
-        rules[i-1].next_rule = i;
-        rules[i].prev_rule = i - 1;
-        rules[i].next_rule = 0;
-        keys[i] = i;
-		printf("源地址:%u.%u.%u.%u:%u 目的地址:%u.%u.%u.%u:%u 源端口:%d 目的端口:%d 协议类型:%s 策略:%s\n",saddr[0],saddr[1],saddr[2],saddr[3],rules[i].saddr_mask,
-		daddr[0],daddr[1],daddr[2],daddr[3],rules[i].daddr_mask,rules[i].sport,rules[i].dport,proto,action);
+    struct xacl_ipv4_rule *rules;
+    __u32 nr;
+    if (xacl_ipv4_read_rules(path, &rules, &nr) < 0)
+        return 1;
 
-        i += 1;
+    printf("-----------------------------------------------------------------------------------------------\n");
+    for (__u32 i = 0; i < nr; i++) {
+        struct xacl_ipv4_rule *r = &rules[i];
+        printf("源地址:%u.%u.%u.%u/%u 目的地址:%u.%u.%u.%u/%u 源端口:%u-%u 目的端口:%u-%u 协议类型:%u 策略:%s\n",
+            r->saddr >> 24, (r->saddr >> 16) & 0xFF, (r->saddr >> 8) & 0xFF, r->saddr & 0xFF, r->saddr_len,
+            r->daddr >> 24, (r->daddr >> 16) & 0xFF, (r->daddr >> 8) & 0xFF, r->daddr & 0xFF, r->daddr_len,
+            r->sport_min, r->sport_max, r->dport_min, r->dport_max, r->ip_proto, action2str(r->action));
     }
 	printf("-----------------------------------------------------------------------------------------------\n");
-    printf("%d rules loaded\n",i-1);
-    rules[0].prev_rule = i - 1;
-
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
-    clear_map();
-    // 使用 libbpf 库中的 bpf_map_update_batch 函数批量更新 BPF 映射。
-    // 这个函数用于一次性更新多个键值对，以提高效率。
 
-    // rules_ipv4_map: 要更新的 BPF 映射的文件描述符（FD）。
-    // keys: 包含要更新的键（key）的数组。
-    // rules: 包含要更新的值的数组。
-    // &i: 这是一个指向整数的指针，表示要更新的键值对的数量。在调用函数后，该整数将包含实际更新的键值对数量。
-    // &opts: 用于配置更新选项的结构体，这里是通过 DECLARE_LIBBPF_OPTS 宏声明并初始化的。
-
-    // 在这里，代码中的 bpf_map_update_batch 操作的目的是将多个键值对一次性更新到 BPF 映射中。
-    // 这样可以通过一次系统调用来完成多个更新操作，提高了效率。
-
-    bpf_map_update_batch(rules_ipv4_map, keys, rules, &i, &opts);
+    // 规则被编译成元组空间写入未生效的bank，写完后原子切换，重载期间不会漏匹配
+    int err = xacl_ipv4_load(&ipv4_maps, rules, nr);
+    free(rules);
+    if (err < 0) {
+        fprintf(stderr, "ERR: compiling IP filter rules: %s\n", strerror(-err));
+        return 1;
+    }
+    printf("%d rules loaded\n",nr);
+    nr_acl_rules = nr;
 
     return 0;   
 }
@@ -574,67 +921,31 @@ int load_handler_mac(char* mac_filter_file){
 
     char *path = mac_filter_file;
     printf("loading config file:%s\n",path);
-    
-    FILE *file = fopen(path, "r");
-    if (file == NULL) {
-        perror("Error opening file");
-        return 1;
-    }
-	__u16 keys[MAX_RULES];
-    struct rules_mac rules[MAX_RULES];
-
-    __u32 i = 1;
-    keys[0] = 0;
-
-    char line[256];
-	printf("-----------------------------------------------------------------------------------------------\n");
-    
-    while (fgets(line, sizeof(line), file) != NULL) {
-        line[strcspn(line, "\n")] = '\0';
-
-        __u8 src_mac[6];
-		__u8 dest_mac[6];
-        char action[10];
-        sscanf(line, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx %hhx:%hhx:%hhx:%hhx:%hhx:%hhx %s",
-           &src_mac[0], &src_mac[1], &src_mac[2], &src_mac[3], &src_mac[4], &src_mac[5],
-		   &dest_mac[0], &dest_mac[1], &dest_mac[2], &dest_mac[3], &dest_mac[4], &dest_mac[5],
-           action);
-
-        //src_mac_u64 = mac_to_u64(src_mac);
-		memcpy(rules[i].source, src_mac, ETH_ALEN);
-		memcpy(rules[i].dest, dest_mac, ETH_ALEN);
-
-        if(strcmp("ALLOW", action) == 0){
-            rules[i].action = XDP_PASS;
-        }else if(strcmp("DENY", action) == 0){
-            rules[i].action = XDP_DROP;
-        }else{
-            rules[i].action = XDP_ABORTED;
-        }
 
-		rules[i-1].next_rule = i;
-        rules[i].prev_rule = i - 1;
-        rules[i].next_rule = 0;
-        keys[i] = i;
+    struct xacl_mac_rule *rules;
+    __u32 nr;
+    if (xacl_mac_read_rules(path, &rules, &nr) < 0)
+        return 1;
 
+    printf("-----------------------------------------------------------------------------------------------\n");
+    for (__u32 i = 0; i < nr; i++) {
+        __u8 *src_mac = rules[i].src, *dest_mac = rules[i].dst;
 		printf("MAC_SRC: %02x:%02x:%02x:%02x:%02x:%02x, MAC_DEST: %02x:%02x:%02x:%02x:%02x:%02x ,Action: %s\n",
                           src_mac[0], src_mac[1], src_mac[2],src_mac[3], src_mac[4], src_mac[5], 
 						  dest_mac[0], dest_mac[1], dest_mac[2],dest_mac[3], dest_mac[4], dest_mac[5], 
-						  action);
-
-		i += 1;
+						  action2str(rules[i].action));
     }
-    
 	printf("-----------------------------------------------------------------------------------------------\n");
-    printf("%d rules loaded\n",i-1);
-    rules[0].prev_rule = i - 1;
 
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
-    clear_map();
-    bpf_map_update_batch(rules_mac_map, keys, rules, &i, &opts);
+    // 规则被编译成源、目的、地址对三张哈希表，写入未生效的bank后原子切换
+    int err = xacl_mac_load(&mac_maps, rules, nr);
+    free(rules);
+    if (err < 0) {
+        fprintf(stderr, "ERR: compiling MAC filter rules: %s\n", strerror(-err));
+        return 1;
+    }
+    printf("%d rules loaded\n",nr);
+    nr_acl_rules = nr;
 
     return 0;   
 }
@@ -643,12 +954,105 @@ static volatile bool exiting = false;
 
 int clear_handler(int argc, char *argv[]){
     int ret = clear_map();
-    printf("%d rules are cleared\n", ret-1);
+    printf("%d rules are cleared\n", ret);
     return 0;
 }
 
 static void sig_handler(int signo) { exiting = true; }
 
+/* 把 sockmap 的配置和统计表固定到 SOCKMAP_PIN_DIR，便于 sockmap_bench 等工具读取 */
+static int sockmap_pin(struct netmanager_kern *skel, bool pin)
+{
+	struct bpf_map *maps[] = {
+		skel->maps.sockmap_config_map, skel->maps.sockmap_ports,
+		skel->maps.sockmap_counters, skel->maps.sockmap_sock_stats,
+	};
+	char path[PATH_MAX];
+
+	if (pin && mkdir(SOCKMAP_PIN_DIR, 0700) && errno != EEXIST)
+		return -errno;
+	for (size_t i = 0; i < sizeof(maps) / sizeof(maps[0]); i++) {
+		snprintf(path, sizeof(path), "%s/%s", SOCKMAP_PIN_DIR, bpf_map__name(maps[i]));
+		unlink(path);	// 上次异常退出残留的固定
+		if (pin && bpf_map__pin(maps[i], path))
+			return -errno;
+	}
+	if (!pin)
+		rmdir(SOCKMAP_PIN_DIR);
+	return 0;
+}
+
+static int run_sockmap(struct config *cfg, int interval)
+{
+	char *default_cgroup = "/sys/fs/cgroup/foo";
+	__u64 prev[SOCKMAP_CNT_MAX] = { 0 };
+	struct sockmap_links links = { 0 };
+	__u16 ports[SOCKMAP_MAX_PORTS];
+	struct netmanager_kern *skel;
+	int nr_ports = 0, err;
+
+	if (cfg->sock_ports) {
+		nr_ports = sockmap_parse_ports(cfg->sock_ports, ports, SOCKMAP_MAX_PORTS);
+		if (nr_ports < 0) {
+			fprintf(stderr, "ERR: invalid --sock-ports %s\n", cfg->sock_ports);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+
+	skel = netmanager_kern__open();
+	if (!skel) {
+		fprintf(stderr, "Failed to open BPF skeleton\n");
+		return EXIT_FAIL_BPF;
+	}
+	// 这里只用到 sockmap 的表，连接跟踪表不必预分配
+	bpf_map__set_max_entries(skel->maps.ct_table, 1);
+	bpf_map__set_max_entries(skel->maps.ct_embryonic, 1);
+
+	err = netmanager_kern__load(skel);
+	if (err) {
+		fprintf(stderr, "Failed to load and verify BPF skeleton\n");
+		goto cleanup;
+	}
+	err = sockmap_pin(skel, true);
+	if (err) {
+		fprintf(stderr, "ERR: pinning sockmap maps: %s\n", strerror(-err));
+		goto cleanup;
+	}
+	err = sockmap_configure(bpf_map__fd(skel->maps.sockmap_config_map),
+				bpf_map__fd(skel->maps.sockmap_ports), ports, nr_ports);
+	if (err) {
+		fprintf(stderr, "ERR: configuring sockmap: %s\n", strerror(-err));
+		goto cleanup;
+	}
+
+	links.sockops_fd = bpf_program__fd(skel->progs.bpf_sockmap);
+	links.msg_fd = bpf_program__fd(skel->progs.bpf_redir);
+	links.map_fd = bpf_map__fd(skel->maps.sock_ops_map);
+	if (cfg->nr_sock_cgroups)
+		err = sockmap_attach(&links, cfg->sock_cgroups, cfg->nr_sock_cgroups);
+	else
+		err = sockmap_attach(&links, &default_cgroup, 1);
+	if (err)
+		goto cleanup;
+
+	printf("sockmap attached to %d cgroup(s), %s\n", links.nr_cgroups,
+	       nr_ports ? "port filter on" : "all TCP connections");
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+	setlocale(LC_NUMERIC, "en_US");
+	while (!exiting) {
+		sleep(interval);
+		sockmap_print(bpf_map__fd(skel->maps.sockmap_counters),
+			      bpf_map__fd(skel->maps.sockmap_sock_stats), prev, interval);
+	}
+	sockmap_detach(&links);
+
+cleanup:
+	sockmap_pin(skel, false);
+	netmanager_kern__destroy(skel);
+	return err < 0 ? -err : err;
+}
+
 int main(int argc, char **argv)
 {
 	int i;
@@ -660,6 +1064,10 @@ int main(int argc, char **argv)
 	struct bpf_map_info info = { 0 };
 	int stats_map_fd;
 	int interval = 2;
+	struct telemetry *tele = NULL;
+	struct conntrack *ct = NULL;
+	struct xsk_pool *xsk = NULL;
+	struct xsk_patterns patterns;
 	int err;  // 错误码
 	int len;  // 字符串长度
 	char errmsg[1024];  // 错误消息字符串
@@ -676,6 +1084,7 @@ int main(int argc, char **argv)
 	    .state       = false,       //会话保持
 	    .clear       = false,       //清理
 		.socketmap_flag =false,
+		.xsk_if_queue = -1,
 	};
 	/* Set default BPF-ELF object file and BPF program name */
 	// 设置默认的BPF ELF对象文件名和BPF程序名称
@@ -686,78 +1095,8 @@ int main(int argc, char **argv)
 	parse_cmdline_args(argc, argv, long_options, &cfg, __doc__);
 
 	if(cfg.socketmap_flag)
-	{
-		struct netmanager_kern *skel;
-		signal(SIGINT, sig_handler);
-    	signal(SIGTERM, sig_handler);
-		skel = netmanager_kern__open();
-		int cgroup_fd = open("/sys/fs/cgroup/foo", O_RDONLY);
-		if (cgroup_fd < 0) {
-			perror("Failed to open cgroup directory");
-			return -1;
-		}
-    	if (!skel) {
-    	    fprintf(stderr, "Failed to open BPF skeleton\n");
-    	    return 1;
-    	}
-
-    	err = netmanager_kern__load(skel);
-    	if (err) {
-    	    fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-    	    goto cleanup;
-    	}
-		err = netmanager_kern__attach(skel);
-        if (err) {
-            fprintf(stderr, "Failed to attach BPF skeleton\n");
-            goto cleanup;
-        }
-		int sock_ops_prog_fd = bpf_program__fd(skel->progs.bpf_sockmap);
-		if (sock_ops_prog_fd < 0) {
-			fprintf(stderr, "Invalid sock_ops program fd: %d\n", sock_ops_prog_fd);
-			return -1;
-		}
-
-		int msg_verdict_prog_fd = bpf_program__fd(skel->progs.bpf_redir);
-		if (msg_verdict_prog_fd < 0) {
-			fprintf(stderr, "Invalid msg_verdict program fd: %d\n", msg_verdict_prog_fd);
-			return -1;
-		}
-
-		int sock_ops_map_fd = bpf_map__fd(skel->maps.sock_ops_map);
-		if (sock_ops_map_fd < 0) {
-			fprintf(stderr, "Invalid sock_ops map fd: %d\n", sock_ops_map_fd);
-			return -1;
-		}
+		return run_sockmap(&cfg, interval);
 
-		err = bpf_prog_attach(sock_ops_prog_fd, cgroup_fd, BPF_CGROUP_SOCK_OPS, 0);
-		if (err) {
-			fprintf(stderr, "Failed to attach bpf_sockmap program: %d\n", err);
-			return 1;
-		}
-
-		//加载并附加msg_verdict程序
-		err = bpf_prog_attach(msg_verdict_prog_fd, sock_ops_map_fd, BPF_SK_MSG_VERDICT, 0);
-		if (err) {
-			fprintf(stderr, "Failed to attach bpf_redir program: %d\n", err);
-			return 1;
-		}
-		while (!exiting) {
-        	sleep(1);
-			printf("----1-----\n");
-        	/* Ctrl-C will cause -EINTR */
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-				printf("Error polling perf buffer: %d\n", err);
-				break;
-			}
-    	}
-		cleanup:	
-    		netmanager_kern__destroy(skel);
-    		return err < 0 ? -err : 0;
-	}
 	/* Required option */
 	// 检查是否提供了必需的选项
 	if (cfg.ifindex == -1) {
@@ -793,6 +1132,12 @@ int main(int argc, char **argv)
 
 	if (verbose)
 		list_avail_progs(obj);
+
+	// 连接跟踪表只有 xdp_entry_state 使用，其他程序不必预分配
+	if (strcmp(cfg.progname, "xdp_entry_state")) {
+		bpf_map__set_max_entries(bpf_object__find_map_by_name(obj, "ct_table"), 1);
+		bpf_map__set_max_entries(bpf_object__find_map_by_name(obj, "ct_embryonic"), 1);
+	}
 	
 	DECLARE_LIBXDP_OPTS(xdp_program_opts, xdp_opts,
                             .obj = obj,
@@ -845,12 +1190,37 @@ int main(int argc, char **argv)
 	ifname = cfg.ifname;
 
 
-	map_fd = open_bpf_map_file(pin_dir, "print_info_map", NULL);
+	// -T 打开采样，内核中只在命中时把流信息写入环形缓冲区
+	struct tele_config tele_cfg = {
+		.enabled      = cfg.print_info,
+		.sample_every = TELE_DEFAULT_SAMPLE_EVERY,
+		.max_per_sec  = TELE_DEFAULT_MAX_PER_SEC,
+	};
+	map_fd = open_bpf_map_file(pin_dir, "tele_config_map", NULL);
 	if (map_fd < 0) {
 		return EXIT_FAIL_BPF;
 	}
 	i = 0;
-	bpf_map_update_elem(map_fd, &i, &cfg.print_info, 0);
+	bpf_map_update_elem(map_fd, &i, &tele_cfg, 0);
+
+	// --state 时丢弃不属于任何跟踪连接的报文，否则只跟踪不拦截
+	struct ct_config ct_cfg = { .enforce = cfg.state };
+	map_fd = open_bpf_map_file(pin_dir, "ct_config_map", NULL);
+	if (map_fd < 0) {
+		return EXIT_FAIL_BPF;
+	}
+	bpf_map_update_elem(map_fd, &i, &ct_cfg, 0);
+
+	// --xsk 时 INSPECT 规则命中的流交给 AF_XDP 慢路径，否则按 XDP_PASS 处理
+	struct xsk_config xsk_cfg = {
+		.enabled      = cfg.xsk,
+		.inspect_miss = cfg.xsk_inspect_miss,
+	};
+	map_fd = open_bpf_map_file(pin_dir, "xsk_config_map", NULL);
+	if (map_fd < 0) {
+		return EXIT_FAIL_BPF;
+	}
+	bpf_map_update_elem(map_fd, &i, &xsk_cfg, 0);
 	
 
 	// 根据不同的选项加载不同的配置文件
@@ -895,6 +1265,36 @@ int main(int argc, char **argv)
 	bpf_map_update_elem(map_fd, &i, &cfg.ifindex, 0);	
 	printf("redirect from ifnum=%d to ifnum=%d\n", cfg.ifindex, cfg.ifindex);
 
+	if (cfg.print_info || cfg.metrics_port) {
+		tele = telemetry_open(pin_dir, cfg.print_info, cfg.metrics_port);
+		if (!tele)
+			return EXIT_FAIL_BPF;
+	}
+	if (!strcmp(cfg.progname, "xdp_entry_state")) {
+		ct = conntrack_open(pin_dir);
+		if (!ct)
+			return EXIT_FAIL_BPF;
+	}
+
+	if (cfg.xsk) {
+		if (xsk_read_patterns(cfg.xsk_file, &patterns) < 0)
+			return EXIT_FAIL_OPTION;
+		printf("%u inspection patterns loaded\n", patterns.nr);
+
+		struct xsk_pool_opts xsk_opts = {
+			.ifname     = cfg.ifname,
+			.pin_dir    = pin_dir,
+			.queue      = cfg.xsk_if_queue,
+			.bind_flags = cfg.xsk_bind_flags,
+			.busy_poll  = cfg.xsk_busy_poll,
+			.inspect    = xsk_inspect_patterns,
+			.ctx        = &patterns,
+		};
+		xsk = xsk_pool_start(&xsk_opts);
+		if (!xsk)
+			return EXIT_FAIL_XDP;
+	}
+
 	//打印统计信息
 	if (cfg.show_stats) {
 		/* Use the --dev name as subdir for finding pinned maps */
@@ -927,8 +1327,10 @@ int main(int argc, char **argv)
 			       );
 		}
 
-		stats_poll(stats_map_fd, info.type, interval);
+		stats_poll(stats_map_fd, info.type, interval, tele, ct, xsk);
 		return EXIT_OK;
 	}
+	if (tele || (ct && cfg.state) || xsk)
+		stats_poll(-1, 0, interval, tele, ct, xsk);
 		
 }
\ No newline at end of file
@@ -25,6 +25,7 @@
 
 #include "common_kern_user.h" 
 #include "../common/parsing_helpers.h"
+#include "../common/xrouter_kern.h"
 
 
 #ifndef memcpy
@@ -53,13 +54,6 @@ struct {
 	__uint(max_entries, 256);
 } tx_port SEC(".maps");
 
-// 路由转发表缓存
-struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
-	__type(key, __u32);
-	__type(value, struct rt_item);
-	__uint(max_entries, MAX_RULES);
-} rtcache_map4 SEC(".maps");
 
 
 static __always_inline
@@ -102,91 +96,6 @@ static __always_inline int ip_decrease_ttl(struct iphdr *iph)
 
 
 
-static __always_inline
-int mac_zero(const __u8 *mac_addr) {
-    // 检查MAC地址是否不全为零
-    for (int i = 0; i < ETH_ALEN; i++) {
-        if (mac_addr[i] != 0)
-            return 1; // 如果有一个字节不为零，返回1表示不为零
-    }
-    return 0; // 如果所有字节都为零，返回0表示全为零
-}
-
-
-static __always_inline
-int ipv4_match(__u32 conn_addr, __u32 rule_addr) {
-    // 直接比较IPv4地址和网络地址
-	if( (!rule_addr) || (conn_addr == rule_addr) ) //0 , match all
-		return 1;
-	return 0;
-}
-
-
-static int match_rules_loop(__u32 index, void *ctx)
-{
-	struct rt_item *p_ctx = (struct rt_item *)ctx;
-
-
-	struct rt_item *p_r = bpf_map_lookup_elem(&rtcache_map4, &index);
-	if(!p_r){
-		return 1; //out of range
-	}
-	
-
-	if( ipv4_match(p_ctx->saddr, p_r->saddr) ) {
-	
-		memcpy(p_ctx->eth_source, p_r->eth_source, ETH_ALEN);
-		memcpy(p_ctx->eth_dest, p_r->eth_dest, ETH_ALEN);
-		
-
-		/*
-		bpf_printk("MAC: %02x:%02x:%02x:%02x:%02x:%02x", 
-           p_ctx->eth_source[0], p_ctx->eth_source[1], p_ctx->eth_source[2],
-           p_ctx->eth_source[3], p_ctx->eth_source[4], p_ctx->eth_source[5]);
-		
-		bpf_printk("MAC: %02x:%02x:%02x:%02x:%02x:%02x", 
-           p_ctx->eth_dest[0], p_ctx->eth_dest[1], p_ctx->eth_dest[2],
-           p_ctx->eth_dest[3], p_ctx->eth_dest[4], p_ctx->eth_dest[5]);
-		
-		
-		bpf_printk("Port: %u", p_ctx->ifindex);
-		*/
-		
-
-		return 1;
-	}
-
-
-	return 1;
-}
-
-
-
-static __always_inline 
-int match_rules(struct rt_item *conn)
-{
-	struct rt_item *ctx = conn;
-	
-	bpf_loop(MAX_RULES, match_rules_loop, ctx, 0);
-
-	
-	/*
-	bpf_printk("MAC: %02x:%02x:%02x:%02x:%02x:%02x", 
-           coon_r.eth_source[0], coon_r.eth_source[1], coon_r.eth_source[2],
-           coon_r.eth_source[3], coon_r.eth_source[4], coon_r.eth_source[5]);
-
-	bpf_printk("MAC: %02x:%02x:%02x:%02x:%02x:%02x", 
-           coon_r.eth_dest[0], coon_r.eth_dest[1], coon_r.eth_dest[2],
-           coon_r.eth_dest[3], coon_r.eth_dest[4], coon_r.eth_dest[5]);
-
-	bpf_printk("Port: %u", coon_r.ifindex);
-	*/
-	
-	
-	return 1;
-}
-
-
 /* Solution to packet03/assignment-4 */
 SEC("xdp_rtcache")
 int xdp_rtcache_prog(struct xdp_md *ctx)
@@ -200,10 +109,8 @@ int xdp_rtcache_prog(struct xdp_md *ctx)
 	struct ethhdr *eth = data;
 	struct ipv6hdr *ip6h;
 	struct iphdr *iph;
-	unsigned int ip4_saddr = 0;
-	//unsigned ifindex = 2;
+	struct xrt_nexthop nhop;
 	int rc;
-	struct rt_item nitem = {.saddr = 0, .eth_source = {0}, .eth_dest = {0}};
 
 
 	nh.pos = data;
@@ -224,25 +131,14 @@ int xdp_rtcache_prog(struct xdp_md *ctx)
 			goto out;
 		
 
-		ip4_saddr = iph->saddr;
-
-		nitem.saddr = ip4_saddr;
-		
-		// 首先精确查找转发表，如果找到就直接转发，不必再经历最长前缀匹配的慢速通配查找
-		match_rules(&nitem);
-	
-		
-
-		if (mac_zero(nitem.eth_dest)) {
-			ip_decrease_ttl(iph);
-			memcpy(eth->h_dest, nitem.eth_dest, ETH_ALEN);
-			memcpy(eth->h_source, nitem.eth_source, ETH_ALEN);
-			action = bpf_redirect_map(&tx_port, 0, 0);
-
+		// 首先查找路由表，命中就直接转发，不必再调用内核的FIB查找
+		rc = xrt_forward(ctx, eth, iph, &nhop);
+		if (rc != XRT_NO_ROUTE) {
+			action = rc;
 			goto out;
 		}
 
-		// 否则执行最长前缀匹配了
+		// 否则交给内核的FIB查找
 		ifib.family = AF_INET;
 		ifib.tos = iph->tos;
 		ifib.l4_protocol = iph->protocol;
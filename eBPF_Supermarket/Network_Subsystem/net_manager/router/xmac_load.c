@@ -3,16 +3,18 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <linux/limits.h>
 
 #include <bpf/bpf.h>
 
 #include "map_common.h"
 #include "common_kern_user.h"
+#include "../common/xrouter_user.h"
 
 
 char *ifname;
 
-int rtcache_map4;
+struct xrt_maps maps;
 
 int print_usage(int id){
     switch(id){
@@ -28,8 +30,10 @@ int print_usage(int id){
 
 
 int load_bpf_map(){
-    rtcache_map4 = open_map(ifname, "rtcache_map4");
-    if(rtcache_map4 < 0){
+    char pin_dir[PATH_MAX];
+
+    snprintf(pin_dir, sizeof(pin_dir), "/sys/fs/bpf/%s", ifname);
+    if(xrt_open_maps(pin_dir, &maps) < 0){
         fprintf(stderr, "load bpf map error,check device name\n");
         return -1;
     }
@@ -38,30 +42,8 @@ int load_bpf_map(){
 }
 
 
-static __u32 ip_to_u32(__u8 *ip_u8) {
-    __u32 ip_u32 = 0;
-    ip_u32 = (ip_u8[0]<<24) | (ip_u8[1]<<16) | (ip_u8[2]<<8) | (ip_u8[3]);
-    //printf("%hhu.%hhu.%hhu.%hhu,%u\n",ip_u8[0],ip_u8[1],ip_u8[2],ip_u8[3],ip_u32);
-    return ip_u32;
-}
-
-
 int clear_map(){
-    __u8 keys[MAX_RULES];
-    for(int i=0; i<MAX_RULES; i++){
-        keys[i] = i;
-    }
-
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
-
-    __u32 count = MAX_RULES - 1;
-
-    bpf_map_delete_batch(rtcache_map4, &keys, &count, &opts);
-
-    return count;
+    return xrt_clear(&maps);
 }
 
 
@@ -73,57 +55,25 @@ int load_handler(int argc, char *argv[]){
 
     char *path = argv[0];
     printf("loading config file:%s\n",path);
-    
-    FILE *file = fopen(path, "r");
-    if (file == NULL) {
-        perror("Error opening file");
-        return 1;
-    }
 
+    struct xrt_config cfg;
+    if(xrt_read_config(path, &cfg) < 0)
+        return 1;
 
-    __u32 keys[MAX_RULES];
-    struct rt_item rules[MAX_RULES];
-
-    __u32 i = 0;
-    keys[0] = 0;
-    char line[MAX_RULES];
-
-    while (fgets(line, sizeof(line), file) != NULL) {
-        line[strcspn(line, "\n")] = '\0';
-
-        __u8 saddr[4];
-        __u8 eth_source[ETH_ALEN];
-        __u8 eth_dest[ETH_ALEN];
-        
-
-        sscanf(line, "%hhu.%hhu.%hhu.%hhu %hhx:%hhx:%hhx:%hhx:%hhx:%hhx %hhx:%hhx:%hhx:%hhx:%hhx:%hhx" ,
-            &saddr[0] ,&saddr[1] ,&saddr[2] ,&saddr[3],
-            &eth_source[0], &eth_source[1], &eth_source[2], &eth_source[3], &eth_source[4], &eth_source[5], 
-            &eth_dest[0], &eth_dest[1], &eth_dest[2], &eth_dest[3], &eth_dest[4], &eth_dest[5]);
-
-        rules[i].saddr = ip_to_u32(saddr);
-        memcpy(rules[i].eth_source, eth_source, ETH_ALEN);
-        memcpy(rules[i].eth_dest, eth_dest, ETH_ALEN);
-
-        keys[i] = i;
-        i += 1;
-       
-    } 
-    printf("%d rules loaded\n",i);
-
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
-    clear_map();
-
-    bpf_map_update_batch(rtcache_map4, keys, rules, &i, &opts);
+    // 路由写入未生效的bank后原子切换，重载期间转发不受影响
+    int ret = xrt_load(&maps, &cfg);
+    xrt_free_config(&cfg);
+    if(ret < 0){
+        fprintf(stderr, "load routes error: %s\n", strerror(-ret));
+        return 1;
+    }
+    printf("%d prefixes loaded\n", ret);
     return 0;  
 }
 
 int clear_handler(int argc, char *argv[]){
     int ret = clear_map();
-    printf("%d rules are cleared\n", ret-1);
+    printf("%d route entries are cleared\n", ret);
     return 0;
 }
 
@@ -0,0 +1,330 @@
+/* 同主机 TCP 的吞吐和延迟测试，对比 sockmap 绕过协议栈与普通协议栈
+ *
+ * 在 netmanager -f 运行时，通过 SOCKMAP_PIN_DIR 下固定的 sockmap_config_map
+ * 切换新建连接是否加速，同一个程序先后测出两种情况；读取 sockmap_counters
+ * 确认数据确实被重定向。没有运行 netmanager -f 时只测普通协议栈。
+ *
+ * sudo cgexec -g unified:foo ./sockmap_bench -s 64 -n 20000 -d 3
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <bpf/bpf.h>
+
+#include "./common/xsockmap_user.h"
+
+#define BENCH_CHUNK	65536
+
+struct bench_opts {
+	int port;
+	int size;		// 延迟测试每次请求的字节数
+	int iters;
+	int secs;		// 吞吐测试时长
+	int mode;		// 0 两种都测，1 只测加速，2 只测协议栈
+};
+
+struct bench_result {
+	double lat_avg, lat_p50, lat_p99;	// 微秒
+	double gbps;
+	__u64 redir_msgs;
+};
+
+static __u64 now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (__u64)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	size_t off = 0;
+
+	while (off < len) {
+		ssize_t n = read(fd, (char *)buf + off, len - off);
+
+		if (n <= 0)
+			return -1;
+		off += n;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	size_t off = 0;
+
+	while (off < len) {
+		ssize_t n = write(fd, (const char *)buf + off, len - off);
+
+		if (n <= 0)
+			return -1;
+		off += n;
+	}
+	return 0;
+}
+
+/* 第一个连接原样回显 size 字节的请求，第二个连接读到 EOF 后回复收到的字节数。
+ * 在子进程中运行，用 _exit 退出，不刷新从父进程继承的 stdio 缓冲
+ */
+static void serve(int lfd, int size)
+{
+	char *buf = malloc(BENCH_CHUNK);
+	__u64 total = 0;
+	ssize_t n;
+	int fd;
+
+	if (!buf)
+		_exit(1);
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0)
+		_exit(1);
+	while (!read_full(fd, buf, size) && !write_full(fd, buf, size))
+		;
+	close(fd);
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0)
+		_exit(1);
+	while ((n = read(fd, buf, BENCH_CHUNK)) > 0)
+		total += n;
+	write_full(fd, &total, sizeof(total));
+	close(fd);
+	free(buf);
+	_exit(0);
+}
+
+static int connect_local(int port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	int one = 1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	__u64 x = *(const __u64 *)a, y = *(const __u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int run_latency(const struct bench_opts *o, struct bench_result *r)
+{
+	__u64 *lat = calloc(o->iters, sizeof(*lat)), sum = 0;
+	char *buf = calloc(1, o->size);
+	int fd = connect_local(o->port), err = -1;
+
+	if (!lat || !buf || fd < 0)
+		goto out;
+	for (int i = 0; i < o->iters; i++) {
+		__u64 t = now_ns();
+
+		if (write_full(fd, buf, o->size) || read_full(fd, buf, o->size))
+			goto out;
+		lat[i] = now_ns() - t;
+		sum += lat[i];
+	}
+	qsort(lat, o->iters, sizeof(*lat), cmp_u64);
+	r->lat_avg = sum / 1e3 / o->iters;
+	r->lat_p50 = lat[o->iters / 2] / 1e3;
+	r->lat_p99 = lat[(__u64)o->iters * 99 / 100] / 1e3;
+	err = 0;
+out:
+	if (fd >= 0)
+		close(fd);
+	free(lat);
+	free(buf);
+	return err;
+}
+
+static int run_throughput(const struct bench_opts *o, struct bench_result *r)
+{
+	char *buf = calloc(1, BENCH_CHUNK);
+	int fd = connect_local(o->port), err = -1;
+	__u64 start, deadline, total = 0;
+
+	if (!buf || fd < 0)
+		goto out;
+	start = now_ns();
+	deadline = start + (__u64)o->secs * 1000000000ULL;
+	while (now_ns() < deadline) {
+		if (write_full(fd, buf, BENCH_CHUNK))
+			goto out;
+	}
+	// 以服务端确认收到的字节数和收到确认的时间为准
+	shutdown(fd, SHUT_WR);
+	if (read_full(fd, &total, sizeof(total)))
+		goto out;
+	r->gbps = total * 8 / ((now_ns() - start) / 1e9) / 1e9;
+	err = 0;
+out:
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	return err;
+}
+
+static int run_once(const struct bench_opts *o, int cnt_fd, struct bench_result *r)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(o->port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	__u64 before[SOCKMAP_CNT_MAX] = { 0 }, after[SOCKMAP_CNT_MAX] = { 0 };
+	int one = 1, lfd, status, err;
+	pid_t pid;
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0)
+		return -errno;
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) || listen(lfd, 4)) {
+		err = -errno;
+		close(lfd);
+		return err;
+	}
+	pid = fork();
+	if (pid < 0) {
+		err = -errno;
+		close(lfd);
+		return err;
+	}
+	if (pid == 0)
+		serve(lfd, o->size);
+	close(lfd);
+
+	if (cnt_fd >= 0)
+		sockmap_read_counters(cnt_fd, before);
+	err = run_latency(o, r);
+	if (!err)
+		err = run_throughput(o, r);
+	if (cnt_fd >= 0)
+		sockmap_read_counters(cnt_fd, after);
+	r->redir_msgs = after[SOCKMAP_CNT_REDIR] - before[SOCKMAP_CNT_REDIR];
+
+	if (err)
+		kill(pid, SIGKILL);
+	waitpid(pid, &status, 0);
+	return err ? -EIO : 0;
+}
+
+static void print_result(const char *name, const struct bench_result *r)
+{
+	printf("%-8s %10.2f %10.2f %10.2f %12.2f %14llu\n", name, r->lat_avg, r->lat_p50,
+	       r->lat_p99, r->gbps, r->redir_msgs);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-p port] [-s size] [-n iters] [-d secs] [-m both|bypass|stack]\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o = { .port = 8080, .size = 64, .iters = 20000, .secs = 3 };
+	struct sockmap_config orig, cfg;
+	struct bench_result r;
+	int cfg_fd, cnt_fd, opt, err = 0;
+	__u32 zero = 0;
+
+	while ((opt = getopt(argc, argv, "p:s:n:d:m:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			o.port = atoi(optarg);
+			break;
+		case 's':
+			o.size = atoi(optarg);
+			break;
+		case 'n':
+			o.iters = atoi(optarg);
+			break;
+		case 'd':
+			o.secs = atoi(optarg);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "bypass"))
+				o.mode = 1;
+			else if (!strcmp(optarg, "stack"))
+				o.mode = 2;
+			else if (strcmp(optarg, "both"))
+				goto err_usage;
+			break;
+		default:
+			goto err_usage;
+		}
+	}
+	if (o.port <= 0 || o.port > 65535 || o.size <= 0 || o.size > BENCH_CHUNK ||
+	    o.iters <= 0 || o.secs <= 0)
+		goto err_usage;
+
+	cfg_fd = bpf_obj_get(SOCKMAP_PIN_DIR "/sockmap_config_map");
+	cnt_fd = bpf_obj_get(SOCKMAP_PIN_DIR "/sockmap_counters");
+	if (cfg_fd < 0 || cnt_fd < 0 || bpf_map_lookup_elem(cfg_fd, &zero, &orig)) {
+		if (o.mode == 1) {
+			fprintf(stderr, "ERR: sockmap maps not found under %s, run netmanager -f first\n",
+				SOCKMAP_PIN_DIR);
+			return EXIT_FAILURE;
+		}
+		fprintf(stderr, "sockmap not running, measuring the TCP/IP stack only\n");
+		cfg_fd = -1;
+		cnt_fd = -1;
+		o.mode = 2;
+	}
+
+	printf("%-8s %10s %10s %10s %12s %14s\n", "mode", "avg(us)", "p50(us)", "p99(us)",
+	       "Gbit/s", "bypassed msgs");
+	for (int m = 1; m <= 2; m++) {
+		if (o.mode && o.mode != m)
+			continue;
+		// 只影响之后新建的连接，已有连接保持原样
+		if (cfg_fd >= 0) {
+			cfg = orig;
+			cfg.enabled = m == 1;
+			bpf_map_update_elem(cfg_fd, &zero, &cfg, BPF_ANY);
+		}
+		memset(&r, 0, sizeof(r));
+		err = run_once(&o, cnt_fd, &r);
+		if (err) {
+			fprintf(stderr, "ERR: %s run failed: %s\n", m == 1 ? "bypass" : "stack",
+				strerror(-err));
+			break;
+		}
+		print_result(m == 1 ? "bypass" : "stack", &r);
+		if (m == 1 && !r.redir_msgs)
+			fprintf(stderr, "WARN: nothing was bypassed, check --cgroup/--sock-ports of netmanager -f\n");
+	}
+	if (cfg_fd >= 0)
+		bpf_map_update_elem(cfg_fd, &zero, &orig, BPF_ANY);
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+
+err_usage:
+	usage(argv[0]);
+	return EXIT_FAILURE;
+}
@@ -37,19 +37,6 @@ struct conn_ipv4 {
 	__u16 ip_proto;
 };
 
-struct rules_ipv4 {
-	__u32 saddr;
-	__u32 daddr;
-	__u8  saddr_mask;
-	__u8  daddr_mask;
-	__u16 sport;
-	__u16 dport;
-	__u16 ip_proto;
-	__u16 action;
-	__u16 prev_rule;
-	__u16 next_rule;
-};
-
 #ifndef XDP_ACTION_MAX
 #define XDP_ACTION_MAX (XDP_REDIRECT + 1)
 #endif
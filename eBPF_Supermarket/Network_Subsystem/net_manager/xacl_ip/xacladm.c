@@ -3,15 +3,17 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <linux/limits.h>
 
 #include <bpf/bpf.h>
 
 #include "map_common.h"
 #include "common_kern_user.h"
+#include "../common/xacl_ipv4_user.h"
 
 char *ifname;
 
-int rules_ipv4_map;
+struct xacl_ipv4_maps maps;
 
 int print_usage(int id){
     switch(id){
@@ -26,8 +28,10 @@ int print_usage(int id){
 }
 
 int load_bpf_map(){
-    rules_ipv4_map = open_map(ifname, "rules_ipv4_map");
-    if(rules_ipv4_map < 0){
+    char pin_dir[PATH_MAX];
+
+    snprintf(pin_dir, sizeof(pin_dir), "/sys/fs/bpf/%s", ifname);
+    if(xacl_ipv4_open_maps(pin_dir, &maps) < 0){
         fprintf(stderr, "load bpf map error,check device name\n");
         return -1;
     }
@@ -35,31 +39,8 @@ int load_bpf_map(){
     return 0;
 }
 
-
-static __u32 ip_to_u32(__u8 *ip_u8) {
-    __u32 ip_u32 = 0;
-    ip_u32 = (ip_u8[0]<<24) | (ip_u8[1]<<16) | (ip_u8[2]<<8) | (ip_u8[3]);
-    //printf("%hhu.%hhu.%hhu.%hhu,%u\n",ip_u8[0],ip_u8[1],ip_u8[2],ip_u8[3],ip_u32);
-    return ip_u32;
-}
-
-
 int clear_map(){
-    __u16 keys[MAX_RULES];
-    for(int i=0; i<MAX_RULES; i++){
-        keys[i] = i;
-    }
-
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
-
-    __u32 count = MAX_RULES - 1;
-
-    bpf_map_delete_batch(rules_ipv4_map, &keys, &count, &opts);
-
-    return count;
+    return xacl_ipv4_clear(&maps);
 }
 
 int load_handler(int argc, char *argv[]){
@@ -70,87 +51,28 @@ int load_handler(int argc, char *argv[]){
 
     char *path = argv[0];
     printf("loading config file:%s\n",path);
-    
-    FILE *file = fopen(path, "r");
-    if (file == NULL) {
-        perror("Error opening file");
+
+    struct xacl_ipv4_rule *rules;
+    __u32 nr;
+    if(xacl_ipv4_read_rules(path, &rules, &nr) < 0)
         return 1;
-    }
 
-    __u16 keys[MAX_RULES];
-    struct rules_ipv4 rules[MAX_RULES];
-
-    __u32 i = 1;
-    keys[0] = 0;
-    char line[256];
-    while (fgets(line, sizeof(line), file) != NULL) {
-        line[strcspn(line, "\n")] = '\0';
-
-        __u8 saddr[4];
-        __u8 daddr[4];
-        char proto[10];
-        char action[10];
-        sscanf(line, "%hhu.%hhu.%hhu.%hhu/%hhu %hhu.%hhu.%hhu.%hhu/%hhu %hu %hu %s %s",
-           &saddr[0] ,&saddr[1] ,&saddr[2] ,&saddr[3] ,&rules[i].saddr_mask, 
-           &daddr[0] ,&daddr[1] ,&daddr[2] ,&daddr[3] ,&rules[i].daddr_mask, 
-           &rules[i].sport, &rules[i].dport, proto, action);
-
-        rules[i].saddr = ip_to_u32(saddr);
-        rules[i].daddr = ip_to_u32(daddr);
-
-        if(strcmp("TCP", proto) == 0){
-            rules[i].ip_proto = IPPROTO_TCP;
-        }else if(strcmp("UDP", proto) == 0){
-            rules[i].ip_proto = IPPROTO_UDP;
-        }else if(strcmp("ICMP", proto) == 0){
-            rules[i].ip_proto = IPPROTO_ICMP;
-        }else{
-            rules[i].ip_proto = 0;
-        }
-
-        if(strcmp("ALLOW", action) == 0){
-            rules[i].action = XDP_PASS;
-        }else if(strcmp("DENY", action) == 0){
-            rules[i].action = XDP_DROP;
-        }else{
-            rules[i].action = XDP_ABORTED;
-        }
-
-        rules[i-1].next_rule = i;
-        rules[i].prev_rule = i - 1;
-        rules[i].next_rule = 0;
-        keys[i] = i;
-
-        i += 1;
+    // 规则先编译成元组空间写入未生效的bank，写完后再原子切换，
+    // 重载期间数据包始终匹配完整的旧规则集或新规则集
+    int ret = xacl_ipv4_load(&maps, rules, nr);
+    free(rules);
+    if(ret < 0){
+        fprintf(stderr, "load rules error: %s\n", strerror(-ret));
+        return 1;
     }
-    printf("%d rules loaded\n",i-1);
-    rules[0].prev_rule = i - 1;
-
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
-    clear_map();
-    // 使用 libbpf 库中的 bpf_map_update_batch 函数批量更新 BPF 映射。
-    // 这个函数用于一次性更新多个键值对，以提高效率。
-
-    // rules_ipv4_map: 要更新的 BPF 映射的文件描述符（FD）。
-    // keys: 包含要更新的键（key）的数组。
-    // rules: 包含要更新的值的数组。
-    // &i: 这是一个指向整数的指针，表示要更新的键值对的数量。在调用函数后，该整数将包含实际更新的键值对数量。
-    // &opts: 用于配置更新选项的结构体，这里是通过 DECLARE_LIBBPF_OPTS 宏声明并初始化的。
-
-    // 在这里，代码中的 bpf_map_update_batch 操作的目的是将多个键值对一次性更新到 BPF 映射中。
-    // 这样可以通过一次系统调用来完成多个更新操作，提高了效率。
-
-    bpf_map_update_batch(rules_ipv4_map, keys, rules, &i, &opts);
+    printf("%d rules loaded\n",nr);
 
     return 0;   
 }
 
 int clear_handler(int argc, char *argv[]){
     int ret = clear_map();
-    printf("%d rules are cleared\n", ret-1);
+    printf("%d rule entries are cleared\n", ret);
     return 0;
 }
 
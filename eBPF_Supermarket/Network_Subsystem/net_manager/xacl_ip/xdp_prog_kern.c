@@ -24,6 +24,8 @@
 
 #include "common_kern_user.h" 
 #include "../common/parsing_helpers.h"
+#include "../common/xacl_ipv4_kern.h"
+#include "../common/xsk_kern_user.h"
 
 struct {
 	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
@@ -32,13 +34,6 @@ struct {
 	__uint(max_entries, XDP_ACTION_MAX);
 } xdp_stats_map SEC(".maps");
 
-struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
-	__type(key, __u16);
-	__type(value, struct rules_ipv4);
-	__uint(max_entries, MAX_RULES);
-} rules_ipv4_map SEC(".maps");
-
 
 static __always_inline
 __u32 xdp_stats_record_action(struct xdp_md *ctx, __u32 action)
@@ -67,80 +62,18 @@ __u32 xdp_stats_record_action(struct xdp_md *ctx, __u32 action)
 	return action;
 }
 
-struct match_rules_loop_ctx{
-	__u16 action;
-	__u16 next_rule;
-	struct conn_ipv4 *conn;
-};
-
-static __always_inline
-int ipv4_cidr_match(__u32 ip_addr, __u32 network_addr, __u8 cidr) {
-	if(network_addr == 0 && cidr == 0)
-        return 1;
-	
-    __u32 subnet_mask = (0xFFFFFFFFU << (32 - cidr)) & 0xFFFFFFFFU;
-
-    __u32 masked_ip = ip_addr & subnet_mask;
-    __u32 masked_network = network_addr & subnet_mask;
-
-    return masked_ip == masked_network;
-}
-
-static __always_inline
-int port_match(__u16 conn_port, __u16 rule_port){
-	if( (!rule_port) || (rule_port == conn_port) ) //0 , match all
-		return 1;
-	return 0;
-}
-
-static int match_rules_ipv4_loop(__u32 index, void *ctx)
-{
-	struct match_rules_loop_ctx *p_ctx = (struct match_rules_loop_ctx *)ctx;
-	if(index != p_ctx->next_rule)
-		return 0;
-
-	struct rules_ipv4 *p_r = bpf_map_lookup_elem(&rules_ipv4_map, &index);
-	if(!p_r){
-		return 1; //out of range
-	}
-
-	p_ctx->next_rule = p_r->next_rule;
-
-	if(index == 0)
-		goto out_match_rules_ipv4_loop;
-
-	if( ipv4_cidr_match(p_ctx->conn->saddr, p_r->saddr, p_r->saddr_mask) && 
-		ipv4_cidr_match(p_ctx->conn->daddr, p_r->daddr, p_r->daddr_mask) &&
-		port_match(p_ctx->conn->sport, p_r->sport) &&
-		port_match(p_ctx->conn->dport, p_r->dport) &&
-		port_match(p_ctx->conn->ip_proto, p_r->ip_proto) ) 
-	{
-		p_ctx->action = p_r->action;
-		return 1;
-	}
-
-out_match_rules_ipv4_loop:
-	if(p_r->next_rule == 0)
-		return 1; //go out loop
-
-	return 0;
-}
-
 static __always_inline
 xdp_act match_rules_ipv4(struct conn_ipv4 *conn)
 {
-	struct match_rules_loop_ctx ctx = {.action = XDP_PASS, .conn = conn, .next_rule = 0};
-	#ifdef KERNEL_5_17
-	bpf_loop(MAX_RULES, match_rules_ipv4_loop, &ctx, 0);
-	#endif
-	#ifdef KERNEL_5_10
-	#pragma unroll
-	for(int i=0; i<MAX_RULES; i++){
-		if(match_rules_ipv4_loop(i,&ctx))
-			break;
-	}
-	#endif
-	return ctx.action;
+	__u32 index;
+	xdp_act action = xacl_ipv4_classify(conn->saddr, conn->daddr, conn->sport, conn->dport,
+					    conn->ip_proto, &index);
+
+	// 独立的 xacl_ip 没有 AF_XDP 慢路径，INSPECT 规则按 XDP_PASS 处理，
+	// 否则不带重定向目标的 XDP_REDIRECT 会丢弃报文
+	if(action == XSK_ACTION_INSPECT)
+		action = XDP_PASS;
+	return action;
 }
 
 SEC("xdp")
@@ -9,12 +9,6 @@
 typedef __u32 xdp_act;
 
 
-#define MAX_RULES 1024
-
-struct key_mac {
-	__u8 src_mac[6];
-};
-
 struct datarec {
 	__u64 rx_packets;
 	__u64 rx_bytes;
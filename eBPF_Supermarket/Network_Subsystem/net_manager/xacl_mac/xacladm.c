@@ -3,14 +3,17 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <linux/limits.h>
 
 #include <bpf/bpf.h>
 
 #include "map_common.h"
 #include "common_kern_user.h"
+#include "../common/xacl_mac_user.h"
 
 char *ifname;
-int src_macs;
+
+struct xacl_mac_maps maps;
 
 
 int print_usage(int id){
@@ -26,8 +29,10 @@ int print_usage(int id){
 }
 
 int load_bpf_map(){
-    src_macs = open_map(ifname, "src_macs");
-    if(src_macs < 0){
+    char pin_dir[PATH_MAX];
+
+    snprintf(pin_dir, sizeof(pin_dir), "/sys/fs/bpf/%s", ifname);
+    if(xacl_mac_open_maps(pin_dir, &maps) < 0){
         fprintf(stderr, "load bpf map error,check device name\n");
         return -1;
     }
@@ -38,21 +43,7 @@ int load_bpf_map(){
 
 
 int clear_map(){
-    __u16 keys[MAX_RULES];
-    for(int i=0; i<MAX_RULES; i++){
-        keys[i] = i;
-    }
-
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
-
-    __u32 count = MAX_RULES ;
-
-    bpf_map_delete_batch(src_macs, &keys, &count, &opts);
-
-    return count;
+    return xacl_mac_clear(&maps);
 }
 
 int load_handler(int argc, char *argv[]){
@@ -63,42 +54,21 @@ int load_handler(int argc, char *argv[]){
 
     char *path = argv[0];
     printf("loading config file:%s\n",path);
-    
-    FILE *file = fopen(path, "r");
-    if (file == NULL) {
-        perror("Error opening file");
-        return 1;
-    }
 
+    struct xacl_mac_rule *rules;
+    __u32 nr;
+    if(xacl_mac_read_rules(path, &rules, &nr) < 0)
+        return 1;
 
-    //__u64 src_mac_u64;
-    __u32 action_mac;
-    char line[256];
-
-    clear_map();
-    while (fgets(line, sizeof(line), file) != NULL) {
-        line[strcspn(line, "\n")] = '\0';
-
-        __u8 src_mac[6];
-        char action[10];
-        sscanf(line, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx %s",
-           &src_mac[0], &src_mac[1], &src_mac[2], &src_mac[3], &src_mac[4], &src_mac[5],
-           action);
-
-        //src_mac_u64 = mac_to_u64(src_mac);
-
-
-        if(strcmp("ALLOW", action) == 0){
-            action_mac = XDP_PASS;
-        }else if(strcmp("DENY", action) == 0){
-            action_mac = XDP_DROP;
-        }else{
-            action_mac = XDP_ABORTED;
-        }
-
-        bpf_map_update_elem(src_macs, src_mac, &action_mac, BPF_ANY);
+    // 通配规则的优先级在编译时展开到各表项中，数据路径只做精确匹配；
+    // 新规则写入未生效的bank后再原子切换
+    int ret = xacl_mac_load(&maps, rules, nr);
+    free(rules);
+    if(ret < 0){
+        fprintf(stderr, "load rules error: %s\n", strerror(-ret));
+        return 1;
     }
-    
+    printf("%d rules loaded\n",nr);
 
     return 0;   
 }
@@ -107,12 +77,12 @@ int load_handler(int argc, char *argv[]){
 
 int clear_handler(int argc, char *argv[]){
     int ret = clear_map();
-    printf("%d rules are cleared\n", ret-1);
+    printf("%d rule entries are cleared\n", ret);
     return 0;
 }
 
 
-int main(int argc, char *argv[]){ //xacladm load enp1s0 ./conf.d/ipv4.conf
+int main(int argc, char *argv[]){ //xacladm load enp1s0 ./conf.d/mac_load.conf
     int ret = 0;
 
     if(argc < 3){
@@ -135,4 +105,4 @@ int main(int argc, char *argv[]){ //xacladm load enp1s0 ./conf.d/ipv4.conf
     }
 
     return ret;
-}
\ No newline at end of file
+}
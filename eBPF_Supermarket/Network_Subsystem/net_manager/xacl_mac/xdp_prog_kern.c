@@ -25,6 +25,7 @@
 #include "common_kern_user.h" 
 #include "../common/parsing_helpers.h"
 #include "../common/rewrite_helpers.h"
+#include "../common/xacl_mac_kern.h"
 
 
 
@@ -39,14 +40,6 @@ struct {
 	__uint(max_entries, XDP_ACTION_MAX);
 } xdp_stats_map SEC(".maps");
 
-/*filter-pass-drop*/
-struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
-	__type(key, ETH_ALEN);
-	__type(value, __u32);
-	__uint(max_entries, MAX_RULES);
-} src_macs SEC(".maps");
-
 
 static __always_inline
 __u32 xdp_stats_record_action(struct xdp_md *ctx, __u32 action)
@@ -86,7 +79,7 @@ int filter_ethernet_filter(struct xdp_md *ctx)
 	struct hdr_cursor nh;
 	int nh_type; //next header type
 	struct ethhdr *eth;
-	__u32 *value;
+	__u32 rule;
 
 
 	nh.pos = data;
@@ -96,15 +89,8 @@ int filter_ethernet_filter(struct xdp_md *ctx)
 	if(nh_type < 0)
 		goto out;
 
-	//action = match_rules_ipv4(&eth->h_source);
-
-	/* check if src mac is in src_macs map */
-	value = bpf_map_lookup_elem(&src_macs, eth->h_source);
-	if (value) {
-        action = *value;
-		goto out;
-    }
-	
+	/* 源、目的、地址对三张哈希表各最多查一次，与规则数无关 */
+	action = xacl_mac_classify(eth->h_source, eth->h_dest, &rule);
 
 out:
 	return xdp_stats_record_action(ctx, action);
@@ -377,12 +377,29 @@ struct {
     __type(key, u32);
     __type(value, struct packet_count);
 } proto_stats SEC(".maps");
+// redis key访问频次的Count-Min sketch, CMS_DEPTH行 * CMS_WIDTH列
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, CMS_DEPTH *CMS_WIDTH);
+    __type(key, u32);
+    __type(value, u32);
+} redis_cms SEC(".maps");
+
+// 候选热点key -> sketch估计的访问次数, 由用户态定期淘汰
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
-    __type(key, char*);  // 键的最大长度，假设为 256 字节
-    __type(value, u32);     // 计数值
-    __uint(max_entries, 1024);  // 最大条目数
-} key_count SEC(".maps");
+    __uint(max_entries, REDIS_TOPK);
+    __type(key, struct redis_key);
+    __type(value, u32);
+} redis_hot_keys SEC(".maps");
+
+// 进入候选集合的最小估计值, 由用户态在每次淘汰后更新
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, u32);
+} redis_topk_min SEC(".maps");
 
 const volatile int filter_dport = 0;
 const volatile int filter_sport = 0;
@@ -20,6 +20,7 @@
 #include "dropreason.h"
 #include "netwatcher.skel.h"
 #include <argp.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
@@ -48,12 +49,10 @@ int cache_size = 0;
 
 // 用于存储从 eBPF map 读取的数据
 typedef struct {
-    char key[256];
+    struct redis_key key;
     u32 value;
 } kv_pair;
 
-static int map_fd;
-
 static int sport = 0, dport = 0; // for filter
 static int all_conn = 0, err_packet = 0, extra_conn_info = 0, layer_time = 0,
            http_info = 0, retrans_info = 0, udp_info = 0, net_filter = 0,
@@ -1470,49 +1469,91 @@ int attach_uprobe_redis(struct netwatcher_bpf *skel) {
     return 0;
 }
 
-void print_top_5_keys() {
-    kv_pair *pairs;
-    pairs = malloc(sizeof(kv_pair) * 1024);
-    if (!pairs) {
-        perror("Failed to allocate memory");
-        exit(EXIT_FAILURE);
+static int kv_pair_cmp(const void *a, const void *b) {
+    const kv_pair *x = a, *y = b;
+    if (x->value == y->value)
+        return 0;
+    return x->value < y->value ? 1 : -1;
+}
+
+// sketch每个周期整体减半, 很久以前的热点key的估计值和准入阈值随之衰减,
+// 新出现的热点key才能进入候选集合
+static void redis_cms_decay(int cms_fd) {
+    static u32 keys[CMS_DEPTH * CMS_WIDTH], cells[CMS_DEPTH * CMS_WIDTH];
+    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts);
+    u32 count = CMS_DEPTH * CMS_WIDTH, out_batch;
+    int err;
+
+    err = bpf_map_lookup_batch(cms_fd, NULL, &out_batch, keys, cells, &count,
+                               &opts);
+    if ((!err || errno == ENOENT) && count == CMS_DEPTH * CMS_WIDTH) {
+        for (u32 i = 0; i < count; i++)
+            cells[i] >>= 1;
+        // 两次系统调用之间内核新增的计数会被覆盖, 对近似计数可以接受
+        if (!bpf_map_update_batch(cms_fd, keys, cells, &count, &opts))
+            return;
+    }
+    // 内核不支持批量操作时逐项处理
+    for (u32 i = 0; i < CMS_DEPTH * CMS_WIDTH; i++) {
+        u32 val;
+        if (bpf_map_lookup_elem(cms_fd, &i, &val) || !val)
+            continue;
+        val >>= 1;
+        bpf_map_update_elem(cms_fd, &i, &val, BPF_ANY);
     }
-    int index = 0;
-    char *key = NULL;
-     while (bpf_map_get_next_key(map_fd, &key, &key) == 0) {
-        // fprintf(stdout, "next_sk: (%p)\n", sk);
-        int count;
-        int err = bpf_map_lookup_elem(map_fd, &key, &count);
-        if (err) {
-            fprintf(stderr, "Failed to read value from the conns map: (%s)\n",
-                    strerror(errno));
-            return ;
-        }
-        memcpy(pairs[index].key, &key, 256);
-        pairs[index].value = count;
-        //printf("Key: %s, Count: %u\n", pairs[index].key, pairs[index].value);
-        index++;
-     }
-    // 获取所有键值对
-
-    // 排序前 5 个元素
-    // 简单选择排序（可替换为其他高效排序算法）
-    for (int i = 0; i < index - 1; i++) {
-        for (int j = i + 1; j < index; j++) {
-            if (pairs[j].value > pairs[i].value) {
-                kv_pair temp = pairs[i];
-                pairs[i] = pairs[j];
-                pairs[j] = temp;
-            }
+}
+
+// 候选集合最多REDIS_TOPK个元素, 每次输出的开销为O(K)
+void print_top_5_keys(struct netwatcher_bpf *skel) {
+    int hot_fd = bpf_map__fd(skel->maps.redis_hot_keys);
+    int min_fd = bpf_map__fd(skel->maps.redis_topk_min);
+    kv_pair pairs[REDIS_TOPK];
+    struct redis_key key, next, *prev = NULL;
+    int index = 0, keep = REDIS_TOPK / 2;
+    u32 zero = 0, min;
+
+    while (index < REDIS_TOPK &&
+           bpf_map_get_next_key(hot_fd, prev, &next) == 0) {
+        key = next;
+        prev = &key;
+        if (bpf_map_lookup_elem(hot_fd, &key, &pairs[index].value) == 0) {
+            pairs[index].key = key;
+            index++;
         }
     }
+    qsort(pairs, index, sizeof(kv_pair), kv_pair_cmp);
+
     printf("----------------------------\n");
-    // 打印前 5 个元素
-    printf("Top 5 Keys:\n");
-    for (int i = 0; i < 5 && i < index; i++) {
-        printf("Key: %s, Count: %u\n", pairs[i].key, pairs[i].value);
+    printf("Top %d Keys:\n", REDIS_TOP_SHOW);
+    for (int i = 0; i < REDIS_TOP_SHOW && i < index; i++) {
+        printf("Key: %s, Count: %u\n", pairs[i].key.key, pairs[i].value);
     }
-    free(pairs);
+
+    // 集合已满时淘汰后半部分, 为新的热点key腾出空间
+    bool evicted = index == REDIS_TOPK;
+    if (evicted) {
+        for (int i = keep; i < index; i++)
+            bpf_map_delete_elem(hot_fd, &pairs[i].key);
+        index = keep;
+    }
+    // sketch、候选集合中的估计值和准入阈值一起减半, 三者保持可比
+    redis_cms_decay(bpf_map__fd(skel->maps.redis_cms));
+    for (int i = 0; i < index; i++) {
+        pairs[i].value >>= 1;
+        // 衰减到0说明已很久没有访问, 直接移出候选集合
+        if (pairs[i].value)
+            bpf_map_update_elem(hot_fd, &pairs[i].key, &pairs[i].value, BPF_EXIST);
+        else
+            bpf_map_delete_elem(hot_fd, &pairs[i].key);
+    }
+    // 淘汰后以保留的最小值作为准入阈值, 否则原阈值同样减半
+    if (evicted)
+        min = pairs[keep - 1].value;
+    else if (bpf_map_lookup_elem(min_fd, &zero, &min) == 0)
+        min >>= 1;
+    else
+        min = 0;
+    bpf_map_update_elem(min_fd, &zero, &min, BPF_ANY);
 }
 int main(int argc, char **argv) {
     char *last_slash = strrchr(argv[0], '/');
@@ -1742,12 +1783,7 @@ int main(int argc, char **argv) {
                     calculate_protocol_usage(proto_stats, 256, 5);
                 }else if(redis_stat)
                 {
-                    map_fd = bpf_map__fd(skel->maps.key_count);
-                    if (map_fd < 0) {
-                        perror("Failed to get map FD");
-                        return 1;
-                    }
-                    print_top_5_keys();
+                    print_top_5_keys(skel);
                 }
                 gettimeofday(&start, NULL);
             }
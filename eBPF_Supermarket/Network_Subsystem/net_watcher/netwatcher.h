@@ -55,6 +55,12 @@ typedef unsigned long long u64;
 #define MAX_STACK_DEPTH 128
 #define MAX_EVENTS 1024
 #define CACHEMAXSIZE 5
+// redis 热点key统计: Count-Min sketch + 候选top-K集合
+#define REDIS_KEY_LEN 64
+#define CMS_DEPTH 4
+#define CMS_WIDTH 4096 // 必须为2的幂
+#define REDIS_TOPK 64  // 内核中候选热点key的最大数目
+#define REDIS_TOP_SHOW 5
 typedef u64 stack_trace_t[MAX_STACK_DEPTH];
 
 struct conn_t {
@@ -198,6 +204,9 @@ struct redis_query {
     u64 begin_time;
     int argc;
 };
+struct redis_key {
+    char key[REDIS_KEY_LEN];
+};
 struct redis_stat_query {
     int pid;
     char comm[20];
@@ -68,12 +68,41 @@ static __always_inline int __handle_redis_end(struct pt_regs *ctx) {
     bpf_ringbuf_submit(message, 0);
     return 0;
 }
+// FNV-1a, 遇到字符串结尾即停止
+static __always_inline u64 redis_key_hash(const struct redis_key *k) {
+    u64 hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < REDIS_KEY_LEN; i++) {
+        if (!k->key[i])
+            break;
+        hash ^= (u8)k->key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// 在Count-Min sketch中为key计数, 返回其估计访问次数
+static __always_inline u32 redis_cms_add(const struct redis_key *k) {
+    u64 hash = redis_key_hash(k);
+    u32 h1 = (u32)hash, h2 = (u32)(hash >> 32) | 1;
+    u32 estimate = (u32)-1;
+    for (u32 i = 0; i < CMS_DEPTH; i++) {
+        u32 idx = i * CMS_WIDTH + ((h1 + i * h2) & (CMS_WIDTH - 1));
+        u32 *cell = bpf_map_lookup_elem(&redis_cms, &idx);
+        if (!cell)
+            return 0;
+        u32 val = __sync_fetch_and_add(cell, 1) + 1;
+        if (val < estimate)
+            estimate = val;
+    }
+    return estimate;
+}
+
 static __always_inline int __handle_redis_key(struct pt_regs *ctx) {
     if(!redis_stat) return 0;
     robj *key_obj = (robj *)PT_REGS_PARM2(ctx);
-    char redis_key[256];
-    u32 *count;
-    u32 initial_count = 1;
+    struct redis_key k = {};
+    u32 estimate, zero = 0;
+    u32 *count, *min;
 
     if (!key_obj)
         return 0;
@@ -90,41 +119,37 @@ static __always_inline int __handle_redis_key(struct pt_regs *ctx) {
     }
 
     int ret;
-    ret = bpf_probe_read_user_str(redis_key, sizeof(redis_key), local_key_obj.ptr);
+    ret = bpf_probe_read_user_str(k.key, sizeof(k.key), local_key_obj.ptr);
     if (ret <= 0) {
         bpf_printk("Read string failed: %d\n", ret);
         return 0;
     }
 
-    // 打印读取到的键值
-    bpf_printk("Read key: %s\n", redis_key);
+    // sketch内存固定, 不受key空间大小限制
+    estimate = redis_cms_add(&k);
 
-    // 查找或更新键的计数
-    count = bpf_map_lookup_elem(&key_count, redis_key);
+    // 已在候选集合中则刷新估计值, 否则超过准入阈值时尝试加入(集合满时失败)
+    count = bpf_map_lookup_elem(&redis_hot_keys, &k);
     if (count) {
-        //bpf_printk("Found key, incrementing count\n");
-        // 如果已经存在，增加计数值
-        (*count)++;
-        bpf_map_update_elem(&key_count, redis_key, count, BPF_ANY);
+        if (estimate > *count)
+            *count = estimate;
     } else {
-        //bpf_printk("Key not found, initializing count\n");
-        // 如果不存在，初始化计数值为 1
-        bpf_map_update_elem(&key_count, redis_key, &initial_count, BPF_ANY);
+        min = bpf_map_lookup_elem(&redis_topk_min, &zero);
+        if (min && estimate > *min)
+            bpf_map_update_elem(&redis_hot_keys, &k, &estimate, BPF_NOEXIST);
     }
 
-    // 打印调试信息
     struct redis_stat_query *message = bpf_ringbuf_reserve(&redis_stat_rb, sizeof(*message), 0);
     if (!message) {
         return 0;
     }
     message->pid=bpf_get_current_pid_tgid() >> 32;
     bpf_get_current_comm(&message->comm, sizeof(message->comm));
-    memcpy(message->key, redis_key, sizeof(message->key));
-    message->key_count=count ? *count : initial_count;
+    memcpy(message->key, k.key, sizeof(message->key));
+    message->key[sizeof(message->key) - 1] = 0;
+    message->key_count = estimate;
     message->value_type=0;
     memset(message->value, 0, sizeof(message->value));
-    bpf_printk("Key: %s\n", message->key);
-    bpf_printk("Count: %d\n", message->key_count);
     bpf_ringbuf_submit(message, 0);
     
     return 0;
@@ -40,18 +40,53 @@ struct {
 }id SEC(".maps");
 
 struct {
-    __uint(type,BPF_MAP_TYPE_HASH);
+    __uint(type,BPF_MAP_TYPE_LRU_HASH);
     __uint(max_entries, 8192);
     __type(key, pid_t);
     __type(value,struct container_id);   
 }container_id_map SEC(".maps");
 
+//(容器ID, 代)到统计槽位的映射,槽位在该代中首次出现时分配
 struct {
     __uint(type,BPF_MAP_TYPE_HASH);
-    __uint(max_entries, 80);
-    __type(key, pid_t);
-    __type(value,struct syscall_value); //记录容器ID、进程名、系统调用号、每个调用号的次数、单位时间内的总延迟   
-}proc_syscall_info SEC(".maps");
+    __uint(max_entries, 2 * CONTAINER_SLOTS);
+    __type(key, struct container_slot_key);
+    __type(value, u32);
+}container_slot_map SEC(".maps");
+
+//CONTAINER_CTL_GEN为当前写入的代,CONTAINER_CTL_NEXT(gen)为该代下一个空闲槽位,
+//用户态每个周期切换代并重置另一代的槽位
+struct {
+    __uint(type,BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 3);
+    __type(key, u32);
+    __type(value, u32);
+}container_syscall_ctl SEC(".maps");
+
+struct {
+    __uint(type,BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, CONTAINER_SYSCALL_ENTRIES);
+    __type(key, u32);
+    __type(value,struct container_syscall_stat);
+}container_syscall_stats SEC(".maps");
+
+static u32 *container_slot(const struct container_slot_key *key){
+    u32 *slot = bpf_map_lookup_elem(&container_slot_map, key);
+    if (slot) {
+        return slot;
+    }
+    u32 next_key = CONTAINER_CTL_NEXT(key->gen);
+    u32 *next = bpf_map_lookup_elem(&container_syscall_ctl, &next_key);
+    if (!next) {
+        return NULL;
+    }
+    u32 new_slot = __sync_fetch_and_add(next, 1);
+    if (new_slot >= CONTAINER_SLOTS) {
+        return NULL;  //本代槽位用尽,该容器等到下一代再统计
+    }
+    bpf_map_update_elem(&container_slot_map, key, &new_slot, BPF_NOEXIST);
+    return bpf_map_lookup_elem(&container_slot_map, key);
+}
 
 static int trace_container_sys_entry(struct trace_event_raw_sys_enter *args){
     u64 st = bpf_ktime_get_ns();
@@ -81,36 +116,33 @@ static int trace_container_sys_exit(struct trace_event_raw_sys_exit *args){
 	}else{ 
 	    return 0;
 	}
-    const void *contain_id = bpf_map_lookup_elem(&container_id_map,&pid);
+    //检查 syscallid 是否超出范围
+    if (syscallid >= MAX_SYSCALL_NUM) {
+        return 0;  // 如果超出范围，直接返回
+    }
+    const struct container_id *contain_id = bpf_map_lookup_elem(&container_id_map,&pid);
     if(contain_id == NULL){
         return 0;
     }
-    //用指针去获取用户定义好的结构体，不然结构体过大会导致栈溢出
-    struct syscall_value *syscall_value = bpf_map_lookup_elem(&proc_syscall_info, &pid);
-    if (!syscall_value) {
+    u32 gen_key = CONTAINER_CTL_GEN;
+    u32 *gen = bpf_map_lookup_elem(&container_syscall_ctl, &gen_key);
+    if (!gen) {
         return 0;
     }
-    //检查 syscallid 是否超出范围
-    //逻辑检查应该放到获取结构体之后的第一步操作，提前的检查让路径变得显式且安全，否则验证器可能无法通过
-    if (syscallid >= MAX_SYSCALL_NUM || syscallid < 0) {
-        return 0;  // 如果超出范围，直接返回
-    }
-    
-    // 读取 container_id
-    int ret = bpf_probe_read_kernel_str(syscall_value->container_id, sizeof(syscall_value->container_id), contain_id);
-    if (ret < 0) {
-        bpf_printk("Failed to read container_id from kernel space, error code: %d\n", ret);
+    struct container_slot_key slot_key = {.gen = *gen & 1};
+    __builtin_memcpy(&slot_key.id, contain_id, sizeof(slot_key.id));
+    u32 *slot = container_slot(&slot_key);
+    if (!slot || *slot >= CONTAINER_SLOTS) {
         return 0;
     }
-
-    // 获取进程名并存储
-    ret = bpf_get_current_comm(syscall_value->proc_name, sizeof(syscall_value->proc_name));
-    if (ret < 0) {
-        bpf_printk("Failed to read process name, error code: %d\n", ret);
+    u32 index = CONTAINER_SYSCALL_INDEX(slot_key.gen, *slot, syscallid);
+    struct container_syscall_stat *stat = bpf_map_lookup_elem(&container_syscall_stats, &index);
+    if (!stat) {
         return 0;
     }
-    syscall_value->syscall_total_delay[syscallid] += delay;  // 加上 delay 的值
-    syscall_value->syscall_id_counts[syscallid] += 1;  // 计数加 1 
+    //每CPU的数组元素,无需原子操作
+    stat->total_delay += delay;
+    stat->count += 1;
     return 0;
 }
 
@@ -151,7 +183,10 @@ static bool is_container_task(const volatile char *hostname){
     }
     if (is_equal){   //表明匹配成功，该进程是需要监听的容器里的进程
         pid_t pid = bpf_get_current_pid_tgid();
-        bpf_map_update_elem(&container_id_map,&pid,&data.nodename,BPF_ANY);
+        //值比nodename长, 其余字节必须为0, 否则同一容器会得到不同的槽位键
+        struct container_id cid = {};
+        __builtin_memcpy(cid.container_id, data.nodename, sizeof(data.nodename));
+        bpf_map_update_elem(&container_id_map,&pid,&cid,BPF_ANY);
         return true;
     } else {
         return false;
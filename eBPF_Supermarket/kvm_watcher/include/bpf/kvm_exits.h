@@ -20,6 +20,7 @@
 #define __KVM_EXITS_H
 
 #include "common.h"
+#include "kvm_hist.h"
 #include "vmlinux.h"
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_core_read.h>
@@ -131,6 +132,10 @@ static int trace_kvm_entry() {
     exit_key.pid = pid;
     exit_key.tid = tid;
     exit_key.reason = reas->reason;
+    if (aggregate) {
+        update_lat_hist(pid, HIST_KVM_EXIT, reas->reason, duration_ns);
+        return 0;
+    }
     update_exit_map(&exit_map, &exit_key, duration_ns);
     return 0;
 }
@@ -156,6 +161,10 @@ static int trace_kvm_userspace_exit(struct userspace_exit *ctx) {
     exit_key.pid = pid;
     exit_key.tid = tid;
     exit_key.reason = ctx->reason;
+    if (aggregate) {
+        update_lat_hist(pid, HIST_USERSPACE_EXIT, ctx->reason, duration_ns);
+        return 0;
+    }
     update_exit_map(&userspace_exit_map, &exit_key, duration_ns);
     return 0;
 }
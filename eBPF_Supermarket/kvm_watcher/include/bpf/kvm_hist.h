@@ -0,0 +1,78 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Kernel space BPF program used for aggregating event latency into
+// per-VM log2 histograms.
+
+#ifndef __KVM_HIST_H
+#define __KVM_HIST_H
+
+#include "common.h"
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+
+// 聚合模式下不再逐事件写入环形缓冲区
+const volatile bool aggregate = false;
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, LAT_HIST_ENTRIES);
+    __type(key, struct lat_hist_key);
+    __type(value, struct lat_hist_value);
+} lat_hist SEC(".maps");
+
+static __always_inline u32 log2_u64(u64 v) {
+    u32 r = 0, shift;
+    shift = (v > 0xFFFFFFFF) << 5;
+    v >>= shift;
+    r |= shift;
+    shift = (v > 0xFFFF) << 4;
+    v >>= shift;
+    r |= shift;
+    shift = (v > 0xFF) << 3;
+    v >>= shift;
+    r |= shift;
+    shift = (v > 0xF) << 2;
+    v >>= shift;
+    r |= shift;
+    shift = (v > 0x3) << 1;
+    v >>= shift;
+    r |= shift;
+    r |= (v >> 1);
+    return r;
+}
+
+static void update_lat_hist(u32 pid, u16 kind, u32 reason, u64 delta_ns) {
+    struct lat_hist_key key = {.pid = pid, .kind = kind, .reason = reason};
+    struct lat_hist_value *value;
+    u32 slot;
+
+    value = bpf_map_lookup_elem(&lat_hist, &key);
+    if (!value) {
+        struct lat_hist_value zero = {};
+        bpf_map_update_elem(&lat_hist, &key, &zero, BPF_NOEXIST);
+        value = bpf_map_lookup_elem(&lat_hist, &key);
+        if (!value)
+            return;
+    }
+    // 每CPU独占一份数据, 无需原子操作
+    slot = log2_u64(delta_ns);
+    if (slot >= LAT_HIST_SLOTS)
+        slot = LAT_HIST_SLOTS - 1;
+    value->slots[slot]++;
+    value->count++;
+    value->total_ns += delta_ns;
+}
+
+#endif /* __KVM_HIST_H */
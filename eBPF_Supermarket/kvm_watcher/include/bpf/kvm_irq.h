@@ -19,6 +19,7 @@
 #define __KVM_IRQ_H
 
 #include "common.h"
+#include "kvm_hist.h"
 #include "vmlinux.h"
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_core_read.h>
@@ -66,6 +67,11 @@ static int exit_kvm_pic_set_irq(struct kvm_pic *s, int irq, int ret, void *rb,
     u64 time = bpf_ktime_get_ns();
     u64 delay = time - *ts;
     bpf_map_delete_elem(&irq_set_delay, &irq_type);
+    if (aggregate) {
+        update_lat_hist(bpf_get_current_pid_tgid() >> 32, HIST_IRQCHIP,
+                        KVM_IRQCHIP_PIC, delay);
+        return 0;
+    }
     RESERVE_RINGBUF_ENTRY(rb, e);
     bpf_probe_read_kernel(&e->irqchip_data.ret, sizeof(int), &ret);
     e->time = *ts;
@@ -106,6 +112,11 @@ static int exit_kvm_ioapic_set_irq(struct kvm_ioapic *ioapic, int irq, int ret,
     u64 time = bpf_ktime_get_ns();
     u64 delay = time - *ts;
     bpf_map_delete_elem(&irq_set_delay, &irq_nr);
+    if (aggregate) {
+        update_lat_hist(bpf_get_current_pid_tgid() >> 32, HIST_IRQCHIP,
+                        KVM_IRQCHIP_IOAPIC, delay);
+        return 0;
+    }
     RESERVE_RINGBUF_ENTRY(rb, e);
     union kvm_ioapic_redirect_entry entry;
     bpf_probe_read_kernel(&entry, sizeof(union kvm_ioapic_redirect_entry),
@@ -156,6 +167,11 @@ static int exit_kvm_set_msi(struct kvm *kvm,
     u64 time = bpf_ktime_get_ns();
     u64 delay = time - *ts;
     bpf_map_delete_elem(&irq_set_delay, &tid);
+    if (aggregate) {
+        update_lat_hist(bpf_get_current_pid_tgid() >> 32, HIST_IRQCHIP,
+                        KVM_MSI, delay);
+        return 0;
+    }
     RESERVE_RINGBUF_ENTRY(rb, e);
     e->irqchip_data.delay = delay;
     e->irqchip_data.irqchip_type = KVM_MSI;
@@ -189,6 +205,11 @@ static int exit_vmx_inject_irq(struct kvm_vcpu *vcpu, void *rb,
     u64 time = bpf_ktime_get_ns();
     u64 delay = time - *ts;
     bpf_map_delete_elem(&irq_inject_delay, &irq_nr);
+    if (aggregate) {
+        update_lat_hist(bpf_get_current_pid_tgid() >> 32, HIST_IRQ_INJECT,
+                        irq_nr, delay);
+        return 0;
+    }
     bool soft;
     bpf_probe_read_kernel(&soft, sizeof(bool), &vcpu->arch.interrupt.soft);
     RESERVE_RINGBUF_ENTRY(rb, e);
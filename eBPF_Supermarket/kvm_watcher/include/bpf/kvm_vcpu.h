@@ -54,6 +54,30 @@ struct {
     __type(value, u32);
 } vcpu_tid SEC(".maps");
 
+// 所有memslot共享的脏页位图, 用户态mmap后读取并清零
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(map_flags, BPF_F_MMAPABLE);
+    __uint(max_entries, DIRTY_BITMAP_WORDS);
+    __type(key, u32);
+    __type(value, u64);
+} dirty_bitmap SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 1024);
+    __type(key, struct dirty_slot_key);
+    __type(value, struct dirty_slot_info);
+} dirty_slots SEC(".maps");
+
+// 位图空间由用户态单线程分配和回收, 内核态只读
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 1024);
+    __type(key, struct dirty_slot_key);
+    __type(value, struct dirty_slot_alloc);
+} dirty_slot_allocs SEC(".maps");
+
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
     __uint(max_entries, 8192);
@@ -228,4 +252,50 @@ static int trace_mark_page_dirty_in_slot(struct kvm *kvm,
 
     return 0;
 }
+
+// 脏页速率模式: 只在位图中置位, 不产生逐页事件
+static int trace_dirty_page_rate(const struct kvm_memory_slot *memslot,
+                                 gfn_t gfn) {
+    struct dirty_slot_key key = {};
+    struct dirty_slot_info *info, new_info = {};
+    struct dirty_slot_alloc *alloc;
+    u64 base_gfn, npages, rel_gfn, *word;
+    u32 flags, idx;
+
+    bpf_probe_read_kernel(&flags, sizeof(memslot->flags), &memslot->flags);
+    if (!(flags & KVM_MEM_LOG_DIRTY_PAGES))
+        return 0;
+    key.pid = bpf_get_current_pid_tgid() >> 32;
+    bpf_probe_read_kernel(&key.slot_id, sizeof(key.slot_id), &memslot->id);
+    bpf_probe_read_kernel(&base_gfn, sizeof(memslot->base_gfn),
+                          &memslot->base_gfn);
+    bpf_probe_read_kernel(&npages, sizeof(memslot->npages), &memslot->npages);
+    info = bpf_map_lookup_elem(&dirty_slots, &key);
+    if (!info) {
+        new_info.base_gfn = base_gfn;
+        new_info.npages = npages;
+        bpf_map_update_elem(&dirty_slots, &key, &new_info, BPF_NOEXIST);
+        info = bpf_map_lookup_elem(&dirty_slots, &key);
+        if (!info)
+            return 0;
+    } else if (info->base_gfn != base_gfn || info->npages != npages) {
+        // 槽位号被复用或memslot被修改, 用户态据此重新分配位图空间
+        info->base_gfn = base_gfn;
+        info->npages = npages;
+    }
+    __sync_fetch_and_add(&info->marks, 1);
+
+    // 用户态尚未按当前的memslot分配位图空间时只计数
+    alloc = bpf_map_lookup_elem(&dirty_slot_allocs, &key);
+    if (!alloc || alloc->base_gfn != base_gfn || alloc->npages != npages)
+        return 0;
+    rel_gfn = gfn - base_gfn;
+    if (rel_gfn >= npages || rel_gfn / 64 >= alloc->nwords)
+        return 0;
+    idx = alloc->offset + (u32)(rel_gfn / 64);
+    word = bpf_map_lookup_elem(&dirty_bitmap, &idx);
+    if (word)
+        __sync_fetch_and_or(word, 1ULL << (rel_gfn & 63));
+    return 0;
+}
 #endif /* __KVM_VCPU_H */
@@ -194,13 +194,22 @@ struct exit_value {
 struct container_id{
     char container_id[20];
 };
-//记录进程系统调用的详细信息
+//槽位按代分配, 用户态读取一代后清空该代的槽位, 已退出的容器不会一直占用槽位
+struct container_slot_key {
+    struct container_id id;
+    __u32 gen;
+};
+#define CONTAINER_CTL_GEN 0              //当前写入的代
+#define CONTAINER_CTL_NEXT(gen) (1 + (gen))  //该代下一个空闲槽位
+//记录容器系统调用的统计信息, 按(代, 容器槽位, 系统调用号)索引
 #define MAX_SYSCALL_NUM 462
-struct syscall_value{
-    char container_id[20]; //容器ID
-    char proc_name[20]; //进程名
-    __u32 syscall_id_counts[MAX_SYSCALL_NUM];
-    __u64 syscall_total_delay[MAX_SYSCALL_NUM];
+#define CONTAINER_SLOTS 8
+#define CONTAINER_SYSCALL_ENTRIES (2 * CONTAINER_SLOTS * MAX_SYSCALL_NUM)
+#define CONTAINER_SYSCALL_INDEX(gen, slot, nr) \
+    (((gen) * CONTAINER_SLOTS + (slot)) * MAX_SYSCALL_NUM + (nr))
+struct container_syscall_stat {
+    __u64 count;
+    __u64 total_delay;  //单位us
 };
 struct dirty_page_info {
     __u64 gfn;
@@ -210,6 +219,56 @@ struct dirty_page_info {
     __u32 pid;
 };
 
+// 脏页速率模式: 每个memslot在dirty_bitmap中占用连续的一段, 每页1位
+#define DIRTY_BITMAP_WORDS (1 << 20)  // 默认可覆盖64M个页面(4KB页即256GB)
+#define DIRTY_WSS_WINDOW 10           // 工作集统计的滑动窗口(周期数)
+
+struct dirty_slot_key {
+    __u32 pid;
+    __u16 slot_id;
+    __u16 pad;
+};
+
+// 内核态记录的memslot, 槽位号被复用或memslot被修改时更新base_gfn和npages
+struct dirty_slot_info {
+    __u64 base_gfn;
+    __u64 npages;
+    __u64 marks;  // mark_page_dirty_in_slot调用次数
+};
+
+// 用户态为memslot分配的位图空间, 与dirty_slot_info中的base_gfn和npages
+// 一致时内核态才会置位, 否则只计数, 等待用户态重新分配
+struct dirty_slot_alloc {
+    __u64 base_gfn;
+    __u64 npages;
+    __u32 offset;  // 在dirty_bitmap中的起始下标(以u64为单位)
+    __u32 nwords;
+};
+
+// 聚合模式: 按(虚拟机pid, 事件类型, 原因)统计的log2延迟直方图
+#define LAT_HIST_SLOTS 32  // 以ns为单位, 最大约4.3s
+#define LAT_HIST_ENTRIES 16384
+
+enum lat_hist_kind {
+    HIST_KVM_EXIT,
+    HIST_USERSPACE_EXIT,
+    HIST_IRQ_INJECT,
+    HIST_IRQCHIP,
+};
+
+struct lat_hist_key {
+    __u32 pid;
+    __u16 kind;
+    __u16 pad;
+    __u32 reason;
+};
+
+struct lat_hist_value {
+    __u64 slots[LAT_HIST_SLOTS];
+    __u64 count;
+    __u64 total_ns;
+};
+
 struct hc_value {
     __u64 a0;
     __u64 a1;
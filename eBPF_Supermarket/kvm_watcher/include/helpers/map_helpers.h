@@ -0,0 +1,67 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+//
+// Helpers for draining BPF hash maps and reading array maps in batches.
+
+#ifndef __MAP_HELPERS_H
+#define __MAP_HELPERS_H
+
+#include <linux/types.h>
+#include <stddef.h>
+
+// 每次批量读取的初始元素个数
+#define MAP_BATCH_CHUNK 1024
+
+// 批量读取的结果, keys/values为连续数组, 按需扩容, 可在多次读取间复用
+struct map_batch {
+    void *keys;
+    void *values;
+    size_t key_size;
+    size_t value_size;
+    size_t count;
+    size_t capacity;
+};
+
+#define MAP_BATCH_KEY(batch, type, i) (&((type *)(batch)->keys)[i])
+#define MAP_BATCH_VALUE(batch, type, i) (&((type *)(batch)->values)[i])
+
+void map_batch__init(struct map_batch *batch, size_t key_size,
+                     size_t value_size);
+void map_batch__free(struct map_batch *batch);
+
+/*
+ * Read and delete every element of the map referenced by fd into batch,
+ * using BPF_MAP_LOOKUP_AND_DELETE_BATCH. Falls back to per-element
+ * get_next_key/lookup/delete on kernels without batch support.
+ * Returns the number of elements read or a negative errno.
+ */
+int lookup_and_delete_batch(int fd, struct map_batch *batch);
+
+// 排序已读取的元素, keys与values保持对应
+int map_batch__sort(struct map_batch *batch,
+                    int (*cmp)(const void *key_a, const void *key_b));
+
+/*
+ * Read count consecutive elements of an array map starting at index start
+ * into values, using BPF_MAP_LOOKUP_BATCH with per-element lookups as a
+ * fallback. For per-CPU maps value_size covers all possible CPUs.
+ * Returns 0 or a negative errno.
+ */
+int array_map_read_range(int fd, __u32 start, __u32 count, void *values,
+                         size_t value_size);
+
+// 将数组map中[start, start + count)区间的元素清零
+int array_map_zero_range(int fd, __u32 start, __u32 count, size_t value_size);
+
+#endif /* __MAP_HELPERS_H */
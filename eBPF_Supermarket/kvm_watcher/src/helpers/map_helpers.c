@@ -0,0 +1,239 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+//
+// Helpers for draining BPF hash maps and reading array maps in batches.
+
+#include <bpf/bpf.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "map_helpers.h"
+
+#ifndef ENOTSUPP
+#define ENOTSUPP 524
+#endif
+
+void map_batch__init(struct map_batch *batch, size_t key_size,
+                     size_t value_size) {
+    memset(batch, 0, sizeof(*batch));
+    batch->key_size = key_size;
+    batch->value_size = value_size;
+}
+
+void map_batch__free(struct map_batch *batch) {
+    free(batch->keys);
+    free(batch->values);
+    batch->keys = NULL;
+    batch->values = NULL;
+    batch->count = 0;
+    batch->capacity = 0;
+}
+
+static int map_batch__reserve(struct map_batch *batch, size_t need) {
+    size_t capacity = batch->capacity ? batch->capacity : MAP_BATCH_CHUNK;
+    void *keys, *values;
+
+    if (batch->count + need <= batch->capacity)
+        return 0;
+    while (capacity < batch->count + need)
+        capacity *= 2;
+
+    keys = realloc(batch->keys, capacity * batch->key_size);
+    if (!keys)
+        return -ENOMEM;
+    batch->keys = keys;
+    values = realloc(batch->values, capacity * batch->value_size);
+    if (!values)
+        return -ENOMEM;
+    batch->values = values;
+    batch->capacity = capacity;
+    return 0;
+}
+
+// 内核不支持批量操作时逐个读取并删除
+static int lookup_and_delete_slow(int fd, struct map_batch *batch) {
+    char *key, *value;
+    int err;
+
+    for (;;) {
+        err = map_batch__reserve(batch, 1);
+        if (err)
+            return err;
+        key = (char *)batch->keys + batch->count * batch->key_size;
+        value = (char *)batch->values + batch->count * batch->value_size;
+        if (bpf_map_get_next_key(fd, NULL, key))
+            break;
+        if (bpf_map_lookup_elem(fd, key, value) == 0)
+            batch->count++;
+        if (bpf_map_delete_elem(fd, key) && errno != ENOENT)
+            return -errno;
+    }
+    return errno == ENOENT ? 0 : -errno;
+}
+
+int lookup_and_delete_batch(int fd, struct map_batch *batch) {
+    // hash map的批量游标是桶下标, 其余类型为key, 取两者的较大值
+    size_t token_size = batch->key_size > sizeof(__u64) ? batch->key_size
+                                                       : sizeof(__u64);
+    void *in = NULL, *out, *tokens;
+    size_t chunk = MAP_BATCH_CHUNK;
+    __u32 n;
+    int err = 0;
+    LIBBPF_OPTS(bpf_map_batch_opts, opts);
+
+    batch->count = 0;
+    tokens = calloc(2, token_size);
+    if (!tokens)
+        return -ENOMEM;
+    out = tokens;
+
+    for (;;) {
+        err = map_batch__reserve(batch, chunk);
+        if (err)
+            break;
+        n = batch->capacity - batch->count;
+        err = bpf_map_lookup_and_delete_batch(
+            fd, in, out, (char *)batch->keys + batch->count * batch->key_size,
+            (char *)batch->values + batch->count * batch->value_size, &n,
+            &opts);
+        err = err ? -errno : 0;
+        if (err == -ENOSPC) {
+            // 单个桶的元素数超过剩余空间, 扩容后重试
+            chunk = (batch->capacity - batch->count) * 2;
+            continue;
+        }
+        if (err && err != -ENOENT) {
+            if (!batch->count && !in &&
+                (err == -EINVAL || err == -ENOTSUPP || err == -EOPNOTSUPP))
+                err = lookup_and_delete_slow(fd, batch);
+            break;
+        }
+        batch->count += n;
+        if (err == -ENOENT) {
+            err = 0;
+            break;
+        }
+        // 下一轮以本轮的输出游标作为输入
+        in = out;
+        out = (char *)tokens + (out == tokens ? token_size : 0);
+    }
+    free(tokens);
+    return err < 0 ? err : (int)batch->count;
+}
+
+int map_batch__sort(struct map_batch *batch,
+                    int (*cmp)(const void *key_a, const void *key_b)) {
+    // key位于每条记录的起始位置, 因此cmp可直接用于记录
+    size_t rec_size = batch->key_size + batch->value_size;
+    char *recs, *rec;
+    size_t i;
+
+    if (batch->count < 2)
+        return 0;
+    recs = malloc(batch->count * rec_size);
+    if (!recs)
+        return -ENOMEM;
+    for (i = 0, rec = recs; i < batch->count; i++, rec += rec_size) {
+        memcpy(rec, (char *)batch->keys + i * batch->key_size,
+               batch->key_size);
+        memcpy(rec + batch->key_size,
+               (char *)batch->values + i * batch->value_size,
+               batch->value_size);
+    }
+    qsort(recs, batch->count, rec_size, cmp);
+    for (i = 0, rec = recs; i < batch->count; i++, rec += rec_size) {
+        memcpy((char *)batch->keys + i * batch->key_size, rec,
+               batch->key_size);
+        memcpy((char *)batch->values + i * batch->value_size,
+               rec + batch->key_size, batch->value_size);
+    }
+    free(recs);
+    return 0;
+}
+
+static __u32 *array_map_keys(__u32 start, __u32 count) {
+    __u32 *keys = malloc(count * sizeof(*keys));
+    if (!keys)
+        return NULL;
+    for (__u32 i = 0; i < count; i++)
+        keys[i] = start + i;
+    return keys;
+}
+
+static bool batch_unsupported(int err) {
+    return err == -EINVAL || err == -ENOTSUPP || err == -EOPNOTSUPP;
+}
+
+int array_map_read_range(int fd, __u32 start, __u32 count, void *values,
+                         size_t value_size) {
+    // 数组map的批量游标为下标, 从游标的下一个元素开始读取
+    __u32 in = start - 1, out, done = 0, n;
+    __u32 *keys;
+    int err = 0;
+    LIBBPF_OPTS(bpf_map_batch_opts, opts);
+
+    keys = malloc(count * sizeof(*keys));
+    if (!keys)
+        return -ENOMEM;
+    while (done < count) {
+        n = count - done;
+        err = bpf_map_lookup_batch(fd, start + done ? &in : NULL, &out,
+                                   keys + done,
+                                   (char *)values + done * value_size, &n,
+                                   &opts);
+        err = err ? -errno : 0;
+        if (err && err != -ENOENT)
+            break;
+        done += n;
+        if (err == -ENOENT || !n)
+            break;
+        in = out;
+    }
+    free(keys);
+    if (err == -ENOENT)
+        err = done == count ? 0 : -ENOENT;
+    if (err && !done && batch_unsupported(err)) {
+        err = 0;
+        for (__u32 i = 0; i < count && !err; i++) {
+            __u32 key = start + i;
+            if (bpf_map_lookup_elem(fd, &key, (char *)values + i * value_size))
+                err = -errno;
+        }
+    }
+    return err;
+}
+
+int array_map_zero_range(int fd, __u32 start, __u32 count, size_t value_size) {
+    __u32 *keys = array_map_keys(start, count);
+    void *zero = calloc(count, value_size);
+    __u32 n = count;
+    int err = -ENOMEM;
+    LIBBPF_OPTS(bpf_map_batch_opts, opts);
+
+    if (!keys || !zero)
+        goto out;
+    err = bpf_map_update_batch(fd, keys, zero, &n, &opts) ? -errno : 0;
+    if (err && batch_unsupported(err)) {
+        err = 0;
+        for (__u32 i = 0; i < count && !err; i++) {
+            if (bpf_map_update_elem(fd, &keys[i], zero, BPF_ANY))
+                err = -errno;
+        }
+    }
+out:
+    free(keys);
+    free(zero);
+    return err;
+}
@@ -33,6 +33,7 @@ char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
 const volatile pid_t vm_pid = -1;
 const volatile char hostname[13] = "";
+const volatile bool dirty_rate = false;
 static struct common_event *e;
 
 // 定义环形缓冲区maps
@@ -105,6 +106,8 @@ SEC("fentry/mark_page_dirty_in_slot")
 int BPF_PROG(fentry_mark_page_dirty_in_slot, struct kvm *kvm,
              const struct kvm_memory_slot *memslot, gfn_t gfn) {
     CHECK_PID(vm_pid);
+    if (dirty_rate)
+        return trace_dirty_page_rate(memslot, gfn);
     return trace_mark_page_dirty_in_slot(kvm, memslot, gfn, &rb, e);
 }
 
@@ -112,6 +115,8 @@ SEC("kprobe/mark_page_dirty_in_slot")
 int BPF_KPROBE(kp_mark_page_dirty_in_slot, struct kvm *kvm,
                const struct kvm_memory_slot *memslot, gfn_t gfn) {
     CHECK_PID(vm_pid);
+    if (dirty_rate)
+        return trace_dirty_page_rate(memslot, gfn);
     return trace_mark_page_dirty_in_slot(kvm, memslot, gfn, &rb, e);
 }
 
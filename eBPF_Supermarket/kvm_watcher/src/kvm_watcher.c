@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <time.h>
@@ -30,6 +31,7 @@
 #include "common.h"
 #include "trace_helpers.h"
 #include "uprobe_helpers.h"
+#include "map_helpers.h"
 #include "kvm_watcher.skel.h"
 
 
@@ -250,7 +252,9 @@ struct KeyValPair {
 
 // 比较函数，用于排序
 int compare(const void *a, const void *b) {
-    return (((struct KeyValPair *)b)->value - ((struct KeyValPair *)a)->value);
+    unsigned int x = ((struct KeyValPair *)a)->value;
+    unsigned int y = ((struct KeyValPair *)b)->value;
+    return x == y ? 0 : (x < y ? 1 : -1);
 }
 
 // 保存脏页信息到文件
@@ -262,41 +266,30 @@ int save_count_dirtypagemap_to_file(struct bpf_map *map) {
         return 1;
     }
     int count_dirty_fd = bpf_map__fd(map);
-    struct dirty_page_info lookup_key = {};
-    struct dirty_page_info next_key = {};
-    unsigned int dirty_counts;
+    struct map_batch batch;
+    map_batch__init(&batch, sizeof(struct dirty_page_info),
+                    sizeof(unsigned int));
+    int count = lookup_and_delete_batch(count_dirty_fd, &batch);
+    if (count < 0) {
+        fprintf(stderr, "failed to drain dirty page map: %d\n", count);
+        fclose(output);
+        map_batch__free(&batch);
+        return -1;
+    }
 
     // 保存键值对到数组
-    struct KeyValPair *pairs = NULL;
-    size_t size = 0;
-
-    while (!bpf_map_get_next_key(count_dirty_fd, &lookup_key, &next_key)) {
-        int err = bpf_map_lookup_elem(count_dirty_fd, &next_key, &dirty_counts);
-        if (err < 0) {
-            fprintf(stderr, "failed to lookup dirty page: %d\n", err);
-            fclose(output);
-            free(pairs);
-            return -1;
-        }
-
-        // 保存到数组
-        pairs = realloc(pairs, (size + 1) * sizeof(struct KeyValPair));
-        pairs[size].key = next_key;
-        pairs[size].value = dirty_counts;
-        size++;
-
-        // 删除元素
-        err = bpf_map_delete_elem(count_dirty_fd, &next_key);
-        if (err < 0) {
-            fprintf(stderr, "failed to cleanup dirty page: %d\n", err);
-            fclose(output);
-            free(pairs);
-            return -1;
-        }
-
-        // 更新 lookup_key
-        lookup_key = next_key;
+    size_t size = count;
+    struct KeyValPair *pairs = calloc(size ? size : 1, sizeof(*pairs));
+    if (!pairs) {
+        fclose(output);
+        map_batch__free(&batch);
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        pairs[i].key = *MAP_BATCH_KEY(&batch, struct dirty_page_info, i);
+        pairs[i].value = *MAP_BATCH_VALUE(&batch, unsigned int, i);
     }
+    map_batch__free(&batch);
 
     // 对数组进行排序
     qsort(pairs, size, sizeof(struct KeyValPair), compare);
@@ -321,6 +314,8 @@ static struct env {
     bool execute_vcpu_load;
     bool execute_halt_poll_ns;
     bool execute_mark_page_dirty;
+    bool dirty_rate;
+    bool aggregate;
     bool execute_page_fault;
     bool mmio_page_fault;
     bool execute_irqchip;
@@ -341,6 +336,8 @@ static struct env {
     .execute_exit = false,
     .execute_halt_poll_ns = false,
     .execute_mark_page_dirty = false,
+    .dirty_rate = false,
+    .aggregate = false,
     .execute_page_fault = false,
     .execute_irqchip = false,
     .execute_irq_inject = false,
@@ -373,6 +370,9 @@ static const struct argp_option opts[] = {
      "Monitoring the variation in vCPU halt-polling time."},
     {"mark_page_dirty", 'd', NULL, 0,
      "Monitor virtual machine dirty page information."},
+    {"dirty_rate", 'r', NULL, 0,
+     "Report dirty page rate and writable working set size per VM.(The -d "
+     "option must be specified.)"},
     {"kvmmmu_page_fault", 'f', NULL, 0,
      "Monitoring the data of kvmmmu page fault."},
     {"kvm_irqchip", 'c', NULL, 0,
@@ -383,6 +383,9 @@ static const struct argp_option opts[] = {
     {"mmio", 'm', NULL, 0,
      "Monitoring the data of mmio page fault.(The -f option must be "
      "specified.)"},
+    {"aggregate", 'g', NULL, 0,
+     "Aggregate latency into per-VM log2 histograms instead of per-event "
+     "output.(The -e, -i or -c option must be specified.)"},
     {"vm_pid", 'p', "PID", 0, "Specify the virtual machine pid to monitor."},
     {"show", 's', NULL, 0, "Visual display"},
     {"monitoring_time", 't', "SEC", 0, "Time for monitoring."},
@@ -450,6 +453,24 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
         case 'T':
             SET_OPTION_AND_CHECK_USAGE(option_selected, env.execute_timer);
             break;
+        case 'g':
+            // 超级调用没有延迟可以聚合, 不与-h组合
+            if (env.execute_exit || env.execute_irq_inject ||
+                env.execute_irqchip) {
+                env.aggregate = true;
+            } else {
+                fprintf(stderr, "The -e, -i or -c option must be specified.\n");
+                argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
+            }
+            break;
+        case 'r':
+            if (env.execute_mark_page_dirty) {
+                env.dirty_rate = true;
+            } else {
+                fprintf(stderr, "The -d option must be specified.\n");
+                argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
+            }
+            break;
         case 'm':
             if (env.execute_page_fault) {
                 env.mmio_page_fault = true;
@@ -777,6 +798,10 @@ static int print_event_head(struct env *env) {
         // 处理无效参数，可以选择抛出错误或返回
         return 1;
     }
+    if (env->aggregate) {
+        printf("Aggregating latency histograms ... \n");
+        return 0;
+    }
     switch (env->event_type) {
         case VCPU_WAKEUP:
             printf("%-18s %-20s %-15s %-15s %-10s %-10s %-10s\n", "TIME(ms)",
@@ -803,6 +828,10 @@ static int print_event_head(struct env *env) {
                    "COMM", "PID/TID", "TYPE", "VCPU_ID", "OLD(ns)", "NEW(ns)");
             break;
         case MARK_PAGE_DIRTY:
+            if (env->dirty_rate) {
+                printf("Waiting dirty page rate ... \n");
+                break;
+            }
             printf("%-18s %-15s %-15s %-10s %-10s %-10s %-10s %-10s\n",
                    "TIME(ms)", "COMM", "PID/TID", "GFN", "REL_GFN", "NPAGES",
                    "USERSPACE_ADDR", "SLOT_ID");
@@ -957,147 +986,143 @@ const char *getCurrentTimeFormatted() {
     return ts;  // 返回指向静态字符串的指针
 }
 
+// 各统计map每个周期批量读取并清空, 结果缓存在可复用的数组中
+static struct map_batch exit_batch, userspace_exit_batch, hc_batch,
+    hc_count_batch, timer_batch, load_batch;
+
+static void init_map_batches(void) {
+    map_batch__init(&exit_batch, sizeof(struct exit_key),
+                    sizeof(struct exit_value));
+    map_batch__init(&userspace_exit_batch, sizeof(struct exit_key),
+                    sizeof(struct exit_value));
+    map_batch__init(&hc_batch, sizeof(struct hc_key), sizeof(struct hc_value));
+    map_batch__init(&hc_count_batch, sizeof(struct hc_key), sizeof(__u32));
+    map_batch__init(&timer_batch, sizeof(struct timer_key),
+                    sizeof(struct timer_value));
+    map_batch__init(&load_batch, sizeof(struct load_key),
+                    sizeof(struct load_value));
+}
+
+static void free_map_batches(void) {
+    map_batch__free(&exit_batch);
+    map_batch__free(&userspace_exit_batch);
+    map_batch__free(&hc_batch);
+    map_batch__free(&hc_count_batch);
+    map_batch__free(&timer_batch);
+    map_batch__free(&load_batch);
+}
+
+#define CMP_FIELD(a, b, field)                      \
+    do {                                            \
+        if ((a)->field != (b)->field)               \
+            return (a)->field < (b)->field ? -1 : 1; \
+    } while (0)
+
 // In order to sort vm_exit maps
-int sort_by_key(int fd, struct exit_key *keys, struct exit_value *values) {
-    int err = 0;
-    struct exit_key lookup_key = {};
-    struct exit_key next_key = {};
-    struct exit_value exit_value;
-    int i = 0, j = 0, count = 0;
-    while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-        j = i - 1;
-        struct exit_key temp_key = next_key;
-        err = bpf_map_lookup_elem(fd, &next_key, &exit_value);
-        if (err < 0) {
-            fprintf(stderr, "failed to lookup exit_value: %d\n", err);
-            return -1;
-        }
-        struct exit_value temp_value = exit_value;
-        while (j >= 0 &&
-               (keys[j].pid > temp_key.pid || (keys[j].tid > temp_key.tid))) {
-            keys[j + 1] = keys[j];
-            values[j + 1] = values[j];
-            j--;
-        }
-        keys[j + 1] = temp_key;
-        values[j + 1] = temp_value;
-        lookup_key = next_key;
-        count++;
-        i++;
-    }
-    return count;
+static int cmp_exit_key(const void *a, const void *b) {
+    const struct exit_key *x = a, *y = b;
+    CMP_FIELD(x, y, pid);
+    CMP_FIELD(x, y, tid);
+    CMP_FIELD(x, y, reason);
+    return 0;
 }
 
-// clear the specific map
-int clear_map(void *lookup_key, void *next_key, enum EventType type, int fd) {
-    int err;
-    switch (type) {
-        case HYPERCALL:
-            memset(lookup_key, 0, sizeof(struct hc_key));
-            break;
-        case TIMER:
-            memset(lookup_key, 0, sizeof(struct timer_key));
-            break;
-        case VCPU_LOAD:
-            memset(lookup_key, 0, sizeof(struct load_key));
-            break;
-        case EXIT:
-            memset(lookup_key, 0, sizeof(struct exit_key));
-            break;
-        default:
-            return -1;
+static int cmp_hc_key(const void *a, const void *b) {
+    const struct hc_key *x = a, *y = b;
+    CMP_FIELD(x, y, pid);
+    CMP_FIELD(x, y, vcpu_id);
+    CMP_FIELD(x, y, nr);
+    return 0;
+}
+
+static int cmp_timer_key(const void *a, const void *b) {
+    const struct timer_key *x = a, *y = b;
+    CMP_FIELD(x, y, pid);
+    CMP_FIELD(x, y, timer_mode);
+    CMP_FIELD(x, y, hv);
+    return 0;
+}
+
+static int cmp_load_key(const void *a, const void *b) {
+    const struct load_key *x = a, *y = b;
+    CMP_FIELD(x, y, pid);
+    CMP_FIELD(x, y, tid);
+    return 0;
+}
+
+// 批量读取并清空map, 再按key排序
+static int drain_sorted(int fd, struct map_batch *batch,
+                        int (*cmp)(const void *, const void *),
+                        const char *map_name) {
+    int count = lookup_and_delete_batch(fd, batch);
+    if (count < 0) {
+        fprintf(stderr, "failed to drain %s map: %d\n", map_name, count);
+        return count;
     }
-    while (!bpf_map_get_next_key(fd, lookup_key, next_key)) {
-        err = bpf_map_delete_elem(fd, next_key);
-        if (err < 0) {
-            fprintf(stderr, "failed to cleanup map: %d\n", err);
-            return -1;
-        }
-        lookup_key = next_key;
+    if (cmp && map_batch__sort(batch, cmp) < 0) {
+        fprintf(stderr, "failed to sort %s map\n", map_name);
+        return -ENOMEM;
     }
-    return 1;
+    return count;
 }
 
 int print_hc_map(struct kvm_watcher_bpf *skel) {
     int fd = bpf_map__fd(skel->maps.hc_map);
     int count_fd = bpf_map__fd(skel->maps.hc_count);
-    int err;
-    struct hc_key lookup_key = {};
-    struct hc_key next_key = {};
-    struct hc_value hc_value = {};
-    int first_run = 1;
-    
-    // Iterate over the map
-    while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-        if (first_run) {
-            first_run = 0;
-            printf(
-                "--------------------------------------------------------------"
-                "----------"
-                "\n");
-            printf("TIME:%s\n", getCurrentTimeFormatted());
-            printf("%-12s %-12s %-12s %-12s %-12s\n", "PID", "VCPU_ID", "NAME",
-                   "COUNTS", "HYPERCALLS");
-        }
-        // Print the current entry
-        err = bpf_map_lookup_elem(fd, &next_key, &hc_value);
-        if (err < 0) {
-            fprintf(stderr, "failed to lookup hc_value: %d\n", err);
-            return -1;
-        }
-        printf("%-12d %-12d %-12s %-12d %-12lld\n", next_key.pid,
-               next_key.vcpu_id, getName(next_key.nr, HYPERCALL_NR),
-               hc_value.counts, hc_value.hypercalls);
-        // // Move to the next key
-        lookup_key = next_key;
+    int count = drain_sorted(fd, &hc_batch, cmp_hc_key, "hc");
+    if (count < 0)
+        return -1;
+    if (count > 0) {
+        printf(
+            "--------------------------------------------------------------"
+            "----------"
+            "\n");
+        printf("TIME:%s\n", getCurrentTimeFormatted());
+        printf("%-12s %-12s %-12s %-12s %-12s\n", "PID", "VCPU_ID", "NAME",
+               "COUNTS", "HYPERCALLS");
     }
-    clear_map(&lookup_key, &next_key, HYPERCALL, fd);
-    clear_map(&lookup_key, &next_key, HYPERCALL, count_fd);
+    for (int i = 0; i < count; i++) {
+        struct hc_key *key = MAP_BATCH_KEY(&hc_batch, struct hc_key, i);
+        struct hc_value *hc_value =
+            MAP_BATCH_VALUE(&hc_batch, struct hc_value, i);
+        printf("%-12d %-12d %-12s %-12d %-12lld\n", key->pid, key->vcpu_id,
+               getName(key->nr, HYPERCALL_NR), hc_value->counts,
+               hc_value->hypercalls);
+    }
+    drain_sorted(count_fd, &hc_count_batch, NULL, "hc_count");
     return 0;
 }
 
 int print_timer_map(struct kvm_watcher_bpf *skel) {
     int fd = bpf_map__fd(skel->maps.timer_map);
-    int err;
-    struct timer_key lookup_key = {};
-    struct timer_key next_key = {};
-    struct timer_value timer_value = {};
-    int first_run = 1;
-
-    // Iterate over the map
-    while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-        if (first_run) {
-            first_run = 0;
-            printf(
-                "--------------------------------------------------------------"
-                "----------\n");
-            printf("TIME:%s\n", getCurrentTimeFormatted());
-            printf("%-12s %-12s %-12s %-12s\n", "PID", "TIMER_MODE", "HV",
-                   "COUNTS");
-        }
-        // Print the current entry
-        err = bpf_map_lookup_elem(fd, &next_key, &timer_value);
-        if (err < 0) {
-            fprintf(stderr, "failed to lookup timer_value: %d\n", err);
-            return -1;
-        }
-        printf("%-12d %-12s %-12d %-12u\n", next_key.pid,
-               getName(next_key.timer_mode, TIMER_MODE_NR), next_key.hv,
-               timer_value.counts);
-        // Move to the next key
-        lookup_key = next_key;
+    int count = drain_sorted(fd, &timer_batch, cmp_timer_key, "timer");
+    if (count < 0)
+        return -1;
+    if (count > 0) {
+        printf(
+            "--------------------------------------------------------------"
+            "----------\n");
+        printf("TIME:%s\n", getCurrentTimeFormatted());
+        printf("%-12s %-12s %-12s %-12s\n", "PID", "TIMER_MODE", "HV",
+               "COUNTS");
+    }
+    for (int i = 0; i < count; i++) {
+        struct timer_key *key =
+            MAP_BATCH_KEY(&timer_batch, struct timer_key, i);
+        struct timer_value *timer_value =
+            MAP_BATCH_VALUE(&timer_batch, struct timer_value, i);
+        printf("%-12d %-12s %-12d %-12u\n", key->pid,
+               getName(key->timer_mode, TIMER_MODE_NR), key->hv,
+               timer_value->counts);
     }
-    clear_map(&lookup_key, &next_key, TIMER, fd);
     return 0;
 }
 
 int print_vcpu_load_map(struct kvm_watcher_bpf *skel) {
     int fd = bpf_map__fd(skel->maps.load_map);
-    int err;
-    struct load_key lookup_key = {};
-    struct load_key next_key = {};
-    struct load_value load_value = {};
-    int first = 1;
+    int count = drain_sorted(fd, &load_batch, cmp_load_key, "vcpu_load");
+    if (count < 0)
+        return -1;
     if (env.show) {
         if (is_first) {
             printf("%-12s %-12s %-12s %-12s %-12s %-12s %-12s %-12s\n", "pid",
@@ -1105,62 +1130,38 @@ int print_vcpu_load_map(struct kvm_watcher_bpf *skel) {
                    "vcpuid", "pcpuid");
             is_first = 0;
         }
-        while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-            err = bpf_map_lookup_elem(fd, &next_key, &load_value);
-            if (err < 0) {
-                fprintf(stderr, "failed to lookup vcpu_load_value: %d\n", err);
-                return -1;
-            }
-            printf("%-12d %-12d %-12.4f %-12.4f %-12.4f %-12u %-12d %-12d\n",
-                   next_key.pid, next_key.tid,
-                   NS_TO_MS_WITH_DECIMAL(load_value.total_time),
-                   NS_TO_MS_WITH_DECIMAL(load_value.max_time),
-                   NS_TO_MS_WITH_DECIMAL(load_value.min_time), load_value.count,
-                   load_value.vcpu_id, load_value.pcpu_id);
-
-            lookup_key = next_key;
-        }
-
     } else {
-        if (first) {
-            first = 0;
-            printf("\nTIME:%s\n", getCurrentTimeFormatted());
-            printf("%-12s %-12s %-12s %-12s %-12s %-12s %-12s %-12s\n", "pid",
-                   "tid", "total_time", "max_time", "min_time", "counts",
-                   "vcpuid", "pcpuid");
-            printf(
-                "------------ ------------ ------------ ------------ "
-                "------------ "
-                "------------ "
-                "------------ "
-                "------------\n");
-        }
-        while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-            err = bpf_map_lookup_elem(fd, &next_key, &load_value);
-            if (err < 0) {
-                fprintf(stderr, "failed to lookup vcpu_load_value: %d\n", err);
-                return -1;
-            }
-            printf("%-12d %-12d %-12.4f %-12.4f %-12.4f %-12u %-12d %-12d\n",
-                   next_key.pid, next_key.tid,
-                   NS_TO_MS_WITH_DECIMAL(load_value.total_time),
-                   NS_TO_MS_WITH_DECIMAL(load_value.max_time),
-                   NS_TO_MS_WITH_DECIMAL(load_value.min_time), load_value.count,
-                   load_value.vcpu_id, load_value.pcpu_id);
-            lookup_key = next_key;
-        }
+        printf("\nTIME:%s\n", getCurrentTimeFormatted());
+        printf("%-12s %-12s %-12s %-12s %-12s %-12s %-12s %-12s\n", "pid",
+               "tid", "total_time", "max_time", "min_time", "counts", "vcpuid",
+               "pcpuid");
+        printf(
+            "------------ ------------ ------------ ------------ "
+            "------------ "
+            "------------ "
+            "------------ "
+            "------------\n");
+    }
+    for (int i = 0; i < count; i++) {
+        struct load_key *key = MAP_BATCH_KEY(&load_batch, struct load_key, i);
+        struct load_value *load_value =
+            MAP_BATCH_VALUE(&load_batch, struct load_value, i);
+        printf("%-12d %-12d %-12.4f %-12.4f %-12.4f %-12u %-12d %-12d\n",
+               key->pid, key->tid,
+               NS_TO_MS_WITH_DECIMAL(load_value->total_time),
+               NS_TO_MS_WITH_DECIMAL(load_value->max_time),
+               NS_TO_MS_WITH_DECIMAL(load_value->min_time), load_value->count,
+               load_value->vcpu_id, load_value->pcpu_id);
     }
-    clear_map(&lookup_key, &next_key, VCPU_LOAD, fd);
     return 0;
 }
 
-void __print_exit_map(int fd, enum NameType name_type) {
-    struct exit_key lookup_key = {};
-    struct exit_key next_key = {};
+void __print_exit_map(int fd, struct map_batch *batch,
+                      enum NameType name_type) {
     int first_run = 1;
-    struct exit_key keys[8192];
-    struct exit_value values[8192];
-    int count = sort_by_key(fd, keys, values);
+    int count = drain_sorted(fd, batch, cmp_exit_key, "exit");
+    struct exit_key *keys = batch->keys;
+    struct exit_value *values = batch->values;
     // Iterate over the array
     __u32 pid = 0;
     __u32 tid = 0;
@@ -1228,16 +1229,506 @@ void __print_exit_map(int fd, enum NameType name_type) {
             }
         }
     }
-    clear_map(&lookup_key, &next_key, EXIT, fd);
 }
 int print_exit_map(struct kvm_watcher_bpf *skel) {
     int exit_fd = bpf_map__fd(skel->maps.exit_map);
     int userspace_exit_fd = bpf_map__fd(skel->maps.userspace_exit_map);
     // printf("\nTIME:%s\n", getCurrentTimeFormatted());
-    __print_exit_map(exit_fd, EXIT_NR);
-    __print_exit_map(userspace_exit_fd, EXIT_USERSPACE_NR);
+    __print_exit_map(exit_fd, &exit_batch, EXIT_NR);
+    __print_exit_map(userspace_exit_fd, &userspace_exit_batch,
+                     EXIT_USERSPACE_NR);
+    return 0;
+}
+// 脏页速率模式下每个memslot在用户态的状态
+struct dirty_slot_state {
+    struct dirty_slot_key key;
+    struct dirty_slot_info info;
+    struct dirty_slot_alloc alloc;  // nwords为0表示没有位图空间, 仅计数
+    __u64 *windows;  // 最近DIRTY_WSS_WINDOW个周期各自的位图, 用于计算工作集
+    __u64 last_marks;
+    __u64 dirty;  // 本周期脏页数
+    __u64 wss;    // 滑动窗口内被写过的页数
+    bool seen;    // 本周期仍在dirty_slots中
+};
+
+// 位图中的一段空闲空间, 以u64为单位
+struct dirty_range {
+    __u32 offset;
+    __u32 nwords;
+};
+
+static struct {
+    __u64 *bitmap;  // mmap后的dirty_bitmap
+    size_t bitmap_size;
+    struct dirty_slot_state *slots;
+    size_t nr_slots;
+    struct dirty_range *free;  // 按offset升序排列且互不相邻
+    size_t nr_free;
+    // 本周期释放的空间, 内核态可能还有写者持有旧的分配, 下个周期才能重新分配
+    struct dirty_range *quarantine;
+    size_t nr_quarantine;
+    __u32 epoch;
+    struct timespec last;
+} dirty_rate_ctx;
+
+static int dirty_range_push(struct dirty_range **ranges, size_t *nr,
+                            size_t pos, struct dirty_range r) {
+    struct dirty_range *tmp = realloc(*ranges, (*nr + 1) * sizeof(r));
+    if (!tmp)
+        return -1;
+    memmove(&tmp[pos + 1], &tmp[pos], (*nr - pos) * sizeof(r));
+    tmp[pos] = r;
+    *ranges = tmp;
+    (*nr)++;
+    return 0;
+}
+
+// 归还到空闲链表, 与前后相邻的空闲段合并
+static void dirty_range_put(struct dirty_range r) {
+    struct dirty_range *f = dirty_rate_ctx.free;
+    size_t n = dirty_rate_ctx.nr_free, pos = 0;
+
+    while (pos < n && f[pos].offset < r.offset)
+        pos++;
+    if (pos > 0 && f[pos - 1].offset + f[pos - 1].nwords == r.offset) {
+        f[pos - 1].nwords += r.nwords;
+        if (pos < n && r.offset + r.nwords == f[pos].offset) {
+            f[pos - 1].nwords += f[pos].nwords;
+            memmove(&f[pos], &f[pos + 1], (n - pos - 1) * sizeof(*f));
+            dirty_rate_ctx.nr_free--;
+        }
+    } else if (pos < n && r.offset + r.nwords == f[pos].offset) {
+        f[pos].offset = r.offset;
+        f[pos].nwords += r.nwords;
+    } else if (dirty_range_push(&dirty_rate_ctx.free, &dirty_rate_ctx.nr_free,
+                                pos, r)) {
+        fprintf(stderr, "Failed to free dirty bitmap range\n");
+    }
+}
+
+// 首次适配, 空间不足时返回-1
+static int dirty_range_get(__u32 nwords, __u32 *offset) {
+    struct dirty_range *f = dirty_rate_ctx.free;
+    for (size_t i = 0; i < dirty_rate_ctx.nr_free; i++) {
+        if (f[i].nwords < nwords)
+            continue;
+        *offset = f[i].offset;
+        f[i].offset += nwords;
+        f[i].nwords -= nwords;
+        if (!f[i].nwords) {
+            memmove(&f[i], &f[i + 1],
+                    (dirty_rate_ctx.nr_free - i - 1) * sizeof(*f));
+            dirty_rate_ctx.nr_free--;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+static int dirty_rate_init(struct kvm_watcher_bpf *skel) {
+    int fd = bpf_map__fd(skel->maps.dirty_bitmap);
+    long page_size = sysconf(_SC_PAGESIZE);
+    __u32 words = bpf_map__max_entries(skel->maps.dirty_bitmap);
+    size_t size = (size_t)words * sizeof(__u64);
+    struct dirty_range all = {.offset = 0, .nwords = words};
+
+    dirty_rate_ctx.bitmap_size = (size + page_size - 1) / page_size * page_size;
+    dirty_rate_ctx.bitmap = mmap(NULL, dirty_rate_ctx.bitmap_size,
+                                 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (dirty_rate_ctx.bitmap == MAP_FAILED) {
+        dirty_rate_ctx.bitmap = NULL;
+        perror("Failed to mmap dirty bitmap");
+        return -errno;
+    }
+    if (dirty_range_push(&dirty_rate_ctx.free, &dirty_rate_ctx.nr_free, 0,
+                         all))
+        return -ENOMEM;
+    clock_gettime(CLOCK_MONOTONIC, &dirty_rate_ctx.last);
+    return 0;
+}
+
+static void dirty_rate_free(void) {
+    for (size_t i = 0; i < dirty_rate_ctx.nr_slots; i++)
+        free(dirty_rate_ctx.slots[i].windows);
+    free(dirty_rate_ctx.slots);
+    free(dirty_rate_ctx.free);
+    free(dirty_rate_ctx.quarantine);
+    if (dirty_rate_ctx.bitmap)
+        munmap(dirty_rate_ctx.bitmap, dirty_rate_ctx.bitmap_size);
+    memset(&dirty_rate_ctx, 0, sizeof(dirty_rate_ctx));
+}
+
+// 收回memslot的位图空间, 先删除内核态可见的分配记录再放入隔离区
+static void dirty_slot_release(struct dirty_slot_state *slot, int alloc_fd) {
+    struct dirty_range r = {.offset = slot->alloc.offset,
+                            .nwords = slot->alloc.nwords};
+    if (!r.nwords)
+        return;
+    bpf_map_delete_elem(alloc_fd, &slot->key);
+    if (dirty_range_push(&dirty_rate_ctx.quarantine,
+                         &dirty_rate_ctx.nr_quarantine,
+                         dirty_rate_ctx.nr_quarantine, r))
+        fprintf(stderr, "Failed to free dirty bitmap range\n");
+    free(slot->windows);
+    slot->windows = NULL;
+    memset(&slot->alloc, 0, sizeof(slot->alloc));
+}
+
+// 新出现的memslot或base_gfn/npages变化后的memslot, 按当前大小重新分配位图空间
+static void dirty_slot_alloc(struct dirty_slot_state *slot, int alloc_fd) {
+    struct dirty_slot_alloc alloc = {.base_gfn = slot->info.base_gfn,
+                                     .npages = slot->info.npages};
+    __u64 nwords = (slot->info.npages + 63) / 64;
+
+    if (slot->alloc.nwords && slot->alloc.base_gfn == alloc.base_gfn &&
+        slot->alloc.npages == alloc.npages)
+        return;
+    dirty_slot_release(slot, alloc_fd);
+    if (!nwords || nwords > UINT32_MAX)
+        return;
+    alloc.nwords = nwords;
+    if (dirty_range_get(alloc.nwords, &alloc.offset))
+        return;  // 位图空间不足, 该memslot仅计数
+    slot->windows = calloc((size_t)DIRTY_WSS_WINDOW * alloc.nwords,
+                           sizeof(__u64));
+    if (!slot->windows) {
+        dirty_range_put((struct dirty_range){alloc.offset, alloc.nwords});
+        return;
+    }
+    memset(dirty_rate_ctx.bitmap + alloc.offset, 0,
+           (size_t)alloc.nwords * sizeof(__u64));
+    if (bpf_map_update_elem(alloc_fd, &slot->key, &alloc, BPF_ANY)) {
+        free(slot->windows);
+        slot->windows = NULL;
+        dirty_range_put((struct dirty_range){alloc.offset, alloc.nwords});
+        return;
+    }
+    slot->alloc = alloc;
+}
+
+static struct dirty_slot_state *dirty_slot_get(
+    const struct dirty_slot_key *key, const struct dirty_slot_info *info) {
+    struct dirty_slot_state *slot, *slots;
+    for (size_t i = 0; i < dirty_rate_ctx.nr_slots; i++) {
+        slot = &dirty_rate_ctx.slots[i];
+        if (slot->key.pid == key->pid && slot->key.slot_id == key->slot_id)
+            goto found;
+    }
+    slots = realloc(dirty_rate_ctx.slots,
+                    (dirty_rate_ctx.nr_slots + 1) * sizeof(*slots));
+    if (!slots)
+        return NULL;
+    dirty_rate_ctx.slots = slots;
+    slot = &slots[dirty_rate_ctx.nr_slots++];
+    memset(slot, 0, sizeof(*slot));
+    slot->key = *key;
+found:
+    slot->info = *info;
+    slot->seen = true;
+    return slot;
+}
+
+// 取出并清零一个memslot的位图, 存为本周期的窗口, 与其余窗口按位或得到工作集,
+// 开销与memslot的位图字数成正比
+static void dirty_slot_scan(struct dirty_slot_state *slot, __u32 epoch) {
+    __u64 *words = dirty_rate_ctx.bitmap + slot->alloc.offset;
+    size_t nwords = slot->alloc.nwords;
+    __u64 *cur = slot->windows + (epoch % DIRTY_WSS_WINDOW) * nwords;
+    slot->dirty = 0;
+    slot->wss = 0;
+    if (!slot->windows)
+        return;
+    for (size_t w = 0; w < nwords; w++) {
+        __u64 bits = words[w] ? __atomic_exchange_n(&words[w], 0,
+                                                    __ATOMIC_RELAXED)
+                              : 0;
+        __u64 any = 0;
+        cur[w] = bits;
+        slot->dirty += __builtin_popcountll(bits);
+        for (int k = 0; k < DIRTY_WSS_WINDOW; k++)
+            any |= slot->windows[k * nwords + w];
+        slot->wss += __builtin_popcountll(any);
+    }
+}
+
+// 同步dirty_slots: 删除已退出虚拟机的记录, 回收消失的memslot的位图空间,
+// 为新的或被修改的memslot分配位图空间
+static int dirty_slots_sync(struct kvm_watcher_bpf *skel) {
+    int fd = bpf_map__fd(skel->maps.dirty_slots);
+    int alloc_fd = bpf_map__fd(skel->maps.dirty_slot_allocs);
+    struct dirty_slot_key key, next, *prev = NULL;
+    struct dirty_slot_info info;
+    size_t n = 0;
+
+    // 上个周期隔离的空间已不会再被旧的写者使用
+    for (size_t i = 0; i < dirty_rate_ctx.nr_quarantine; i++)
+        dirty_range_put(dirty_rate_ctx.quarantine[i]);
+    dirty_rate_ctx.nr_quarantine = 0;
+
+    for (size_t i = 0; i < dirty_rate_ctx.nr_slots; i++)
+        dirty_rate_ctx.slots[i].seen = false;
+    // memslot数目很少, 逐项读取即可
+    while (!bpf_map_get_next_key(fd, prev, &next)) {
+        key = next;
+        prev = &key;
+        if (kill(key.pid, 0) && errno == ESRCH) {
+            bpf_map_delete_elem(fd, &key);
+            continue;
+        }
+        if (!bpf_map_lookup_elem(fd, &key, &info) &&
+            !dirty_slot_get(&key, &info))
+            return -1;
+    }
+    for (size_t i = 0; i < dirty_rate_ctx.nr_slots; i++) {
+        struct dirty_slot_state *slot = &dirty_rate_ctx.slots[i];
+        if (!slot->seen) {
+            dirty_slot_release(slot, alloc_fd);
+            continue;
+        }
+        dirty_slot_alloc(slot, alloc_fd);
+        dirty_rate_ctx.slots[n++] = *slot;
+    }
+    dirty_rate_ctx.nr_slots = n;
+    return 0;
+}
+
+static int cmp_dirty_slot(const void *a, const void *b) {
+    const struct dirty_slot_state *x = a, *y = b;
+    CMP_FIELD(x, y, key.pid);
+    CMP_FIELD(x, y, key.slot_id);
     return 0;
 }
+
+#define PAGES_TO_MB(pages) ((double)(pages) * (1 << PAGE_SHIFT) / (1 << 20))
+
+int print_dirty_rate(struct kvm_watcher_bpf *skel) {
+    struct timespec now;
+    double interval;
+
+    if (!dirty_rate_ctx.bitmap || dirty_slots_sync(skel))
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    interval = (now.tv_sec - dirty_rate_ctx.last.tv_sec) +
+               (now.tv_nsec - dirty_rate_ctx.last.tv_nsec) / 1e9;
+    dirty_rate_ctx.last = now;
+    if (interval <= 0)
+        interval = 1;
+    dirty_rate_ctx.epoch++;
+
+    qsort(dirty_rate_ctx.slots, dirty_rate_ctx.nr_slots,
+          sizeof(struct dirty_slot_state), cmp_dirty_slot);
+    printf("\nTIME:%s  INTERVAL:%.2fs  WSS_WINDOW:%d intervals\n",
+           getCurrentTimeFormatted(), interval, DIRTY_WSS_WINDOW);
+    printf("%-10s %-8s %-12s %-14s %-12s %-12s %-12s %-12s\n", "PID", "SLOTS",
+           "DIRTY_PAGES", "RATE(pages/s)", "RATE(MB/s)", "WSS(pages)",
+           "WSS(MB)", "MARKS/s");
+    for (size_t i = 0; i < dirty_rate_ctx.nr_slots;) {
+        __u32 pid = dirty_rate_ctx.slots[i].key.pid;
+        __u64 dirty = 0, wss = 0, marks = 0;
+        int slots = 0;
+        for (; i < dirty_rate_ctx.nr_slots &&
+               dirty_rate_ctx.slots[i].key.pid == pid;
+             i++) {
+            struct dirty_slot_state *slot = &dirty_rate_ctx.slots[i];
+            dirty_slot_scan(slot, dirty_rate_ctx.epoch);
+            dirty += slot->dirty;
+            wss += slot->wss;
+            marks += slot->info.marks - slot->last_marks;
+            slot->last_marks = slot->info.marks;
+            slots++;
+        }
+        printf("%-10u %-8d %-12llu %-14.1f %-12.2f %-12llu %-12.2f %-12.1f\n",
+               pid, slots, dirty, dirty / interval,
+               PAGES_TO_MB(dirty) / interval, wss, PAGES_TO_MB(wss),
+               marks / interval);
+    }
+    return 0;
+}
+
+// 聚合模式: 汇总每CPU的直方图后按虚拟机输出
+#define LAT_HIST_TOP_VMS 10
+
+struct lat_hist_entry {
+    struct lat_hist_key key;
+    struct lat_hist_value value;
+};
+
+// 不同类型的延迟互相重叠(如中断注入发生在退出处理之中), 按类型分别统计占比
+struct vm_exit_share {
+    __u32 pid;
+    __u32 kind;
+    __u64 count;
+    __u64 total_ns;
+    __u64 slots[LAT_HIST_SLOTS];
+    const struct lat_hist_entry *top;  // 耗时最多的原因
+};
+
+static struct map_batch lat_hist_batch;
+
+static int cmp_lat_hist_entry(const void *a, const void *b) {
+    const struct lat_hist_entry *x = a, *y = b;
+    CMP_FIELD(x, y, key.kind);
+    CMP_FIELD(x, y, key.pid);
+    CMP_FIELD(x, y, key.reason);
+    return 0;
+}
+
+static int cmp_vm_share(const void *a, const void *b) {
+    const struct vm_exit_share *x = a, *y = b;
+    CMP_FIELD(x, y, kind);
+    if (x->total_ns != y->total_ns)
+        return x->total_ns < y->total_ns ? 1 : -1;
+    return 0;
+}
+
+// 取log2直方图中对应分位所在桶的上界(us)
+static double hist_percentile_us(const __u64 *slots, __u64 count,
+                                 double percentile) {
+    __u64 target = count * percentile, sum = 0;
+    for (int i = 0; i < LAT_HIST_SLOTS; i++) {
+        sum += slots[i];
+        if (sum > target)
+            return NS_TO_US_WITH_DECIMAL(1ULL << (i + 1));
+    }
+    return NS_TO_US_WITH_DECIMAL(1ULL << LAT_HIST_SLOTS);
+}
+
+static const char *lat_hist_reason(const struct lat_hist_key *key,
+                                   char *buf, size_t size) {
+    static const char *irqchips[] = {"PIC", "IOAPIC", "MSI"};
+    switch (key->kind) {
+        case HIST_KVM_EXIT:
+            return getName(key->reason, EXIT_NR);
+        case HIST_USERSPACE_EXIT:
+            return getName(key->reason, EXIT_USERSPACE_NR);
+        case HIST_IRQCHIP:
+            if (key->reason < sizeof(irqchips) / sizeof(irqchips[0]))
+                return irqchips[key->reason];
+            break;
+        default:
+            break;
+    }
+    snprintf(buf, size, "%#x", key->reason);
+    return buf;
+}
+
+int print_lat_hist(struct kvm_watcher_bpf *skel) {
+    static const char *kinds[] = {"KVM_EXIT", "USER_EXIT", "IRQ_INJECT",
+                                  "IRQCHIP"};
+    int fd = bpf_map__fd(skel->maps.lat_hist);
+    int ncpus = libbpf_num_possible_cpus();
+    struct lat_hist_entry *entries = NULL;
+    struct vm_exit_share *vms = NULL;
+    size_t nr_vms = 0;
+    __u64 all_ns[sizeof(kinds) / sizeof(kinds[0])] = {};
+    char buf[16];
+    int count;
+
+    if (ncpus <= 0)
+        return -1;
+    if (!lat_hist_batch.key_size)
+        map_batch__init(&lat_hist_batch, sizeof(struct lat_hist_key),
+                        sizeof(struct lat_hist_value) * ncpus);
+    count = lookup_and_delete_batch(fd, &lat_hist_batch);
+    if (count <= 0)
+        return count;
+
+    entries = calloc(count, sizeof(*entries));
+    vms = calloc(count, sizeof(*vms));
+    if (!entries || !vms) {
+        free(entries);
+        free(vms);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        struct lat_hist_value *percpu = MAP_BATCH_VALUE(
+            &lat_hist_batch, struct lat_hist_value, (size_t)i * ncpus);
+        entries[i].key = *MAP_BATCH_KEY(&lat_hist_batch, struct lat_hist_key, i);
+        for (int cpu = 0; cpu < ncpus; cpu++) {
+            for (int j = 0; j < LAT_HIST_SLOTS; j++)
+                entries[i].value.slots[j] += percpu[cpu].slots[j];
+            entries[i].value.count += percpu[cpu].count;
+            entries[i].value.total_ns += percpu[cpu].total_ns;
+        }
+    }
+    qsort(entries, count, sizeof(*entries), cmp_lat_hist_entry);
+
+    // 按(类型, 虚拟机)合并, 计算各虚拟机占同类型全部耗时的比例
+    for (int i = 0; i < count; i++) {
+        struct lat_hist_entry *entry = &entries[i];
+        struct vm_exit_share *vm;
+        if (entry->key.kind >= sizeof(kinds) / sizeof(kinds[0]))
+            continue;
+        if (!nr_vms || vms[nr_vms - 1].pid != entry->key.pid ||
+            vms[nr_vms - 1].kind != entry->key.kind) {
+            vms[nr_vms].pid = entry->key.pid;
+            vms[nr_vms].kind = entry->key.kind;
+            nr_vms++;
+        }
+        vm = &vms[nr_vms - 1];
+        vm->count += entry->value.count;
+        vm->total_ns += entry->value.total_ns;
+        for (int j = 0; j < LAT_HIST_SLOTS; j++)
+            vm->slots[j] += entry->value.slots[j];
+        if (!vm->top || entry->value.total_ns > vm->top->value.total_ns)
+            vm->top = entry;
+        all_ns[entry->key.kind] += entry->value.total_ns;
+    }
+    qsort(vms, nr_vms, sizeof(*vms), cmp_vm_share);
+
+    printf("\nTIME:%s\n", getCurrentTimeFormatted());
+    for (size_t i = 0, rank = 0; i < nr_vms; i++, rank++) {
+        struct vm_exit_share *vm = &vms[i];
+        if (!i || vm->kind != vms[i - 1].kind) {
+            printf("%-6s %-10s %-11s %-12s %-14s %-10s %-10s %-10s %-10s "
+                   "%s\n",
+                   "RANK", "PID", "TYPE", "EVENTS", "TOTAL(ms)", "SHARE(%)",
+                   "AVG(us)", "P50(us)", "P99(us)", "TOP_REASON");
+            rank = 0;
+        }
+        printf("%-6zu %-10u %-11s %-12llu %-14.4f %-10.2f %-10.2f %-10.2f "
+               "%-10.2f %s\n",
+               rank + 1, vm->pid, kinds[vm->kind], vm->count,
+               NS_TO_MS_WITH_DECIMAL(vm->total_ns),
+               all_ns[vm->kind] ? 100.0 * vm->total_ns / all_ns[vm->kind]
+                                : 0.0,
+               NS_TO_US_WITH_DECIMAL(vm->count ? vm->total_ns / vm->count : 0),
+               hist_percentile_us(vm->slots, vm->count, 0.5),
+               hist_percentile_us(vm->slots, vm->count, 0.99),
+               lat_hist_reason(&vm->top->key, buf, sizeof(buf)));
+    }
+
+    // 每种类型中耗时最多的若干虚拟机按原因展开
+    printf("%-10s %-11s %-22s %-12s %-10s %-10s %-10s\n", "PID", "TYPE",
+           "REASON", "COUNT", "AVG(us)", "P50(us)", "P99(us)");
+    for (size_t i = 0, rank = 0; i < nr_vms; i++, rank++) {
+        if (i && vms[i].kind != vms[i - 1].kind)
+            rank = 0;
+        if (rank >= LAT_HIST_TOP_VMS)
+            continue;
+        for (int j = 0; j < count; j++) {
+            struct lat_hist_entry *entry = &entries[j];
+            // 排空与BPF侧BPF_NOEXIST插入零值竞争时会读到count为0的项
+            if (entry->key.pid != vms[i].pid ||
+                entry->key.kind != vms[i].kind || !entry->value.count)
+                continue;
+            printf("%-10u %-11s %-22s %-12llu %-10.2f %-10.2f %-10.2f\n",
+                   entry->key.pid, kinds[entry->key.kind],
+                   lat_hist_reason(&entry->key, buf, sizeof(buf)),
+                   entry->value.count,
+                   NS_TO_US_WITH_DECIMAL(entry->value.total_ns /
+                                         entry->value.count),
+                   hist_percentile_us(entry->value.slots, entry->value.count,
+                                      0.5),
+                   hist_percentile_us(entry->value.slots, entry->value.count,
+                                      0.99));
+        }
+    }
+    free(entries);
+    free(vms);
+    return 0;
+}
+
 // 移动光标到指定位置
 void move_cursor(int row, int col) {
     printf("\033[%d;%dH", row, col); // ANSI 转义序列：移动光标到指定行列
@@ -1253,109 +1744,115 @@ void print_description() {
     move_cursor(4, 1);
     printf("--------------------------------------------\n");
     move_cursor(5, 1);
-    printf("%-13s %-10s %-10s %-10s %-10s %-15s\n", 
-           "ContainerID", "Comm", "Pid", "SYSCALLID", "Counts", "AVG_DELAY(us)");
+    printf("%-13s %-10s %-10s %-15s\n", "ContainerID", "SYSCALLID", "Counts",
+           "AVG_DELAY(us)");
     move_cursor(6, 1);
     printf("==============================================================\n");
 }
 
-int memset_big_struct(struct kvm_watcher_bpf *skel){
-    //对占用大内存的结构体的map进行初始化
-    int fd_memset = bpf_map__fd(skel->maps.proc_syscall_info);
-    int fd_proc = bpf_map__fd(skel->maps.container_id_map);
-    pid_t pid ,next_pid;
-    while (!bpf_map_get_next_key(fd_proc, &pid, &next_pid)) {
-        struct syscall_value new_value = {};
-        int err = bpf_map_lookup_elem(fd_memset,&next_pid,&new_value);
-        //填充 new_value
-        strncpy(new_value.container_id, "", sizeof(new_value.container_id));
-        strncpy(new_value.proc_name, "", sizeof(new_value.proc_name));
-        // 初始化 syscalls 的 counts 和延迟为0
-        memset(new_value.syscall_id_counts, 0, sizeof(new_value.syscall_id_counts));
-        memset(new_value.syscall_total_delay, 0, sizeof(new_value.syscall_total_delay));
-        // 在 BPF map 中插入初始化的值
-        int ret = bpf_map_update_elem(fd_memset, &next_pid, &new_value, BPF_ANY);
-        if (ret < 0) {
-            perror("Error updating BPF map");
-            return -1;
-        }
-        pid = next_pid;
-    }
-    //清除记录容器pid的map,不然无法重新给系统调用信息的map赋值
-    memset(&pid, 0, sizeof(pid_t));
-    memset(&next_pid, 0, sizeof(pid_t));
-    while (!bpf_map_get_next_key(fd_proc, pid, next_pid)) {
-        int err = bpf_map_delete_elem(fd_proc, next_pid);
-        if (err < 0) {
-            fprintf(stderr, "failed to cleanup map: %d\n", err);
-            return -1;
+// 在前五名中按调用次数插入一个系统调用
+#define CONTAINER_TOP_SYSCALLS 5
+struct syscall_rank {
+    int nr;
+    __u64 count;
+    __u64 total_delay;
+};
+
+static void insert_top_syscall(struct syscall_rank *top, int nr, __u64 count,
+                               __u64 total_delay) {
+    for (int j = 0; j < CONTAINER_TOP_SYSCALLS; j++) {
+        if (count > top[j].count) {
+            // 将当前值插入到正确的位置，后面的值依次后移
+            memmove(&top[j + 1], &top[j],
+                    (CONTAINER_TOP_SYSCALLS - j - 1) * sizeof(*top));
+            top[j].nr = nr;
+            top[j].count = count;
+            top[j].total_delay = total_delay;
+            break;
         }
-        pid = next_pid;
     }
-    return 0;
 }
-int print_container_syscall(struct kvm_watcher_bpf *skel){
-    OUTPUT_INTERVAL(2);
-    memset_big_struct(skel);
+
+int print_container_syscall(struct kvm_watcher_bpf *skel) {
+    int ctl_fd = bpf_map__fd(skel->maps.container_syscall_ctl);
+    int stats_fd = bpf_map__fd(skel->maps.container_syscall_stats);
+    int slot_fd = bpf_map__fd(skel->maps.container_slot_map);
+    int ncpus = libbpf_num_possible_cpus();
+    __u32 entries = CONTAINER_SLOTS * MAX_SYSCALL_NUM;
+    struct container_syscall_stat *stats;
+    struct container_slot_key key, next_key, *prev = NULL;
+    struct container_slot_key old_keys[2 * CONTAINER_SLOTS];
+    __u32 gen_key = CONTAINER_CTL_GEN, next_slot_key, gen = 0, old;
+    __u32 start, slot, zero = 0;
+    int err, nr_old = 0;
+
     OUTPUT_INTERVAL(5);
-    int fd = bpf_map__fd(skel->maps.proc_syscall_info);
-    int fd1 = bpf_map__fd(skel->maps.container_id_map);
-    struct syscall_value values;
-    pid_t lookup_key,next_key;
-    
-    int err ;
-    //打印表头
-    //printf("%-13s %-10s %-10s %-10s %-10s %-10s\n","ContainerID", "Comm","Pid","SYSCALLID","Counts","avage_DELAY(us)");
+    if (ncpus <= 0)
+        return -1;
+    // 内核侧正在写入gen, 另一代在上一个周期就已切换出来, 不会再有写者,
+    // 读取并清零后再切换过去, 因此输出的是上一个周期的统计
+    bpf_map_lookup_elem(ctl_fd, &gen_key, &gen);
+    gen &= 1;
+    old = gen ^ 1;
+    stats = calloc((size_t)entries * ncpus, sizeof(*stats));
+    if (!stats)
+        return -1;
+    start = CONTAINER_SYSCALL_INDEX(old, 0, 0);
+    err = array_map_read_range(stats_fd, start, entries, stats,
+                               sizeof(*stats) * ncpus);
+    if (err < 0) {
+        fprintf(stderr, "failed to read syscall stats: %d\n", err);
+        goto out;
+    }
+
     print_description();
     move_cursor(7, 1);
-    while(!bpf_map_get_next_key(fd,&lookup_key,&next_key)){
-        err = bpf_map_lookup_elem(fd,&next_key,&values);
-        if (err < 0) {
-                fprintf(stderr, "failed to lookup values: %d\n", err);
-                return -1;
-        }
-        //找出最大的前五个系统调用号
-        int max[5] = {-1, -1, -1, -1, -1}; // 记录前五个最大值的下标
-        int top_values[5] = {0,0,0,0,0}; // 记录前五个最大值
-        uint64_t result = -1;
-        for (int i = 0; i < 462; i++) {
-            for (int j = 0; j < 5; j++) {
-                if (values.syscall_id_counts[i] > top_values[j]) {
-                    // 将当前值插入到正确的位置，后面的值依次后移
-                    for (int k = 5 - 1; k > j; k--) {
-                        top_values[k] = top_values[k - 1];
-                        max[k] = max[k - 1];
-                    }
-                    top_values[j] = values.syscall_id_counts[i];
-                    max[j] = i;
-                    break;
-                }
+    // 每代最多CONTAINER_SLOTS个槽位, 与容器内进程数无关
+    while (!bpf_map_get_next_key(slot_fd, prev, &next_key)) {
+        struct syscall_rank top[CONTAINER_TOP_SYSCALLS] = {};
+        key = next_key;
+        prev = &key;
+        if (key.gen != old || nr_old >= 2 * CONTAINER_SLOTS)
+            continue;
+        old_keys[nr_old++] = key;
+        if (bpf_map_lookup_elem(slot_fd, &key, &slot) ||
+            slot >= CONTAINER_SLOTS)
+            continue;
+        for (int nr = 0; nr < MAX_SYSCALL_NUM; nr++) {
+            struct container_syscall_stat *percpu =
+                &stats[((size_t)slot * MAX_SYSCALL_NUM + nr) * ncpus];
+            __u64 count = 0, total_delay = 0;
+            for (int cpu = 0; cpu < ncpus; cpu++) {
+                count += percpu[cpu].count;
+                total_delay += percpu[cpu].total_delay;
             }
+            insert_top_syscall(top, nr, count, total_delay);
         }
-        for(int i = 0;i<5;i++){
-            if(max[i] == -1){
-                continue;
-            }
-            result = values.syscall_total_delay[max[i]] / values.syscall_id_counts[max[i]];
-            printf("%-13s %-10s %-10d %-10d %-10d %llu\n",values.container_id,values.proc_name,next_key,
-                max[i],values.syscall_id_counts[max[i]],result); 
-        }
-        lookup_key = next_key;
-        if(result != -1){
-            printf("==============================================================\n");
+        if (!top[0].count)
+            continue;
+        for (int i = 0; i < CONTAINER_TOP_SYSCALLS && top[i].count; i++) {
+            printf("%-13s %-10d %-10llu %llu\n", key.id.container_id,
+                   top[i].nr, top[i].count, top[i].total_delay / top[i].count);
         }
+        printf("==============================================================\n");
     }
-    memset(&lookup_key, 0, sizeof(pid_t));
-    memset(&next_key, 0, sizeof(pid_t));
-    while (!bpf_map_get_next_key(fd, lookup_key, next_key)) {
-        err = bpf_map_delete_elem(fd, next_key);
-        if (err < 0) {
-            fprintf(stderr, "failed to cleanup map: %d\n", err);
-            return -1;
-        }
-        lookup_key = next_key;
+    // 清零已读取的一代并回收其槽位, 切换后内核侧重新为活跃的容器分配槽位
+    err = array_map_zero_range(stats_fd, start, entries,
+                               sizeof(*stats) * ncpus);
+    if (err < 0) {
+        fprintf(stderr, "failed to reset syscall stats: %d\n", err);
+        goto out;
     }
-    return 0;
+    for (int i = 0; i < nr_old; i++)
+        bpf_map_delete_elem(slot_fd, &old_keys[i]);
+    next_slot_key = CONTAINER_CTL_NEXT(old);
+    bpf_map_update_elem(ctl_fd, &next_slot_key, &zero, BPF_ANY);
+    err = bpf_map_update_elem(ctl_fd, &gen_key, &old, BPF_ANY);
+    if (err < 0)
+        fprintf(stderr, "failed to switch syscall generation: %d\n", err);
+out:
+    free(stats);
+    return err < 0 ? -1 : 0;
 }
 void print_map_and_check_error(int (*print_func)(struct kvm_watcher_bpf *),
                                struct kvm_watcher_bpf *skel,
@@ -1408,8 +1905,14 @@ int main(int argc, char **argv) {
     /* Parameterize BPF code with parameter */
     skel->rodata->vm_pid = env.vm_pid;
     strcpy(skel->rodata->hostname, env.hostname);
+    skel->rodata->dirty_rate = env.dirty_rate;
+    skel->rodata->aggregate = env.aggregate;
+    // 未开启脏页速率模式时不为位图分配内存
+    if (!env.dirty_rate)
+        bpf_map__set_max_entries(skel->maps.dirty_bitmap, 1);
     /* 禁用或加载内核挂钩函数 */
     set_disable_load(skel);
+    init_map_batches();
 
     /* 加载并验证BPF程序 */
     err = kvm_watcher_bpf__load(skel);
@@ -1424,6 +1927,11 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Failed to attach BPF skeleton\n");
         goto cleanup;
     }
+    if (env.dirty_rate) {
+        err = dirty_rate_init(skel);
+        if (err)
+            goto cleanup;
+    }
     /* 设置环形缓冲区轮询 */
     rb = ring_buffer__new(bpf_map__fd(skel->maps.rb), handle_event, NULL, NULL);
     if (!rb) {
@@ -1457,9 +1965,15 @@ int main(int argc, char **argv) {
         if (env.execute_hypercall) {
             print_map_and_check_error(print_hc_map, skel, "hypercall", err);
         }
-        if (env.execute_exit) {
+        if (env.aggregate) {
+            print_map_and_check_error(print_lat_hist, skel, "lat_hist", err);
+        } else if (env.execute_exit) {
             print_map_and_check_error(print_exit_map, skel, "exit", err);
         }
+        if (env.dirty_rate) {
+            print_map_and_check_error(print_dirty_rate, skel, "dirty_rate",
+                                      err);
+        }
         if (env.execute_timer) {
             print_map_and_check_error(print_timer_map, skel, "timer", err);
         }
@@ -1481,7 +1995,7 @@ int main(int argc, char **argv) {
             break;
         }
     }
-    if (env.execute_mark_page_dirty) {
+    if (env.execute_mark_page_dirty && !env.dirty_rate) {
         err = save_count_dirtypagemap_to_file(skel->maps.count_dirty_map);
         if (err < 0) {
             printf("Save count dirty page map to file fail: %d\n", err);
@@ -1493,6 +2007,9 @@ int main(int argc, char **argv) {
     }
 cleanup:
     ring_buffer__free(rb);
+    free_map_batches();
+    map_batch__free(&lat_hist_batch);
+    dirty_rate_free();
     kvm_watcher_bpf__destroy(skel);
     return -err;
 }
\ No newline at end of file